@@ -15,46 +15,129 @@
  */
 
 #include "../util/darray.h"
+#include "../util/platform.h"
 #include "../util/threading.h"
 
 #include "decl.h"
 #include "signal.h"
 
+/*
+ *   Signalling takes no locks.  Signals are looked up in a hash table, and
+ * each signal's callbacks are kept in an immutable list.  Both are replaced
+ * rather than modified when signals are added or callbacks are connected or
+ * disconnected.
+ *
+ *   New signals are stored in the current table while it's at most half
+ * full, and it's only replaced when it has to grow.  Readers may still be
+ * looking through a replaced table, so those are kept until the handler is
+ * destroyed, which takes less memory than the current table as each one
+ * was half the size of the next.
+ *
+ *   Each signal counts the readers that are taking a reference to its
+ * callback list separately for even and odd epochs, and the epoch is only
+ * advanced once nothing is counted towards the next one.  A replaced list
+ * can no longer be referenced once the epoch is two past the one it was
+ * replaced in, as both counts have been seen at zero since, so it's kept on
+ * the signal's retired list until then and until nothing references it
+ * anymore.  Readers that start after an advance count towards the new
+ * epoch, so they never hold up the next one.
+ */
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 struct signal_callback {
 	signal_callback_t callback;
 	void              *data;
-	bool              remove;
+};
+
+struct callback_list {
+	volatile long          ref;
+	size_t                 num;
+	struct signal_callback *array;
+	struct callback_list   *next_retired;
+	long                   retired_epoch;
 };
 
 struct signal_info {
 	struct decl_info               func;
-	DARRAY(struct signal_callback) callbacks;
+	uint32_t                       hash;
+	struct callback_list           *callbacks;
+	struct callback_list           *retired;
+	volatile long                  epoch;
+	volatile long                  readers[2];
+	volatile long                  waiting;
 	pthread_mutex_t                mutex;
-	bool                           signalling;
+	pthread_cond_t                 cond;
 
 	struct signal_info             *next;
 };
 
+struct signal_table {
+	size_t                         size;
+	struct signal_info             **entries;
+	struct signal_table            *next_retired;
+};
+
+/* signals being signalled on this thread */
+struct signal_frame {
+	struct signal_info             *sig;
+	struct callback_list           *callbacks;
+	struct signal_frame            *prev;
+};
+
+static THREAD_LOCAL struct signal_frame *thread_frames = NULL;
+
+static struct callback_list *callback_list_create(size_t num)
+{
+	struct callback_list *list = bmalloc(sizeof(struct callback_list) +
+			sizeof(struct signal_callback) * num);
+
+	list->ref           = 1;
+	list->num           = num;
+	list->array         = (struct signal_callback*)(list + 1);
+	list->next_retired  = NULL;
+	list->retired_epoch = 0;
+	return list;
+}
+
+/* FNV-1a */
+static inline uint32_t signal_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (uint8_t)*(name++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 static inline struct signal_info *signal_info_create(struct decl_info *info)
 {
-	pthread_mutexattr_t attr;
 	struct signal_info *si;
 
-	if (pthread_mutexattr_init(&attr) != 0)
-		return NULL;
-	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
-		return NULL;
+	si = bzalloc(sizeof(struct signal_info));
+
+	si->func = *info;
+	si->hash = signal_hash(info->name);
 
-	si = bmalloc(sizeof(struct signal_info));
+	if (pthread_mutex_init(&si->mutex, NULL) != 0) {
+		blog(LOG_ERROR, "Could not create signal");
 
-	si->func       = *info;
-	si->next       = NULL;
-	si->signalling = false;
-	da_init(si->callbacks);
+		decl_info_free(&si->func);
+		bfree(si);
+		return NULL;
+	}
 
-	if (pthread_mutex_init(&si->mutex, &attr) != 0) {
+	if (pthread_cond_init(&si->cond, NULL) != 0) {
 		blog(LOG_ERROR, "Could not create signal");
 
+		pthread_mutex_destroy(&si->mutex);
 		decl_info_free(&si->func);
 		bfree(si);
 		return NULL;
@@ -66,18 +149,27 @@ static inline struct signal_info *signal_info_create(struct decl_info *info)
 static inline void signal_info_destroy(struct signal_info *si)
 {
 	if (si) {
+		struct callback_list *list = si->retired;
+
+		while (list) {
+			struct callback_list *next = list->next_retired;
+			bfree(list);
+			list = next;
+		}
+
+		pthread_cond_destroy(&si->cond);
 		pthread_mutex_destroy(&si->mutex);
 		decl_info_free(&si->func);
-		da_free(si->callbacks);
+		bfree(si->callbacks);
 		bfree(si);
 	}
 }
 
-static inline size_t signal_get_callback_idx(struct signal_info *si,
+static inline size_t signal_get_callback_idx(struct callback_list *list,
 		signal_callback_t callback, void *data)
 {
-	for (size_t i = 0; i < si->callbacks.num; i++) {
-		struct signal_callback *sc = si->callbacks.array+i;
+	for (size_t i = 0; list && i < list->num; i++) {
+		struct signal_callback *sc = list->array+i;
 
 		if (sc->callback == callback && sc->data == data)
 			return i;
@@ -87,35 +179,206 @@ static inline size_t signal_get_callback_idx(struct signal_info *si,
 }
 
 struct signal_handler {
-	struct signal_info *first;
-	pthread_mutex_t    mutex;
+	struct signal_info  *first;
+	size_t              num_signals;
+	struct signal_table *table;
+	struct signal_table *retired_tables;
+	pthread_mutex_t     mutex;
 };
 
-static struct signal_info *getsignal(signal_handler_t handler,
-		const char *name, struct signal_info **p_last)
+static struct signal_info *table_find(struct signal_table *table,
+		const char *name, uint32_t hash)
 {
-	struct signal_info *signal, *last= NULL;
+	size_t mask;
+
+	if (!table)
+		return NULL;
 
-	signal = handler->first;
-	while (signal != NULL) {
-		if (strcmp(signal->func.name, name) == 0)
-			break;
+	mask = table->size - 1;
 
-		last = signal;
-		signal = signal->next;
+	for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+		struct signal_info *si = os_atomic_load_ptr(
+				(void *const volatile *)&table->entries[pos]);
+
+		if (!si)
+			return NULL;
+		if (si->hash == hash && strcmp(si->func.name, name) == 0)
+			return si;
 	}
+}
 
-	if (p_last)
-		*p_last = last;
-	return signal;
+/* signals are never removed before the handler is destroyed, so the result
+ * stays valid */
+static inline struct signal_info *getsignal(signal_handler_t handler,
+		const char *name)
+{
+	return table_find(os_atomic_load_ptr(
+			(void *const volatile *)&handler->table),
+			name, signal_hash(name));
+}
+
+static void free_tables(struct signal_table *table)
+{
+	while (table) {
+		struct signal_table *next = table->next_retired;
+		bfree(table);
+		table = next;
+	}
+}
+
+/* readers stop at the first empty entry, so they either see the new signal
+ * or don't find it, as if it had been added after they looked */
+static void table_insert(struct signal_table *table, struct signal_info *si)
+{
+	size_t pos = si->hash & (table->size - 1);
+
+	while (table->entries[pos])
+		pos = (pos + 1) & (table->size - 1);
+
+	os_atomic_set_ptr((void *volatile *)&table->entries[pos], si);
+}
+
+/* call with handler->mutex held */
+static void rebuild_table(signal_handler_t handler)
+{
+	struct signal_table *table, *old;
+	size_t size = 16;
+
+	while (size < handler->num_signals * 2)
+		size *= 2;
+
+	table          = bmalloc(sizeof(struct signal_table) +
+			sizeof(struct signal_info*) * size);
+	table->size    = size;
+	table->entries = (struct signal_info**)(table + 1);
+	table->next_retired = NULL;
+	memset(table->entries, 0, sizeof(struct signal_info*) * size);
+
+	for (struct signal_info *si = handler->first; si; si = si->next)
+		table_insert(table, si);
+
+	old = os_atomic_set_ptr((void *volatile *)&handler->table, table);
+	if (old) {
+		old->next_retired       = handler->retired_tables;
+		handler->retired_tables = old;
+	}
+}
+
+/* wakes up threads waiting in signal_handler_disconnect after a reader has
+ * released a callback list or stopped counting towards an epoch */
+static inline void wake_waiters(struct signal_info *sig)
+{
+	if (os_atomic_load_long(&sig->waiting)) {
+		pthread_mutex_lock(&sig->mutex);
+		pthread_cond_broadcast(&sig->cond);
+		pthread_mutex_unlock(&sig->mutex);
+	}
+}
+
+/* takes a reference to the signal's current callback list */
+static struct callback_list *get_callbacks(struct signal_info *sig)
+{
+	struct callback_list *list;
+	long epoch = os_atomic_load_long(&sig->epoch);
+
+	os_atomic_inc_long(&sig->readers[epoch & 1]);
+
+	list = os_atomic_load_ptr((void *const volatile *)&sig->callbacks);
+	if (list)
+		os_atomic_inc_long(&list->ref);
+
+	os_atomic_dec_long(&sig->readers[epoch & 1]);
+	wake_waiters(sig);
+	return list;
+}
+
+/* call with sig->mutex held.  advances the epoch if no reader is counted
+ * towards the next one, which is left over from the one before. */
+static inline void advance_epoch(struct signal_info *sig)
+{
+	long epoch = os_atomic_load_long(&sig->epoch);
+
+	if (os_atomic_load_long(&sig->readers[(epoch + 1) & 1]) == 0)
+		os_atomic_set_long(&sig->epoch, epoch + 1);
+}
+
+/* call with sig->mutex held.  frees retired lists that can no longer be
+ * signalled, and returns whether any that contain the given callback are
+ * still in use by other threads (or could still be referenced by them). */
+static bool prune_retired(struct signal_info *sig,
+		signal_callback_t callback, void *data)
+{
+	struct callback_list **p_list = &sig->retired;
+	bool in_use = false;
+	long epoch;
+
+	advance_epoch(sig);
+	advance_epoch(sig);
+	epoch = os_atomic_load_long(&sig->epoch);
+
+	while (*p_list) {
+		struct callback_list *list = *p_list;
+		long refs = os_atomic_load_long(&list->ref);
+		bool referable = epoch - list->retired_epoch < 2;
+
+		if (refs == 1 && !referable) {
+			*p_list = list->next_retired;
+			bfree(list);
+			continue;
+		}
+
+		p_list = &list->next_retired;
+
+		if (!callback || signal_get_callback_idx(list, callback,
+					data) == DARRAY_INVALID)
+			continue;
+
+		for (struct signal_frame *frame = thread_frames; frame;
+				frame = frame->prev) {
+			if (frame->callbacks == list)
+				refs--;
+		}
+
+		if (refs > 1 || referable)
+			in_use = true;
+	}
+
+	return in_use;
+}
+
+static inline bool thread_in_signal(struct signal_info *sig)
+{
+	for (struct signal_frame *frame = thread_frames; frame;
+			frame = frame->prev) {
+		if (frame->sig == sig)
+			return true;
+	}
+
+	return false;
+}
+
+/* call with sig->mutex held */
+static void publish_callbacks(struct signal_info *sig,
+		struct callback_list *list)
+{
+	struct callback_list *old;
+
+	old = os_atomic_set_ptr((void *volatile *)&sig->callbacks, list);
+
+	if (old) {
+		old->retired_epoch = os_atomic_load_long(&sig->epoch);
+		old->next_retired  = sig->retired;
+		sig->retired       = old;
+	}
+
+	prune_retired(sig, NULL, NULL);
 }
 
 /* ------------------------------------------------------------------------- */
 
 signal_handler_t signal_handler_create(void)
 {
-	struct signal_handler *handler = bmalloc(sizeof(struct signal_handler));
-	handler->first = NULL;
+	struct signal_handler *handler = bzalloc(sizeof(struct signal_handler));
 
 	if (pthread_mutex_init(&handler->mutex, NULL) != 0) {
 		blog(LOG_ERROR, "Couldn't create signal handler!");
@@ -137,6 +400,8 @@ void signal_handler_destroy(signal_handler_t handler)
 		}
 
 		pthread_mutex_destroy(&handler->mutex);
+		free_tables(handler->retired_tables);
+		bfree(handler->table);
 		bfree(handler);
 	}
 }
@@ -144,7 +409,7 @@ void signal_handler_destroy(signal_handler_t handler)
 bool signal_handler_add(signal_handler_t handler, const char *signal_decl)
 {
 	struct decl_info func = {0};
-	struct signal_info *sig, *last;
+	struct signal_info *sig;
 	bool success = true;
 
 	if (!parse_decl_string(&func, signal_decl)) {
@@ -154,17 +419,26 @@ bool signal_handler_add(signal_handler_t handler, const char *signal_decl)
 
 	pthread_mutex_lock(&handler->mutex);
 
-	sig = getsignal(handler, func.name, &last);
+	sig = table_find(handler->table, func.name, signal_hash(func.name));
 	if (sig) {
 		blog(LOG_WARNING, "Signal declaration '%s' exists", func.name);
 		decl_info_free(&func);
 		success = false;
 	} else {
 		sig = signal_info_create(&func);
-		if (!last)
+		if (sig) {
+			sig->next      = handler->first;
 			handler->first = sig;
-		else
-			last->next = sig;
+			handler->num_signals++;
+
+			if (!handler->table ||
+			    handler->table->size < handler->num_signals * 2)
+				rebuild_table(handler);
+			else
+				table_insert(handler->table, sig);
+		} else {
+			success = false;
+		}
 	}
 
 	pthread_mutex_unlock(&handler->mutex);
@@ -175,16 +449,15 @@ bool signal_handler_add(signal_handler_t handler, const char *signal_decl)
 void signal_handler_connect(signal_handler_t handler, const char *signal,
 		signal_callback_t callback, void *data)
 {
-	struct signal_info *sig, *last;
-	struct signal_callback cb_data = {callback, data, false};
-	size_t idx;
+	struct signal_info *sig;
+	struct callback_list *list, *old;
+	struct signal_callback cb_data = {callback, data};
+	size_t num;
 
 	if (!handler)
 		return;
 
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, signal, &last);
-	pthread_mutex_unlock(&handler->mutex);
+	sig = getsignal(handler, signal);
 
 	if (!sig) {
 		blog(LOG_WARNING, "signal_handler_connect: "
@@ -196,72 +469,99 @@ void signal_handler_connect(signal_handler_t handler, const char *signal,
 
 	pthread_mutex_lock(&sig->mutex);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (idx == DARRAY_INVALID)
-		da_push_back(sig->callbacks, &cb_data);
-	
-	pthread_mutex_unlock(&sig->mutex);
-}
-
-static inline struct signal_info *getsignal_locked(signal_handler_t handler,
-		const char *name)
-{
-	struct signal_info *sig;
+	old = sig->callbacks;
+	if (signal_get_callback_idx(old, callback, data) != DARRAY_INVALID) {
+		pthread_mutex_unlock(&sig->mutex);
+		return;
+	}
 
-	if (!handler)
-		return NULL;
+	num  = old ? old->num : 0;
+	list = callback_list_create(num + 1);
+	if (num)
+		memcpy(list->array, old->array,
+				sizeof(struct signal_callback) * num);
+	list->array[num] = cb_data;
 
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, name, NULL);
-	pthread_mutex_unlock(&handler->mutex);
+	publish_callbacks(sig, list);
 
-	return sig;
+	pthread_mutex_unlock(&sig->mutex);
 }
 
 void signal_handler_disconnect(signal_handler_t handler, const char *signal,
 		signal_callback_t callback, void *data)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
+	struct signal_info *sig;
+	struct callback_list *list = NULL, *old;
 	size_t idx;
 
+	if (!handler)
+		return;
+
+	sig = getsignal(handler, signal);
 	if (!sig)
 		return;
 
 	pthread_mutex_lock(&sig->mutex);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (idx != DARRAY_INVALID) {
-		if (sig->signalling)
-			sig->callbacks.array[idx].remove = true;
-		else
-			da_erase(sig->callbacks, idx);
+	old = sig->callbacks;
+	idx = signal_get_callback_idx(old, callback, data);
+	if (idx == DARRAY_INVALID) {
+		pthread_mutex_unlock(&sig->mutex);
+		return;
+	}
+
+	if (old->num > 1) {
+		list = callback_list_create(old->num - 1);
+		memcpy(list->array, old->array,
+				sizeof(struct signal_callback) * idx);
+		memcpy(list->array + idx, old->array + idx + 1,
+				sizeof(struct signal_callback) *
+				(old->num - idx - 1));
 	}
-	
+
+	publish_callbacks(sig, list);
+
+	/* the callback may still be running on other threads with an older
+	 * list, and must not be called once this returns.  the mutex isn't
+	 * held while waiting, as those callbacks may need it.  from within
+	 * the same signal this can't wait, as other threads signalling it
+	 * could be waiting for this one in turn. */
+	os_atomic_inc_long(&sig->waiting);
+
+	while (!thread_in_signal(sig) && prune_retired(sig, callback, data))
+		pthread_cond_wait(&sig->cond, &sig->mutex);
+
+	os_atomic_dec_long(&sig->waiting);
 	pthread_mutex_unlock(&sig->mutex);
 }
 
 void signal_handler_signal(signal_handler_t handler, const char *signal,
 		calldata_t params)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
+	struct signal_frame frame;
+	struct signal_info *sig;
+
+	if (!handler)
+		return;
 
+	sig = getsignal(handler, signal);
 	if (!sig)
 		return;
 
-	pthread_mutex_lock(&sig->mutex);
-	sig->signalling = true;
+	frame.callbacks = get_callbacks(sig);
+	if (!frame.callbacks)
+		return;
 
-	for (size_t i = 0; i < sig->callbacks.num; i++) {
-		struct signal_callback *cb = sig->callbacks.array+i;
-		cb->callback(cb->data, params);
-	}
+	frame.sig     = sig;
+	frame.prev    = thread_frames;
+	thread_frames = &frame;
 
-	for (size_t i = sig->callbacks.num; i > 0; i--) {
-		struct signal_callback *cb = sig->callbacks.array+i-1;
-		if (cb->remove)
-			da_erase(sig->callbacks, i-1);
+	for (size_t i = 0; i < frame.callbacks->num; i++) {
+		struct signal_callback *cb = frame.callbacks->array+i;
+		cb->callback(cb->data, params);
 	}
 
-	sig->signalling = false;
-	pthread_mutex_unlock(&sig->mutex);
+	thread_frames = frame.prev;
+	os_atomic_dec_long(&frame.callbacks->ref);
+	wake_waiters(sig);
 }
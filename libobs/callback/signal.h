@@ -29,6 +29,10 @@ extern "C" {
  *
  *   This is used to create a signal handler which can broadcast events
  * to one or more callbacks connected to a signal.
+ *
+ *   Signalling does not lock, so signals can be sent from any thread.  Once
+ * signal_handler_disconnect returns, the callback is no longer running or
+ * going to be called, unless it was disconnected from within the same signal.
  */
 
 struct signal_handler;
@@ -25,6 +25,7 @@
 
 #include "audio-io.h"
 #include "audio-resampler.h"
+#include "audio-mix.h"
 
 /* #define DEBUG_AUDIO */
 
@@ -81,13 +82,18 @@ struct audio_output {
 
 	pthread_t                  thread;
 	os_event_t                 stop_event;
+	uint64_t                   period_ns;
 
 	DARRAY(uint8_t)            mix_buffers[MAX_AV_PLANES];
+	audio_mix_float_t          mix_float;
 
 	bool                       initialized;
 
+	/* lines are only ever removed from the list by the audio thread, which
+	 * allows it to mix a snapshot of the list without holding line_mutex */
 	pthread_mutex_t            line_mutex;
 	struct audio_line          *first_line;
+	DARRAY(struct audio_line*) mix_lines;
 
 	pthread_mutex_t            input_mutex;
 	DARRAY(struct audio_input) inputs;
@@ -181,34 +187,27 @@ static inline size_t min_size(size_t a, size_t b)
 	((val > maxval) ? maxval : ((val < minval) ? minval : val))
 #endif
 
-#define MIX_BUFFER_SIZE 256
-
-/* TODO: optimize mixing */
-static void mix_float(uint8_t *mix_in, struct circlebuf *buf, size_t size)
-{
-	float *mix = (float*)mix_in;
-	float vals[MIX_BUFFER_SIZE];
-	register float mix_val;
-
-	while (size) {
-		size_t pop_count = min_size(size, sizeof(vals));
-		size -= pop_count;
-
-		circlebuf_pop_front(buf, vals, pop_count);
-		pop_count /= sizeof(float);
-
-		/* This sequence provides hints for MSVC to use packed SSE 
-		 * instructions addps, minps, maxps, etc. */
-		for (size_t i = 0; i < pop_count; i++) {
-			mix_val =  *mix + vals[i];
-
-			/* clamp confuses the optimisation */
-			mix_val = (mix_val >  1.0f) ?  1.0f : mix_val; 
-			mix_val = (mix_val < -1.0f) ? -1.0f : mix_val;
-
-			*(mix++) = mix_val;
-		}
+/* mixes directly from the (at most two) contiguous spans of the circular
+ * buffer rather than popping the data into a temporary buffer first */
+static void mix_float(struct audio_output *audio, uint8_t *mix_in,
+		struct circlebuf *buf, size_t size)
+{
+	float   *mix       = (float*)mix_in;
+	uint8_t *data      = (uint8_t*)buf->data + buf->start_pos;
+	size_t  start_size = buf->capacity - buf->start_pos;
+
+	if (start_size < size) {
+		audio->mix_float(mix, (const float*)data,
+				start_size / sizeof(float));
+		audio->mix_float((float*)(mix_in + start_size),
+				(const float*)buf->data,
+				(size - start_size) / sizeof(float));
+	} else {
+		audio->mix_float(mix, (const float*)data,
+				size / sizeof(float));
 	}
+
+	circlebuf_pop_front(buf, NULL, size);
 }
 
 static inline bool mix_audio_line(struct audio_output *audio,
@@ -228,7 +227,7 @@ static inline bool mix_audio_line(struct audio_output *audio,
 	for (size_t i = 0; i < audio->planes; i++) {
 		size_t pop_size = min_size(size, line->buffers[i].size);
 
-		mix_float(audio->mix_buffers[i].array + time_offset,
+		mix_float(audio, audio->mix_buffers[i].array + time_offset,
 				&line->buffers[i], pop_size);
 	}
 
@@ -283,10 +282,39 @@ static inline void do_audio_output(struct audio_output *audio,
 	pthread_mutex_unlock(&audio->input_mutex);
 }
 
+/* removes depleted lines that are no longer in use, and takes a snapshot of
+ * the remaining lines to mix */
+static void gather_mix_lines(struct audio_output *audio)
+{
+	struct audio_line *line;
+
+	pthread_mutex_lock(&audio->line_mutex);
+
+	da_resize(audio->mix_lines, 0);
+
+	line = audio->first_line;
+	while (line) {
+		struct audio_line *next = line->next;
+		bool remove;
+
+		pthread_mutex_lock(&line->mutex);
+		remove = !line->buffers[0].size && !line->alive;
+		pthread_mutex_unlock(&line->mutex);
+
+		if (remove)
+			audio_output_removeline(audio, line);
+		else
+			da_push_back(audio->mix_lines, &line);
+
+		line = next;
+	}
+
+	pthread_mutex_unlock(&audio->line_mutex);
+}
+
 static uint64_t mix_and_output(struct audio_output *audio, uint64_t audio_time,
 		uint64_t prev_time)
 {
-	struct audio_line *line = audio->first_line;
 	uint32_t frames = (uint32_t)ts_diff_frames(audio, audio_time,
 	                                           prev_time);
 	size_t bytes = frames * audio->block_size;
@@ -307,17 +335,10 @@ static uint64_t mix_and_output(struct audio_output *audio, uint64_t audio_time,
 	}
 
 	/* mix audio lines */
-	while (line) {
-		struct audio_line *next = line->next;
+	gather_mix_lines(audio);
 
-		/* if line marked for removal, destroy and move to the next */
-		if (!line->buffers[0].size) {
-			if (!line->alive) {
-				audio_output_removeline(audio, line);
-				line = next;
-				continue;
-			}
-		}
+	for (size_t i = 0; i < audio->mix_lines.num; i++) {
+		struct audio_line *line = audio->mix_lines.array[i];
 
 		pthread_mutex_lock(&line->mutex);
 
@@ -330,8 +351,6 @@ static uint64_t mix_and_output(struct audio_output *audio, uint64_t audio_time,
 			line->base_timestamp = audio_time;
 
 		pthread_mutex_unlock(&line->mutex);
-
-		line = next;
 	}
 
 	/* output */
@@ -340,26 +359,32 @@ static uint64_t mix_and_output(struct audio_output *audio, uint64_t audio_time,
 	return audio_time;
 }
 
-/* sample audio 40 times a second */
-#define AUDIO_WAIT_TIME (1000/40)
-
+/* mixes audio once per period (audio_output_info.period_frames, or a
+ * default of 1/40th of a second), sleeping to absolute deadlines so the
+ * period doesn't drift with the time spent mixing */
 static void *audio_thread(void *param)
 {
 	struct audio_output *audio = param;
 	uint64_t buffer_time = audio->info.buffer_ms * 1000000;
-	uint64_t prev_time = os_gettime_ns() - buffer_time;
+	uint64_t period_ns   = audio->period_ns;
+	uint64_t start_time  = os_gettime_ns();
+	uint64_t next_time   = start_time + period_ns;
+	uint64_t prev_time   = start_time - buffer_time;
 	uint64_t audio_time;
 
 	while (os_event_try(audio->stop_event) == EAGAIN) {
-		os_sleep_ms(AUDIO_WAIT_TIME);
-
-		pthread_mutex_lock(&audio->line_mutex);
+		if (!os_sleepto_ns(next_time)) {
+			/* if more than a full period behind, mix everything
+			 * that has elapsed at once and realign to the clock */
+			uint64_t cur_time = os_gettime_ns();
+			if (cur_time - next_time > period_ns)
+				next_time = cur_time;
+		}
 
-		audio_time = os_gettime_ns() - buffer_time;
+		audio_time = next_time - buffer_time;
 		audio_time = mix_and_output(audio, audio_time, prev_time);
 		prev_time  = audio_time;
-
-		pthread_mutex_unlock(&audio->line_mutex);
+		next_time += period_ns;
 	}
 
 	return NULL;
@@ -477,6 +502,15 @@ static inline bool valid_audio_params(struct audio_output_info *info)
 	       info->speakers > 0;
 }
 
+static inline uint32_t get_period_frames(const struct audio_output_info *info)
+{
+	if (!info->period_frames)
+		return info->samples_per_sec / 40;
+	if (info->period_frames < AUDIO_OUTPUT_MIN_PERIOD)
+		return AUDIO_OUTPUT_MIN_PERIOD;
+	return info->period_frames;
+}
+
 int audio_output_open(audio_t *audio, struct audio_output_info *info)
 {
 	struct audio_output *out;
@@ -496,6 +530,8 @@ int audio_output_open(audio_t *audio, struct audio_output_info *info)
 	out->planes     = planar ? out->channels : 1;
 	out->block_size = (planar ? 1 : out->channels) *
 	                  get_audio_bytes_per_channel(info->format);
+	out->mix_float  = audio_get_mix_float_func();
+	out->period_ns  = conv_frames_to_time(out, get_period_frames(info));
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		goto fail;
@@ -545,6 +581,7 @@ void audio_output_close(audio_t audio)
 	for (size_t i = 0; i < MAX_AV_PLANES; i++)
 		da_free(audio->mix_buffers[i]);
 
+	da_free(audio->mix_lines);
 	da_free(audio->inputs);
 	os_event_destroy(audio->stop_event);
 	pthread_mutex_destroy(&audio->line_mutex);
@@ -587,13 +624,14 @@ const struct audio_output_info *audio_output_getinfo(audio_t audio)
 	return audio ? &audio->info : NULL;
 }
 
+/* the line is removed by the audio thread once its buffered data has been
+ * mixed, see gather_mix_lines */
 void audio_line_destroy(struct audio_line *line)
 {
 	if (line) {
-		if (!line->buffers[0].size)
-			audio_output_removeline(line->audio, line);
-		else
-			line->alive = false;
+		pthread_mutex_lock(&line->mutex);
+		line->alive = false;
+		pthread_mutex_unlock(&line->mutex);
 	}
 }
 
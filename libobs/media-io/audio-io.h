@@ -76,8 +76,15 @@ struct audio_output_info {
 	enum audio_format   format;
 	enum speaker_layout speakers;
 	uint64_t            buffer_ms;
+
+	/* audio frames mixed per wakeup of the audio thread.  0 uses the
+	 * default of 1/40th of a second, otherwise clamped to at least
+	 * AUDIO_OUTPUT_MIN_PERIOD frames */
+	uint32_t            period_frames;
 };
 
+#define AUDIO_OUTPUT_MIN_PERIOD 1024
+
 struct audio_convert_info {
 	uint32_t            samples_per_sec;
 	enum audio_format   format;
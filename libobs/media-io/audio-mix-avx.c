@@ -0,0 +1,47 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/* this file is compiled with AVX code generation enabled, only call into it
+ * after checking for OS_CPU_FEATURE_AVX */
+
+#include "audio-mix.h"
+#include <immintrin.h>
+
+void audio_mix_float_avx(float *mix, const float *in, size_t count)
+{
+	__m256 min_val = _mm256_set1_ps(-1.0f);
+	__m256 max_val = _mm256_set1_ps( 1.0f);
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 val0 = _mm256_add_ps(_mm256_loadu_ps(mix+i),
+				_mm256_loadu_ps(in+i));
+		__m256 val1 = _mm256_add_ps(_mm256_loadu_ps(mix+i+8),
+				_mm256_loadu_ps(in+i+8));
+
+		/* operand order lets NaN through, see audio-mix.c */
+		_mm256_storeu_ps(mix+i, _mm256_min_ps(max_val,
+				_mm256_max_ps(min_val, val0)));
+		_mm256_storeu_ps(mix+i+8, _mm256_min_ps(max_val,
+				_mm256_max_ps(min_val, val1)));
+	}
+
+	_mm256_zeroupper();
+
+	/* remaining samples */
+	audio_mix_float_sse2(mix+i, in+i, count-i);
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "../util/platform.h"
+#include "audio-mix.h"
+#include <xmmintrin.h>
+
+/* min/max return their second operand if either is NaN, so the value being
+ * clamped goes second to let NaN through the same way the scalar
+ * comparisons do */
+
+void audio_mix_float_sse2(float *mix, const float *in, size_t count)
+{
+	__m128 min_val = _mm_set1_ps(-1.0f);
+	__m128 max_val = _mm_set1_ps( 1.0f);
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128 val0 = _mm_add_ps(_mm_loadu_ps(mix+i),
+				_mm_loadu_ps(in+i));
+		__m128 val1 = _mm_add_ps(_mm_loadu_ps(mix+i+4),
+				_mm_loadu_ps(in+i+4));
+		__m128 val2 = _mm_add_ps(_mm_loadu_ps(mix+i+8),
+				_mm_loadu_ps(in+i+8));
+		__m128 val3 = _mm_add_ps(_mm_loadu_ps(mix+i+12),
+				_mm_loadu_ps(in+i+12));
+
+		_mm_storeu_ps(mix+i,
+				_mm_min_ps(max_val, _mm_max_ps(min_val, val0)));
+		_mm_storeu_ps(mix+i+4,
+				_mm_min_ps(max_val, _mm_max_ps(min_val, val1)));
+		_mm_storeu_ps(mix+i+8,
+				_mm_min_ps(max_val, _mm_max_ps(min_val, val2)));
+		_mm_storeu_ps(mix+i+12,
+				_mm_min_ps(max_val, _mm_max_ps(min_val, val3)));
+	}
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 val = _mm_add_ps(_mm_loadu_ps(mix+i),
+				_mm_loadu_ps(in+i));
+		_mm_storeu_ps(mix+i,
+				_mm_min_ps(max_val, _mm_max_ps(min_val, val)));
+	}
+
+	for (; i < count; i++) {
+		float val = mix[i] + in[i];
+		val = (val >  1.0f) ?  1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		mix[i] = val;
+	}
+}
+
+audio_mix_float_t audio_get_mix_float_func(void)
+{
+	if (os_get_cpu_features() & OS_CPU_FEATURE_AVX)
+		return audio_mix_float_avx;
+
+	return audio_mix_float_sse2;
+}
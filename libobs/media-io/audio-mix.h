@@ -0,0 +1,43 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Audio mixing kernels.  Each adds 'count' samples of 'in' to 'mix', clamping
+ * the result to [-1.0, 1.0].  Neither buffer needs to be aligned.  The
+ * results are bit for bit the same as adding and clamping one sample at a
+ * time with comparisons, including NaN samples, which are passed through.
+ */
+
+typedef void (*audio_mix_float_t)(float *mix, const float *in, size_t count);
+
+EXPORT void audio_mix_float_sse2(float *mix, const float *in, size_t count);
+EXPORT void audio_mix_float_avx(float *mix, const float *in, size_t count);
+
+/** Returns the fastest mixing kernel supported by the current CPU */
+EXPORT audio_mix_float_t audio_get_mix_float_func(void);
+
+#ifdef __cplusplus
+}
+#endif
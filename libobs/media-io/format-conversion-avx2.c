@@ -0,0 +1,198 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "format-conversion.h"
+#include <immintrin.h>
+
+/*
+ * AVX2 versions of the packed 444 YUV compression functions.  These process
+ * 8 pixels at a time and produce output identical to the SSE2 versions.
+ */
+
+#define get_m128_32_0(val) (*((uint32_t*)&val))
+#define get_m128_32_1(val) (*(((uint32_t*)&val)+1))
+
+static FORCE_INLINE void pack_lum_avx2(uint8_t *lum0, uint8_t *lum1,
+		__m256i line1, __m256i line2, __m256i lum_mask,
+		__m256i lane_order)
+{
+	__m256i pack_val = _mm256_packs_epi32(
+			_mm256_srli_epi32(_mm256_and_si256(line1, lum_mask), 8),
+			_mm256_srli_epi32(_mm256_and_si256(line2, lum_mask), 8));
+	__m128i lum_val;
+
+	/* each lane packs 4 pixels of both lines, so gather the dwords of
+	 * line 1 into the low qword and those of line 2 into the high one */
+	pack_val = _mm256_packus_epi16(pack_val, pack_val);
+	pack_val = _mm256_permutevar8x32_epi32(pack_val, lane_order);
+	lum_val  = _mm256_castsi256_si128(pack_val);
+
+	_mm_storel_epi64((__m128i*)lum0, lum_val);
+	_mm_storel_epi64((__m128i*)lum1, _mm_unpackhi_epi64(lum_val, lum_val));
+}
+
+static FORCE_INLINE __m256i avg_chroma_avx2(__m256i line1, __m256i line2,
+		__m256i uv_mask)
+{
+	__m256i add_val = _mm256_add_epi16(
+			_mm256_and_si256(line1, uv_mask),
+			_mm256_and_si256(line2, uv_mask));
+	__m256i avg_val = _mm256_add_epi16(
+			add_val,
+			_mm256_shuffle_epi32(add_val, _MM_SHUFFLE(2, 3, 0, 1)));
+	avg_val = _mm256_srai_epi16(avg_val, 2);
+	return _mm256_shuffle_epi32(avg_val, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+void compress_uyvx_to_i420_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane   = output[0];
+	uint8_t  *u_plane     = output[1];
+	uint8_t  *v_plane     = output[2];
+	uint32_t width        = in_linesize < out_linesize[0] ?
+		in_linesize : out_linesize[0];
+	uint32_t last_x;
+	uint32_t y;
+
+	__m256i lum_mask   = _mm256_set1_epi32(0x0000FF00);
+	__m256i uv_mask    = _mm256_set1_epi16(0x00FF);
+	__m256i lane_order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m128i uv_order   = _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7,
+			8, 9, 12, 13, 10, 11, 14, 15);
+
+	/* the last block of each row is moved back to overlap the previous
+	 * one rather than running past the end of the row */
+	if (width < 8 || (width & 3) != 0) {
+		compress_uyvx_to_i420_sse2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		return;
+	}
+
+	last_x = width - 8;
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos        = y      * in_linesize;
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+		uint32_t lum_y_pos    = y      * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x < width; x += 8) {
+			const uint8_t *img;
+			uint32_t lum_pos0, chroma_pos;
+			__m256i line1, line2, avg_val;
+			__m128i uv_val;
+
+			if (x > last_x)
+				x = last_x;
+
+			img        = input + y_pos + x*4;
+			lum_pos0   = lum_y_pos + x;
+			chroma_pos = chroma_y_pos + (x>>1);
+
+			line1 = _mm256_loadu_si256((const __m256i*)img);
+			line2 = _mm256_loadu_si256(
+					(const __m256i*)(img + in_linesize));
+
+			pack_lum_avx2(lum_plane + lum_pos0,
+					lum_plane + lum_pos0 + out_linesize[0],
+					line1, line2, lum_mask, lane_order);
+
+			avg_val = avg_chroma_avx2(line1, line2, uv_mask);
+			avg_val = _mm256_shufflelo_epi16(avg_val,
+					_MM_SHUFFLE(3, 1, 2, 0));
+			avg_val = _mm256_packus_epi16(avg_val, avg_val);
+			avg_val = _mm256_permutevar8x32_epi32(avg_val,
+					lane_order);
+
+			/* U01 U23 V01 V23 U45 U67 V45 V67 -> U... V... */
+			uv_val = _mm_shuffle_epi8(
+					_mm256_castsi256_si128(avg_val),
+					uv_order);
+
+			*(uint32_t*)(u_plane+chroma_pos) = get_m128_32_0(uv_val);
+			*(uint32_t*)(v_plane+chroma_pos) = get_m128_32_1(uv_val);
+		}
+	}
+
+	_mm256_zeroupper();
+}
+
+void compress_uyvx_to_nv12_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane    = output[0];
+	uint8_t  *chroma_plane = output[1];
+	uint32_t width         = in_linesize < out_linesize[0] ?
+		in_linesize : out_linesize[0];
+	uint32_t last_x;
+	uint32_t y;
+
+	__m256i lum_mask   = _mm256_set1_epi32(0x0000FF00);
+	__m256i uv_mask    = _mm256_set1_epi16(0x00FF);
+	__m256i lane_order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	if (width < 8 || (width & 3) != 0) {
+		compress_uyvx_to_nv12_sse2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		return;
+	}
+
+	last_x = width - 8;
+
+	for (y = start_y; y < end_y; y += 2) {
+		uint32_t y_pos        = y      * in_linesize;
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+		uint32_t lum_y_pos    = y      * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x < width; x += 8) {
+			const uint8_t *img;
+			uint32_t lum_pos0;
+			__m256i line1, line2, avg_val;
+
+			if (x > last_x)
+				x = last_x;
+
+			img      = input + y_pos + x*4;
+			lum_pos0 = lum_y_pos + x;
+
+			line1 = _mm256_loadu_si256((const __m256i*)img);
+			line2 = _mm256_loadu_si256(
+					(const __m256i*)(img + in_linesize));
+
+			pack_lum_avx2(lum_plane + lum_pos0,
+					lum_plane + lum_pos0 + out_linesize[0],
+					line1, line2, lum_mask, lane_order);
+
+			avg_val = avg_chroma_avx2(line1, line2, uv_mask);
+			avg_val = _mm256_packus_epi16(avg_val, avg_val);
+			avg_val = _mm256_permutevar8x32_epi32(avg_val,
+					lane_order);
+
+			_mm_storel_epi64(
+				(__m128i*)(chroma_plane + chroma_y_pos + x),
+				_mm256_castsi256_si128(avg_val));
+		}
+	}
+
+	_mm256_zeroupper();
+}
@@ -15,6 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include "../util/platform.h"
 #include "format-conversion.h"
 #include <xmmintrin.h>
 #include <emmintrin.h>
@@ -78,7 +79,7 @@ static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
 	return a < b ? a : b;
 }
 
-void compress_uyvx_to_i420(
+void compress_uyvx_to_i420_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -116,7 +117,7 @@ void compress_uyvx_to_i420(
 	}
 }
 
-void compress_uyvx_to_nv12(
+void compress_uyvx_to_nv12_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -152,13 +153,68 @@ void compress_uyvx_to_nv12(
 	}
 }
 
+static inline bool have_avx2(void)
+{
+	static volatile int avx2 = -1;
+
+	if (avx2 == -1)
+		avx2 = (os_get_cpu_features() & OS_CPU_FEATURE_AVX2) != 0;
+	return avx2 == 1;
+}
+
+void compress_uyvx_to_i420(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	if (have_avx2())
+		compress_uyvx_to_i420_avx2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+	else
+		compress_uyvx_to_i420_sse2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+}
+
+void compress_uyvx_to_nv12(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	if (have_avx2())
+		compress_uyvx_to_nv12_avx2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+	else
+		compress_uyvx_to_nv12_sse2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+}
+
+/* expands 16 luma values and 8 U/V values (each shared by two pixels) to 16
+ * packed 444 pixels */
+#define unpack_yuvx(output, lum, u_val, v_val)                                \
+do {                                                                          \
+	__m128i zero   = _mm_setzero_si128();                                 \
+	__m128i lum_u0 = _mm_unpacklo_epi8(lum, u_val);                       \
+	__m128i lum_u1 = _mm_unpackhi_epi8(lum, u_val);                       \
+	__m128i v_x0   = _mm_unpacklo_epi8(v_val, zero);                      \
+	__m128i v_x1   = _mm_unpackhi_epi8(v_val, zero);                      \
+                                                                              \
+	_mm_storeu_si128((__m128i*)(output),                                  \
+			_mm_unpacklo_epi16(lum_u0, v_x0));                    \
+	_mm_storeu_si128((__m128i*)(output) + 1,                              \
+			_mm_unpackhi_epi16(lum_u0, v_x0));                    \
+	_mm_storeu_si128((__m128i*)(output) + 2,                              \
+			_mm_unpacklo_epi16(lum_u1, v_x1));                    \
+	_mm_storeu_si128((__m128i*)(output) + 3,                              \
+			_mm_unpackhi_epi16(lum_u1, v_x1));                    \
+} while (false)
+
 void decompress_420(
 		const uint8_t *const input[], const uint32_t in_linesize[],
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize)
 {
 	uint32_t start_y_d2 = start_y/2;
-	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize/4)/2;
 	uint32_t height_d2  = end_y/2;
 	uint32_t y;
 
@@ -167,14 +223,35 @@ void decompress_420(
 		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
 		register const uint8_t *lum0, *lum1;
 		register uint32_t *output0, *output1;
-		uint32_t x;
+		uint32_t x = 0;
 
 		lum0 = input[0] + y * 2 * in_linesize[0];
 		lum1 = lum0 + in_linesize[0];
-		output0 = (uint32_t*)(output + y * 2 * in_linesize[0]);
-		output1 = (uint32_t*)((uint8_t*)output0 + in_linesize[0]);
+		output0 = (uint32_t*)(output + y * 2 * out_linesize);
+		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
+
+		for (; x + 8 <= width_d2; x += 8) {
+			__m128i u_val = _mm_loadl_epi64((const __m128i*)chroma0);
+			__m128i v_val = _mm_loadl_epi64((const __m128i*)chroma1);
+			u_val = _mm_unpacklo_epi8(u_val, u_val);
+			v_val = _mm_unpacklo_epi8(v_val, v_val);
+
+			unpack_yuvx(output0,
+					_mm_loadu_si128((const __m128i*)lum0),
+					u_val, v_val);
+			unpack_yuvx(output1,
+					_mm_loadu_si128((const __m128i*)lum1),
+					u_val, v_val);
+
+			chroma0 += 8;
+			chroma1 += 8;
+			lum0    += 16;
+			lum1    += 16;
+			output0 += 16;
+			output1 += 16;
+		}
 
-		for (x = 0; x < width_d2; x++) {
+		for (; x < width_d2; x++) {
 			uint32_t out;
 			out = (*(chroma0++) << 8) | (*(chroma1++) << 16);
 
@@ -193,15 +270,17 @@ void decompress_nv12(
 		uint8_t *output, uint32_t out_linesize)
 {
 	uint32_t start_y_d2 = start_y/2;
-	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize)/2;
+	uint32_t width_d2   = min_uint32(in_linesize[0], out_linesize/4)/2;
 	uint32_t height_d2  = end_y/2;
 	uint32_t y;
 
+	__m128i u_mask = _mm_set1_epi16(0x00FF);
+
 	for (y = start_y_d2; y < height_d2; y++) {
 		const uint16_t *chroma;
 		register const uint8_t *lum0, *lum1;
 		register uint32_t *output0, *output1;
-		uint32_t x;
+		uint32_t x = 0;
 
 		chroma = (const uint16_t*)(input[1] + y * in_linesize[1]);
 		lum0 = input[0] + y * 2 * in_linesize[0];
@@ -209,7 +288,30 @@ void decompress_nv12(
 		output0 = (uint32_t*)(output + y * 2 * out_linesize);
 		output1 = (uint32_t*)((uint8_t*)output0 + out_linesize);
 
-		for (x = 0; x < width_d2; x++) {
+		for (; x + 8 <= width_d2; x += 8) {
+			__m128i uv_val = _mm_loadu_si128((const __m128i*)chroma);
+			__m128i u_val  = _mm_and_si128(uv_val, u_mask);
+			__m128i v_val  = _mm_srli_epi16(uv_val, 8);
+
+			/* duplicate each U/V byte for both pixels sharing it */
+			u_val = _mm_or_si128(u_val, _mm_slli_epi16(u_val, 8));
+			v_val = _mm_or_si128(v_val, _mm_slli_epi16(v_val, 8));
+
+			unpack_yuvx(output0,
+					_mm_loadu_si128((const __m128i*)lum0),
+					u_val, v_val);
+			unpack_yuvx(output1,
+					_mm_loadu_si128((const __m128i*)lum1),
+					u_val, v_val);
+
+			chroma  += 8;
+			lum0    += 16;
+			lum1    += 16;
+			output0 += 16;
+			output1 += 16;
+		}
+
+		for (; x < width_d2; x++) {
 			uint32_t out = *(chroma++) << 8;
 
 			*(output0++) = *(lum0++) | out;
@@ -221,13 +323,27 @@ void decompress_nv12(
 	}
 }
 
+/* each input dword holds two pixels; the first keeps the dword as is, and the
+ * second gets its own luma value moved in to the first luma position */
+#define unpack_422(output, input, keep_mask, lum_mask)                        \
+do {                                                                          \
+	__m128i dw  = _mm_loadu_si128((const __m128i*)(input));               \
+	__m128i dw2 = _mm_or_si128(_mm_and_si128(dw, keep_mask),              \
+			_mm_and_si128(_mm_srli_epi32(dw, 16), lum_mask));     \
+                                                                              \
+	_mm_storeu_si128((__m128i*)(output),                                  \
+			_mm_unpacklo_epi32(dw, dw2));                         \
+	_mm_storeu_si128((__m128i*)(output) + 1,                              \
+			_mm_unpackhi_epi32(dw, dw2));                         \
+} while (false)
+
 void decompress_422(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output, uint32_t out_linesize,
 		bool leading_lum)
 {
-	uint32_t width_d2 = min_uint32(in_linesize, out_linesize)/2;
+	uint32_t width_d2 = min_uint32(in_linesize, out_linesize/2)/4;
 	uint32_t y;
 
 	register const uint32_t *input32;
@@ -235,11 +351,22 @@ void decompress_422(
 	register uint32_t       *output32;
 
 	if (leading_lum) {
+		__m128i keep_mask = _mm_set1_epi32(0xFFFFFF00);
+		__m128i lum_mask  = _mm_set1_epi32(0x000000FF);
+
 		for (y = start_y; y < end_y; y++) {
 			input32     = (const uint32_t*)(input + y*in_linesize);
 			input32_end = input32 + width_d2;
 			output32    = (uint32_t*)(output + y*out_linesize);
 
+			while (input32 + 4 <= input32_end) {
+				unpack_422(output32, input32, keep_mask,
+						lum_mask);
+
+				output32 += 8;
+				input32  += 4;
+			}
+
 			while(input32 < input32_end) {
 				register uint32_t dw = *input32;
 
@@ -253,11 +380,22 @@ void decompress_422(
 			}
 		}
 	} else {
+		__m128i keep_mask = _mm_set1_epi32(0xFFFF00FF);
+		__m128i lum_mask  = _mm_set1_epi32(0x0000FF00);
+
 		for (y = start_y; y < end_y; y++) {
 			input32     = (const uint32_t*)(input + y*in_linesize);
 			input32_end = input32 + width_d2;
 			output32    = (uint32_t*)(output + y*out_linesize);
 
+			while (input32 + 4 <= input32_end) {
+				unpack_422(output32, input32, keep_mask,
+						lum_mask);
+
+				output32 += 8;
+				input32  += 4;
+			}
+
 			while (input32 < input32_end) {
 				register uint32_t dw = *input32;
 
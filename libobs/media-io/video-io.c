@@ -20,6 +20,7 @@
 #include "../util/platform.h"
 #include "../util/threading.h"
 #include "../util/darray.h"
+#include "../util/circlebuf.h"
 
 #include "format-conversion.h"
 #include "video-io.h"
@@ -27,6 +28,22 @@
 #include "video-scaler.h"
 
 #define MAX_CONVERT_BUFFERS 3
+#define MAX_CACHED_FRAMES   32
+#define MAX_QUEUED_FRAMES   3
+
+/* a frame the video output shares between the inputs that are processing
+ * it.  the thread swapping frames can write its frames straight in to these
+ * (see video_output_lock_frame), otherwise each new frame is copied in to one
+ * the first time it's output.  inputs can hold on to it after their callback
+ * with video_data_addref, so there are enough of these for every input and
+ * encoder queue to be full.  the frame buffers are only allocated once
+ * they're first needed */
+struct cached_frame_info {
+	struct video_output       *video;
+	struct video_data         frame;
+	struct video_frame        buffer;
+	volatile long             refs;
+};
 
 struct video_input {
 	struct video_scale_info   conversion;
@@ -36,14 +53,20 @@ struct video_input {
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
-};
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
+	/* each input scales and processes its frames on its own thread so a
+	 * slow input doesn't hold up the others */
+	pthread_t                 thread;
+	os_sem_t                  frame_sem;
+	pthread_mutex_t           queue_mutex;
+	struct circlebuf          queue;
+	bool                      thread_active;
+	bool                      stop;
+	bool                      detached;
+
+	volatile long             total_frames;
+	volatile long             dropped_frames;
+};
 
 struct video_output {
 	struct video_output_info   info;
@@ -52,6 +75,7 @@ struct video_output {
 	pthread_mutex_t            data_mutex;
 	os_event_t                 stop_event;
 
+	/* each of these holds a reference to its cached frame, if it has one */
 	struct video_data          cur_frame;
 	struct video_data          next_frame;
 	bool                       new_frame;
@@ -63,15 +87,81 @@ struct video_output {
 
 	bool                       initialized;
 
+	/* cached frames are taken and let go of under cache_mutex, and
+	 * cache_cond is signalled whenever one of them is no longer used */
+	pthread_mutex_t            cache_mutex;
+	pthread_cond_t             cache_cond;
+	struct cached_frame_info   cache[MAX_CACHED_FRAMES];
+
 	pthread_mutex_t            input_mutex;
-	DARRAY(struct video_input) inputs;
+	DARRAY(struct video_input*) inputs;
 };
 
+static struct cached_frame_info *cache_acquire(struct video_output *video)
+{
+	struct cached_frame_info *cached = NULL;
+
+	pthread_mutex_lock(&video->cache_mutex);
+
+	for (size_t i = 0; i < MAX_CACHED_FRAMES; i++) {
+		if (os_atomic_load_long(&video->cache[i].refs) == 0) {
+			cached = video->cache+i;
+			os_atomic_set_long(&cached->refs, 1);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&video->cache_mutex);
+
+	if (cached && !cached->buffer.data[0]) {
+		video_frame_init(&cached->buffer, video->info.format,
+				video->info.width, video->info.height);
+
+		memcpy(cached->frame.data, cached->buffer.data,
+				sizeof(cached->frame.data));
+		memcpy(cached->frame.linesize, cached->buffer.linesize,
+				sizeof(cached->frame.linesize));
+	}
+
+	return cached;
+}
+
+static void cached_frame_release(struct cached_frame_info *frame)
+{
+	struct video_output *video = frame->video;
+
+	pthread_mutex_lock(&video->cache_mutex);
+	if (os_atomic_dec_long(&frame->refs) == 0)
+		pthread_cond_broadcast(&video->cache_cond);
+	pthread_mutex_unlock(&video->cache_mutex);
+}
+
+static void video_input_free(struct video_input *input)
+{
+	while (input->queue.size) {
+		struct cached_frame_info *frame;
+		circlebuf_pop_front(&input->queue, &frame, sizeof(frame));
+		cached_frame_release(frame);
+	}
+
+	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
+		video_frame_free(&input->frame[i]);
+	video_scaler_destroy(input->scaler);
+
+	circlebuf_free(&input->queue);
+	os_sem_destroy(input->frame_sem);
+	pthread_mutex_destroy(&input->queue_mutex);
+	bfree(input);
+}
+
 /* ------------------------------------------------------------------------- */
 
 static inline void video_swapframes(struct video_output *video)
 {
 	if (video->new_frame) {
+		if (video->cur_frame.cached)
+			cached_frame_release(video->cur_frame.cached);
+
 		video->cur_frame = video->next_frame;
 		video->new_frame = false;
 	}
@@ -100,12 +190,112 @@ static inline bool scale_video_output(struct video_input *input,
 				data->data[i]     = frame->data[i];
 				data->linesize[i] = frame->linesize[i];
 			}
+
+			/* the scaled frame is reused, so it can't be kept */
+			data->cached = NULL;
 		}
 	}
 
 	return success;
 }
 
+static void *video_input_thread(void *param)
+{
+	struct video_input *input = param;
+
+	while (os_sem_wait(input->frame_sem) == 0) {
+		struct cached_frame_info *cached = NULL;
+		struct video_data frame;
+
+		if (input->stop)
+			break;
+
+		pthread_mutex_lock(&input->queue_mutex);
+		if (input->queue.size)
+			circlebuf_pop_front(&input->queue, &cached,
+					sizeof(cached));
+		pthread_mutex_unlock(&input->queue_mutex);
+
+		if (!cached)
+			continue;
+
+		frame = cached->frame;
+		if (scale_video_output(input, &frame))
+			input->callback(input->param, &frame);
+
+		cached_frame_release(cached);
+	}
+
+	/* disconnected from within its own callback, see video_input_destroy */
+	if (input->detached)
+		video_input_free(input);
+
+	return NULL;
+}
+
+static void video_input_destroy(struct video_input *input)
+{
+	if (input->thread_active) {
+		input->stop = true;
+		os_sem_post(input->frame_sem);
+
+		if (pthread_equal(pthread_self(), input->thread)) {
+			input->detached = true;
+			pthread_detach(input->thread);
+			return;
+		}
+
+		pthread_join(input->thread, NULL);
+	}
+
+	if (input->dropped_frames)
+		blog(LOG_INFO, "video input: %ld of %ld frames dropped",
+				input->dropped_frames, input->total_frames);
+
+	video_input_free(input);
+}
+
+/* copies a frame that wasn't written in to the cache by the thread swapping
+ * frames in to it, so it's still around after the next swap */
+static void cache_cur_frame(struct video_output *video)
+{
+	struct cached_frame_info *cached = cache_acquire(video);
+	struct video_frame src;
+
+	if (!cached)
+		return;
+
+	memcpy(src.data, video->cur_frame.data, sizeof(src.data));
+	memcpy(src.linesize, video->cur_frame.linesize, sizeof(src.linesize));
+	video_frame_copy(&cached->buffer, &src, video->info.format,
+			video->info.height);
+
+	cached->frame.timestamp = video->cur_frame.timestamp;
+	video->cur_frame = cached->frame;
+}
+
+static inline void video_input_push(struct video_input *input,
+		struct cached_frame_info *cached)
+{
+	bool queued = false;
+
+	os_atomic_inc_long(&input->total_frames);
+
+	pthread_mutex_lock(&input->queue_mutex);
+	if (cached &&
+	    input->queue.size < MAX_QUEUED_FRAMES * sizeof(cached)) {
+		os_atomic_inc_long(&cached->refs);
+		circlebuf_push_back(&input->queue, &cached, sizeof(cached));
+		queued = true;
+	}
+	pthread_mutex_unlock(&input->queue_mutex);
+
+	if (queued)
+		os_sem_post(input->frame_sem);
+	else
+		os_atomic_inc_long(&input->dropped_frames);
+}
+
 static inline void video_output_cur_frame(struct video_output *video)
 {
 	if (!video->cur_frame.data[0])
@@ -113,10 +303,16 @@ static inline void video_output_cur_frame(struct video_output *video)
 
 	pthread_mutex_lock(&video->input_mutex);
 
-	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
-		if (scale_video_output(input, &video->cur_frame))
-			input->callback(input->param, &video->cur_frame);
+	if (video->inputs.num) {
+		/* the inputs get the current frame by reference, and it only
+		 * needs to be copied if it isn't already in the cache.  frames
+		 * that are repeated are passed on again as they are */
+		if (!video->cur_frame.cached)
+			cache_cur_frame(video);
+
+		for (size_t i = 0; i < video->inputs.num; i++)
+			video_input_push(video->inputs.array[i],
+					video->cur_frame.cached);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -190,10 +386,19 @@ int video_output_open(video_t *video, struct video_output_info *info)
 		(double)info->fps_num);
 	out->initialized = false;
 
+	for (size_t i = 0; i < MAX_CACHED_FRAMES; i++) {
+		out->cache[i].video        = out;
+		out->cache[i].frame.cached = out->cache+i;
+	}
+
 	if (pthread_mutex_init(&out->data_mutex, NULL) != 0)
 		goto fail;
 	if (pthread_mutex_init(&out->input_mutex, NULL) != 0)
 		goto fail;
+	if (pthread_mutex_init(&out->cache_mutex, NULL) != 0)
+		goto fail;
+	if (pthread_cond_init(&out->cache_cond, NULL) != 0)
+		goto fail;
 	if (os_event_init(&out->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail;
 	if (os_event_init(&out->update_event, OS_EVENT_TYPE_AUTO) != 0)
@@ -218,13 +423,33 @@ void video_output_close(video_t video)
 	video_output_stop(video);
 
 	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+		video_input_destroy(video->inputs.array[i]);
 	da_free(video->inputs);
 
+	if (video->cur_frame.cached)
+		cached_frame_release(video->cur_frame.cached);
+	if (video->new_frame && video->next_frame.cached)
+		cached_frame_release(video->next_frame.cached);
+
+	/* inputs that disconnected from within their own callback may still be
+	 * letting go of their frames */
+	pthread_mutex_lock(&video->cache_mutex);
+	for (size_t i = 0; i < MAX_CACHED_FRAMES; i++) {
+		while (os_atomic_load_long(&video->cache[i].refs) > 0)
+			pthread_cond_wait(&video->cache_cond,
+					&video->cache_mutex);
+	}
+	pthread_mutex_unlock(&video->cache_mutex);
+
+	for (size_t i = 0; i < MAX_CACHED_FRAMES; i++)
+		video_frame_free(&video->cache[i].buffer);
+
 	os_event_destroy(video->update_event);
 	os_event_destroy(video->stop_event);
 	pthread_mutex_destroy(&video->data_mutex);
 	pthread_mutex_destroy(&video->input_mutex);
+	pthread_mutex_destroy(&video->cache_mutex);
+	pthread_cond_destroy(&video->cache_cond);
 	bfree(video);
 }
 
@@ -233,7 +458,7 @@ static size_t video_get_input_idx(video_t video,
 		void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -274,6 +499,15 @@ static inline bool video_input_init(struct video_input *input,
 					input->conversion.height);
 	}
 
+	if (pthread_mutex_init(&input->queue_mutex, NULL) != 0)
+		return false;
+	if (os_sem_init(&input->frame_sem, 0) != 0)
+		return false;
+	if (pthread_create(&input->thread, NULL, video_input_thread,
+				input) != 0)
+		return false;
+
+	input->thread_active = true;
 	return true;
 }
 
@@ -290,28 +524,30 @@ bool video_output_connect(video_t video,
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(struct video_input));
 
-		input.callback = callback;
-		input.param    = param;
+		pthread_mutex_init_value(&input->queue_mutex);
+		input->callback = callback;
+		input->param    = param;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format    = video->info.format;
-			input.conversion.width     = video->info.width;
-			input.conversion.height    = video->info.height;
+			input->conversion.format    = video->info.format;
+			input->conversion.width     = video->info.width;
+			input->conversion.height    = video->info.height;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
+		success = video_input_init(input, video);
 		if (success)
 			da_push_back(video->inputs, &input);
+		else
+			video_input_destroy(input);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
@@ -323,6 +559,8 @@ void video_output_disconnect(video_t video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
 {
+	struct video_input *input = NULL;
+
 	if (!video || !callback)
 		return;
 
@@ -330,11 +568,16 @@ void video_output_disconnect(video_t video,
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array+idx);
+		input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
+
+	/* the input's thread is joined without the lock held, its callback
+	 * might be waiting on something that needs it */
+	if (input)
+		video_input_destroy(input);
 }
 
 bool video_output_active(video_t video)
@@ -348,14 +591,41 @@ const struct video_output_info *video_output_getinfo(video_t video)
 	return video ? &video->info : NULL;
 }
 
+bool video_output_lock_frame(video_t video, struct video_data *frame)
+{
+	struct cached_frame_info *cached;
+
+	if (!video || !frame) return false;
+
+	cached = cache_acquire(video);
+	if (!cached)
+		return false;
+
+	memcpy(frame->data, cached->frame.data, sizeof(frame->data));
+	memcpy(frame->linesize, cached->frame.linesize,
+			sizeof(frame->linesize));
+	frame->cached = cached;
+	return true;
+}
+
 void video_output_swap_frame(video_t video, struct video_data *frame)
 {
+	struct cached_frame_info *skipped = NULL;
+
 	if (!video) return;
 
+	if (frame->cached)
+		frame->cached->frame.timestamp = frame->timestamp;
+
 	pthread_mutex_lock(&video->data_mutex);
+	if (video->new_frame)
+		skipped = video->next_frame.cached;
 	video->next_frame = *frame;
 	video->new_frame = true;
 	pthread_mutex_unlock(&video->data_mutex);
+
+	if (skipped)
+		cached_frame_release(skipped);
 }
 
 bool video_output_wait(video_t video)
@@ -413,3 +683,40 @@ uint32_t video_output_num_skipped_frames(video_t video)
 {
 	return video->skipped_frames;
 }
+
+bool video_data_addref(const struct video_data *frame)
+{
+	if (!frame || !frame->cached)
+		return false;
+
+	os_atomic_inc_long(&frame->cached->refs);
+	return true;
+}
+
+void video_data_release(const struct video_data *frame)
+{
+	if (frame && frame->cached)
+		cached_frame_release(frame->cached);
+}
+
+uint32_t video_output_num_dropped_frames(video_t video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param)
+{
+	uint32_t dropped = 0;
+	size_t   idx;
+
+	if (!video)
+		return 0;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	idx = video_get_input_idx(video, callback, param);
+	if (idx != DARRAY_INVALID)
+		dropped = (uint32_t)os_atomic_load_long(
+				&video->inputs.array[idx]->dropped_frames);
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	return dropped;
+}
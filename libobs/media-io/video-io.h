@@ -46,10 +46,16 @@ enum video_format {
 	VIDEO_FORMAT_BGRX,
 };
 
+struct cached_frame_info;
+
 struct video_data {
 	uint8_t           *data[MAX_AV_PLANES];
 	uint32_t          linesize[MAX_AV_PLANES];
 	uint64_t          timestamp;
+
+	/* set if the data belongs to a frame the video output shares between
+	 * its inputs, see video_data_addref */
+	struct cached_frame_info *cached;
 };
 
 struct video_output_info {
@@ -133,7 +139,23 @@ EXPORT void video_output_disconnect(video_t video,
 EXPORT bool video_output_active(video_t video);
 
 EXPORT const struct video_output_info *video_output_getinfo(video_t video);
+
+/**
+ * Gets a frame from the video output's cache for the next frame to be
+ * written in to, so that it's passed to the inputs by reference instead of
+ * being copied.  The frame is handed back with video_output_swap_frame, or
+ * with video_data_release if it isn't used.  Returns false if every cached
+ * frame is in use.
+ */
+EXPORT bool video_output_lock_frame(video_t video, struct video_data *frame);
+
+/**
+ * Sets the next frame to output.  A frame from video_output_lock_frame is
+ * taken over by the video output, any other frame has to stay valid until
+ * the next call.
+ */
 EXPORT void video_output_swap_frame(video_t video, struct video_data *frame);
+
 EXPORT bool video_output_wait(video_t video);
 EXPORT uint64_t video_getframetime(video_t video);
 EXPORT uint64_t video_gettime(video_t video);
@@ -145,6 +167,23 @@ EXPORT double video_output_framerate(video_t video);
 
 EXPORT uint32_t video_output_num_skipped_frames(video_t video);
 
+/**
+ * Keeps the data of a frame passed to a video output callback valid after
+ * the callback returns, until video_data_release is called.  The data must
+ * not be modified.  Returns false if the frame can't be kept (for example if
+ * it was scaled for that input), in which case the data has to be copied.
+ */
+EXPORT bool video_data_addref(const struct video_data *frame);
+EXPORT void video_data_release(const struct video_data *frame);
+
+/**
+ * Returns the number of frames dropped for a connected input because it was
+ * still busy with previous frames
+ */
+EXPORT uint32_t video_output_num_dropped_frames(video_t video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param);
+
 
 #ifdef __cplusplus
 }
@@ -19,6 +19,11 @@
 #include "obs-avc.h"
 #include "util/array-serializer.h"
 
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 enum {
 	NAL_UNKNOWN   = 0,
 	NAL_SLICE     = 1,
@@ -33,47 +38,53 @@ enum {
 	NAL_FILLER    = 12,
 };
 
-enum {
-	NAL_PRIORITY_DISPOSABLE = 0,
-	NAL_PRIORITY_LOW        = 1,
-	NAL_PRIORITY_HIGH       = 2,
-	NAL_PRIORITY_HIGHEST    = 3,
-};
+static inline int lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
 
-/* NOTE: I noticed that FFmpeg does some unusual special handling of certain
- * scenarios that I was unaware of, so instead of just searching for {0, 0, 1}
- * we'll just use the code from FFmpeg - http://www.ffmpeg.org/ */
-static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p,
+/* NOTE: returns the first {0, 0, 1} sequence, like the FFmpeg function this
+ * replaced.  16 bytes are tested for zeros at a time, and only blocks that
+ * contain a zero are checked for the full start code.  most of a packet is
+ * compressed slice data where zero bytes are rare, so nearly all blocks are
+ * skipped after a single compare. */
+static const uint8_t *find_startcode_internal(const uint8_t *p,
 		const uint8_t *end)
 {
-	const uint8_t *a = p + 4 - ((intptr_t)p & 3);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one  = _mm_set1_epi8(1);
+
+	/* the full check reads two bytes past the 16 bytes being tested */
+	while (end - p >= 19) {
+		__m128i  a = _mm_loadu_si128((const __m128i*)p);
+		__m128i  za = _mm_cmpeq_epi8(a, zero);
+		uint32_t mask;
+
+		if (!_mm_movemask_epi8(za)) {
+			p += 16;
+			continue;
+		}
 
-	for (end -= 3; p < a && p < end; p++) {
-		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
-			return p;
-	}
+		mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(
+			_mm_and_si128(za, _mm_cmpeq_epi8(zero,
+				_mm_loadu_si128((const __m128i*)(p + 1)))),
+			_mm_cmpeq_epi8(one,
+				_mm_loadu_si128((const __m128i*)(p + 2)))));
+		if (mask)
+			return p + lowest_bit(mask);
 
-	for (end -= 3; p < end; p += 4) {
-		uint32_t x = *(const uint32_t*)p;
-
-		if ((x - 0x01010101) & (~x) & 0x80808080) {
-			if (p[1] == 0) {
-				if (p[0] == 0 && p[2] == 1)
-					return p;
-				if (p[2] == 0 && p[3] == 1)
-					return p+1;
-			}
-
-			if (p[3] == 0) {
-				if (p[2] == 0 && p[4] == 1)
-					return p+2;
-				if (p[4] == 0 && p[5] == 1)
-					return p+3;
-			}
-		}
+		p += 16;
 	}
 
-	for (end += 3; p < end; p++) {
+	/* like FFmpeg, a start code is never matched in the last three
+	 * bytes */
+	for (end -= 3; p < end; p++) {
 		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
 			return p;
 	}
@@ -83,29 +94,47 @@ static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p,
 
 const uint8_t *obs_avc_find_startcode(const uint8_t *p, const uint8_t *end)
 {
-	const uint8_t *out= ff_avc_find_startcode_internal(p, end);
+	const uint8_t *out= find_startcode_internal(p, end);
 	if (p < out && out < end && !out[-1]) out--;
 	return out;
 }
 
+bool obs_avc_next_nal(struct obs_avc_nal *nal, const uint8_t **pos,
+		const uint8_t *end)
+{
+	const uint8_t *nal_start = obs_avc_find_startcode(*pos, end);
+
+	while (nal_start < end && !*(nal_start++));
+
+	if (nal_start == end) {
+		*pos = end;
+		return false;
+	}
+
+	*pos      = obs_avc_find_startcode(nal_start, end);
+	nal->data = nal_start;
+	nal->size = *pos - nal_start;
+	return true;
+}
+
 static inline int get_drop_priority(int priority)
 {
 	switch (priority) {
-	case NAL_PRIORITY_DISPOSABLE: return NAL_PRIORITY_DISPOSABLE;
-	case NAL_PRIORITY_LOW:        return NAL_PRIORITY_LOW;
+	case OBS_NAL_PRIORITY_DISPOSABLE: return OBS_NAL_PRIORITY_DISPOSABLE;
+	case OBS_NAL_PRIORITY_LOW:        return OBS_NAL_PRIORITY_LOW;
 	}
 
-	return NAL_PRIORITY_HIGHEST;
+	return OBS_NAL_PRIORITY_HIGHEST;
 }
 
-static void serialize_avc_data(struct serializer *s, const uint8_t *data,
-		size_t size, bool *is_keyframe, int *priority)
+void obs_parse_avc_packet_info(struct encoder_packet *packet)
 {
-	const uint8_t *nal_start, *nal_end;
-	const uint8_t *end = data+size;
+	const uint8_t *nal_start, *end = packet->data + packet->size;
 	int type;
 
-	nal_start = obs_avc_find_startcode(data, end);
+	/* all slices of a picture are of the same kind, so the search stops
+	 * at the first one rather than scanning the whole packet */
+	nal_start = obs_avc_find_startcode(packet->data, end);
 	while (true) {
 		while (nal_start < end && !*(nal_start++));
 
@@ -115,34 +144,47 @@ static void serialize_avc_data(struct serializer *s, const uint8_t *data,
 		type = nal_start[0] & 0x1F;
 
 		if (type == NAL_SLICE_IDR || type == NAL_SLICE) {
-			if (is_keyframe)
-				*is_keyframe = (type == NAL_SLICE_IDR);
-			if (priority)
-				*priority = nal_start[0] >> 5;
+			packet->keyframe = (type == NAL_SLICE_IDR);
+			packet->priority = nal_start[0] >> 5;
+			break;
 		}
 
-		nal_end = obs_avc_find_startcode(nal_start, end);
-		s_wb32(s, (uint32_t)(nal_end - nal_start));
-		s_write(s, nal_start, nal_end - nal_start);
-		nal_start = nal_end;
+		nal_start = obs_avc_find_startcode(nal_start, end);
 	}
+
+	packet->drop_priority = get_drop_priority(packet->priority);
 }
 
 void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 		const struct encoder_packet *src)
 {
-	struct array_output_data output;
-	struct serializer s;
+	const uint8_t      *end = src->data + src->size;
+	const uint8_t      *pos;
+	struct obs_avc_nal nal;
+	size_t             size = 0;
+	uint8_t            *out;
 
-	array_output_serializer_init(&s, &output);
 	*avc_packet = *src;
-
-	serialize_avc_data(&s, src->data, src->size, &avc_packet->keyframe,
-			&avc_packet->priority);
-
-	avc_packet->data          = output.bytes.array;
-	avc_packet->size          = output.bytes.num;
-	avc_packet->drop_priority = get_drop_priority(avc_packet->priority);
+	avc_packet->refs = NULL;
+	obs_parse_avc_packet_info(avc_packet);
+
+	/* size the output first so it only has to be allocated once */
+	pos = src->data;
+	while (obs_avc_next_nal(&nal, &pos, end))
+		size += sizeof(uint32_t) + nal.size;
+
+	avc_packet->data = out = size ? bmalloc(size) : NULL;
+	avc_packet->size = size;
+
+	pos = src->data;
+	while (obs_avc_next_nal(&nal, &pos, end)) {
+		*out++ = (uint8_t)(nal.size >> 24);
+		*out++ = (uint8_t)(nal.size >> 16);
+		*out++ = (uint8_t)(nal.size >> 8);
+		*out++ = (uint8_t)nal.size;
+		memcpy(out, nal.data, nal.size);
+		out += nal.size;
+	}
 }
 
 static inline bool has_start_code(const uint8_t *data)
@@ -157,29 +199,19 @@ static void get_sps_pps(const uint8_t *data, size_t size,
 		const uint8_t **sps, size_t *sps_size,
 		const uint8_t **pps, size_t *pps_size)
 {
-	const uint8_t *nal_start, *nal_end;
-	const uint8_t *end = data+size;
+	const uint8_t      *end = data+size;
+	struct obs_avc_nal nal;
 	int type;
 
-	nal_start = obs_avc_find_startcode(data, end);
-	while (true) {
-		while (nal_start < end && !*(nal_start++));
-
-		if (nal_start == end)
-			break;
-
-		nal_end = obs_avc_find_startcode(nal_start, end);
-
-		type = nal_start[0] & 0x1F;
+	while (obs_avc_next_nal(&nal, &data, end)) {
+		type = nal.data[0] & 0x1F;
 		if (type == NAL_SPS) {
-			*sps = nal_start;
-			*sps_size = nal_end - nal_start;
+			*sps = nal.data;
+			*sps_size = nal.size;
 		} else if (type == NAL_PPS) {
-			*pps = nal_start;
-			*pps_size = nal_end - nal_start;
+			*pps = nal.data;
+			*pps_size = nal.size;
 		}
-
-		nal_start = nal_end;
 	}
 }
 
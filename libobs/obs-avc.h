@@ -25,10 +25,38 @@ extern "C" {
 
 struct encoder_packet;
 
+/* nal_ref_idc values, stored in encoder_packet::priority */
+enum {
+	OBS_NAL_PRIORITY_DISPOSABLE = 0,
+	OBS_NAL_PRIORITY_LOW        = 1,
+	OBS_NAL_PRIORITY_HIGH       = 2,
+	OBS_NAL_PRIORITY_HIGHEST    = 3,
+};
+
+/* A NAL unit within Annex B data, not including its start code */
+struct obs_avc_nal {
+	const uint8_t *data;
+	size_t        size;
+};
+
 /* Helpers for parsing AVC NAL units.  */
 
 EXPORT const uint8_t *obs_avc_find_startcode(const uint8_t *p,
 		const uint8_t *end);
+
+/**
+ * Gets the next NAL unit of Annex B data in place, and advances *pos past it.
+ * Returns false once there are no NAL units left.
+ */
+EXPORT bool obs_avc_next_nal(struct obs_avc_nal *nal, const uint8_t **pos,
+		const uint8_t *end);
+
+/**
+ * Sets the keyframe and priority values of an Annex B packet without
+ * converting or copying its data.
+ */
+EXPORT void obs_parse_avc_packet_info(struct encoder_packet *packet);
+
 EXPORT void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 		const struct encoder_packet *src);
 EXPORT size_t obs_parse_avc_header(uint8_t **header, const uint8_t *data,
@@ -18,18 +18,26 @@
 #include "util/bmem.h"
 #include "util/threading.h"
 #include "util/darray.h"
+#include "util/dstr.h"
+#include "util/serializer.h"
+#include "util/array-serializer.h"
 #include "graphics/vec2.h"
 #include "graphics/vec3.h"
 #include "graphics/vec4.h"
 #include "graphics/quat.h"
 #include "obs-data.h"
 
-#include <jansson.h>
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
 
 struct obs_data_item {
 	volatile long        ref;
 	struct obs_data      *parent;
 	struct obs_data_item *next;
+	struct obs_data_item **prev_next;
+	uint32_t             hash;
 	enum obs_data_type   type;
 	size_t               name_len;
 	size_t               data_len;
@@ -44,11 +52,27 @@ struct obs_data {
 	volatile long        ref;
 	char                 *json;
 	struct obs_data_item *first_item;
+	size_t               num_items;
+
+	/* open addressing (linear probing) index of the item list, only
+	 * created once the object has more than a few items */
+	struct obs_data_item **index;
+	size_t               index_size;
+
+	/* snapshots are frozen; a mutable object keeps its last snapshot
+	 * until it changes, so unchanged children can be shared */
+	bool                 frozen;
+	bool                 changed;
+	struct obs_data      *snapshot;
 };
 
 struct obs_data_array {
 	volatile long        ref;
 	DARRAY(obs_data_t)   objects;
+
+	bool                 frozen;
+	bool                 changed;
+	struct obs_data_array *snapshot;
 };
 
 struct obs_data_number {
@@ -137,7 +161,7 @@ static inline obs_data_t get_item_default_obj(struct obs_data_item *item)
 	if (!item || !item->default_size)
 		return NULL;
 
-	return *(obs_data_t*)get_item_data(item);
+	return *(obs_data_t*)get_item_default_data(item);
 }
 
 static inline obs_data_t get_item_autoselect_obj(struct obs_data_item *item)
@@ -145,7 +169,7 @@ static inline obs_data_t get_item_autoselect_obj(struct obs_data_item *item)
 	if (!item || !item->autoselect_size)
 		return NULL;
 
-	return *(obs_data_t*)get_item_data(item);
+	return *(obs_data_t*)get_item_autoselect_data(item);
 }
 
 static inline obs_data_array_t get_item_array(struct obs_data_item *item)
@@ -162,7 +186,7 @@ static inline obs_data_array_t get_item_default_array(
 	if (!item || !item->default_size)
 		return NULL;
 
-	return *(obs_data_array_t*)get_item_data(item);
+	return *(obs_data_array_t*)get_item_default_data(item);
 }
 
 static inline obs_data_array_t get_item_autoselect_array(
@@ -171,7 +195,7 @@ static inline obs_data_array_t get_item_autoselect_array(
 	if (!item || !item->autoselect_size)
 		return NULL;
 
-	return *(obs_data_array_t*)get_item_data(item);
+	return *(obs_data_array_t*)get_item_autoselect_data(item);
 }
 
 static inline void item_data_release(struct obs_data_item *item)
@@ -227,7 +251,7 @@ static inline void item_data_addref(struct obs_data_item *item)
 
 static inline void item_default_data_addref(struct obs_data_item *item)
 {
-	if (!item->data_size)
+	if (!item->default_size)
 		return;
 
 	if (item->type == OBS_DATA_OBJECT) {
@@ -252,6 +276,19 @@ static inline void item_autoselect_data_addref(struct obs_data_item *item)
 	}
 }
 
+/* FNV-1a */
+static inline uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (uint8_t)*(name++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 static struct obs_data_item *obs_data_item_create(const char *name,
 		const void *data, size_t size, enum obs_data_type type,
 		bool default_data, bool autoselect_data)
@@ -271,6 +308,7 @@ static struct obs_data_item *obs_data_item_create(const char *name,
 	item->type     = type;
 	item->name_len = name_size;
 	item->ref      = 1;
+	item->hash     = hash_name(name);
 
 	if (default_data) {
 		item->default_len = size;
@@ -291,45 +329,166 @@ static struct obs_data_item *obs_data_item_create(const char *name,
 	return item;
 }
 
-static struct obs_data_item **get_item_prev_next(struct obs_data *data,
-		struct obs_data_item *current)
+/* the parent is only valid while the item is still attached to it */
+static inline struct obs_data *item_owner(struct obs_data_item *item)
 {
-	if (!current || !data)
-		return NULL;
+	return item->prev_next ? item->parent : NULL;
+}
+
+static inline bool item_frozen(struct obs_data_item *item)
+{
+	struct obs_data *owner = item_owner(item);
+	return owner && owner->frozen;
+}
+
+static inline void item_changed(struct obs_data_item *item)
+{
+	struct obs_data *owner = item_owner(item);
+	if (owner)
+		owner->changed = true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Item index */
 
-	struct obs_data_item **prev_next = &data->first_item;
-	struct obs_data_item *item       = data->first_item;
+#define INDEX_MIN_ITEMS 8
+
+static inline size_t index_pos(struct obs_data *data, uint32_t hash)
+{
+	return (size_t)hash & (data->index_size - 1);
+}
+
+static void index_insert(struct obs_data *data, struct obs_data_item *item)
+{
+	size_t pos = index_pos(data, item->hash);
+
+	while (data->index[pos])
+		pos = (pos + 1) & (data->index_size - 1);
+
+	data->index[pos] = item;
+}
+
+static void index_rebuild(struct obs_data *data, size_t size)
+{
+	struct obs_data_item *item = data->first_item;
+
+	bfree(data->index);
+	data->index      = bzalloc(sizeof(struct obs_data_item*) * size);
+	data->index_size = size;
 
 	while (item) {
-		if (item == current)
-			return prev_next;
+		index_insert(data, item);
+		item = item->next;
+	}
+}
 
-		prev_next = &item->next;
-		item      = item->next;
+/* keeps the index at most half full */
+static inline void index_add(struct obs_data *data, struct obs_data_item *item)
+{
+	if (data->index && data->num_items * 2 <= data->index_size) {
+		index_insert(data, item);
+
+	} else if (data->num_items >= INDEX_MIN_ITEMS) {
+		size_t size = data->index ? data->index_size * 2 : 32;
+		index_rebuild(data, size);
 	}
+}
 
-	return NULL;
+static size_t index_find_ptr(struct obs_data *data,
+		struct obs_data_item *item, uint32_t hash)
+{
+	size_t pos = index_pos(data, hash);
+
+	while (data->index[pos] != item)
+		pos = (pos + 1) & (data->index_size - 1);
+
+	return pos;
 }
 
-static inline void obs_data_item_detach(struct obs_data_item *item)
+/* backward shift deletion, so no tombstones are needed */
+static void index_remove(struct obs_data *data, struct obs_data_item *item)
 {
-	struct obs_data_item **prev_next = get_item_prev_next(item->parent,
-			item);
+	size_t mask = data->index_size - 1;
+	size_t hole = index_find_ptr(data, item, item->hash);
+	size_t pos  = hole;
+
+	for (;;) {
+		size_t home;
+
+		data->index[hole] = NULL;
+
+		for (;;) {
+			pos = (pos + 1) & mask;
+			if (!data->index[pos])
+				return;
 
-	if (prev_next) {
-		*prev_next = item->next;
-		item->next = NULL;
+			home = index_pos(data, data->index[pos]->hash);
+
+			/* move the entry into the hole unless its home slot
+			 * lies cyclically within (hole, pos] */
+			if (hole <= pos ?
+					(home <= hole || home > pos) :
+					(home <= hole && home > pos))
+				break;
+		}
+
+		data->index[hole] = data->index[pos];
+		hole = pos;
 	}
 }
 
+static inline void obs_data_item_attach(struct obs_data *data,
+		struct obs_data_item *item)
+{
+	item->parent    = data;
+	item->prev_next = &data->first_item;
+	item->next      = data->first_item;
+
+	if (data->first_item)
+		data->first_item->prev_next = &item->next;
+	data->first_item = item;
+
+	data->num_items++;
+	data->changed = true;
+	index_add(data, item);
+}
+
+static inline void obs_data_item_detach(struct obs_data_item *item)
+{
+	struct obs_data *data = item->parent;
+
+	if (!item->prev_next)
+		return;
+
+	*item->prev_next = item->next;
+	if (item->next)
+		item->next->prev_next = item->prev_next;
+
+	item->prev_next = NULL;
+	item->next      = NULL;
+
+	data->num_items--;
+	data->changed = true;
+	if (data->index)
+		index_remove(data, item);
+}
+
 static inline void obs_data_item_reattach(struct obs_data_item *old_ptr,
 		struct obs_data_item *new_ptr)
 {
-	struct obs_data_item **prev_next = get_item_prev_next(new_ptr->parent,
-			old_ptr);
+	struct obs_data *data = new_ptr->parent;
+
+	if (!new_ptr->prev_next)
+		return;
 
-	if (prev_next)
-		*prev_next = new_ptr;
+	*new_ptr->prev_next = new_ptr;
+	if (new_ptr->next)
+		new_ptr->next->prev_next = &new_ptr->next;
+
+	if (data->index) {
+		size_t pos = index_find_ptr(data, old_ptr, new_ptr->hash);
+		data->index[pos] = new_ptr;
+	}
 }
 
 static struct obs_data_item *obs_data_item_ensure_capacity(
@@ -391,222 +550,1195 @@ static inline void obs_data_item_setdata(
 				get_default_data_ptr(item),
 				item->default_len + item->autoselect_size);
 
-	if (size) {
-		memcpy(get_item_data(item), data, size);
-		item_data_addref(item);
+	if (size) {
+		memcpy(get_item_data(item), data, size);
+		item_data_addref(item);
+	}
+
+	item_changed(item);
+	*p_item = item;
+}
+
+static inline void obs_data_item_set_default_data(
+		struct obs_data_item **p_item, const void *data, size_t size,
+		enum obs_data_type type)
+{
+	if (!p_item || !*p_item)
+		return;
+
+	struct obs_data_item *item = *p_item;
+	void *old_autoselect_data = get_autoselect_data_ptr(item);
+	item_default_data_release(item);
+
+	item->type         = type;
+	item->default_size = size;
+	item->default_len  = item->autoselect_size ?
+				get_align_size(size) : size;
+	item->data_len     = item->data_size ?
+				get_align_size(item->data_size) : 0;
+	item = obs_data_item_ensure_capacity(item);
+
+	if (item->autoselect_size)
+		move_data(*p_item, old_autoselect_data, item,
+				get_autoselect_data_ptr(item),
+				item->autoselect_size);
+
+	if (size) {
+		memcpy(get_item_default_data(item), data, size);
+		item_default_data_addref(item);
+	}
+
+	item_changed(item);
+	*p_item = item;
+}
+
+static inline void obs_data_item_set_autoselect_data(
+		struct obs_data_item **p_item, const void *data, size_t size,
+		enum obs_data_type type)
+{
+	if (!p_item || !*p_item)
+		return;
+
+	struct obs_data_item *item = *p_item;
+	item_autoselect_data_release(item);
+
+	item->autoselect_size = size;
+	item->type            = type;
+	item->data_len        = item->data_size ?
+					get_align_size(item->data_size) : 0;
+	item->default_len     = item->default_size ?
+					get_align_size(item->default_size) : 0;
+	item = obs_data_item_ensure_capacity(item);
+
+	if (size) {
+		memcpy(get_item_autoselect_data(item), data, size);
+		item_autoselect_data_addref(item);
+	}
+
+	item_changed(item);
+	*p_item = item;
+}
+
+/* ------------------------------------------------------------------------- */
+/* JSON writer: items are written straight to a string, in the same format
+ * jansson used (JSON_PRESERVE_ORDER | JSON_INDENT(4)) */
+
+/* same rules as jansson: no overlong forms, surrogates or code points past
+ * U+10FFFF */
+static bool valid_utf8(const char *str, size_t len)
+{
+	const uint8_t *pos = (const uint8_t*)str;
+	const uint8_t *end = pos + len;
+
+	while (pos < end) {
+		uint8_t  c = *(pos++);
+		size_t   count;
+		uint32_t val;
+
+		if (c < 0x80)
+			continue;
+		else if (c >= 0xC2 && c <= 0xDF)
+			count = 1, val = c & 0x1F;
+		else if (c >= 0xE0 && c <= 0xEF)
+			count = 2, val = c & 0x0F;
+		else if (c >= 0xF0 && c <= 0xF4)
+			count = 3, val = c & 0x07;
+		else
+			return false;
+
+		if ((size_t)(end - pos) < count)
+			return false;
+
+		for (size_t i = 0; i < count; i++) {
+			if ((pos[i] & 0xC0) != 0x80)
+				return false;
+			val = (val << 6) | (pos[i] & 0x3F);
+		}
+
+		if (val > 0x10FFFF || (val >= 0xD800 && val <= 0xDFFF))
+			return false;
+		if ((count == 2 && val < 0x800) || (count == 3 && val < 0x10000))
+			return false;
+
+		pos += count;
+	}
+
+	return true;
+}
+
+static inline void json_write_indent(struct dstr *out, int depth)
+{
+	dstr_cat_ch(out, '\n');
+	for (int i = 0; i < depth; i++)
+		dstr_ncat(out, "    ", 4);
+}
+
+static void json_write_string(struct dstr *out, const char *str)
+{
+	const char *start = str;
+
+	dstr_cat_ch(out, '"');
+
+	for (; *str; str++) {
+		uint8_t c = (uint8_t)*str;
+		char    seq[8];
+		const char *esc;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		dstr_ncat(out, start, str - start);
+		start = str + 1;
+
+		switch (c) {
+		case '"':  esc = "\\\""; break;
+		case '\\': esc = "\\\\"; break;
+		case '\b': esc = "\\b";  break;
+		case '\f': esc = "\\f";  break;
+		case '\n': esc = "\\n";  break;
+		case '\r': esc = "\\r";  break;
+		case '\t': esc = "\\t";  break;
+		default:
+			sprintf(seq, "\\u%04X", c);
+			esc = seq;
+		}
+
+		dstr_cat(out, esc);
+	}
+
+	dstr_ncat(out, start, str - start);
+	dstr_cat_ch(out, '"');
+}
+
+static void json_write_int(struct dstr *out, long long val)
+{
+	char buf[32];
+	sprintf(buf, "%lld", val);
+	dstr_cat(out, buf);
+}
+
+static void json_write_double(struct dstr *out, double val)
+{
+	char buf[64];
+	char decimal = *localeconv()->decimal_point;
+	char *pos;
+
+	sprintf(buf, "%.17g", val);
+
+	if (decimal != '.' && (pos = strchr(buf, decimal)) != NULL)
+		*pos = '.';
+
+	/* keeps it a real number when read back */
+	if (!strchr(buf, '.') && !strchr(buf, 'e'))
+		strcat(buf, ".0");
+
+	/* no '+' or leading zeros in the exponent */
+	pos = strchr(buf, 'e');
+	if (pos) {
+		char *start = pos + 1;
+		char *end   = start + 1;
+
+		if (*start == '-')
+			start++;
+		while (*end == '0')
+			end++;
+		if (end != start)
+			memmove(start, end, strlen(end) + 1);
+	}
+
+	dstr_cat(out, buf);
+}
+
+/* items that jansson would have refused are left out, as before */
+static bool json_item_writable(struct obs_data_item *item)
+{
+	const char *name = get_item_name(item);
+
+	if (!obs_data_item_has_user_value(item))
+		return false;
+	if (!valid_utf8(name, strlen(name)))
+		return false;
+
+	if (item->type == OBS_DATA_STRING) {
+		const char *str = get_item_data(item);
+		return str && valid_utf8(str, strlen(str));
+
+	} else if (item->type == OBS_DATA_NUMBER) {
+		struct obs_data_number *num = get_item_data(item);
+		return num->type == OBS_DATA_NUM_INT ||
+			(!isnan(num->double_val) && !isinf(num->double_val));
+	}
+
+	return item->type == OBS_DATA_BOOLEAN ||
+	       item->type == OBS_DATA_OBJECT  ||
+	       item->type == OBS_DATA_ARRAY;
+}
+
+static void json_write_obj(struct dstr *out, struct obs_data *data, int depth);
+
+static void json_write_array(struct dstr *out, struct obs_data_array *array,
+		int depth)
+{
+	size_t num = array ? array->objects.num : 0;
+
+	dstr_cat_ch(out, '[');
+	if (!num) {
+		dstr_cat_ch(out, ']');
+		return;
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		if (i)
+			dstr_cat_ch(out, ',');
+		json_write_indent(out, depth + 1);
+		json_write_obj(out, array->objects.array[i], depth + 1);
+	}
+
+	json_write_indent(out, depth);
+	dstr_cat_ch(out, ']');
+}
+
+static void json_write_item(struct dstr *out, struct obs_data_item *item,
+		int depth)
+{
+	void *ptr = get_item_data(item);
+
+	json_write_string(out, get_item_name(item));
+	dstr_ncat(out, ": ", 2);
+
+	if (item->type == OBS_DATA_STRING) {
+		json_write_string(out, ptr);
+
+	} else if (item->type == OBS_DATA_NUMBER) {
+		struct obs_data_number *num = ptr;
+
+		if (num->type == OBS_DATA_NUM_INT)
+			json_write_int(out, num->int_val);
+		else
+			json_write_double(out, num->double_val);
+
+	} else if (item->type == OBS_DATA_BOOLEAN) {
+		dstr_cat(out, *(bool*)ptr ? "true" : "false");
+
+	} else if (item->type == OBS_DATA_OBJECT) {
+		json_write_obj(out, *(obs_data_t*)ptr, depth);
+
+	} else if (item->type == OBS_DATA_ARRAY) {
+		json_write_array(out, *(obs_data_array_t*)ptr, depth);
+	}
+}
+
+static void json_write_obj(struct dstr *out, struct obs_data *data, int depth)
+{
+	struct obs_data_item *item = data ? data->first_item : NULL;
+	bool first = true;
+
+	dstr_cat_ch(out, '{');
+
+	for (; item; item = item->next) {
+		if (!json_item_writable(item))
+			continue;
+
+		if (!first)
+			dstr_cat_ch(out, ',');
+		json_write_indent(out, depth + 1);
+		json_write_item(out, item, depth + 1);
+		first = false;
+	}
+
+	if (!first)
+		json_write_indent(out, depth);
+	dstr_cat_ch(out, '}');
+}
+
+/* ------------------------------------------------------------------------- */
+/* JSON reader: values are added to the obs_data objects as they are parsed,
+ * accepting the same input jansson did with JSON_REJECT_DUPLICATES */
+
+static struct obs_data_item *get_item(struct obs_data *data,
+		const char *name);
+
+struct json_reader {
+	const char *start;
+	const char *pos;
+	const char *error;
+};
+
+static inline bool json_error(struct json_reader *r, const char *error)
+{
+	if (!r->error)
+		r->error = error;
+	return false;
+}
+
+static inline void json_skip_whitespace(struct json_reader *r)
+{
+	while (*r->pos == ' ' || *r->pos == '\t' ||
+	       *r->pos == '\n' || *r->pos == '\r')
+		r->pos++;
+}
+
+static inline int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static int32_t json_read_escape(struct json_reader *r)
+{
+	int32_t val = 0;
+
+	for (int i = 0; i < 4; i++) {
+		int digit = hex_digit(r->pos[i]);
+		if (digit < 0)
+			return -1;
+		val = (val << 4) | digit;
+	}
+
+	r->pos += 4;
+	return val;
+}
+
+static void utf8_append(struct dstr *str, int32_t val)
+{
+	char   buf[4];
+	size_t len;
+
+	if (val < 0x80) {
+		buf[0] = (char)val;
+		len = 1;
+	} else if (val < 0x800) {
+		buf[0] = (char)(0xC0 | (val >> 6));
+		buf[1] = (char)(0x80 | (val & 0x3F));
+		len = 2;
+	} else if (val < 0x10000) {
+		buf[0] = (char)(0xE0 | (val >> 12));
+		buf[1] = (char)(0x80 | ((val >> 6) & 0x3F));
+		buf[2] = (char)(0x80 | (val & 0x3F));
+		len = 3;
+	} else {
+		buf[0] = (char)(0xF0 | (val >> 18));
+		buf[1] = (char)(0x80 | ((val >> 12) & 0x3F));
+		buf[2] = (char)(0x80 | ((val >> 6) & 0x3F));
+		buf[3] = (char)(0x80 | (val & 0x3F));
+		len = 4;
+	}
+
+	dstr_ncat(str, buf, len);
+}
+
+static bool json_read_unicode(struct json_reader *r, struct dstr *str)
+{
+	int32_t val = json_read_escape(r);
+
+	if (val < 0)
+		return json_error(r, "invalid escape");
+	if (val == 0)
+		return json_error(r, "\\u0000 is not allowed");
+
+	if (val >= 0xD800 && val <= 0xDBFF) {
+		int32_t low;
+
+		if (r->pos[0] != '\\' || r->pos[1] != 'u')
+			return json_error(r, "invalid Unicode surrogate");
+
+		r->pos += 2;
+		low = json_read_escape(r);
+		if (low < 0xDC00 || low > 0xDFFF)
+			return json_error(r, "invalid Unicode surrogate");
+
+		val = ((val - 0xD800) << 10) + (low - 0xDC00) + 0x10000;
+
+	} else if (val >= 0xDC00 && val <= 0xDFFF) {
+		return json_error(r, "invalid Unicode surrogate");
+	}
+
+	utf8_append(str, val);
+	return true;
+}
+
+/* decodes the string at the reader position (after the opening quote) */
+static bool json_read_string(struct json_reader *r, struct dstr *str)
+{
+	const char *start = r->pos;
+
+	dstr_ensure_capacity(str, 1);
+	str->array[0] = 0;
+	str->len      = 0;
+
+	for (;;) {
+		uint8_t c = (uint8_t)*r->pos;
+
+		if (c == '"' || c == '\\' || c < 0x20) {
+			size_t len = r->pos - start;
+
+			if (!valid_utf8(start, len))
+				return json_error(r, "invalid UTF-8");
+			dstr_ncat(str, start, len);
+
+			if (c == '"') {
+				r->pos++;
+				break;
+			} else if (!c) {
+				return json_error(r, "premature end of input");
+			} else if (c < 0x20) {
+				return json_error(r, "control character in "
+				                     "string");
+			}
+
+			c = (uint8_t)*(++r->pos);
+			r->pos++;
+
+			switch (c) {
+			case '"':
+			case '\\':
+			case '/': dstr_cat_ch(str, (char)c); break;
+			case 'b': dstr_cat_ch(str, '\b'); break;
+			case 'f': dstr_cat_ch(str, '\f'); break;
+			case 'n': dstr_cat_ch(str, '\n'); break;
+			case 'r': dstr_cat_ch(str, '\r'); break;
+			case 't': dstr_cat_ch(str, '\t'); break;
+			case 'u':
+				if (!json_read_unicode(r, str))
+					return false;
+				break;
+			default:
+				return json_error(r, "invalid escape");
+			}
+
+			start = r->pos;
+		} else {
+			r->pos++;
+		}
+	}
+
+	return true;
+}
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline bool is_alpha(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool json_literal(struct json_reader *r, const char *literal)
+{
+	size_t len = strlen(literal);
+	return strncmp(r->pos, literal, len) == 0 && !is_alpha(r->pos[len]);
+}
+
+static bool json_read_number(struct json_reader *r, struct obs_data *data,
+		const char *key)
+{
+	const char *start = r->pos;
+	bool is_real = false;
+	char buf[64];
+	char *text = buf;
+	size_t len;
+	bool success = true;
+
+	if (*r->pos == '-')
+		r->pos++;
+
+	if (*r->pos == '0') {
+		if (is_digit(*(++r->pos)))
+			return json_error(r, "invalid token");
+	} else if (is_digit(*r->pos)) {
+		while (is_digit(*r->pos))
+			r->pos++;
+	} else {
+		return json_error(r, "invalid token");
+	}
+
+	if (*r->pos == '.') {
+		if (!is_digit(*(++r->pos)))
+			return json_error(r, "invalid token");
+		while (is_digit(*r->pos))
+			r->pos++;
+		is_real = true;
+	}
+
+	if (*r->pos == 'e' || *r->pos == 'E') {
+		r->pos++;
+		if (*r->pos == '+' || *r->pos == '-')
+			r->pos++;
+		if (!is_digit(*r->pos))
+			return json_error(r, "invalid token");
+		while (is_digit(*r->pos))
+			r->pos++;
+		is_real = true;
+	}
+
+	len = r->pos - start;
+	if (len >= sizeof(buf))
+		text = bmalloc(len + 1);
+	memcpy(text, start, len);
+	text[len] = 0;
+
+	errno = 0;
+
+	if (is_real) {
+		char decimal = *localeconv()->decimal_point;
+		char *point = strchr(text, '.');
+		double val;
+
+		if (point && decimal != '.')
+			*point = decimal;
+
+		val = strtod(text, NULL);
+		if (errno == ERANGE && (val == HUGE_VAL || val == -HUGE_VAL))
+			success = json_error(r, "real number overflow");
+		else if (data)
+			obs_data_setdouble(data, key, val);
+
+	} else {
+		long long val = strtoll(text, NULL, 10);
+
+		if (errno == ERANGE)
+			success = json_error(r, "too big integer");
+		else if (data)
+			obs_data_setint(data, key, val);
+	}
+
+	if (text != buf)
+		bfree(text);
+	return success;
+}
+
+static bool json_read_obj(struct json_reader *r, struct obs_data *data);
+static bool json_read_array(struct json_reader *r, struct obs_data *data,
+		const char *key);
+
+/* reads the value at the reader position and stores it as 'key' in 'data',
+ * or just validates it if 'data' is NULL */
+static bool json_read_value(struct json_reader *r, struct obs_data *data,
+		const char *key, struct dstr *str)
+{
+	json_skip_whitespace(r);
+
+	switch (*r->pos) {
+	case '{': {
+		obs_data_t obj = obs_data_create();
+		bool success;
+
+		r->pos++;
+		success = json_read_obj(r, obj);
+		if (success && data)
+			obs_data_setobj(data, key, obj);
+
+		obs_data_release(obj);
+		return success;
+	}
+
+	case '[':
+		r->pos++;
+		return json_read_array(r, data, key);
+
+	case '"':
+		r->pos++;
+		if (!json_read_string(r, str))
+			return false;
+		if (data)
+			obs_data_setstring(data, key, str->array);
+		return true;
+	}
+
+	if (*r->pos == '-' || is_digit(*r->pos))
+		return json_read_number(r, data, key);
+
+	if (json_literal(r, "true")) {
+		r->pos += 4;
+		if (data)
+			obs_data_setbool(data, key, true);
+		return true;
+
+	} else if (json_literal(r, "false")) {
+		r->pos += 5;
+		if (data)
+			obs_data_setbool(data, key, false);
+		return true;
+
+	} else if (json_literal(r, "null")) {
+		r->pos += 4;
+		return true;
+	}
+
+	return json_error(r, "invalid token");
+}
+
+/* only objects are kept from arrays, like obs_data_array requires */
+static bool json_read_array(struct json_reader *r, struct obs_data *data,
+		const char *key)
+{
+	obs_data_array_t array = data ? obs_data_array_create() : NULL;
+	struct dstr str = {0};
+	bool success = false;
+
+	json_skip_whitespace(r);
+	if (*r->pos == ']') {
+		r->pos++;
+		success = true;
+		goto finish;
+	}
+
+	for (;;) {
+		json_skip_whitespace(r);
+
+		if (*r->pos == '{') {
+			obs_data_t obj = obs_data_create();
+
+			r->pos++;
+			if (!json_read_obj(r, obj)) {
+				obs_data_release(obj);
+				goto finish;
+			}
+
+			if (array)
+				obs_data_array_push_back(array, obj);
+			obs_data_release(obj);
+
+		} else if (!json_read_value(r, NULL, NULL, &str)) {
+			goto finish;
+		}
+
+		json_skip_whitespace(r);
+		if (*r->pos == ']') {
+			r->pos++;
+			success = true;
+			break;
+		} else if (*r->pos != ',') {
+			json_error(r, "']' expected");
+			break;
+		}
+
+		r->pos++;
+	}
+
+finish:
+	if (success && data)
+		obs_data_setarray(data, key, array);
+
+	obs_data_array_release(array);
+	dstr_free(&str);
+	return success;
+}
+
+/* items are added to the front of the list, so restore the order they had
+ * in the document (and will be written back in) */
+static void reverse_items(struct obs_data *data)
+{
+	struct obs_data_item *item = data->first_item;
+	struct obs_data_item *prev = NULL;
+
+	while (item) {
+		struct obs_data_item *next = item->next;
+
+		item->next      = prev;
+		item->prev_next = next ? &next->next : &data->first_item;
+
+		prev = item;
+		item = next;
+	}
+
+	data->first_item = prev;
+}
+
+static bool json_read_obj(struct json_reader *r, struct obs_data *data)
+{
+	struct dstr key = {0};
+	struct dstr str = {0};
+	DARRAY(char*) null_keys;
+	bool success = false;
+
+	da_init(null_keys);
+
+	json_skip_whitespace(r);
+	if (*r->pos == '}') {
+		r->pos++;
+		return true;
+	}
+
+	for (;;) {
+		bool duplicate;
+
+		json_skip_whitespace(r);
+		if (*r->pos != '"') {
+			json_error(r, "string or '}' expected");
+			break;
+		}
+
+		r->pos++;
+		if (!json_read_string(r, &key))
+			break;
+
+		/* null values are not stored, but still count as keys */
+		duplicate = get_item(data, key.array) != NULL;
+		for (size_t i = 0; !duplicate && i < null_keys.num; i++)
+			duplicate = strcmp(null_keys.array[i], key.array) == 0;
+
+		if (duplicate) {
+			json_error(r, "duplicate object key");
+			break;
+		}
+
+		json_skip_whitespace(r);
+		if (*r->pos != ':') {
+			json_error(r, "':' expected");
+			break;
+		}
+
+		r->pos++;
+		json_skip_whitespace(r);
+
+		if (json_literal(r, "null")) {
+			char *null_key = bstrdup(key.array);
+			da_push_back(null_keys, &null_key);
+		}
+
+		if (!json_read_value(r, data, key.array, &str))
+			break;
+
+		json_skip_whitespace(r);
+		if (*r->pos == '}') {
+			r->pos++;
+			reverse_items(data);
+			success = true;
+			break;
+		} else if (*r->pos != ',') {
+			json_error(r, "'}' expected");
+			break;
+		}
+
+		r->pos++;
+	}
+
+	for (size_t i = 0; i < null_keys.num; i++)
+		bfree(null_keys.array[i]);
+	da_free(null_keys);
+	dstr_free(&key);
+	dstr_free(&str);
+	return success;
+}
+
+static bool json_read_root(struct json_reader *r, struct obs_data *data)
+{
+	json_skip_whitespace(r);
+
+	/* the root can be an array, but only objects have items to add */
+	if (*r->pos == '{') {
+		r->pos++;
+		if (!json_read_obj(r, data))
+			return false;
+
+	} else if (*r->pos == '[') {
+		r->pos++;
+		if (!json_read_array(r, NULL, NULL))
+			return false;
+
+	} else {
+		return json_error(r, "'[' or '{' expected");
+	}
+
+	json_skip_whitespace(r);
+	if (*r->pos)
+		return json_error(r, "end of file expected");
+
+	return true;
+}
+
+static int json_error_line(struct json_reader *r)
+{
+	int line = 1;
+
+	for (const char *pos = r->start; pos < r->pos; pos++) {
+		if (*pos == '\n')
+			line++;
 	}
 
-	*p_item = item;
+	return line;
 }
 
-static inline void obs_data_item_set_default_data(
-		struct obs_data_item **p_item, const void *data, size_t size,
-		enum obs_data_type type)
-{
-	if (!p_item || !*p_item)
-		return;
+/* ------------------------------------------------------------------------- */
+/* Binary format: a compact alternative to JSON for snapshots and IPC.
+ *
+ *   header:  "OBSD" u8 version
+ *   object:  { u8 type, key, value } ... u8 BIN_END
+ *   key:     varint (len << 1 | 1) followed by the name on first use, or
+ *            varint (index << 1) referring to an earlier key
+ *   string:  varint length followed by the bytes (no terminator)
+ *   int:     zigzag varint
+ *   double:  8 bytes, little endian
+ *   object:  nested object body
+ *   array:   varint count followed by that many object bodies
+ *
+ * Only values that can be written as JSON are stored, so the two formats
+ * convert losslessly to one another. */
+
+#define BIN_VERSION 1
+
+/* objects and arrays are read recursively, so corrupt data could otherwise
+ * nest deep enough to overflow the stack */
+#define BIN_MAX_DEPTH 128
+
+enum bin_type {
+	BIN_END,
+	BIN_STRING,
+	BIN_INT,
+	BIN_DOUBLE,
+	BIN_FALSE,
+	BIN_TRUE,
+	BIN_OBJECT,
+	BIN_ARRAY
+};
 
-	struct obs_data_item *item = *p_item;
-	void *old_autoselect_data = get_autoselect_data_ptr(item);
-	item_default_data_release(item);
+struct bin_writer {
+	struct serializer    *s;
 
-	item->type         = type;
-	item->default_size = size;
-	item->default_len  = item->autoselect_size ?
-				get_align_size(size) : size;
-	item->data_len     = item->data_size ?
-				get_align_size(item->data_size) : 0;
-	item = obs_data_item_ensure_capacity(item);
+	/* interned key names, with an open addressing index of them */
+	DARRAY(struct obs_data_item*) keys;
+	size_t               *index;
+	size_t               index_size;
+};
 
-	if (item->autoselect_size)
-		move_data(*p_item, old_autoselect_data, item,
-				get_autoselect_data_ptr(item),
-				item->autoselect_size);
+static inline void bin_write_varint(struct bin_writer *w, uint64_t val)
+{
+	uint8_t buf[10];
+	size_t  len = 0;
 
-	if (size) {
-		memcpy(get_item_default_data(item), data, size);
-		item_default_data_addref(item);
+	while (val >= 0x80) {
+		buf[len++] = (uint8_t)val | 0x80;
+		val >>= 7;
 	}
+	buf[len++] = (uint8_t)val;
 
-	*p_item = item;
+	s_write(w->s, buf, len);
 }
 
-static inline void obs_data_item_set_autoselect_data(
-		struct obs_data_item **p_item, const void *data, size_t size,
-		enum obs_data_type type)
+static void bin_key_index_rebuild(struct bin_writer *w)
 {
-	if (!p_item || !*p_item)
-		return;
+	size_t size = w->index_size ? w->index_size * 2 : 64;
 
-	struct obs_data_item *item = *p_item;
-	item_autoselect_data_release(item);
+	bfree(w->index);
+	w->index      = bzalloc(size * sizeof(size_t));
+	w->index_size = size;
 
-	item->autoselect_size = size;
-	item->type            = type;
-	item->data_len        = item->data_size ?
-					get_align_size(item->data_size) : 0;
-	item->default_len     = item->default_size ?
-					get_align_size(item->default_size) : 0;
-	item = obs_data_item_ensure_capacity(item);
+	for (size_t i = 0; i < w->keys.num; i++) {
+		size_t pos = w->keys.array[i]->hash & (size - 1);
+		while (w->index[pos])
+			pos = (pos + 1) & (size - 1);
+		w->index[pos] = i + 1;
+	}
+}
 
-	if (size) {
-		memcpy(get_item_autoselect_data(item), data, size);
-		item_autoselect_data_addref(item);
+static void bin_write_key(struct bin_writer *w, struct obs_data_item *item)
+{
+	const char *name = get_item_name(item);
+	size_t     mask  = w->index_size - 1;
+	size_t     pos   = item->hash & mask;
+	size_t     len;
+
+	for (; w->index[pos]; pos = (pos + 1) & mask) {
+		struct obs_data_item *key = w->keys.array[w->index[pos] - 1];
+
+		if (key->hash == item->hash &&
+		    strcmp(get_item_name(key), name) == 0) {
+			bin_write_varint(w, (uint64_t)(w->index[pos] - 1) << 1);
+			return;
+		}
 	}
 
-	*p_item = item;
+	len = strlen(name);
+	bin_write_varint(w, ((uint64_t)len << 1) | 1);
+	s_write(w->s, name, len);
+
+	/* items are referenced by the data being written, so they stay valid
+	 * until writing has finished */
+	da_push_back(w->keys, &item);
+	w->index[pos] = w->keys.num;
+
+	if (w->keys.num * 2 > w->index_size)
+		bin_key_index_rebuild(w);
 }
 
-/* ------------------------------------------------------------------------- */
+static void bin_write_obj(struct bin_writer *w, struct obs_data *data);
+
+static void bin_write_item(struct bin_writer *w, struct obs_data_item *item)
+{
+	void *ptr = get_item_data(item);
+
+	if (item->type == OBS_DATA_STRING) {
+		size_t len = strlen(ptr);
 
-static void obs_data_add_json_item(obs_data_t data, const char *key,
-		json_t *json);
+		s_w8(w->s, BIN_STRING);
+		bin_write_key(w, item);
+		bin_write_varint(w, len);
+		s_write(w->s, ptr, len);
 
-static inline void obs_data_add_json_object_data(obs_data_t data, json_t *jobj)
+	} else if (item->type == OBS_DATA_NUMBER) {
+		struct obs_data_number *num = ptr;
+
+		if (num->type == OBS_DATA_NUM_INT) {
+			uint64_t val = (uint64_t)num->int_val;
+
+			s_w8(w->s, BIN_INT);
+			bin_write_key(w, item);
+			bin_write_varint(w, (val << 1) ^ (0 - (val >> 63)));
+		} else {
+			s_w8(w->s, BIN_DOUBLE);
+			bin_write_key(w, item);
+			s_wld(w->s, num->double_val);
+		}
+
+	} else if (item->type == OBS_DATA_BOOLEAN) {
+		s_w8(w->s, *(bool*)ptr ? BIN_TRUE : BIN_FALSE);
+		bin_write_key(w, item);
+
+	} else if (item->type == OBS_DATA_OBJECT) {
+		s_w8(w->s, BIN_OBJECT);
+		bin_write_key(w, item);
+		bin_write_obj(w, *(obs_data_t*)ptr);
+
+	} else if (item->type == OBS_DATA_ARRAY) {
+		struct obs_data_array *array = *(obs_data_array_t*)ptr;
+		size_t num = array ? array->objects.num : 0;
+
+		s_w8(w->s, BIN_ARRAY);
+		bin_write_key(w, item);
+		bin_write_varint(w, num);
+
+		for (size_t i = 0; i < num; i++)
+			bin_write_obj(w, array->objects.array[i]);
+	}
+}
+
+static void bin_write_obj(struct bin_writer *w, struct obs_data *data)
 {
-	const char *item_key;
-	json_t *jitem;
+	struct obs_data_item *item = data ? data->first_item : NULL;
 
-	json_object_foreach (jobj, item_key, jitem) {
-		obs_data_add_json_item(data, item_key, jitem);
+	for (; item; item = item->next) {
+		if (json_item_writable(item))
+			bin_write_item(w, item);
 	}
+
+	s_w8(w->s, BIN_END);
 }
 
-static inline void obs_data_add_json_object(obs_data_t data, const char *key,
-		json_t *jobj)
+struct bin_reader {
+	struct serializer    *s;
+	DARRAY(char*)        keys;
+	struct dstr          str;
+	const char           *error;
+};
+
+static inline bool bin_error(struct bin_reader *r, const char *error)
 {
-	obs_data_t sub_obj = obs_data_create();
+	if (!r->error)
+		r->error = error;
+	return false;
+}
 
-	obs_data_add_json_object_data(sub_obj, jobj);
-	obs_data_setobj(data, key, sub_obj);
-	obs_data_release(sub_obj);
+static inline bool bin_read(struct bin_reader *r, void *data, size_t size)
+{
+	if (s_read(r->s, data, size) != size)
+		return bin_error(r, "unexpected end of data");
+	return true;
 }
 
-static void obs_data_add_json_array(obs_data_t data, const char *key,
-		json_t *jarray)
+static bool bin_read_varint(struct bin_reader *r, uint64_t *val)
 {
-	obs_data_array_t array = obs_data_array_create();
-	size_t idx;
-	json_t *jitem;
+	*val = 0;
 
-	json_array_foreach (jarray, idx, jitem) {
-		obs_data_t item;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t byte;
 
-		if (!json_is_object(jitem))
-			continue;
+		if (!bin_read(r, &byte, 1))
+			return false;
 
-		item = obs_data_create();
-		obs_data_add_json_object_data(item, jitem);
-		obs_data_array_push_back(array, item);
-		obs_data_release(item);
+		*val |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
 	}
 
-	obs_data_setarray(data, key, array);
-	obs_data_array_release(array);
+	return bin_error(r, "invalid varint");
 }
 
-static void obs_data_add_json_item(obs_data_t data, const char *key,
-		json_t *json)
+/* read in chunks so a corrupt length can't make it allocate more than there
+ * is data for */
+static bool bin_read_bytes(struct bin_reader *r, struct dstr *str,
+		uint64_t len)
 {
-	if (json_is_object(json))
-		obs_data_add_json_object(data, key, json);
-	else if (json_is_array(json))
-		obs_data_add_json_array(data, key, json);
-	else if (json_is_string(json))
-		obs_data_setstring(data, key, json_string_value(json));
-	else if (json_is_integer(json))
-		obs_data_setint(data, key, json_integer_value(json));
-	else if (json_is_real(json))
-		obs_data_setdouble(data, key, json_real_value(json));
-	else if (json_is_true(json))
-		obs_data_setbool(data, key, true);
-	else if (json_is_false(json))
-		obs_data_setbool(data, key, false);
-}
+	str->len = 0;
+	dstr_ensure_capacity(str, 1);
 
-/* ------------------------------------------------------------------------- */
+	while (len) {
+		size_t chunk = len > 4096 ? 4096 : (size_t)len;
 
-static inline void set_json_string(json_t *json, const char *name,
-		obs_data_item_t item)
+		dstr_ensure_capacity(str, str->len + chunk + 1);
+		if (!bin_read(r, str->array + str->len, chunk))
+			return false;
+
+		str->len += chunk;
+		len      -= chunk;
+	}
+
+	str->array[str->len] = 0;
+
+	if (strlen(str->array) != str->len)
+		return bin_error(r, "null character in string");
+	return true;
+}
+
+static inline bool bin_read_string(struct bin_reader *r)
 {
-	const char *val = obs_data_item_getstring(item);
-	json_object_set_new(json, name, json_string(val));
+	uint64_t len;
+	return bin_read_varint(r, &len) && bin_read_bytes(r, &r->str, len);
 }
 
-static inline void set_json_number(json_t *json, const char *name,
-		obs_data_item_t item)
+static bool bin_read_key(struct bin_reader *r, const char **key)
 {
-	enum obs_data_number_type type = obs_data_item_numtype(item);
+	uint64_t val;
+
+	if (!bin_read_varint(r, &val))
+		return false;
+
+	if (val & 1) {
+		char *name;
+
+		if (!bin_read_bytes(r, &r->str, val >> 1))
+			return false;
+
+		name = bstrdup_n(r->str.array, r->str.len);
+		da_push_back(r->keys, &name);
+		*key = name;
 
-	if (type == OBS_DATA_NUM_INT) {
-		long long val = obs_data_item_getint(item);
-		json_object_set_new(json, name, json_integer(val));
 	} else {
-		double val = obs_data_item_getdouble(item);
-		json_object_set_new(json, name, json_real(val));
+		if ((val >> 1) >= r->keys.num)
+			return bin_error(r, "invalid key index");
+		*key = r->keys.array[val >> 1];
 	}
+
+	return true;
 }
 
-static inline void set_json_bool(json_t *json, const char *name,
-		obs_data_item_t item)
+static inline double bin_double(uint64_t bits)
 {
-	bool val = obs_data_item_getbool(item);
-	json_object_set_new(json, name, val ? json_true() : json_false());
+	double val;
+	memcpy(&val, &bits, sizeof(val));
+	return val;
 }
 
-static json_t *obs_data_to_json(obs_data_t data);
+static bool bin_read_obj(struct bin_reader *r, struct obs_data *data,
+		int depth);
 
-static inline void set_json_obj(json_t *json, const char *name,
-		obs_data_item_t item)
+static bool bin_read_array(struct bin_reader *r, struct obs_data *data,
+		const char *key, int depth)
 {
-	obs_data_t obj = obs_data_item_getobj(item);
-	json_object_set_new(json, name, obs_data_to_json(obj));
-	obs_data_release(obj);
-}
+	obs_data_array_t array = obs_data_array_create();
+	uint64_t num;
+	bool success = bin_read_varint(r, &num);
 
-static inline void set_json_array(json_t *json, const char *name,
-		obs_data_item_t item)
-{
-	json_t           *jarray = json_array();
-	obs_data_array_t array   = obs_data_item_getarray(item);
-	size_t           count   = obs_data_array_count(array);
+	/* each object takes at least one byte, so a bad count just runs out
+	 * of data */
+	for (uint64_t i = 0; success && i < num; i++) {
+		obs_data_t obj = obs_data_create();
 
-	for (size_t idx = 0; idx < count; idx++) {
-		obs_data_t sub_item = obs_data_array_item(array, idx);
-		json_t     *jitem   = obs_data_to_json(sub_item);
-		json_array_append_new(jarray, jitem);
-		obs_data_release(sub_item);
+		success = bin_read_obj(r, obj, depth + 1);
+		if (success)
+			obs_data_array_push_back(array, obj);
+		obs_data_release(obj);
 	}
 
-	json_object_set_new(json, name, jarray);
+	if (success)
+		obs_data_setarray(data, key, array);
+
 	obs_data_array_release(array);
+	return success;
+}
+
+static bool bin_read_item(struct bin_reader *r, struct obs_data *data,
+		uint8_t type, int depth)
+{
+	const char *key;
+	uint8_t    buf[8];
+	uint64_t   val;
+
+	if (!bin_read_key(r, &key))
+		return false;
+	if (get_item(data, key))
+		return bin_error(r, "duplicate object key");
+
+	switch (type) {
+	case BIN_STRING:
+		if (!bin_read_string(r))
+			return false;
+		obs_data_setstring(data, key, r->str.array);
+		return true;
+
+	case BIN_INT:
+		if (!bin_read_varint(r, &val))
+			return false;
+		obs_data_setint(data, key, (long long)(val >> 1) ^
+				-(long long)(val & 1));
+		return true;
+
+	case BIN_DOUBLE:
+		if (!bin_read(r, buf, sizeof(buf)))
+			return false;
+
+		val = 0;
+		for (int i = 7; i >= 0; i--)
+			val = (val << 8) | buf[i];
+		obs_data_setdouble(data, key, bin_double(val));
+		return true;
+
+	case BIN_FALSE:
+	case BIN_TRUE:
+		obs_data_setbool(data, key, type == BIN_TRUE);
+		return true;
+
+	case BIN_OBJECT: {
+		obs_data_t obj = obs_data_create();
+		bool success = bin_read_obj(r, obj, depth + 1);
+
+		if (success)
+			obs_data_setobj(data, key, obj);
+		obs_data_release(obj);
+		return success;
+	}
+
+	case BIN_ARRAY:
+		return bin_read_array(r, data, key, depth);
+	}
+
+	return bin_error(r, "invalid value type");
 }
 
-static json_t *obs_data_to_json(obs_data_t data)
+static bool bin_read_obj(struct bin_reader *r, struct obs_data *data,
+		int depth)
 {
-	json_t *json = json_object();
-	obs_data_item_t item = NULL;
+	uint8_t type;
 
-	for (item = obs_data_first(data); item; obs_data_item_next(&item)) {
-		enum obs_data_type type = obs_data_item_gettype(item);
-		const char *name        = get_item_name(item);
+	if (depth > BIN_MAX_DEPTH)
+		return bin_error(r, "nesting too deep");
 
-		if (!obs_data_item_has_user_value(item))
-			continue;
+	for (;;) {
+		if (!bin_read(r, &type, 1))
+			return false;
 
-		if (type == OBS_DATA_STRING)
-			set_json_string(json, name, item);
-		else if (type == OBS_DATA_NUMBER)
-			set_json_number(json, name, item);
-		else if (type == OBS_DATA_BOOLEAN)
-			set_json_bool(json, name, item);
-		else if (type == OBS_DATA_OBJECT)
-			set_json_obj(json, name, item);
-		else if (type == OBS_DATA_ARRAY)
-			set_json_array(json, name, item);
+		if (type == BIN_END)
+			break;
+		if (!bin_read_item(r, data, type, depth))
+			return false;
 	}
 
-	return json;
+	reverse_items(data);
+	return true;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -623,17 +1755,22 @@ obs_data_t obs_data_create_from_json(const char *json_string)
 {
 	obs_data_t data = obs_data_create();
 
-	json_error_t error;
-	json_t *root = json_loads(json_string, JSON_REJECT_DUPLICATES, &error);
+	struct json_reader reader = {json_string, json_string, NULL};
 
-	if (root) {
-		obs_data_add_json_object_data(data, root);
-		json_decref(root);
-	} else {
+	if (!json_string) {
+		json_error(&reader, "wrong arguments");
+
+	} else if (!json_read_root(&reader, data)) {
+		/* nothing from a partially read string is kept */
+		obs_data_release(data);
+		data = obs_data_create();
+	}
+
+	if (reader.error)
 		blog(LOG_ERROR, "obs-data.c: [obs_data_create_from_json] "
 		                "Failed reading json string (%d): %s",
-		                error.line, error.text);
-	}
+		                json_string ? json_error_line(&reader) : 0,
+		                reader.error);
 
 	return data;
 }
@@ -648,14 +1785,20 @@ static inline void obs_data_destroy(struct obs_data *data)
 {
 	struct obs_data_item *item = data->first_item;
 
+	/* items can outlive the object if they are still referenced
+	 * elsewhere, so unlink them first */
 	while (item) {
 		struct obs_data_item *next = item->next;
+		item->parent    = NULL;
+		item->prev_next = NULL;
+		item->next      = NULL;
 		obs_data_item_release(&item);
 		item = next;
 	}
 
-	/* NOTE: don't use bfree for json text, allocated by json */
-	free(data->json);
+	obs_data_release(data->snapshot);
+	bfree(data->json);
+	bfree(data->index);
 	bfree(data);
 }
 
@@ -671,22 +1814,102 @@ const char *obs_data_getjson(obs_data_t data)
 {
 	if (!data) return NULL;
 
-	/* NOTE: don't use libobs bfree for json text */
-	free(data->json);
-	data->json = NULL;
+	struct dstr json = {0};
 
-	json_t *root = obs_data_to_json(data);
-	data->json = json_dumps(root, JSON_PRESERVE_ORDER | JSON_INDENT(4));
-	json_decref(root);
+	bfree(data->json);
+
+	json_write_obj(&json, data, 0);
+	data->json = json.array;
 
 	return data->json;
 }
 
+void obs_data_write_binary(obs_data_t data, struct serializer *s)
+{
+	if (!data || !s) return;
+
+	struct bin_writer writer = {s};
+
+	s_write(s, "OBSD", 4);
+	s_w8(s, BIN_VERSION);
+
+	bin_key_index_rebuild(&writer);
+	bin_write_obj(&writer, data);
+
+	da_free(writer.keys);
+	bfree(writer.index);
+}
+
+obs_data_t obs_data_read_binary(struct serializer *s)
+{
+	struct bin_reader reader = {s};
+	obs_data_t data = NULL;
+	char magic[4];
+	uint8_t version;
+
+	if (!s) {
+		bin_error(&reader, "wrong arguments");
+
+	} else if (!bin_read(&reader, magic, sizeof(magic)) ||
+	           memcmp(magic, "OBSD", sizeof(magic)) != 0) {
+		bin_error(&reader, "not obs_data binary data");
+
+	} else if (!bin_read(&reader, &version, 1) ||
+	           version != BIN_VERSION) {
+		bin_error(&reader, "unsupported version");
+
+	} else {
+		data = obs_data_create();
+		if (!bin_read_obj(&reader, data, 0)) {
+			obs_data_release(data);
+			data = NULL;
+		}
+	}
+
+	for (size_t i = 0; i < reader.keys.num; i++)
+		bfree(reader.keys.array[i]);
+	da_free(reader.keys);
+	dstr_free(&reader.str);
+
+	if (reader.error)
+		blog(LOG_ERROR, "obs-data.c: [obs_data_read_binary] "
+		                "Failed reading binary data: %s",
+		                reader.error);
+
+	return data;
+}
+
+obs_data_t obs_data_create_from_binary(const void *bytes, size_t size)
+{
+	struct array_input_data input;
+	struct serializer s;
+
+	array_input_serializer_init(&s, &input, bytes, size);
+	return obs_data_read_binary(&s);
+}
+
 static struct obs_data_item *get_item(struct obs_data *data, const char *name)
 {
 	if (!data) return NULL;
 
-	struct obs_data_item *item = data->first_item;
+	struct obs_data_item *item;
+
+	if (data->index) {
+		uint32_t hash = hash_name(name);
+		size_t   pos  = index_pos(data, hash);
+
+		while ((item = data->index[pos]) != NULL) {
+			if (item->hash == hash &&
+			    strcmp(get_item_name(item), name) == 0)
+				return item;
+
+			pos = (pos + 1) & (data->index_size - 1);
+		}
+
+		return NULL;
+	}
+
+	item = data->first_item;
 
 	while (item) {
 		if (strcmp(get_item_name(item), name) == 0)
@@ -705,13 +1928,13 @@ static void set_item_data(struct obs_data *data, struct obs_data_item **item,
 {
 	obs_data_item_t new_item = NULL;
 
+	if (data ? data->frozen : (item && *item && item_frozen(*item)))
+		return;
+
 	if ((!item || (item && !*item)) && data) {
 		new_item = obs_data_item_create(name, ptr, size, type,
 				default_data, autoselect_data);
-		new_item->next = data->first_item;
-		new_item->parent = data;
-
-		data->first_item = new_item;
+		obs_data_item_attach(data, new_item);
 
 	} else if (default_data) {
 		obs_data_item_set_default_data(item, ptr, size, type);
@@ -803,7 +2026,7 @@ void obs_data_erase(obs_data_t data, const char *name)
 {
 	struct obs_data_item *item = get_item(data, name);
 
-	if (item) {
+	if (item && !data->frozen) {
 		obs_data_item_detach(item);
 		obs_data_item_release(&item);
 	}
@@ -1066,6 +2289,7 @@ static inline void obs_data_array_destroy(obs_data_array_t array)
 		for (size_t i = 0; i < array->objects.num; i++)
 			obs_data_release(array->objects.array[i]);
 		da_free(array->objects);
+		obs_data_array_release(array->snapshot);
 		bfree(array);
 	}
 }
@@ -1100,30 +2324,256 @@ obs_data_t obs_data_array_item(obs_data_array_t array, size_t idx)
 
 size_t obs_data_array_push_back(obs_data_array_t array, obs_data_t obj)
 {
-	if (!array || !obj)
+	if (!array || !obj || array->frozen)
 		return 0;
 
+	array->changed = true;
 	os_atomic_inc_long(&obj->ref);
 	return da_push_back(array->objects, &obj);
 }
 
 void obs_data_array_insert(obs_data_array_t array, size_t idx, obs_data_t obj)
 {
-	if (!array || !obj)
+	if (!array || !obj || array->frozen)
 		return;
 
+	array->changed = true;
 	os_atomic_inc_long(&obj->ref);
 	da_insert(array->objects, idx, &obj);
 }
 
 void obs_data_array_erase(obs_data_array_t array, size_t idx)
 {
-	if (array) {
+	if (array && !array->frozen) {
+		array->changed = true;
 		obs_data_release(array->objects.array[idx]);
 		da_erase(array->objects, idx);
 	}
 }
 
+/* ------------------------------------------------------------------------- */
+/* Snapshots */
+
+static obs_data_t data_snapshot(struct obs_data *data);
+static obs_data_array_t array_snapshot(struct obs_data_array *array);
+
+/* objects and arrays are replaced with snapshots of themselves, which will
+ * be the same ones as last time if they haven't changed since */
+static inline void *child_snapshot(enum obs_data_type type, const void *ptr)
+{
+	if (type == OBS_DATA_OBJECT)
+		return data_snapshot(*(obs_data_t*)ptr);
+	else
+		return array_snapshot(*(obs_data_array_t*)ptr);
+}
+
+static inline void child_release(enum obs_data_type type, void *child)
+{
+	if (type == OBS_DATA_OBJECT)
+		obs_data_release(child);
+	else
+		obs_data_array_release(child);
+}
+
+static inline bool is_child_type(enum obs_data_type type)
+{
+	return type == OBS_DATA_OBJECT || type == OBS_DATA_ARRAY;
+}
+
+static void snapshot_value(struct obs_data *snapshot,
+		struct obs_data_item **new_item, const char *name,
+		enum obs_data_type type, const void *ptr, size_t size,
+		bool default_data, bool autoselect_data)
+{
+	void *child = NULL;
+
+	if (is_child_type(type)) {
+		child = child_snapshot(type, ptr);
+		ptr   = &child;
+	}
+
+	if (*new_item) {
+		set_item_data(snapshot, new_item, name, ptr, size, type,
+				default_data, autoselect_data);
+	} else {
+		*new_item = obs_data_item_create(name, ptr, size, type,
+				default_data, autoselect_data);
+		obs_data_item_attach(snapshot, *new_item);
+	}
+
+	if (child)
+		child_release(type, child);
+}
+
+static void snapshot_item(struct obs_data *snapshot,
+		struct obs_data_item *item)
+{
+	const char *name = get_item_name(item);
+	struct obs_data_item *new_item = NULL;
+
+	/* copied in the same order values would normally be set in, and
+	 * items left without any values are dropped */
+	if (item->default_size)
+		snapshot_value(snapshot, &new_item, name, item->type,
+				get_default_data_ptr(item), item->default_size,
+				true, false);
+	if (item->data_size)
+		snapshot_value(snapshot, &new_item, name, item->type,
+				get_data_ptr(item), item->data_size,
+				false, false);
+	if (item->autoselect_size)
+		snapshot_value(snapshot, &new_item, name, item->type,
+				get_autoselect_data_ptr(item),
+				item->autoselect_size, false, true);
+}
+
+static inline bool child_current(enum obs_data_type type, size_t size,
+		const void *ptr, const void *snapshot_ptr)
+{
+	void *child;
+	bool current;
+
+	if (!size)
+		return true;
+
+	child   = child_snapshot(type, ptr);
+	current = child == *(void**)snapshot_ptr;
+	child_release(type, child);
+
+	return current;
+}
+
+static inline bool item_has_values(struct obs_data_item *item)
+{
+	return item->data_size || item->default_size || item->autoselect_size;
+}
+
+static inline struct obs_data_item *next_with_values(
+		struct obs_data_item *item)
+{
+	while (item && !item_has_values(item))
+		item = item->next;
+	return item;
+}
+
+/* an unchanged object can still have changed children */
+static bool snapshot_current(struct obs_data *data)
+{
+	struct obs_data_item *item = next_with_values(data->first_item);
+	struct obs_data_item *snap = data->snapshot->first_item;
+
+	for (; item && snap; item = next_with_values(item->next),
+	                     snap = snap->next) {
+		if (!is_child_type(item->type))
+			continue;
+
+		if (!child_current(item->type, item->data_size,
+					get_data_ptr(item),
+					get_data_ptr(snap)) ||
+		    !child_current(item->type, item->default_size,
+					get_default_data_ptr(item),
+					get_default_data_ptr(snap)) ||
+		    !child_current(item->type, item->autoselect_size,
+					get_autoselect_data_ptr(item),
+					get_autoselect_data_ptr(snap)))
+			return false;
+	}
+
+	return !item && !snap;
+}
+
+static obs_data_t data_snapshot(struct obs_data *data)
+{
+	struct obs_data *snapshot;
+
+	if (!data)
+		return NULL;
+
+	if (data->frozen || (data->snapshot && !data->changed &&
+	                     snapshot_current(data))) {
+		snapshot = data->frozen ? data : data->snapshot;
+		obs_data_addref(snapshot);
+		return snapshot;
+	}
+
+	snapshot = obs_data_create();
+
+	for (struct obs_data_item *item = data->first_item; item;
+			item = item->next)
+		snapshot_item(snapshot, item);
+
+	reverse_items(snapshot);
+	snapshot->frozen = true;
+
+	obs_data_release(data->snapshot);
+	data->snapshot = snapshot;
+	data->changed  = false;
+
+	obs_data_addref(snapshot);
+	return snapshot;
+}
+
+static bool array_snapshot_current(struct obs_data_array *array)
+{
+	struct obs_data_array *snapshot = array->snapshot;
+
+	if (snapshot->objects.num != array->objects.num)
+		return false;
+
+	for (size_t i = 0; i < array->objects.num; i++) {
+		obs_data_t child = data_snapshot(array->objects.array[i]);
+		bool current = child == snapshot->objects.array[i];
+
+		obs_data_release(child);
+		if (!current)
+			return false;
+	}
+
+	return true;
+}
+
+static obs_data_array_t array_snapshot(struct obs_data_array *array)
+{
+	struct obs_data_array *snapshot;
+
+	if (!array)
+		return NULL;
+
+	if (array->frozen || (array->snapshot && !array->changed &&
+	                      array_snapshot_current(array))) {
+		snapshot = array->frozen ? array : array->snapshot;
+		obs_data_array_addref(snapshot);
+		return snapshot;
+	}
+
+	snapshot = obs_data_array_create();
+
+	for (size_t i = 0; i < array->objects.num; i++) {
+		obs_data_t child = data_snapshot(array->objects.array[i]);
+		obs_data_array_push_back(snapshot, child);
+		obs_data_release(child);
+	}
+
+	snapshot->frozen = true;
+
+	obs_data_array_release(array->snapshot);
+	array->snapshot = snapshot;
+	array->changed  = false;
+
+	obs_data_array_addref(snapshot);
+	return snapshot;
+}
+
+obs_data_t obs_data_snapshot(obs_data_t data)
+{
+	return data_snapshot(data);
+}
+
+bool obs_data_is_snapshot(obs_data_t data)
+{
+	return data && data->frozen;
+}
+
 /* ------------------------------------------------------------------------- */
 /* Item status inspection */
 
@@ -1177,7 +2627,7 @@ void obs_data_unset_autoselect_value(obs_data_t data, const char *name)
 
 void obs_data_item_unset_user_value(obs_data_item_t item)
 {
-	if (!item || !item->data_size)
+	if (!item || !item->data_size || item_frozen(item))
 		return;
 
 	void *old_non_user_data = get_default_data_ptr(item);
@@ -1190,11 +2640,13 @@ void obs_data_item_unset_user_value(obs_data_item_t item)
 		move_data(item, old_non_user_data, item,
 				get_default_data_ptr(item),
 				item->default_len + item->autoselect_size);
+
+	item_changed(item);
 }
 
 void obs_data_item_unset_default_value(obs_data_item_t item)
 {
-	if (!item || !item->default_size)
+	if (!item || !item->default_size || item_frozen(item))
 		return;
 
 	void *old_autoselect_data = get_autoselect_data_ptr(item);
@@ -1207,15 +2659,18 @@ void obs_data_item_unset_default_value(obs_data_item_t item)
 		move_data(item, old_autoselect_data, item,
 				get_autoselect_data_ptr(item),
 				item->autoselect_size);
+
+	item_changed(item);
 }
 
 void obs_data_item_unset_autoselect_value(obs_data_item_t item)
 {
-	if (!item || !item->autoselect_size)
+	if (!item || !item->autoselect_size || item_frozen(item))
 		return;
 
 	item_autoselect_data_release(item);
 	item->autoselect_size = 0;
+	item_changed(item);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1272,7 +2727,7 @@ void obs_data_item_release(obs_data_item_t *item)
 
 void obs_data_item_remove(obs_data_item_t *item)
 {
-	if (item && *item) {
+	if (item && *item && !item_frozen(*item)) {
 		obs_data_item_detach(*item);
 		obs_data_item_release(item);
 	}
@@ -27,6 +27,7 @@ struct vec2;
 struct vec3;
 struct vec4;
 struct quat;
+struct serializer;
 
 /*
  * OBS data settings storage
@@ -67,6 +68,34 @@ EXPORT void obs_data_release(obs_data_t data);
 
 EXPORT const char *obs_data_getjson(obs_data_t data);
 
+/*
+ * Binary serialization
+ *
+ *   A more compact and faster alternative to JSON, for things such as
+ * autosave snapshots or sending settings to other processes.  Holds the same
+ * values JSON does, so data can be converted between the two without loss.
+ * The read functions return NULL if the data is invalid.
+ */
+
+EXPORT void obs_data_write_binary(obs_data_t data, struct serializer *s);
+EXPORT obs_data_t obs_data_read_binary(struct serializer *s);
+EXPORT obs_data_t obs_data_create_from_binary(const void *bytes, size_t size);
+
+/*
+ * Snapshots
+ *
+ *   Returns an immutable copy of the data, which other threads can read
+ * without locking while the original keeps being modified.  Objects and
+ * arrays that haven't changed since the previous snapshot are shared with it
+ * rather than copied again.  Snapshots must be taken on the thread that
+ * modifies the data, and attempts to modify a snapshot are ignored.
+ * obs_data_getjson stores its result in the object, so it isn't safe to call
+ * on the same snapshot from several threads at once.
+ */
+
+EXPORT obs_data_t obs_data_snapshot(obs_data_t data);
+EXPORT bool obs_data_is_snapshot(obs_data_t data);
+
 EXPORT void obs_data_apply(obs_data_t target, obs_data_t apply_data);
 
 EXPORT void obs_data_erase(obs_data_t data, const char *name);
@@ -15,9 +15,13 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include "util/platform.h"
 #include "obs.h"
 #include "obs-internal.h"
 
+#define DEFAULT_VIDEO_QUEUE 4
+#define DEFAULT_AUDIO_QUEUE 32
+
 static inline struct obs_encoder_info *get_encoder_info(const char *id)
 {
 	for (size_t i = 0; i < obs->encoder_types.num; i++) {
@@ -36,11 +40,47 @@ const char *obs_encoder_getdisplayname(const char *id)
 	return ei ? ei->getname() : NULL;
 }
 
+static void *encode_thread(void *param);
+
+static const char *encoder_signals[] = {
+	"void bitrate_changed(ptr encoder, int bitrate)",
+	NULL
+};
+
+static void encoder_get_queue_stats(void *param, calldata_t params)
+{
+	struct obs_encoder *encoder = param;
+	uint64_t avg_time;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	avg_time = encoder->frames_encoded ?
+		encoder->encode_time_total / encoder->frames_encoded : 0;
+
+	calldata_setint(params, "queued",
+			(long long)(encoder->queue.size / sizeof(void*)));
+	calldata_setint(params, "max_queued", (long long)encoder->max_queued);
+	calldata_setint(params, "encoded", (long long)encoder->frames_encoded);
+	calldata_setint(params, "dropped", (long long)encoder->frames_dropped);
+	calldata_setfloat(params, "avg_encode_ms",
+			(double)avg_time / 1000000.0);
+	calldata_setfloat(params, "max_encode_ms",
+			(double)encoder->encode_time_max / 1000000.0);
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+}
+
 static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		obs_data_t settings)
 {
 	pthread_mutex_init_value(&encoder->callbacks_mutex);
 	pthread_mutex_init_value(&encoder->outputs_mutex);
+	pthread_mutex_init_value(&encoder->encode_mutex);
+	pthread_mutex_init_value(&encoder->queue_mutex);
+
+	encoder->queue_policy = OBS_ENCODER_QUEUE_BLOCK;
+	encoder->max_queued   = encoder->info.type == OBS_ENCODER_VIDEO ?
+		DEFAULT_VIDEO_QUEUE : DEFAULT_AUDIO_QUEUE;
 
 	if (!obs_context_data_init(&encoder->context, settings, name))
 		return false;
@@ -48,10 +88,32 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		return false;
 	if (pthread_mutex_init(&encoder->outputs_mutex, NULL) != 0)
 		return false;
+	if (pthread_mutex_init(&encoder->encode_mutex, NULL) != 0)
+		return false;
+	if (pthread_mutex_init(&encoder->queue_mutex, NULL) != 0)
+		return false;
+	if (pthread_cond_init(&encoder->queue_cond, NULL) != 0)
+		return false;
+	if (os_sem_init(&encoder->queue_sem, 0) != 0)
+		return false;
+	if (pthread_create(&encoder->encode_thread, NULL, encode_thread,
+				encoder) != 0)
+		return false;
+
+	encoder->encode_thread_active = true;
+
+	signal_handler_add_array(encoder->context.signals, encoder_signals);
+	proc_handler_add(encoder->context.procs,
+			"void get_queue_stats(out int queued, "
+			"out int max_queued, out int encoded, "
+			"out int dropped, out float avg_encode_ms, "
+			"out float max_encode_ms)",
+			encoder_get_queue_stats, encoder);
 
 	if (encoder->info.defaults)
 		encoder->info.defaults(encoder->context.settings);
 
+	obs_context_data_update_snapshot(&encoder->context);
 	return true;
 }
 
@@ -130,11 +192,59 @@ static inline struct video_scale_info *get_video_info(
 	return NULL;
 }
 
+static inline void free_queued_frame(struct encoder_queued_frame *frame)
+{
+	video_frame_free(&frame->video);
+	bfree(frame->audio);
+	bfree(frame);
+}
+
+/* call with queue_mutex held */
+static inline void release_queued_frame(struct obs_encoder *encoder,
+		struct encoder_queued_frame *frame)
+{
+	video_data_release(&frame->held);
+	frame->held.cached = NULL;
+
+	da_push_back(encoder->frame_pool, &frame);
+}
+
+/* call with queue_mutex held */
+static void flush_frame_queue(struct obs_encoder *encoder)
+{
+	while (encoder->queue.size) {
+		struct encoder_queued_frame *frame;
+		circlebuf_pop_front(&encoder->queue, &frame, sizeof(frame));
+		release_queued_frame(encoder, frame);
+	}
+
+	pthread_cond_broadcast(&encoder->queue_cond);
+}
+
+/* the pooled frames are sized for the current format, so this must be called
+ * whenever the format changes */
+static void free_frame_pool(struct obs_encoder *encoder)
+{
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	for (size_t i = 0; i < encoder->frame_pool.num; i++)
+		free_queued_frame(encoder->frame_pool.array[i]);
+	da_free(encoder->frame_pool);
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+}
+
 static void add_connection(struct obs_encoder *encoder)
 {
 	struct audio_convert_info audio_info = {0};
 	struct video_scale_info   video_info = {0};
 
+	free_frame_pool(encoder);
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	encoder->accepting_frames = true;
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
 	if (encoder->info.type == OBS_ENCODER_AUDIO) {
 		get_audio_info(encoder, &audio_info);
 		audio_output_connect(encoder->media, &audio_info, receive_audio,
@@ -142,7 +252,17 @@ static void add_connection(struct obs_encoder *encoder)
 	} else {
 		struct video_scale_info *info = NULL;
 
+		const struct video_output_info *voi;
+
 		info = get_video_info(encoder, &video_info);
+		voi  = video_output_getinfo(encoder->media);
+
+		encoder->video_format = info ? info->format : voi->format;
+		encoder->video_width  = info && info->width ?
+			info->width : voi->width;
+		encoder->video_height = info && info->height ?
+			info->height : voi->height;
+
 		video_output_connect(encoder->media, info, receive_video,
 				encoder);
 	}
@@ -152,6 +272,13 @@ static void add_connection(struct obs_encoder *encoder)
 
 static void remove_connection(struct obs_encoder *encoder)
 {
+	/* wakes up the media thread if it's waiting on a full queue, so it
+	 * can return before being disconnected */
+	pthread_mutex_lock(&encoder->queue_mutex);
+	encoder->accepting_frames = false;
+	flush_frame_queue(encoder);
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
 	if (encoder->info.type == OBS_ENCODER_AUDIO)
 		audio_output_disconnect(encoder->media, receive_audio,
 				encoder);
@@ -159,16 +286,41 @@ static void remove_connection(struct obs_encoder *encoder)
 		video_output_disconnect(encoder->media, receive_video,
 				encoder);
 
+	pthread_mutex_lock(&encoder->queue_mutex);
+	flush_frame_queue(encoder);
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	/* wait for any frame that's currently being encoded, unless this was
+	 * called from the encode thread itself */
+	if (!pthread_equal(pthread_self(), encoder->encode_thread)) {
+		pthread_mutex_lock(&encoder->encode_mutex);
+		pthread_mutex_unlock(&encoder->encode_mutex);
+	}
+
 	encoder->active = false;
 }
 
 static inline void free_audio_buffers(struct obs_encoder *encoder)
 {
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+	for (size_t i = 0; i < MAX_AV_PLANES; i++)
 		circlebuf_free(&encoder->audio_input_buffer[i]);
-		bfree(encoder->audio_output_buffer[i]);
-		encoder->audio_output_buffer[i] = NULL;
+}
+
+static void stop_encode_thread(struct obs_encoder *encoder)
+{
+	if (encoder->encode_thread_active) {
+		encoder->encode_thread_exit = true;
+		os_sem_post(encoder->queue_sem);
+		pthread_join(encoder->encode_thread, NULL);
+		encoder->encode_thread_active = false;
 	}
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	flush_frame_queue(encoder);
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	free_frame_pool(encoder);
+	circlebuf_free(&encoder->queue);
 }
 
 static void obs_encoder_actually_destroy(obs_encoder_t encoder)
@@ -184,6 +336,7 @@ static void obs_encoder_actually_destroy(obs_encoder_t encoder)
 
 		blog(LOG_INFO, "encoder '%s' destroyed", encoder->context.name);
 
+		stop_encode_thread(encoder);
 		free_audio_buffers(encoder);
 
 		if (encoder->context.data)
@@ -191,6 +344,10 @@ static void obs_encoder_actually_destroy(obs_encoder_t encoder)
 		da_free(encoder->callbacks);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
+		pthread_mutex_destroy(&encoder->encode_mutex);
+		pthread_mutex_destroy(&encoder->queue_mutex);
+		pthread_cond_destroy(&encoder->queue_cond);
+		os_sem_destroy(encoder->queue_sem);
 		obs_context_data_free(&encoder->context);
 		bfree(encoder);
 	}
@@ -261,15 +418,38 @@ obs_properties_t obs_encoder_properties(obs_encoder_t encoder)
 	return NULL;
 }
 
+/* outputs usually change encoder parameters from their packet callback,
+ * which is called from the encode thread with encode_mutex already held */
+static inline bool lock_encode(struct obs_encoder *encoder)
+{
+	if (pthread_equal(pthread_self(), encoder->encode_thread))
+		return false;
+
+	pthread_mutex_lock(&encoder->encode_mutex);
+	return true;
+}
+
 void obs_encoder_update(obs_encoder_t encoder, obs_data_t settings)
 {
+	bool locked;
+
 	if (!encoder) return;
 
 	obs_data_apply(encoder->context.settings, settings);
 
-	if (encoder->info.update && encoder->context.data)
+	locked = lock_encode(encoder);
+
+	if (encoder->info.update && encoder->context.data) {
 		encoder->info.update(encoder->context.data,
 				encoder->context.settings);
+		os_atomic_set_long(&encoder->requested_bitrate, 0);
+		os_atomic_set_long(&encoder->bitrate, 0);
+	}
+
+	if (locked)
+		pthread_mutex_unlock(&encoder->encode_mutex);
+
+	obs_context_data_update_snapshot(&encoder->context);
 }
 
 bool obs_encoder_get_extra_data(obs_encoder_t encoder, uint8_t **extra_data,
@@ -290,13 +470,11 @@ obs_data_t obs_encoder_get_settings(obs_encoder_t encoder)
 	return encoder->context.settings;
 }
 
-static inline void reset_audio_buffers(struct obs_encoder *encoder)
+obs_data_t obs_encoder_get_settings_snapshot(obs_encoder_t encoder)
 {
-	free_audio_buffers(encoder);
+	if (!encoder) return NULL;
 
-	for (size_t i = 0; i < encoder->planes; i++)
-		encoder->audio_output_buffer[i] =
-			bmalloc(encoder->framesize_bytes);
+	return obs_context_data_get_snapshot(&encoder->context);
 }
 
 static void intitialize_audio_encoder(struct obs_encoder *encoder)
@@ -310,7 +488,7 @@ static void intitialize_audio_encoder(struct obs_encoder *encoder)
 	encoder->framesize  = encoder->info.frame_size(encoder->context.data);
 
 	encoder->framesize_bytes = encoder->blocksize * encoder->framesize;
-	reset_audio_buffers(encoder);
+	free_audio_buffers(encoder);
 }
 
 bool obs_encoder_initialize(obs_encoder_t encoder)
@@ -328,8 +506,10 @@ bool obs_encoder_initialize(obs_encoder_t encoder)
 	if (!encoder->context.data)
 		return false;
 
-	encoder->paired_encoder  = NULL;
-	encoder->start_ts        = 0;
+	encoder->paired_encoder    = NULL;
+	encoder->start_ts          = 0;
+	encoder->bitrate           = 0;
+	encoder->requested_bitrate = 0;
 
 	if (encoder->info.type == OBS_ENCODER_AUDIO)
 		intitialize_audio_encoder(encoder);
@@ -483,6 +663,7 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 	first_packet      = *packet;
 	first_packet.data = data.array;
 	first_packet.size = data.num;
+	first_packet.refs = NULL;
 
 	cb->new_packet(cb->param, &first_packet);
 	cb->sent_first_packet = true;
@@ -530,41 +711,218 @@ static inline void do_encode(struct obs_encoder *encoder,
 	}
 
 	if (received) {
+		struct encoder_packet shared;
+
 		/* we use system time here to ensure sync with other encoders,
 		 * you do not want to use relative timestamps here */
 		pkt.dts_usec = encoder->start_ts / 1000 + packet_dts_usec(&pkt);
 
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
-		for (size_t i = 0; i < encoder->callbacks.num; i++) {
-			struct encoder_callback *cb;
-			cb = encoder->callbacks.array+i;
-			send_packet(encoder, cb, &pkt);
+		/* the data the encoder returns is only valid until the next
+		 * encode call, so outputs would each have to copy it.  copying
+		 * it once into shared data lets every output just take a
+		 * reference to it. */
+		if (encoder->callbacks.num) {
+			obs_duplicate_encoder_packet(&shared, &pkt);
+
+			for (size_t i = 0; i < encoder->callbacks.num; i++) {
+				struct encoder_callback *cb;
+				cb = encoder->callbacks.array+i;
+				send_packet(encoder, cb, &shared);
+			}
+
+			obs_free_encoder_packet(&shared);
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
 	}
 }
 
+/* called from the encode thread with encode_mutex held.  returns the new
+ * bitrate if one was requested and the encoder accepted it */
+static uint32_t apply_requested_bitrate(struct obs_encoder *encoder)
+{
+	long bitrate = os_atomic_set_long(&encoder->requested_bitrate, 0);
+
+	if (!bitrate)
+		return 0;
+
+	if (!encoder->info.set_bitrate(encoder->context.data,
+				(uint32_t)bitrate)) {
+		blog(LOG_WARNING, "Encoder '%s' failed to change its bitrate "
+		                  "to %ld", encoder->context.name, bitrate);
+		return 0;
+	}
+
+	os_atomic_set_long(&encoder->bitrate, bitrate);
+	return (uint32_t)bitrate;
+}
+
+static void signal_bitrate_changed(struct obs_encoder *encoder,
+		uint32_t bitrate)
+{
+	struct calldata params = {0};
+
+	calldata_setptr(&params, "encoder", encoder);
+	calldata_setint(&params, "bitrate", (long long)bitrate);
+	signal_handler_signal(encoder->context.signals, "bitrate_changed",
+			&params);
+	calldata_free(&params);
+}
+
+static void *encode_thread(void *param)
+{
+	struct obs_encoder *encoder = param;
+
+	while (os_sem_wait(encoder->queue_sem) == 0) {
+		struct encoder_queued_frame *frame = NULL;
+		uint64_t start_time, encode_time;
+		uint32_t new_bitrate = 0;
+
+		if (encoder->encode_thread_exit)
+			break;
+
+		pthread_mutex_lock(&encoder->encode_mutex);
+
+		pthread_mutex_lock(&encoder->queue_mutex);
+		if (encoder->queue.size) {
+			circlebuf_pop_front(&encoder->queue, &frame,
+					sizeof(frame));
+			pthread_cond_signal(&encoder->queue_cond);
+		}
+		pthread_mutex_unlock(&encoder->queue_mutex);
+
+		if (frame) {
+			new_bitrate = apply_requested_bitrate(encoder);
+
+			start_time = os_gettime_ns();
+			do_encode(encoder, &frame->frame);
+			encode_time = os_gettime_ns() - start_time;
+
+			pthread_mutex_lock(&encoder->queue_mutex);
+			encoder->frames_encoded++;
+			encoder->encode_time_total += encode_time;
+			if (encode_time > encoder->encode_time_max)
+				encoder->encode_time_max = encode_time;
+			release_queued_frame(encoder, frame);
+			pthread_mutex_unlock(&encoder->queue_mutex);
+		}
+
+		pthread_mutex_unlock(&encoder->encode_mutex);
+
+		if (new_bitrate)
+			signal_bitrate_changed(encoder, new_bitrate);
+	}
+
+	return NULL;
+}
+
+static struct encoder_queued_frame *get_queued_frame(
+		struct obs_encoder *encoder)
+{
+	struct encoder_queued_frame *frame = NULL;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	if (encoder->frame_pool.num) {
+		frame = da_end(encoder->frame_pool);
+		da_pop_back(encoder->frame_pool);
+	}
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	if (!frame) {
+		frame = bzalloc(sizeof(struct encoder_queued_frame));
+
+		if (encoder->info.type == OBS_ENCODER_AUDIO)
+			frame->audio = bmalloc(encoder->framesize_bytes *
+					encoder->planes);
+	}
+
+	return frame;
+}
+
+static void queue_frame(struct obs_encoder *encoder,
+		struct encoder_queued_frame *frame)
+{
+	size_t max_size = encoder->max_queued * sizeof(frame);
+	bool   queued   = true;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	if (encoder->queue_policy == OBS_ENCODER_QUEUE_BLOCK)
+		while (encoder->accepting_frames &&
+		       encoder->queue.size >= max_size)
+			pthread_cond_wait(&encoder->queue_cond,
+					&encoder->queue_mutex);
+
+	if (!encoder->accepting_frames) {
+		queued = false;
+
+	} else if (encoder->queue.size >= max_size) {
+		encoder->frames_dropped++;
+
+		if (encoder->queue_policy == OBS_ENCODER_QUEUE_DROP_OLDEST) {
+			struct encoder_queued_frame *oldest;
+			circlebuf_pop_front(&encoder->queue, &oldest,
+					sizeof(oldest));
+			release_queued_frame(encoder, oldest);
+		} else {
+			queued = false;
+		}
+	}
+
+	if (queued)
+		circlebuf_push_back(&encoder->queue, &frame, sizeof(frame));
+	else
+		release_queued_frame(encoder, frame);
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	if (queued)
+		os_sem_post(encoder->queue_sem);
+}
+
 static void receive_video(void *param, struct video_data *frame)
 {
-	struct obs_encoder    *encoder  = param;
-	struct encoder_frame  enc_frame;
+	struct obs_encoder          *encoder = param;
+	struct encoder_queued_frame *queued  = get_queued_frame(encoder);
+
+	memset(&queued->frame, 0, sizeof(struct encoder_frame));
+
+	if (video_data_addref(frame)) {
+		queued->held = *frame;
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			queued->frame.data[i]     = frame->data[i];
+			queued->frame.linesize[i] = frame->linesize[i];
+		}
+
+	} else {
+		struct video_frame src;
 
-	memset(&enc_frame, 0, sizeof(struct encoder_frame));
+		if (!queued->video.data[0])
+			video_frame_init(&queued->video, encoder->video_format,
+					encoder->video_width,
+					encoder->video_height);
 
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		enc_frame.data[i]     = frame->data[i];
-		enc_frame.linesize[i] = frame->linesize[i];
+		memcpy(src.data, frame->data, sizeof(src.data));
+		memcpy(src.linesize, frame->linesize, sizeof(src.linesize));
+		video_frame_copy(&queued->video, &src, encoder->video_format,
+				encoder->video_height);
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			queued->frame.data[i]     = queued->video.data[i];
+			queued->frame.linesize[i] = queued->video.linesize[i];
+		}
 	}
 
 	if (!encoder->start_ts)
 		encoder->start_ts = frame->timestamp;
 
-	enc_frame.frames = 1;
-	enc_frame.pts    = encoder->cur_pts;
+	queued->frame.frames = 1;
+	queued->frame.pts    = encoder->cur_pts;
 
-	do_encode(encoder, &enc_frame);
+	queue_frame(encoder, queued);
 
 	encoder->cur_pts += encoder->timebase_num;
 }
@@ -612,23 +970,24 @@ static bool buffer_audio(struct obs_encoder *encoder, struct audio_data *data)
 
 static void send_audio_data(struct obs_encoder *encoder)
 {
-	struct encoder_frame  enc_frame;
+	struct encoder_queued_frame *queued = get_queued_frame(encoder);
 
-	memset(&enc_frame, 0, sizeof(struct encoder_frame));
+	memset(&queued->frame, 0, sizeof(struct encoder_frame));
 
 	for (size_t i = 0; i < encoder->planes; i++) {
-		circlebuf_pop_front(&encoder->audio_input_buffer[i],
-				encoder->audio_output_buffer[i],
+		uint8_t *plane = queued->audio + encoder->framesize_bytes * i;
+
+		circlebuf_pop_front(&encoder->audio_input_buffer[i], plane,
 				encoder->framesize_bytes);
 
-		enc_frame.data[i]     = encoder->audio_output_buffer[i];
-		enc_frame.linesize[i] = (uint32_t)encoder->framesize_bytes;
+		queued->frame.data[i]     = plane;
+		queued->frame.linesize[i] = (uint32_t)encoder->framesize_bytes;
 	}
 
-	enc_frame.frames = (uint32_t)encoder->framesize;
-	enc_frame.pts    = encoder->cur_pts;
+	queued->frame.frames = (uint32_t)encoder->framesize;
+	queued->frame.pts    = encoder->cur_pts;
 
-	do_encode(encoder, &enc_frame);
+	queue_frame(encoder, queued);
 
 	encoder->cur_pts += encoder->framesize;
 }
@@ -644,6 +1003,59 @@ static void receive_audio(void *param, struct audio_data *data)
 		send_audio_data(encoder);
 }
 
+void obs_encoder_set_queue_policy(obs_encoder_t encoder,
+		enum obs_encoder_queue_policy policy, size_t max_frames)
+{
+	if (!encoder) return;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	encoder->queue_policy = policy;
+	encoder->max_queued   = max_frames ? max_frames : 1;
+	pthread_cond_broadcast(&encoder->queue_cond);
+	pthread_mutex_unlock(&encoder->queue_mutex);
+}
+
+bool obs_encoder_set_bitrate(obs_encoder_t encoder, uint32_t bitrate)
+{
+	if (!encoder || !bitrate) return false;
+	if (!encoder->info.set_bitrate || !encoder->context.data) return false;
+
+	os_atomic_set_long(&encoder->requested_bitrate, (long)bitrate);
+	return true;
+}
+
+/* called from output threads, so the settings are read from the snapshot */
+uint32_t obs_encoder_get_bitrate(obs_encoder_t encoder)
+{
+	obs_data_t settings;
+	uint32_t bitrate;
+	long override;
+
+	if (!encoder) return 0;
+
+	override = os_atomic_load_long(&encoder->requested_bitrate);
+	if (!override)
+		override = os_atomic_load_long(&encoder->bitrate);
+	if (override)
+		return (uint32_t)override;
+
+	settings = obs_context_data_get_snapshot(&encoder->context);
+	bitrate  = (uint32_t)obs_data_getint(settings, "bitrate");
+	obs_data_release(settings);
+
+	return bitrate;
+}
+
+signal_handler_t obs_encoder_signalhandler(obs_encoder_t encoder)
+{
+	return encoder ? encoder->context.signals : NULL;
+}
+
+proc_handler_t obs_encoder_prochandler(obs_encoder_t encoder)
+{
+	return encoder ? encoder->context.procs : NULL;
+}
+
 void obs_encoder_add_output(struct obs_encoder *encoder,
 		struct obs_output *output)
 {
@@ -664,15 +1076,35 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 	pthread_mutex_unlock(&encoder->outputs_mutex);
 }
 
+/* shared packet data is allocated along with its reference count, which is
+ * stored in front of the data.  the offset keeps the data aligned. */
+#define SHARED_DATA_OFFSET 16
+
 void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
 	*dst = *src;
-	dst->data = bmemdup(src->data, src->size);
+
+	if (src->refs) {
+		os_atomic_inc_long(src->refs);
+		return;
+	}
+
+	dst->refs = bmalloc(SHARED_DATA_OFFSET + src->size);
+	dst->data = (uint8_t*)dst->refs + SHARED_DATA_OFFSET;
+	*dst->refs = 1;
+
+	memcpy(dst->data, src->data, src->size);
 }
 
 void obs_free_encoder_packet(struct encoder_packet *packet)
 {
-	bfree(packet->data);
+	if (packet->refs) {
+		if (os_atomic_dec_long(packet->refs) == 0)
+			bfree((void*)packet->refs);
+	} else {
+		bfree(packet->data);
+	}
+
 	memset(packet, 0, sizeof(struct encoder_packet));
 }
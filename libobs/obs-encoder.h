@@ -23,6 +23,16 @@ enum obs_encoder_type {
 	OBS_ENCODER_VIDEO
 };
 
+/**
+ * Specifies what happens to a new frame when an encoder's queue of frames
+ * waiting to be encoded is full
+ */
+enum obs_encoder_queue_policy {
+	OBS_ENCODER_QUEUE_BLOCK,       /**< Wait for the encoder to catch up */
+	OBS_ENCODER_QUEUE_DROP_OLDEST, /**< Drop the oldest queued frame */
+	OBS_ENCODER_QUEUE_DROP_NEWEST  /**< Drop the new frame */
+};
+
 /** Encoder output packet */
 struct encoder_packet {
 	uint8_t               *data;        /**< Packet data */
@@ -44,6 +54,10 @@ struct encoder_packet {
 	/* DTS in microseconds */
 	int64_t               dts_usec;
 
+	/* Audio track index, used by outputs to interleave multiple audio
+	 * tracks */
+	size_t                track_idx;
+
 	/**
 	 * Packet priority
 	 *
@@ -59,6 +73,13 @@ struct encoder_packet {
 	 * priority or higher to continue transmission.
 	 */
 	int                   drop_priority;
+
+	/**
+	 * Reference count of the packet data when it's shared between
+	 * packets, or NULL if the packet owns its data outright.  Shared data
+	 * must not be modified.
+	 */
+	volatile long         *refs;
 };
 
 /** Encoder input frame */
@@ -209,6 +230,17 @@ struct obs_encoder_info {
 	 *                    otherwise
 	 */
 	bool (*video_info)(void *data, struct video_scale_info *info);
+
+	/**
+	 * Changes the target bitrate while the encoder is active, usually in
+	 * response to network conditions.  Unlike update, this does not
+	 * change the encoder's settings.
+	 *
+	 * @param  data     Data associated with this encoder context
+	 * @param  bitrate  New target bitrate, in kilobits per second
+	 * @return          true if successful, false otherwise
+	 */
+	bool (*set_bitrate)(void *data, uint32_t bitrate);
 };
 
 EXPORT void obs_register_encoder_s(const struct obs_encoder_info *info,
@@ -0,0 +1,162 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-internal.h"
+#include "obs-interleave.h"
+
+static inline void free_packet_queue(struct circlebuf *queue)
+{
+	while (queue->size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(queue, &packet, sizeof(packet));
+		obs_free_encoder_packet(&packet);
+	}
+
+	circlebuf_free(queue);
+}
+
+void packet_interleaver_free(struct packet_interleaver *il)
+{
+	free_packet_queue(&il->video);
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_TRACKS; i++)
+		free_packet_queue(&il->audio[i]);
+}
+
+void packet_interleaver_reset(struct packet_interleaver *il,
+		size_t num_audio_tracks)
+{
+	packet_interleaver_free(il);
+
+	if (num_audio_tracks > MAX_OUTPUT_AUDIO_TRACKS)
+		num_audio_tracks = MAX_OUTPUT_AUDIO_TRACKS;
+
+	il->received_video   = false;
+	il->num_audio_tracks = num_audio_tracks;
+	memset(il->received_audio, 0, sizeof(il->received_audio));
+}
+
+static bool prepare_interleaved_packet(struct packet_interleaver *il,
+		struct encoder_packet *out, struct encoder_packet *in)
+{
+	int64_t offset;
+
+	/* audio and video need to start at timestamp 0, and the encoders
+	 * may not currently be at 0 when we get data.  so, we store the
+	 * current dts as offset and subtract that value from the dts/pts
+	 * of the output packet. */
+	if (in->type == OBS_ENCODER_VIDEO) {
+		if (!il->received_video) {
+			il->first_video_ts = in->dts_usec;
+			il->video_offset   = in->dts;
+			il->received_video = true;
+		}
+
+		offset = il->video_offset;
+	} else{
+		/* don't accept audio that's before the first video timestamp */
+		if (!il->received_video ||
+		    in->dts_usec < il->first_video_ts)
+			return false;
+
+		if (!il->received_audio[in->track_idx]) {
+			il->audio_offsets[in->track_idx]  = in->dts;
+			il->received_audio[in->track_idx] = true;
+		}
+
+		offset = il->audio_offsets[in->track_idx];
+	}
+
+	obs_duplicate_encoder_packet(out, in);
+	out->dts -= offset;
+	out->pts -= offset;
+
+	/* convert the newly adjusted dts to relative dts time to ensure proper
+	 * interleaving.  if we're using an audio encoder that's already been
+	 * started on another output, then the first audio packet may not be
+	 * quite perfectly synced up in terms of system time (and there's
+	 * nothing we can really do about that), but it will always at least be
+	 * within a 23ish millisecond threshold (at least for AAC) */
+	out->dts_usec = packet_dts_usec(out);
+	return true;
+}
+
+static inline struct circlebuf *get_packet_queue(struct packet_interleaver *il,
+		struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO)
+		return &il->video;
+
+	if (packet->track_idx >= il->num_audio_tracks)
+		return NULL;
+
+	return &il->audio[packet->track_idx];
+}
+
+bool packet_interleaver_push(struct packet_interleaver *il,
+		struct encoder_packet *packet)
+{
+	struct circlebuf      *queue = get_packet_queue(il, packet);
+	struct encoder_packet out;
+
+	if (!queue || !prepare_interleaved_packet(il, &out, packet))
+		return false;
+
+	circlebuf_push_back(queue, &out, sizeof(out));
+	return true;
+}
+
+/* returns the queue holding the packet with the lowest timestamp, or NULL if
+ * any of the streams has no queued packets (in which case a packet with a
+ * lower timestamp could still arrive on that stream) */
+static struct circlebuf *get_next_packet_queue(struct packet_interleaver *il)
+{
+	struct circlebuf      *next_queue = &il->video;
+	struct encoder_packet next_packet;
+
+	if (!next_queue->size)
+		return NULL;
+
+	circlebuf_peek_front(next_queue, &next_packet, sizeof(next_packet));
+
+	for (size_t i = 0; i < il->num_audio_tracks; i++) {
+		struct circlebuf      *queue = &il->audio[i];
+		struct encoder_packet packet;
+
+		if (!queue->size)
+			return NULL;
+
+		circlebuf_peek_front(queue, &packet, sizeof(packet));
+		if (packet.dts_usec < next_packet.dts_usec) {
+			next_queue  = queue;
+			next_packet = packet;
+		}
+	}
+
+	return next_queue;
+}
+
+bool packet_interleaver_pop(struct packet_interleaver *il,
+		struct encoder_packet *packet)
+{
+	struct circlebuf *queue = get_next_packet_queue(il);
+
+	if (!queue)
+		return false;
+
+	circlebuf_pop_front(queue, packet, sizeof(*packet));
+	return true;
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "util/circlebuf.h"
+#include "obs.h"
+
+#define MAX_OUTPUT_AUDIO_TRACKS 4
+
+/* merges the packets of an output's video encoder and audio tracks in to a
+ * single stream in dts order.  each encoder's packets already arrive in dts
+ * order, so each stream is queued separately and the queues are merged as
+ * packets become ready */
+struct packet_interleaver {
+	bool              received_video;
+	int64_t           first_video_ts;
+	int64_t           video_offset;
+
+	/* each audio track comes from its own encoder, so each one's
+	 * timestamps start from its own first packet */
+	bool              received_audio[MAX_OUTPUT_AUDIO_TRACKS];
+	int64_t           audio_offsets[MAX_OUTPUT_AUDIO_TRACKS];
+
+	struct circlebuf  video;
+	struct circlebuf  audio[MAX_OUTPUT_AUDIO_TRACKS];
+	size_t            num_audio_tracks;
+};
+
+/** Frees any queued packets and starts over with the given audio tracks */
+extern void packet_interleaver_reset(struct packet_interleaver *il,
+		size_t num_audio_tracks);
+extern void packet_interleaver_free(struct packet_interleaver *il);
+
+/**
+ * Queues a copy of an encoded packet, with its timestamps made relative to
+ * the first packet of its stream.  Returns false if the packet was discarded
+ * (audio from before the first video packet, or an unknown audio track).
+ */
+extern bool packet_interleaver_push(struct packet_interleaver *il,
+		struct encoder_packet *packet);
+
+/**
+ * Pops the packet with the lowest dts.  Returns false while any of the
+ * streams has nothing queued, as a packet with a lower dts could still
+ * arrive on that stream.  The packet has to be freed with
+ * obs_free_encoder_packet.
+ */
+extern bool packet_interleaver_pop(struct packet_interleaver *il,
+		struct encoder_packet *packet);
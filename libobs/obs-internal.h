@@ -22,6 +22,7 @@
 #include "util/circlebuf.h"
 #include "util/dstr.h"
 #include "util/threading.h"
+#include "util/task-pool.h"
 #include "callback/signal.h"
 #include "callback/proc.h"
 
@@ -29,9 +30,11 @@
 
 #include "media-io/audio-resampler.h"
 #include "media-io/video-io.h"
+#include "media-io/video-frame.h"
 #include "media-io/audio-io.h"
 
 #include "obs.h"
+#include "obs-interleave.h"
 
 #define NUM_TEXTURES 2
 #define MICROSECOND_DEN 1000000
@@ -120,6 +123,10 @@ struct obs_core_video {
 	uint32_t                        plane_sizes[3];
 	uint32_t                        plane_linewidth[3];
 
+	/* splits CPU format conversion of output frames and async source
+	 * frames into row bands, only used from the video thread */
+	task_pool_t                     convert_pool;
+
 	uint32_t                        output_width;
 	uint32_t                        output_height;
 	uint32_t                        base_width;
@@ -201,6 +208,13 @@ struct obs_context_data {
 	DARRAY(char*)                   rename_cache;
 	pthread_mutex_t                 rename_cache_mutex;
 
+	/* snapshot of the settings as of the last update, which other
+	 * threads can read without locking.  replaced snapshots are kept
+	 * until no reader could still be about to reference them */
+	obs_data_t                      settings_snapshot;
+	volatile long                   snapshot_readers;
+	DARRAY(obs_data_t)              retired_snapshots;
+
 	pthread_mutex_t                 *mutex;
 	struct obs_context_data         *next;
 	struct obs_context_data         **prev_next;
@@ -219,10 +233,43 @@ extern void obs_context_data_remove(struct obs_context_data *context);
 extern void obs_context_data_setname(struct obs_context_data *context,
 		const char *name);
 
+extern void obs_context_data_update_snapshot(
+		struct obs_context_data *context);
+extern obs_data_t obs_context_data_get_snapshot(
+		struct obs_context_data *context);
+
 
 /* ------------------------------------------------------------------------- */
 /* sources  */
 
+struct async_frame {
+	struct source_frame             *frame;
+	long                            unused_count;
+
+	/* true if the frame belongs to the source's frame cache, otherwise the
+	 * frame was created by a filter and is destroyed when released */
+	bool                            cached;
+
+	/* set if the frame data is owned by the source itself rather than
+	 * allocated by the cache, see obs_source_output_video_owned */
+	void (*release)(void *param, struct source_frame *frame);
+	void                            *param;
+};
+
+/* must be a power of two */
+#define MAX_ASYNC_FRAMES 32
+
+/*
+ * Bounded single-producer/single-consumer queue of async frames.  Only the
+ * producer writes the tail and only the consumer writes the head, so pushing
+ * and popping never need a lock.
+ */
+struct async_frame_queue {
+	struct async_frame              *frames[MAX_ASYNC_FRAMES];
+	volatile long                   head;
+	volatile long                   tail;
+};
+
 struct obs_source {
 	struct obs_context_data         context;
 	struct obs_source_info          info;
@@ -308,13 +355,30 @@ struct obs_source {
 	float                           async_color_range_max[3];
 	int                             async_plane_offset[2];
 	bool                            async_flip;
-	DARRAY(struct source_frame*)    video_frames;
-	pthread_mutex_t                 video_mutex;
 	uint32_t                        async_width;
 	uint32_t                        async_height;
 	uint32_t                        async_convert_width;
 	uint32_t                        async_convert_height;
 
+	/* frames are pushed to async_frames by the thread outputting video and
+	 * popped by the graphics thread.  released cache frames are handed back
+	 * to the outputting thread through async_returns, so the frame cache is
+	 * only ever touched by the outputting thread (under async_output_mutex,
+	 * in case a source outputs video from more than one thread).
+	 * async_held tracks the frames obs_source_getframe has handed out that
+	 * haven't been released yet, and is only touched by the graphics
+	 * thread */
+	struct async_frame_queue        async_frames;
+	struct async_frame_queue        async_returns;
+	DARRAY(struct async_frame*)     async_held;
+	pthread_mutex_t                 async_output_mutex;
+	DARRAY(struct async_frame*)     async_cache;
+	enum video_format               async_cache_format;
+	uint32_t                        async_cache_width;
+	uint32_t                        async_cache_height;
+	volatile long                   async_frames_dropped;
+	volatile long                   async_frames_skipped;
+
 	/* filters */
 	struct obs_source               *filter_parent;
 	struct obs_source               *filter_target;
@@ -348,15 +412,8 @@ struct obs_output {
 	struct obs_context_data         context;
 	struct obs_output_info          info;
 
-	bool                            received_video;
-	bool                            received_audio;
-	int64_t                         first_video_ts;
-	int64_t                         video_offset;
-	int64_t                         audio_offset;
-	int64_t                         highest_audio_ts;
-	int64_t                         highest_video_ts;
 	pthread_mutex_t                 interleaved_mutex;
-	DARRAY(struct encoder_packet)   interleaved_packets;
+	struct packet_interleaver       interleaver;
 
 	int                             reconnect_retry_sec;
 	int                             reconnect_retry_max;
@@ -396,6 +453,19 @@ struct encoder_callback {
 	void *param;
 };
 
+struct encoder_queued_frame {
+	struct encoder_frame            frame;
+
+	/* reference to the video output's own copy of the frame, which is
+	 * used as is unless the frame was scaled for the encoder */
+	struct video_data               held;
+
+	/* storage for the frame data otherwise, depending on the encoder
+	 * type.  the video buffer is only allocated once it's needed */
+	struct video_frame              video;
+	uint8_t                         *audio;
+};
+
 struct obs_encoder {
 	struct obs_context_data         context;
 	struct obs_encoder_info         info;
@@ -414,7 +484,40 @@ struct obs_encoder {
 	int64_t                         cur_pts;
 
 	struct circlebuf                audio_input_buffer[MAX_AV_PLANES];
-	uint8_t                         *audio_output_buffer[MAX_AV_PLANES];
+
+	enum video_format               video_format;
+	uint32_t                        video_width;
+	uint32_t                        video_height;
+
+	/* frames are queued and encoded on a separate thread so a slow encode
+	 * doesn't hold up the media thread feeding the encoder.  queued video
+	 * frames reference the video output's data where possible, and are
+	 * copied otherwise.  encode_mutex is held while a frame is being
+	 * encoded */
+	pthread_t                       encode_thread;
+	bool                            encode_thread_active;
+	volatile bool                   encode_thread_exit;
+	os_sem_t                        queue_sem;
+	pthread_mutex_t                 encode_mutex;
+	pthread_mutex_t                 queue_mutex;
+	pthread_cond_t                  queue_cond;
+	struct circlebuf                queue;
+	DARRAY(struct encoder_queued_frame*) frame_pool;
+	enum obs_encoder_queue_policy   queue_policy;
+	size_t                          max_queued;
+	bool                            accepting_frames;
+
+	uint64_t                        frames_encoded;
+	uint64_t                        frames_dropped;
+	uint64_t                        encode_time_total;
+	uint64_t                        encode_time_max;
+
+	/* bitrate set with obs_encoder_set_bitrate, 0 if not overridden.
+	 * outputs change the bitrate from their packet callbacks, so it's
+	 * only requested there and applied by the encode thread before the
+	 * next frame instead of waiting on encode_mutex */
+	volatile long                   bitrate;
+	volatile long                   requested_bitrate;
 
 	/* if a video encoder is paired with an audio encoder, make it start
 	 * up at the specific timestamp.  if this is the audio encoder,
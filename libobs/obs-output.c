@@ -42,6 +42,7 @@ static const char *output_signals[] = {
 	"void stop(ptr output, int code)",
 	"void reconnect(ptr output)",
 	"void reconnect_success(ptr output)",
+	"void congestion(ptr output, int stage, int send_kbps)",
 	NULL
 };
 
@@ -90,6 +91,8 @@ obs_output_t obs_output_create(const char *id, const char *name,
 	if (!output->context.data)
 		goto fail;
 
+	obs_context_data_update_snapshot(&output->context);
+
 	output->reconnect_retry_sec = 2;
 	output->reconnect_retry_max = 20;
 	output->valid               = true;
@@ -106,13 +109,6 @@ fail:
 	return NULL;
 }
 
-static inline void free_packets(struct obs_output *output)
-{
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_free_encoder_packet(output->interleaved_packets.array+i);
-	da_free(output->interleaved_packets);
-}
-
 void obs_output_destroy(obs_output_t output)
 {
 	if (output) {
@@ -125,7 +121,7 @@ void obs_output_destroy(obs_output_t output)
 		if (output->service)
 			output->service->output = NULL;
 
-		free_packets(output);
+		packet_interleaver_free(&output->interleaver);
 
 		if (output->context.data)
 			output->info.destroy(output->context.data);
@@ -225,6 +221,8 @@ void obs_output_update(obs_output_t output, obs_data_t settings)
 	if (output->info.update)
 		output->info.update(output->context.data,
 				output->context.settings);
+
+	obs_context_data_update_snapshot(&output->context);
 }
 
 obs_data_t obs_output_get_settings(obs_output_t output)
@@ -236,6 +234,13 @@ obs_data_t obs_output_get_settings(obs_output_t output)
 	return output->context.settings;
 }
 
+obs_data_t obs_output_get_settings_snapshot(obs_output_t output)
+{
+	if (!output) return NULL;
+
+	return obs_context_data_get_snapshot(&output->context);
+}
+
 bool obs_output_canpause(obs_output_t output)
 {
 	return output ? (output->info.pause != NULL) : false;
@@ -424,115 +429,29 @@ static inline struct audio_convert_info *get_audio_conversion(
 	return output->audio_conversion_set ? &output->audio_conversion : NULL;
 }
 
-static bool prepare_interleaved_packet(struct obs_output *output,
-		struct encoder_packet *out, struct encoder_packet *in)
-{
-	int64_t offset;
-
-	/* audio and video need to start at timestamp 0, and the encoders
-	 * may not currently be at 0 when we get data.  so, we store the
-	 * current dts as offset and subtract that value from the dts/pts
-	 * of the output packet. */
-	if (in->type == OBS_ENCODER_VIDEO) {
-		if (!output->received_video) {
-			output->first_video_ts = in->dts_usec;
-			output->video_offset   = in->dts;
-			output->received_video = true;
-		}
-
-		offset = output->video_offset;
-	} else{
-		/* don't accept audio that's before the first video timestamp */
-		if (!output->received_video ||
-		    in->dts_usec < output->first_video_ts)
-			return false;
-
-		if (!output->received_audio) {
-			output->audio_offset   = in->dts;
-			output->received_audio = true;
-		}
-
-		offset = output->audio_offset;
-	}
-
-	obs_duplicate_encoder_packet(out, in);
-	out->dts -= offset;
-	out->pts -= offset;
-
-	/* convert the newly adjusted dts to relative dts time to ensure proper
-	 * interleaving.  if we're using an audio encoder that's already been
-	 * started on another output, then the first audio packet may not be
-	 * quite perfectly synced up in terms of system time (and there's
-	 * nothing we can really do about that), but it will always at least be
-	 * within a 23ish millisecond threshold (at least for AAC) */
-	out->dts_usec = packet_dts_usec(out);
-	return true;
-}
-
-static inline bool has_higher_opposing_ts(struct obs_output *output,
-		struct encoder_packet *packet)
-{
-	if (packet->type == OBS_ENCODER_VIDEO)
-		return output->highest_audio_ts > packet->dts_usec;
-	else
-		return output->highest_video_ts > packet->dts_usec;
-}
-
+/* every packet that's ready is sent, not just the oldest one, so the queues
+ * can't build up when one stream's packets arrive in bursts */
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
-
-	/* do not send an interleaved packet if there's no packet of the
-	 * opposing type of a higher timstamp in the interleave buffer.
-	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
-		return;
-
-	if (out.type == OBS_ENCODER_VIDEO)
-		output->total_frames++;
+	struct encoder_packet out;
 
-	da_erase(output->interleaved_packets, 0);
-	output->info.encoded_packet(output->context.data, &out);
-	obs_free_encoder_packet(&out);
-}
+	while (packet_interleaver_pop(&output->interleaver, &out)) {
+		if (out.type == OBS_ENCODER_VIDEO)
+			output->total_frames++;
 
-static inline void set_higher_ts(struct obs_output *output,
-		struct encoder_packet *packet)
-{
-	if (packet->type == OBS_ENCODER_VIDEO) {
-		if (output->highest_video_ts < packet->dts_usec)
-			output->highest_video_ts = packet->dts_usec;
-	} else {
-		if (output->highest_audio_ts < packet->dts_usec)
-			output->highest_audio_ts = packet->dts_usec;
+		output->info.encoded_packet(output->context.data, &out);
+		obs_free_encoder_packet(&out);
 	}
 }
 
 static void interleave_packets(void *data, struct encoder_packet *packet)
 {
-	struct obs_output     *output = data;
-	struct encoder_packet out;
-	size_t                idx;
+	struct obs_output *output = data;
 
 	pthread_mutex_lock(&output->interleaved_mutex);
 
-	if (prepare_interleaved_packet(output, &out, packet)) {
-		for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-			struct encoder_packet *cur_packet;
-			cur_packet = output->interleaved_packets.array + idx;
-
-			if (out.dts_usec < cur_packet->dts_usec)
-				break;
-		}
-
-		da_insert(output->interleaved_packets, idx, &out);
-		set_higher_ts(output, &out);
-
-		/* when both video and audio have been received, we're ready
-		 * to start sending out packets (one at a time) */
-		if (output->received_audio && output->received_video)
-			send_interleaved(output);
-	}
+	if (packet_interleaver_push(&output->interleaver, packet))
+		send_interleaved(output);
 
 	pthread_mutex_unlock(&output->interleaved_mutex);
 }
@@ -559,11 +478,10 @@ static void hook_data_capture(struct obs_output *output, bool encoded,
 	void (*encoded_callback)(void *data, struct encoder_packet *packet);
 
 	if (encoded) {
-		output->received_video   = false;
-		output->received_video   = false;
-		output->highest_audio_ts = 0;
-		output->highest_video_ts = 0;
-		free_packets(output);
+		pthread_mutex_lock(&output->interleaved_mutex);
+		packet_interleaver_reset(&output->interleaver,
+				has_audio ? 1 : 0);
+		pthread_mutex_unlock(&output->interleaved_mutex);
 
 		encoded_callback = (has_video && has_audio) ?
 			interleave_packets : default_encoded_callback;
@@ -812,3 +730,18 @@ void obs_output_signal_stop(obs_output_t output, int code)
 	else
 		signal_stop(output, code);
 }
+
+void obs_output_signal_congestion(obs_output_t output, int stage,
+		int send_kbps)
+{
+	struct calldata params = {0};
+
+	if (!output)
+		return;
+
+	calldata_setptr(&params, "output", output);
+	calldata_setint(&params, "stage", stage);
+	calldata_setint(&params, "send_kbps", send_kbps);
+	signal_handler_signal(output->context.signals, "congestion", &params);
+	calldata_free(&params);
+}
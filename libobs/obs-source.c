@@ -111,14 +111,14 @@ bool obs_source_init(struct obs_source *source,
 	source->present_volume = 0.0f;
 	source->sync_offset = 0;
 	pthread_mutex_init_value(&source->filter_mutex);
-	pthread_mutex_init_value(&source->video_mutex);
+	pthread_mutex_init_value(&source->async_output_mutex);
 	pthread_mutex_init_value(&source->audio_mutex);
 
 	if (pthread_mutex_init(&source->filter_mutex, NULL) != 0)
 		return false;
 	if (pthread_mutex_init(&source->audio_mutex, NULL) != 0)
 		return false;
-	if (pthread_mutex_init(&source->video_mutex, NULL) != 0)
+	if (pthread_mutex_init(&source->async_output_mutex, NULL) != 0)
 		return false;
 
 	if (info->output_flags & OBS_SOURCE_AUDIO) {
@@ -178,6 +178,8 @@ obs_source_t obs_source_create(enum obs_source_type type, const char *id,
 	if (!source->context.data)
 		blog(LOG_ERROR, "Failed to create source '%s'!", name);
 
+	obs_context_data_update_snapshot(&source->context);
+
 	if (!obs_source_init(source, info))
 		goto fail;
 
@@ -210,6 +212,8 @@ void source_frame_init(struct source_frame *frame, enum video_format format,
 	}
 }
 
+static void free_async_frames(struct obs_source *source);
+
 void obs_source_destroy(struct obs_source *source)
 {
 	size_t i;
@@ -234,8 +238,7 @@ void obs_source_destroy(struct obs_source *source)
 	for (i = 0; i < source->filters.num; i++)
 		obs_source_release(source->filters.array[i]);
 
-	for (i = 0; i < source->video_frames.num; i++)
-		source_frame_destroy(source->video_frames.array[i]);
+	free_async_frames(source);
 
 	gs_entercontext(obs->video.graphics);
 	texrender_destroy(source->async_convert_texrender);
@@ -249,11 +252,10 @@ void obs_source_destroy(struct obs_source *source)
 	audio_resampler_destroy(source->resampler);
 
 	texrender_destroy(source->filter_texrender);
-	da_free(source->video_frames);
 	da_free(source->filters);
 	pthread_mutex_destroy(&source->filter_mutex);
 	pthread_mutex_destroy(&source->audio_mutex);
-	pthread_mutex_destroy(&source->video_mutex);
+	pthread_mutex_destroy(&source->async_output_mutex);
 	obs_context_data_free(&source->context);
 	bfree(source);
 }
@@ -379,6 +381,8 @@ void obs_source_update(obs_source_t source, obs_data_t settings)
 		source->info.update(source->context.data,
 				source->context.settings);
 	}
+
+	obs_context_data_update_snapshot(&source->context);
 }
 
 static void activate_source(obs_source_t source)
@@ -482,10 +486,24 @@ void obs_source_deactivate(obs_source_t source, enum view_type type)
 	}
 }
 
+static bool ready_async_frame(obs_source_t source, uint64_t sys_time);
+static inline size_t async_queue_size(struct async_frame_queue *queue);
+
+/* frames of inactive sources are never rendered, so make sure that old frames
+ * are still cycled out of the queue */
+static inline void cycle_frames(struct obs_source *source)
+{
+	if (async_queue_size(&source->async_frames) && !source->activate_refs)
+		ready_async_frame(source, os_gettime_ns());
+}
+
 void obs_source_video_tick(obs_source_t source, float seconds)
 {
 	if (!source) return;
 
+	if (source->info.output_flags & OBS_SOURCE_ASYNC)
+		cycle_frames(source);
+
 	if (source->defer_update)
 		obs_source_deferred_update(source);
 
@@ -907,14 +925,47 @@ static bool update_async_texrender(struct obs_source *source,
 	return true;
 }
 
+struct decompress_band {
+	enum convert_type         type;
+	const struct source_frame *frame;
+	uint8_t                   *output;
+	uint32_t                  linesize;
+};
+
+static void decompress_frame_band(void *param, uint32_t start_y,
+		uint32_t end_y)
+{
+	struct decompress_band    *band  = param;
+	const struct source_frame *frame = band->frame;
+
+	if (band->type == CONVERT_420)
+		decompress_420((const uint8_t* const*)frame->data,
+				frame->linesize,
+				start_y, end_y, band->output, band->linesize);
+
+	else if (band->type == CONVERT_NV12)
+		decompress_nv12((const uint8_t* const*)frame->data,
+				frame->linesize,
+				start_y, end_y, band->output, band->linesize);
+
+	else if (band->type == CONVERT_422_Y)
+		decompress_422(frame->data[0], frame->linesize[0],
+				start_y, end_y, band->output, band->linesize,
+				true);
+
+	else if (band->type == CONVERT_422_U)
+		decompress_422(frame->data[0], frame->linesize[0],
+				start_y, end_y, band->output, band->linesize,
+				false);
+}
+
 static bool update_async_texture(struct obs_source *source,
 		const struct source_frame *frame)
 {
 	texture_t         tex       = source->async_texture;
 	texrender_t       texrender = source->async_convert_texrender;
 	enum convert_type type      = get_convert_type(frame->format);
-	uint8_t           *ptr;
-	uint32_t          linesize;
+	struct decompress_band band;
 
 	source->async_format     = frame->format;
 	source->async_flip       = frame->flip;
@@ -935,26 +986,15 @@ static bool update_async_texture(struct obs_source *source,
 		return true;
 	}
 
-	if (!texture_map(tex, &ptr, &linesize))
+	if (!texture_map(tex, &band.output, &band.linesize))
 		return false;
 
-	if (type == CONVERT_420)
-		decompress_420((const uint8_t* const*)frame->data,
-				frame->linesize,
-				0, frame->height, ptr, linesize);
+	band.type  = type;
+	band.frame = frame;
 
-	else if (type == CONVERT_NV12)
-		decompress_nv12((const uint8_t* const*)frame->data,
-				frame->linesize,
-				0, frame->height, ptr, linesize);
-
-	else if (type == CONVERT_422_Y)
-		decompress_422(frame->data[0], frame->linesize[0],
-				0, frame->height, ptr, linesize, true);
-
-	else if (type == CONVERT_422_U)
-		decompress_422(frame->data[0], frame->linesize[0],
-				0, frame->height, ptr, linesize, false);
+	/* the planar formats share chroma between pairs of rows */
+	task_pool_run_bands(obs->video.convert_pool, frame->height, 2,
+			decompress_frame_band, &band);
 
 	texture_unmap(tex);
 	return true;
@@ -1223,6 +1263,13 @@ obs_data_t obs_source_getsettings(obs_source_t source)
 	return source->context.settings;
 }
 
+obs_data_t obs_source_get_settings_snapshot(obs_source_t source)
+{
+	if (!source) return NULL;
+
+	return obs_context_data_get_snapshot(&source->context);
+}
+
 static inline struct source_frame *filter_async_video(obs_source_t source,
 		struct source_frame *in)
 {
@@ -1299,44 +1346,248 @@ static void copy_frame_data(struct source_frame *dst,
 	}
 }
 
-static inline struct source_frame *cache_video(const struct source_frame *frame)
+/* number of frames a cached frame can go unused before it's freed */
+#define MAX_UNUSED_FRAME_DURATION 5
+
+#define ASYNC_QUEUE_MASK (MAX_ASYNC_FRAMES - 1)
+
+/* producer only */
+static inline bool async_queue_push(struct async_frame_queue *queue,
+		struct async_frame *af)
 {
-	/* TODO: use an actual cache */
-	struct source_frame *new_frame = source_frame_create(frame->format,
-			frame->width, frame->height);
+	unsigned long head = (unsigned long)os_atomic_load_long(&queue->head);
+	unsigned long tail = (unsigned long)queue->tail;
 
-	copy_frame_data(new_frame, frame);
-	return new_frame;
+	if (tail - head == MAX_ASYNC_FRAMES)
+		return false;
+
+	queue->frames[tail & ASYNC_QUEUE_MASK] = af;
+	os_atomic_set_long(&queue->tail, (long)(tail + 1));
+	return true;
 }
 
-static bool ready_async_frame(obs_source_t source, uint64_t sys_time);
+static inline size_t async_queue_size(struct async_frame_queue *queue)
+{
+	unsigned long head = (unsigned long)os_atomic_load_long(&queue->head);
+	unsigned long tail = (unsigned long)os_atomic_load_long(&queue->tail);
 
-static inline void cycle_frames(struct obs_source *source)
+	return (size_t)(tail - head);
+}
+
+/* consumer only, the queue must not be empty */
+static inline struct async_frame *async_queue_peek(
+		struct async_frame_queue *queue)
 {
-	if (source->video_frames.num && !source->activate_refs)
-		ready_async_frame(source, os_gettime_ns());
+	return queue->frames[(unsigned long)queue->head & ASYNC_QUEUE_MASK];
 }
 
-void obs_source_output_video(obs_source_t source,
+/* consumer only */
+static inline struct async_frame *async_queue_pop(
+		struct async_frame_queue *queue)
+{
+	unsigned long head = (unsigned long)queue->head;
+	unsigned long tail = (unsigned long)os_atomic_load_long(&queue->tail);
+	struct async_frame *af;
+
+	if (head == tail)
+		return NULL;
+
+	af = queue->frames[head & ASYNC_QUEUE_MASK];
+	os_atomic_set_long(&queue->head, (long)(head + 1));
+	return af;
+}
+
+static inline bool async_frame_matches_cache(struct obs_source *source,
 		const struct source_frame *frame)
 {
-	if (!source || !frame)
+	return frame->format == source->async_cache_format &&
+	       frame->width  == source->async_cache_width  &&
+	       frame->height == source->async_cache_height;
+}
+
+static void destroy_async_frame(struct async_frame *af)
+{
+	if (af->release)
+		af->release(af->param, af->frame);
+	else
+		source_frame_destroy(af->frame);
+	bfree(af);
+}
+
+/* puts a frame back into the cache, or destroys it if it doesn't belong to
+ * the cache or the frame format has changed since.  must be called with
+ * async_output_mutex locked */
+static void recycle_async_frame(struct obs_source *source,
+		struct async_frame *af)
+{
+	if (af->cached && async_frame_matches_cache(source, af->frame)) {
+		af->unused_count = 0;
+		da_push_back(source->async_cache, &af);
+	} else {
+		destroy_async_frame(af);
+	}
+}
+
+/* releases a frame from the graphics thread.  frames owned by the source or
+ * created by filters are released right away, cache frames are handed back
+ * to the thread outputting video */
+static void release_async_frame(struct obs_source *source,
+		struct async_frame *af)
+{
+	if (!af)
 		return;
 
-	struct source_frame *output = cache_video(frame);
+	if (!af->cached || !async_queue_push(&source->async_returns, af))
+		destroy_async_frame(af);
+}
+
+/* collects frames released by the graphics thread and frees cached frames
+ * that haven't been used for a while.  must be called with
+ * async_output_mutex locked */
+static void clean_frame_cache(struct obs_source *source)
+{
+	struct async_frame *af;
+
+	for (size_t i = source->async_cache.num; i > 0; i--) {
+		af = source->async_cache.array[i-1];
+
+		if (!async_frame_matches_cache(source, af->frame) ||
+		    ++af->unused_count >= MAX_UNUSED_FRAME_DURATION) {
+			destroy_async_frame(af);
+			da_erase(source->async_cache, i-1);
+		}
+	}
+
+	while ((af = async_queue_pop(&source->async_returns)) != NULL)
+		recycle_async_frame(source, af);
+}
+
+static void free_async_frames(struct obs_source *source)
+{
+	struct async_frame *af;
+
+	while ((af = async_queue_pop(&source->async_frames)) != NULL)
+		destroy_async_frame(af);
+	while ((af = async_queue_pop(&source->async_returns)) != NULL)
+		destroy_async_frame(af);
+
+	for (size_t i = 0; i < source->async_held.num; i++)
+		destroy_async_frame(source->async_held.array[i]);
+	da_free(source->async_held);
+
+	for (size_t i = 0; i < source->async_cache.num; i++)
+		destroy_async_frame(source->async_cache.array[i]);
+	da_free(source->async_cache);
+}
+
+/* must be called with async_output_mutex locked */
+static struct async_frame *cache_video(struct obs_source *source,
+		const struct source_frame *frame)
+{
+	struct async_frame *af;
+
+	source->async_cache_format = frame->format;
+	source->async_cache_width  = frame->width;
+	source->async_cache_height = frame->height;
+
+	clean_frame_cache(source);
+
+	if (source->async_cache.num) {
+		af = source->async_cache.array[source->async_cache.num-1];
+		da_pop_back(source->async_cache);
+	} else {
+		af         = bzalloc(sizeof(struct async_frame));
+		af->cached = true;
+		af->frame  = source_frame_create(frame->format,
+				frame->width, frame->height);
+	}
+
+	copy_frame_data(af->frame, frame);
+	return af;
+}
+
+/* must be called with async_output_mutex locked */
+static void output_async_frame(struct obs_source *source,
+		struct async_frame *af)
+{
+	struct source_frame *output;
 
 	pthread_mutex_lock(&source->filter_mutex);
-	output = filter_async_video(source, output);
+	output = filter_async_video(source, af->frame);
 	pthread_mutex_unlock(&source->filter_mutex);
 
-	if (output) {
-		pthread_mutex_lock(&source->video_mutex);
-		cycle_frames(source);
-		da_push_back(source->video_frames, &output);
-		pthread_mutex_unlock(&source->video_mutex);
+	/* filters may replace the frame with one of their own */
+	if (output != af->frame) {
+		recycle_async_frame(source, af);
+		if (!output)
+			return;
+
+		af        = bzalloc(sizeof(struct async_frame));
+		af->frame = output;
+	}
+
+	/* if the graphics thread has fallen behind, drop the newest frame
+	 * rather than the frames that are already queued */
+	if (!async_queue_push(&source->async_frames, af)) {
+		os_atomic_inc_long(&source->async_frames_dropped);
+		recycle_async_frame(source, af);
 	}
 }
 
+void obs_source_output_video(obs_source_t source,
+		const struct source_frame *frame)
+{
+	if (!source || !frame)
+		return;
+
+	pthread_mutex_lock(&source->async_output_mutex);
+	output_async_frame(source, cache_video(source, frame));
+	pthread_mutex_unlock(&source->async_output_mutex);
+}
+
+void obs_source_output_video_owned(obs_source_t source,
+		struct source_frame *frame,
+		void (*release)(void *param, struct source_frame *frame),
+		void *param)
+{
+	struct async_frame *af;
+
+	if (!frame)
+		return;
+	if (!source) {
+		if (release)
+			release(param, frame);
+		return;
+	}
+	if (!release) {
+		obs_source_output_video(source, frame);
+		return;
+	}
+
+	af          = bzalloc(sizeof(struct async_frame));
+	af->frame   = frame;
+	af->release = release;
+	af->param   = param;
+
+	pthread_mutex_lock(&source->async_output_mutex);
+	output_async_frame(source, af);
+	pthread_mutex_unlock(&source->async_output_mutex);
+}
+
+uint32_t obs_source_get_dropped_frames(obs_source_t source)
+{
+	return source ?
+		(uint32_t)os_atomic_load_long(&source->async_frames_dropped) :
+		0;
+}
+
+uint32_t obs_source_get_skipped_frames(obs_source_t source)
+{
+	return source ?
+		(uint32_t)os_atomic_load_long(&source->async_frames_skipped) :
+		0;
+}
+
 static inline struct filtered_audio *filter_async_audio(obs_source_t source,
 		struct filtered_audio *in)
 {
@@ -1486,17 +1737,27 @@ static inline bool frame_out_of_bounds(obs_source_t source, uint64_t ts)
 	return ((ts - source->last_frame_ts) > MAX_TIMESTAMP_JUMP);
 }
 
+static inline void skip_async_frame(obs_source_t source,
+		struct async_frame *af)
+{
+	if (af) {
+		os_atomic_inc_long(&source->async_frames_skipped);
+		release_async_frame(source, af);
+	}
+}
+
 static bool ready_async_frame(obs_source_t source, uint64_t sys_time)
 {
-	struct source_frame *next_frame = source->video_frames.array[0];
-	struct source_frame *frame      = NULL;
+	struct async_frame_queue *queue = &source->async_frames;
+	struct async_frame *next_frame  = async_queue_peek(queue);
+	struct async_frame *frame       = NULL;
 	uint64_t sys_offset = sys_time - source->last_sys_timestamp;
-	uint64_t frame_time = next_frame->timestamp;
+	uint64_t frame_time = next_frame->frame->timestamp;
 	uint64_t frame_offset = 0;
 
 	/* account for timestamp invalidation */
 	if (frame_out_of_bounds(source, frame_time)) {
-		source->last_frame_ts = next_frame->timestamp;
+		source->last_frame_ts = frame_time;
 		os_atomic_inc_long(&source->av_sync_ref);
 	} else {
 		frame_offset = frame_time - source->last_frame_ts;
@@ -1504,39 +1765,36 @@ static bool ready_async_frame(obs_source_t source, uint64_t sys_time)
 	}
 
 	while (frame_offset <= sys_offset) {
-		source_frame_destroy(frame);
+		skip_async_frame(source, frame);
 
-		if (source->video_frames.num == 1)
+		if (async_queue_size(queue) == 1)
 			return true;
 
-		frame = next_frame;
-		da_erase(source->video_frames, 0);
-		next_frame = source->video_frames.array[0];
+		frame = async_queue_pop(queue);
+		next_frame = async_queue_peek(queue);
 
 		/* more timestamp checking and compensating */
-		if ((next_frame->timestamp - frame_time) > MAX_TIMESTAMP_JUMP) {
+		if ((next_frame->frame->timestamp - frame_time) >
+				MAX_TIMESTAMP_JUMP) {
 			source->last_frame_ts =
-				next_frame->timestamp - frame_offset;
+				next_frame->frame->timestamp - frame_offset;
 			os_atomic_inc_long(&source->av_sync_ref);
 		}
 
-		frame_time   = next_frame->timestamp;
+		frame_time   = next_frame->frame->timestamp;
 		frame_offset = frame_time - source->last_frame_ts;
 	}
 
-	source_frame_destroy(frame);
+	skip_async_frame(source, frame);
 
 	return frame != NULL;
 }
 
-static inline struct source_frame *get_closest_frame(obs_source_t source,
+static inline struct async_frame *get_closest_frame(obs_source_t source,
 		uint64_t sys_time)
 {
-	if (ready_async_frame(source, sys_time)) {
-		struct source_frame *frame = source->video_frames.array[0];
-		da_erase(source->video_frames, 0);
-		return frame;
-	}
+	if (ready_async_frame(source, sys_time))
+		return async_queue_pop(&source->async_frames);
 
 	return NULL;
 }
@@ -1546,54 +1804,61 @@ static inline struct source_frame *get_closest_frame(obs_source_t source,
  * were cached between renders, then releases the unnecessary frames and uses
  * the frame with the closest timing to ensure sync.  Also ensures that timing
  * with audio is synchronized.
+ *
+ * Must only be called from the graphics thread.
  */
 struct source_frame *obs_source_getframe(obs_source_t source)
 {
-	struct source_frame *frame = NULL;
+	struct async_frame *af = NULL;
 	uint64_t sys_time;
 
-	if (!source)
+	if (!source || !async_queue_size(&source->async_frames))
 		return NULL;
 
-	pthread_mutex_lock(&source->video_mutex);
-
-	if (!source->video_frames.num)
-		goto unlock;
-
 	sys_time = os_gettime_ns();
 
 	if (!source->last_frame_ts) {
-		frame = source->video_frames.array[0];
-		da_erase(source->video_frames, 0);
-
-		source->last_frame_ts = frame->timestamp;
+		af = async_queue_pop(&source->async_frames);
+		source->last_frame_ts = af->frame->timestamp;
 	} else {
-		frame = get_closest_frame(source, sys_time);
+		af = get_closest_frame(source, sys_time);
 	}
 
 	/* reset timing to current system time */
-	if (frame) {
-		source->timing_adjust = sys_time - frame->timestamp;
+	if (af) {
+		source->timing_adjust = sys_time - af->frame->timestamp;
 		source->timing_set = true;
 	}
 
 	source->last_sys_timestamp = sys_time;
 
-unlock:
-	pthread_mutex_unlock(&source->video_mutex);
-
-	if (frame)
-		obs_source_addref(source);
+	if (!af)
+		return NULL;
 
-	return frame;
+	da_push_back(source->async_held, &af);
+	obs_source_addref(source);
+	return af->frame;
 }
 
 void obs_source_releaseframe(obs_source_t source, struct source_frame *frame)
 {
-	if (source && frame) {
-		source_frame_destroy(frame);
-		obs_source_release(source);
+	if (!source || !frame)
+		return;
+
+	for (size_t i = source->async_held.num; i > 0; i--) {
+		struct async_frame *af = source->async_held.array[i-1];
+
+		if (af->frame == frame) {
+			da_erase(source->async_held, i-1);
+			release_async_frame(source, af);
+			obs_source_release(source);
+			return;
+		}
 	}
+
+	blog(LOG_WARNING, "obs_source_releaseframe: frame %p was not "
+	                  "obtained from obs_source_getframe on source '%s'",
+	                  frame, source->context.name);
 }
 
 const char *obs_source_getname(obs_source_t source)
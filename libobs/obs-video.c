@@ -302,14 +302,44 @@ static inline uint32_t make_aligned_linesize_offset(uint32_t offset,
 	return (offset / dst_linesize) * src_linesize + remainder;
 }
 
+/* the output frame is written straight in to one of the video output's
+ * cached frames when one is free, so that it's passed on to the outputs
+ * without being copied again */
+static void get_output_frame(struct obs_core_video *video,
+		struct video_data *new_frame, int cur_texture)
+{
+	struct source_frame *fallback = &video->convert_frames[cur_texture];
+
+	if (video_output_lock_frame(video->video, new_frame))
+		return;
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		new_frame->data[i]     = fallback->data[i];
+		new_frame->linesize[i] = fallback->linesize[i];
+	}
+	new_frame->cached = NULL;
+}
+
+static inline void set_output_frame(struct video_data *frame,
+		const struct video_data *new_frame)
+{
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		frame->data[i]     = new_frame->data[i];
+		frame->linesize[i] = new_frame->linesize[i];
+	}
+	frame->cached = new_frame->cached;
+}
+
 static void fix_gpu_converted_alignment(struct obs_core_video *video,
 		struct video_data *frame, int cur_texture)
 {
-	struct source_frame *new_frame = &video->convert_frames[cur_texture];
+	struct video_data new_frame;
 	uint32_t src_linesize = frame->linesize[0];
 	uint32_t dst_linesize = video->output_width * 4;
 	uint32_t src_pos      = 0;
 
+	get_output_frame(video, &new_frame, cur_texture);
+
 	for (size_t i = 0; i < 3; i++) {
 		if (video->plane_linewidth[i] == 0)
 			break;
@@ -317,16 +347,13 @@ static void fix_gpu_converted_alignment(struct obs_core_video *video,
 		src_pos = make_aligned_linesize_offset(video->plane_offsets[i],
 				dst_linesize, src_linesize);
 
-		copy_dealign(new_frame->data[i], 0, dst_linesize,
+		copy_dealign(new_frame.data[i], 0, dst_linesize,
 				frame->data[0], src_pos, src_linesize,
 				video->plane_sizes[i]);
 	}
 
 	/* replace with cached frames */
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		frame->data[i]     = new_frame->data[i];
-		frame->linesize[i] = new_frame->linesize[i];
-	}
+	set_output_frame(frame, &new_frame);
 }
 
 static bool set_gpu_converted_data(struct obs_core_video *video,
@@ -349,34 +376,48 @@ static bool set_gpu_converted_data(struct obs_core_video *video,
 	return true;
 }
 
-static bool convert_frame(struct obs_core_video *video,
-		struct video_data *frame,
-		const struct video_output_info *info, int cur_texture)
+struct convert_band {
+	enum video_format   format;
+	struct video_data   *frame;
+	struct video_data   *new_frame;
+};
+
+static void convert_frame_band(void *param, uint32_t start_y, uint32_t end_y)
 {
-	struct source_frame *new_frame = &video->convert_frames[cur_texture];
+	struct convert_band *band = param;
 
-	if (info->format == VIDEO_FORMAT_I420) {
+	if (band->format == VIDEO_FORMAT_I420)
 		compress_uyvx_to_i420(
-				frame->data[0], frame->linesize[0],
-				0, info->height,
-				new_frame->data, new_frame->linesize);
-
-	} else if (info->format == VIDEO_FORMAT_NV12) {
+				band->frame->data[0], band->frame->linesize[0],
+				start_y, end_y,
+				band->new_frame->data, band->new_frame->linesize);
+	else
 		compress_uyvx_to_nv12(
-				frame->data[0], frame->linesize[0],
-				0, info->height,
-				new_frame->data, new_frame->linesize);
+				band->frame->data[0], band->frame->linesize[0],
+				start_y, end_y,
+				band->new_frame->data, band->new_frame->linesize);
+}
 
-	} else {
+static bool convert_frame(struct obs_core_video *video,
+		struct video_data *frame,
+		const struct video_output_info *info, int cur_texture)
+{
+	struct video_data new_frame;
+	struct convert_band band = {info->format, frame, &new_frame};
+
+	if (info->format != VIDEO_FORMAT_I420 &&
+	    info->format != VIDEO_FORMAT_NV12) {
 		blog(LOG_ERROR, "convert_frame: unsupported texture format");
 		return false;
 	}
 
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		frame->data[i]     = new_frame->data[i];
-		frame->linesize[i] = new_frame->linesize[i];
-	}
+	get_output_frame(video, &new_frame, cur_texture);
+
+	/* bands are kept to an even number of rows for the chroma planes */
+	task_pool_run_bands(video->convert_pool, info->height, 2,
+			convert_frame_band, &band);
 
+	set_output_frame(frame, &new_frame);
 	return true;
 }
 
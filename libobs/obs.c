@@ -16,6 +16,7 @@
 ******************************************************************************/
 
 #include "callback/calldata.h"
+#include "util/platform.h"
 
 #include "obs.h"
 #include "obs-internal.h"
@@ -240,6 +241,21 @@ static bool obs_init_graphics(struct obs_video_info *ovi)
 	return success;
 }
 
+#define MAX_CONVERT_THREADS 4
+
+static inline size_t get_convert_threads(void)
+{
+	/* leave half the cores for encoders and the graphics thread, and
+	 * count the video thread itself as one of the converting threads */
+	int threads = os_get_logical_cores() / 2 - 1;
+
+	if (threads < 0)
+		return 0;
+	if (threads > MAX_CONVERT_THREADS)
+		return MAX_CONVERT_THREADS;
+	return (size_t)threads;
+}
+
 static bool obs_init_video(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
@@ -279,6 +295,10 @@ static bool obs_init_video(struct obs_video_info *ovi)
 
 	gs_leavecontext();
 
+	video->convert_pool = task_pool_create(get_convert_threads());
+	blog(LOG_INFO, "CPU format conversion threads: %d",
+			(int)task_pool_threads(video->convert_pool) + 1);
+
 	errorcode = pthread_create(&video->video_thread, NULL,
 			obs_video_thread, obs);
 	if (errorcode != 0)
@@ -312,6 +332,9 @@ static void obs_free_video(void)
 		video_output_close(video->video);
 		video->video = NULL;
 
+		task_pool_destroy(video->convert_pool);
+		video->convert_pool = NULL;
+
 		if (!video->graphics)
 			return;
 
@@ -648,10 +671,12 @@ bool obs_reset_audio(struct audio_output_info *ai)
 	blog(LOG_INFO, "audio settings reset:\n"
 	               "\tsamples per sec: %d\n"
 	               "\tspeakers:        %d\n"
-	               "\tbuffering (ms):  %d\n",
+	               "\tbuffering (ms):  %d\n"
+	               "\tperiod (frames): %d\n",
 	               (int)ai->samples_per_sec,
 	               (int)ai->speakers,
-	               (int)ai->buffer_ms);
+	               (int)ai->buffer_ms,
+	               (int)ai->period_frames);
 
 	return obs_init_audio(ai);
 }
@@ -1240,11 +1265,23 @@ bool obs_context_data_init(
 	}
 }
 
+#define MAX_RETIRED_SNAPSHOTS 16
+
+static void release_retired_snapshots(struct obs_context_data *context)
+{
+	for (size_t i = 0; i < context->retired_snapshots.num; i++)
+		obs_data_release(context->retired_snapshots.array[i]);
+	da_resize(context->retired_snapshots, 0);
+}
+
 void obs_context_data_free(struct obs_context_data *context)
 {
 	signal_handler_destroy(context->signals);
 	proc_handler_destroy(context->procs);
 	obs_data_release(context->settings);
+	obs_data_release(context->settings_snapshot);
+	release_retired_snapshots(context);
+	da_free(context->retired_snapshots);
 	obs_context_data_remove(context);
 	pthread_mutex_destroy(&context->rename_cache_mutex);
 	bfree(context->name);
@@ -1300,3 +1337,41 @@ void obs_context_data_setname(struct obs_context_data *context,
 
 	pthread_mutex_unlock(&context->rename_cache_mutex);
 }
+
+/* must be called from the thread that modifies the settings */
+void obs_context_data_update_snapshot(struct obs_context_data *context)
+{
+	obs_data_t snapshot = obs_data_snapshot(context->settings);
+	obs_data_t old;
+
+	old = os_atomic_set_ptr((void *volatile *)&context->settings_snapshot,
+			snapshot);
+	if (old)
+		da_push_back(context->retired_snapshots, &old);
+
+	/* a reader may have loaded a replaced pointer and not referenced it
+	 * yet.  readers that start after the swap only see the new snapshot,
+	 * so once there are no readers at all, every replaced one is safe to
+	 * release.  readers only hold the count for a moment, so waiting is
+	 * only needed if it never drops to zero between updates */
+	if (context->retired_snapshots.num >= MAX_RETIRED_SNAPSHOTS) {
+		while (os_atomic_load_long(&context->snapshot_readers) > 0)
+			os_sleep_ms(0);
+	}
+
+	if (os_atomic_load_long(&context->snapshot_readers) == 0)
+		release_retired_snapshots(context);
+}
+
+obs_data_t obs_context_data_get_snapshot(struct obs_context_data *context)
+{
+	obs_data_t snapshot;
+
+	os_atomic_inc_long(&context->snapshot_readers);
+	snapshot = os_atomic_load_ptr(
+			(void *const volatile *)&context->settings_snapshot);
+	obs_data_addref(snapshot);
+	os_atomic_dec_long(&context->snapshot_readers);
+
+	return snapshot;
+}
@@ -556,6 +556,12 @@ EXPORT void obs_source_filter_setorder(obs_source_t source, obs_source_t filter,
 /** Gets the settings string for a source */
 EXPORT obs_data_t obs_source_getsettings(obs_source_t source);
 
+/**
+ * Gets an immutable snapshot of the source settings as of the last update,
+ * which can be read from any thread without locking
+ */
+EXPORT obs_data_t obs_source_get_settings_snapshot(obs_source_t source);
+
 /** Gets the name of a source */
 EXPORT const char *obs_source_getname(obs_source_t source);
 
@@ -626,6 +632,19 @@ EXPORT void obs_source_load(obs_source_t source);
 EXPORT void obs_source_output_video(obs_source_t source,
 		const struct source_frame *frame);
 
+/**
+ * Outputs asynchronous video data without copying it.  The frame and its data
+ * remain owned by the caller, and must stay valid until the release callback
+ * is called once the frame has been displayed or dropped.
+ *
+ * @note  The release callback may be called from any thread, and may be
+ *        called after the source has been destroyed.
+ */
+EXPORT void obs_source_output_video_owned(obs_source_t source,
+		struct source_frame *frame,
+		void (*release)(void *param, struct source_frame *frame),
+		void *param);
+
 /** Outputs audio data (always asynchronous) */
 EXPORT void obs_source_output_audio(obs_source_t source,
 		const struct source_audio *audio);
@@ -637,6 +656,18 @@ EXPORT struct source_frame *obs_source_getframe(obs_source_t source);
 EXPORT void obs_source_releaseframe(obs_source_t source,
 		struct source_frame *frame);
 
+/**
+ * Returns the number of async video frames that were dropped because the
+ * frame queue was full when they were output
+ */
+EXPORT uint32_t obs_source_get_dropped_frames(obs_source_t source);
+
+/**
+ * Returns the number of async video frames that were skipped because a more
+ * recent frame was already available when rendering
+ */
+EXPORT uint32_t obs_source_get_skipped_frames(obs_source_t source);
+
 /** Default RGB filter handler for generic effect filters */
 EXPORT void obs_source_process_filter(obs_source_t filter, effect_t effect,
 		uint32_t width, uint32_t height, enum gs_color_format format,
@@ -803,6 +834,12 @@ EXPORT void obs_output_pause(obs_output_t output);
 /* Gets the current output settings string */
 EXPORT obs_data_t obs_output_get_settings(obs_output_t output);
 
+/**
+ * Gets an immutable snapshot of the output settings as of the last update,
+ * which can be read from any thread without locking
+ */
+EXPORT obs_data_t obs_output_get_settings_snapshot(obs_output_t output);
+
 /** Returns the signal handler for an output  */
 EXPORT signal_handler_t obs_output_signalhandler(obs_output_t output);
 
@@ -907,6 +944,19 @@ EXPORT void obs_output_end_data_capture(obs_output_t output);
  */
 EXPORT void obs_output_signal_stop(obs_output_t output, int code);
 
+/**
+ * Signals that the output is unable to send data as fast as it's being
+ * encoded, and is dropping frames to catch up.
+ *
+ * @param  output     Output context
+ * @param  stage      How aggressively frames are being dropped, or 0 if the
+ *                    output is no longer congested
+ * @param  send_kbps  Measured send rate in kilobits per second, or 0 if
+ *                    unknown.  Used to pick a lower encoder bitrate.
+ */
+EXPORT void obs_output_signal_congestion(obs_output_t output, int stage,
+		int send_kbps);
+
 
 /* ------------------------------------------------------------------------- */
 /* Encoders */
@@ -968,6 +1018,12 @@ EXPORT bool obs_encoder_get_extra_data(obs_encoder_t encoder,
 /** Returns the current settings for this encoder */
 EXPORT obs_data_t obs_encoder_get_settings(obs_encoder_t encoder);
 
+/**
+ * Gets an immutable snapshot of the encoder settings as of the last update,
+ * which can be read from any thread without locking
+ */
+EXPORT obs_data_t obs_encoder_get_settings_snapshot(obs_encoder_t encoder);
+
 /** Sets the video output context to be used with this encoder */
 EXPORT void obs_encoder_set_video(obs_encoder_t encoder, video_t video);
 
@@ -989,10 +1045,60 @@ EXPORT audio_t obs_encoder_audio(obs_encoder_t encoder);
 /** Returns true if encoder is active, false otherwise */
 EXPORT bool obs_encoder_active(obs_encoder_t encoder);
 
-/** Duplicates an encoder packet */
+/**
+ * Sets what happens when the encoder falls behind and its queue of frames
+ * waiting to be encoded fills up.  Defaults to OBS_ENCODER_QUEUE_BLOCK.
+ *
+ * @param  encoder     Encoder context
+ * @param  policy      What to do with new frames when the queue is full
+ * @param  max_frames  Maximum number of frames that can be queued
+ */
+EXPORT void obs_encoder_set_queue_policy(obs_encoder_t encoder,
+		enum obs_encoder_queue_policy policy, size_t max_frames);
+
+/**
+ * Changes the target bitrate of an active encoder without changing its
+ * settings, for example to follow the available network bandwidth.  The
+ * change is made on the encoder's thread before it encodes the next frame,
+ * so this doesn't wait for an encode in progress and is safe to call from
+ * output callbacks.  Signals "bitrate_changed" once it's been applied.  The
+ * override is cleared when the encoder is updated or reinitialized.
+ *
+ * @param  encoder  Encoder context
+ * @param  bitrate  Target bitrate in kilobits per second
+ * @return          false if the encoder can't change its bitrate while
+ *                  active
+ */
+EXPORT bool obs_encoder_set_bitrate(obs_encoder_t encoder, uint32_t bitrate);
+
+/**
+ * Returns the current target bitrate of an encoder in kilobits per second,
+ * which is the "bitrate" setting unless changed with obs_encoder_set_bitrate
+ */
+EXPORT uint32_t obs_encoder_get_bitrate(obs_encoder_t encoder);
+
+/** Returns the signal handler of an encoder */
+EXPORT signal_handler_t obs_encoder_signalhandler(obs_encoder_t encoder);
+
+/**
+ * Returns the procedure handler of an encoder.  Encoders provide:
+ *
+ *   void get_queue_stats(out int queued, out int max_queued,
+ *                        out int encoded, out int dropped,
+ *                        out float avg_encode_ms, out float max_encode_ms)
+ */
+EXPORT proc_handler_t obs_encoder_prochandler(obs_encoder_t encoder);
+
+/**
+ * Duplicates an encoder packet.  The data is copied only the first time; if
+ * the source packet already shares its data, the duplicate takes another
+ * reference to it instead.  Either way the data of both packets must then be
+ * treated as read-only.
+ */
 EXPORT void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src);
 
+/** Frees an encoder packet, or releases its reference to shared data */
 EXPORT void obs_free_encoder_packet(struct encoder_packet *packet);
 
 
@@ -44,3 +44,57 @@ void array_output_serializer_free(struct array_output_data *data)
 {
 	da_free(data->bytes);
 }
+
+static size_t array_input_read(void *param, void *data, size_t size)
+{
+	struct array_input_data *input = param;
+	size_t remaining = input->size - input->pos;
+
+	if (size > remaining)
+		size = remaining;
+
+	memcpy(data, input->bytes + input->pos, size);
+	input->pos += size;
+	return size;
+}
+
+static uint64_t array_input_seek(void *param, int64_t offset,
+		enum serialize_seek_type seek_type)
+{
+	struct array_input_data *input = param;
+	int64_t pos;
+
+	if (seek_type == SERIALIZE_SEEK_START)
+		pos = offset;
+	else if (seek_type == SERIALIZE_SEEK_CURRENT)
+		pos = (int64_t)input->pos + offset;
+	else
+		pos = (int64_t)input->size + offset;
+
+	if (pos < 0)
+		pos = 0;
+	else if (pos > (int64_t)input->size)
+		pos = (int64_t)input->size;
+
+	input->pos = (size_t)pos;
+	return input->pos;
+}
+
+static uint64_t array_input_get_pos(void *param)
+{
+	struct array_input_data *input = param;
+	return input->pos;
+}
+
+void array_input_serializer_init(struct serializer *s,
+		struct array_input_data *data, const void *bytes, size_t size)
+{
+	memset(s, 0, sizeof(struct serializer));
+	data->bytes = bytes;
+	data->size  = size;
+	data->pos   = 0;
+	s->data     = data;
+	s->read     = array_input_read;
+	s->seek     = array_input_seek;
+	s->get_pos  = array_input_get_pos;
+}
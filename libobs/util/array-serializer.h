@@ -26,3 +26,13 @@ struct array_output_data {
 EXPORT void array_output_serializer_init(struct serializer *s,
 		struct array_output_data *data);
 EXPORT void array_output_serializer_free(struct array_output_data *data);
+
+/* reads from a memory buffer, which must stay valid while it is used */
+struct array_input_data {
+	const uint8_t *bytes;
+	size_t        size;
+	size_t        pos;
+};
+
+EXPORT void array_input_serializer_init(struct serializer *s,
+		struct array_input_data *data, const void *bytes, size_t size);
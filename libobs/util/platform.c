@@ -24,6 +24,12 @@
 #include "utf8.h"
 #include "dstr.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
 FILE *os_wfopen(const wchar_t *path, const char *mode)
 {
 	FILE *file = NULL;
@@ -412,3 +418,74 @@ size_t os_mbs_to_utf8_ptr(const char *str, size_t len, char **pstr)
 	*pstr = dst;
 	return out_len;
 }
+
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+static inline void os_cpuid(uint32_t regs[4], uint32_t leaf, uint32_t subleaf)
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* state components the OS saves on context switches (XCR0) */
+static inline uint64_t os_xgetbv(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+#define XSTATE_YMM    0x6
+#define XSTATE_ZMM    0xE6
+
+uint32_t os_get_cpu_features(void)
+{
+	uint32_t features = 0;
+	uint32_t regs[4];
+	uint32_t max_leaf;
+	uint64_t xstate = 0;
+
+	os_cpuid(regs, 0, 0);
+	max_leaf = regs[0];
+	if (max_leaf < 1)
+		return 0;
+
+	os_cpuid(regs, 1, 0);
+	if (regs[3] & (1<<26))
+		features |= OS_CPU_FEATURE_SSE2;
+	if (regs[2] & (1<<19))
+		features |= OS_CPU_FEATURE_SSE41;
+
+	/* osxsave and avx */
+	if ((regs[2] & (1<<27)) && (regs[2] & (1<<28))) {
+		xstate = os_xgetbv();
+		if ((xstate & XSTATE_YMM) == XSTATE_YMM)
+			features |= OS_CPU_FEATURE_AVX;
+	}
+
+	if (max_leaf < 7 || !(features & OS_CPU_FEATURE_AVX))
+		return features;
+
+	os_cpuid(regs, 7, 0);
+	if (regs[1] & (1<<5))
+		features |= OS_CPU_FEATURE_AVX2;
+
+	/* avx512f and avx512bw */
+	if ((regs[1] & (1<<16)) && (regs[1] & (1<<30)) &&
+	    (xstate & XSTATE_ZMM) == XSTATE_ZMM)
+		features |= OS_CPU_FEATURE_AVX512;
+
+	return features;
+}
+#else
+uint32_t os_get_cpu_features(void)
+{
+	return 0;
+}
+#endif
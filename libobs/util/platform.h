@@ -76,6 +76,21 @@ EXPORT os_cpu_usage_info_t os_cpu_usage_info_start(void);
 EXPORT double              os_cpu_usage_info_query(os_cpu_usage_info_t info);
 EXPORT void                os_cpu_usage_info_destroy(os_cpu_usage_info_t info);
 
+#define OS_CPU_FEATURE_SSE2   (1<<0)
+#define OS_CPU_FEATURE_SSE41  (1<<1)
+#define OS_CPU_FEATURE_AVX    (1<<2)
+#define OS_CPU_FEATURE_AVX2   (1<<3)
+#define OS_CPU_FEATURE_AVX512 (1<<4)
+
+/**
+ * Returns the OS_CPU_FEATURE_* flags of the instruction sets that are
+ * supported by both the CPU and the operating system.
+ */
+EXPORT uint32_t os_get_cpu_features(void);
+
+/** Returns the number of logical processors available to the process */
+EXPORT int os_get_logical_cores(void);
+
 /**
  * Sleeps to a specific time (in nanoseconds).  Doesn't have to be super
  * accurate in terms of actual slept time because the target time is ensured.
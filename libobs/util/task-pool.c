@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bmem.h"
+#include "threading.h"
+#include "task-pool.h"
+
+struct task_worker {
+	struct task_pool   *pool;
+	pthread_t          thread;
+	os_sem_t           start;
+
+	uint32_t           band_start;
+	uint32_t           band_end;
+};
+
+struct task_pool {
+	struct task_worker *workers;
+	size_t             num_workers;
+
+	/* only one set of bands is in flight at a time */
+	pthread_mutex_t    run_mutex;
+	os_sem_t           done;
+	bool               exit;
+
+	task_band_proc_t   proc;
+	void               *param;
+};
+
+static void *task_worker_thread(void *data)
+{
+	struct task_worker *worker = data;
+	struct task_pool   *pool   = worker->pool;
+
+	while (os_sem_wait(worker->start) == 0) {
+		if (pool->exit)
+			break;
+
+		pool->proc(pool->param, worker->band_start, worker->band_end);
+		os_sem_post(pool->done);
+	}
+
+	return NULL;
+}
+
+task_pool_t task_pool_create(size_t threads)
+{
+	struct task_pool *pool = bzalloc(sizeof(struct task_pool));
+
+	pthread_mutex_init_value(&pool->run_mutex);
+	if (pthread_mutex_init(&pool->run_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&pool->done, 0) != 0)
+		goto fail;
+
+	pool->workers = bzalloc(sizeof(struct task_worker) * threads);
+
+	for (size_t i = 0; i < threads; i++) {
+		struct task_worker *worker = pool->workers + i;
+		worker->pool = pool;
+
+		if (os_sem_init(&worker->start, 0) != 0)
+			goto fail;
+		if (pthread_create(&worker->thread, NULL, task_worker_thread,
+					worker) != 0) {
+			os_sem_destroy(worker->start);
+			goto fail;
+		}
+
+		pool->num_workers++;
+	}
+
+	return pool;
+
+fail:
+	task_pool_destroy(pool);
+	return NULL;
+}
+
+void task_pool_destroy(task_pool_t pool)
+{
+	if (!pool)
+		return;
+
+	pool->exit = true;
+
+	for (size_t i = 0; i < pool->num_workers; i++) {
+		struct task_worker *worker = pool->workers + i;
+		void *thread_ret;
+
+		os_sem_post(worker->start);
+		pthread_join(worker->thread, &thread_ret);
+		os_sem_destroy(worker->start);
+	}
+
+	os_sem_destroy(pool->done);
+	pthread_mutex_destroy(&pool->run_mutex);
+	bfree(pool->workers);
+	bfree(pool);
+}
+
+size_t task_pool_threads(task_pool_t pool)
+{
+	return pool ? pool->num_workers : 0;
+}
+
+static inline uint32_t band_offset(uint32_t count, uint32_t align,
+		size_t idx, size_t bands)
+{
+	uint32_t offset = (uint32_t)((uint64_t)count * idx / bands);
+	return offset - offset % align;
+}
+
+void task_pool_run_bands(task_pool_t pool, uint32_t count,
+		uint32_t align, task_band_proc_t proc, void *param)
+{
+	size_t bands;
+	uint32_t first_end;
+
+	if (!align)
+		align = 1;
+
+	bands = count / align;
+	if (!pool || bands < 2 || !pool->num_workers) {
+		proc(param, 0, count);
+		return;
+	}
+
+	if (bands > pool->num_workers + 1)
+		bands = pool->num_workers + 1;
+
+	pthread_mutex_lock(&pool->run_mutex);
+
+	pool->proc  = proc;
+	pool->param = param;
+
+	for (size_t i = 1; i < bands; i++) {
+		struct task_worker *worker = pool->workers + (i - 1);
+
+		worker->band_start = band_offset(count, align, i, bands);
+		worker->band_end   = (i == bands - 1) ? count :
+			band_offset(count, align, i + 1, bands);
+		os_sem_post(worker->start);
+	}
+
+	first_end = band_offset(count, align, 1, bands);
+	proc(param, 0, first_end);
+
+	for (size_t i = 1; i < bands; i++)
+		os_sem_wait(pool->done);
+
+	pthread_mutex_unlock(&pool->run_mutex);
+}
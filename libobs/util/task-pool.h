@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Task pool
+ *
+ *   A small set of persistent worker threads used to split a piece of work
+ * into bands (for example, rows of an image) and process them in parallel.
+ * The calling thread processes the first band itself and blocks until the
+ * rest are done, so a pool with zero threads simply runs the work inline.
+ */
+
+#include "c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct task_pool;
+typedef struct task_pool *task_pool_t;
+
+typedef void (*task_band_proc_t)(void *param, uint32_t start, uint32_t end);
+
+EXPORT task_pool_t task_pool_create(size_t threads);
+EXPORT void task_pool_destroy(task_pool_t pool);
+
+/** Returns the number of worker threads (not counting the caller) */
+EXPORT size_t task_pool_threads(task_pool_t pool);
+
+/**
+ * Splits [0, count) into bands whose boundaries are multiples of 'align',
+ * calls 'proc' on each band in parallel and waits for all of them to finish.
+ * 'pool' can be NULL, in which case the whole range is processed inline.
+ */
+EXPORT void task_pool_run_bands(task_pool_t pool, uint32_t count,
+		uint32_t align, task_band_proc_t proc, void *param);
+
+#ifdef __cplusplus
+}
+#endif
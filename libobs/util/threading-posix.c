@@ -248,3 +248,23 @@ long os_atomic_dec_long(volatile long *val)
 {
 	return __sync_sub_and_fetch(val, 1);
 }
+
+long os_atomic_set_long(volatile long *val, long new_val)
+{
+	return __atomic_exchange_n(val, new_val, __ATOMIC_SEQ_CST);
+}
+
+long os_atomic_load_long(const volatile long *val)
+{
+	return __atomic_load_n(val, __ATOMIC_SEQ_CST);
+}
+
+void *os_atomic_set_ptr(void *volatile *ptr, void *new_ptr)
+{
+	return __atomic_exchange_n(ptr, new_ptr, __ATOMIC_SEQ_CST);
+}
+
+void *os_atomic_load_ptr(void *const volatile *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
@@ -160,3 +160,24 @@ long os_atomic_dec_long(volatile long *val)
 {
 	return InterlockedDecrement(val);
 }
+
+long os_atomic_set_long(volatile long *val, long new_val)
+{
+	return InterlockedExchange(val, new_val);
+}
+
+long os_atomic_load_long(const volatile long *val)
+{
+	return InterlockedOr((volatile long*)val, 0);
+}
+
+void *os_atomic_set_ptr(void *volatile *ptr, void *new_ptr)
+{
+	return InterlockedExchangePointer(ptr, new_ptr);
+}
+
+void *os_atomic_load_ptr(void *const volatile *ptr)
+{
+	return InterlockedCompareExchangePointer((void *volatile *)ptr,
+			NULL, NULL);
+}
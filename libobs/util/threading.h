@@ -72,6 +72,11 @@ EXPORT int  os_sem_wait(os_sem_t sem);
 
 EXPORT long os_atomic_inc_long(volatile long *val);
 EXPORT long os_atomic_dec_long(volatile long *val);
+EXPORT long os_atomic_set_long(volatile long *val, long new_val);
+EXPORT long os_atomic_load_long(const volatile long *val);
+
+EXPORT void *os_atomic_set_ptr(void *volatile *ptr, void *new_ptr);
+EXPORT void *os_atomic_load_ptr(void *const volatile *ptr);
 
 
 #ifdef __cplusplus
@@ -431,6 +431,7 @@ bool OBSBasic::InitBasicConfigDefaults()
 	config_set_default_string(basicConfig, "Audio", "ChannelSetup",
 			"Stereo");
 	config_set_default_uint  (basicConfig, "Audio", "BufferingTime", 1000);
+	config_set_default_uint  (basicConfig, "Audio", "PeriodFrames", 0);
 
 	config_set_default_string(basicConfig, "Audio", "DesktopDevice1",
 			hasDesktopAudio ? "default" : "disabled");
@@ -1122,6 +1123,8 @@ bool OBSBasic::ResetAudio()
 		ai.speakers = SPEAKERS_STEREO;
 
 	ai.buffer_ms = config_get_uint(basicConfig, "Audio", "BufferingTime");
+	ai.period_frames = (uint32_t)config_get_uint(basicConfig, "Audio",
+			"PeriodFrames");
 
 	return obs_reset_audio(&ai);
 }
@@ -44,6 +44,22 @@ struct v4l2_buffer_data {
 	void *start;
 };
 
+/*
+ * The mapped buffers are reference counted, when capturing without copying
+ * the frames handed to libobs keep the buffers mapped until they are released
+ * even if the capture has been stopped in the meantime.
+ */
+struct v4l2_buffer_set {
+	volatile long refs;
+	pthread_mutex_t mutex;
+	bool streaming;
+
+	int_fast32_t dev;
+	uint_fast32_t count;
+	struct v4l2_buffer_data *buf;
+	struct source_frame *frames;
+};
+
 struct v4l2_data {
 	char *device;
 
@@ -60,8 +76,9 @@ struct v4l2_data {
 	int_fast32_t height;
 	int_fast32_t fps_numerator;
 	int_fast32_t fps_denominator;
-	uint_fast32_t buf_count;
-	struct v4l2_buffer_data *buf;
+	int_fast32_t buf_request;
+	bool zero_copy;
+	struct v4l2_buffer_set *buffers;
 };
 
 static enum video_format v4l2_to_obs_video_format(uint_fast32_t format)
@@ -90,6 +107,23 @@ static void unpack_tuple(int *a, int *b, int packed)
 	*b = packed & 0xffff;
 }
 
+/*
+ * queue a buffer with the device again
+ */
+static int_fast32_t v4l2_queue_buffer(int_fast32_t dev, uint_fast32_t index)
+{
+	struct v4l2_buffer buf;
+
+	/* this is also called when libobs releases a frame, so nothing is
+	 * left over from a previous dequeue of the buffer */
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+
+	return ioctl(dev, VIDIOC_QBUF, &buf);
+}
+
 /*
  * start capture
  */
@@ -97,14 +131,8 @@ static int_fast32_t v4l2_start_capture(struct v4l2_data *data)
 {
 	enum v4l2_buf_type type;
 
-	for (uint_fast32_t i = 0; i < data->buf_count; ++i) {
-		struct v4l2_buffer buf;
-
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = i;
-
-		if (ioctl(data->dev, VIDIOC_QBUF, &buf) < 0) {
+	for (uint_fast32_t i = 0; i < data->buffers->count; ++i) {
+		if (v4l2_queue_buffer(data->dev, i) < 0) {
 			blog(LOG_ERROR, "v4l2-input: unable to queue buffer");
 			return -1;
 		}
@@ -116,6 +144,10 @@ static int_fast32_t v4l2_start_capture(struct v4l2_data *data)
 		return -1;
 	}
 
+	pthread_mutex_lock(&data->buffers->mutex);
+	data->buffers->streaming = true;
+	pthread_mutex_unlock(&data->buffers->mutex);
+
 	return 0;
 }
 
@@ -126,6 +158,11 @@ static int_fast32_t v4l2_stop_capture(struct v4l2_data *data)
 {
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
+	/* buffers released by libobs after this must not be queued again */
+	pthread_mutex_lock(&data->buffers->mutex);
+	data->buffers->streaming = false;
+	pthread_mutex_unlock(&data->buffers->mutex);
+
 	if (ioctl(data->dev, VIDIOC_STREAMOFF, &type) < 0) {
 		blog(LOG_ERROR, "v4l2-input: unable to stop stream");
 	}
@@ -133,14 +170,50 @@ static int_fast32_t v4l2_stop_capture(struct v4l2_data *data)
 	return 0;
 }
 
+/*
+ * release a reference to the buffers, unmapping them with the last one
+ */
+static void v4l2_buffer_set_release(struct v4l2_buffer_set *set)
+{
+	if (os_atomic_dec_long(&set->refs) != 0)
+		return;
+
+	for (uint_fast32_t i = 0; i < set->count; ++i) {
+		if (set->buf[i].start != MAP_FAILED)
+			munmap(set->buf[i].start, set->buf[i].length);
+	}
+
+	pthread_mutex_destroy(&set->mutex);
+	bfree(set->frames);
+	bfree(set->buf);
+	bfree(set);
+}
+
+/*
+ * called by libobs when it no longer needs a frame captured without copying
+ */
+static void v4l2_release_frame(void *param, struct source_frame *frame)
+{
+	struct v4l2_buffer_set *set = param;
+	uint_fast32_t index = (uint_fast32_t)(frame - set->frames);
+
+	pthread_mutex_lock(&set->mutex);
+	if (set->streaming && v4l2_queue_buffer(set->dev, index) < 0)
+		blog(LOG_DEBUG, "v4l2-input: failed to enqueue buffer");
+	pthread_mutex_unlock(&set->mutex);
+
+	v4l2_buffer_set_release(set);
+}
+
 /*
  * create memory mapping for buffers
  */
 static int_fast32_t v4l2_create_mmap(struct v4l2_data *data)
 {
 	struct v4l2_requestbuffers req;
+	struct v4l2_buffer_set *set;
 
-	req.count = 4;
+	req.count = data->buf_request;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
 
@@ -154,8 +227,18 @@ static int_fast32_t v4l2_create_mmap(struct v4l2_data *data)
 		return -1;
 	}
 
-	data->buf_count = req.count;
-	data->buf = bzalloc(req.count * sizeof(struct v4l2_buffer_data));
+	set = bzalloc(sizeof(struct v4l2_buffer_set));
+	set->refs = 1;
+	set->dev = data->dev;
+	set->count = req.count;
+	set->buf = bzalloc(req.count * sizeof(struct v4l2_buffer_data));
+	set->frames = bzalloc(req.count * sizeof(struct source_frame));
+	pthread_mutex_init_value(&set->mutex);
+	pthread_mutex_init(&set->mutex, NULL);
+	data->buffers = set;
+
+	for (uint_fast32_t i = 0; i < req.count; ++i)
+		set->buf[i].start = MAP_FAILED;
 
 	for (uint_fast32_t i = 0; i < req.count; ++i) {
 		struct v4l2_buffer buf;
@@ -169,12 +252,12 @@ static int_fast32_t v4l2_create_mmap(struct v4l2_data *data)
 			return -1;
 		}
 
-		data->buf[i].length = buf.length;
-		data->buf[i].start = mmap(NULL, buf.length,
+		set->buf[i].length = buf.length;
+		set->buf[i].start = mmap(NULL, buf.length,
 			PROT_READ | PROT_WRITE, MAP_SHARED,
 			data->dev, buf.m.offset);
 
-		if (data->buf[i].start == MAP_FAILED) {
+		if (set->buf[i].start == MAP_FAILED) {
 			blog(LOG_ERROR, "v4l2-input: mmap for buffer failed");
 			return -1;
 		}
@@ -184,17 +267,13 @@ static int_fast32_t v4l2_create_mmap(struct v4l2_data *data)
 }
 
 /*
- * destroy memory mapping for buffers
+ * destroy memory mapping for buffers, frames still held by libobs keep them
+ * mapped until they are released
  */
 static void v4l2_destroy_mmap(struct v4l2_data *data)
 {
-	for(uint_fast32_t i = 0; i < data->buf_count; ++i) {
-		if (data->buf[i].start != MAP_FAILED)
-			munmap(data->buf[i].start, data->buf[i].length);
-	}
-
-	data->buf_count = 0;
-	bfree(data->buf);
+	v4l2_buffer_set_release(data->buffers);
+	data->buffers = NULL;
 }
 
 /*
@@ -203,6 +282,7 @@ static void v4l2_destroy_mmap(struct v4l2_data *data)
 static void *v4l2_thread(void *vptr)
 {
 	V4L2_DATA(vptr);
+	struct v4l2_buffer_set *set = data->buffers;
 
 	if (v4l2_start_capture(data) < 0)
 		goto exit;
@@ -212,7 +292,7 @@ static void *v4l2_thread(void *vptr)
 		fd_set fds;
 		struct timeval tv;
 		struct v4l2_buffer buf;
-		struct source_frame out;
+		struct source_frame *out;
 
 		FD_ZERO(&fds);
 		FD_SET(data->dev, &fds);
@@ -241,17 +321,27 @@ static void *v4l2_thread(void *vptr)
 			break;
 		}
 
+		out = &set->frames[buf.index];
 		video_format_get_parameters(VIDEO_CS_709, VIDEO_RANGE_PARTIAL,
-				out.color_matrix, out.color_range_min,
-				out.color_range_max);
-		out.data[0] = (uint8_t *) data->buf[buf.index].start;
-		out.linesize[0] = data->linesize;
-		out.width = data->width;
-		out.height = data->height;
-		out.timestamp = timeval2ns(buf.timestamp);
-		out.format = v4l2_to_obs_video_format(data->pixelformat);
+				out->color_matrix, out->color_range_min,
+				out->color_range_max);
+		out->data[0] = (uint8_t *) set->buf[buf.index].start;
+		out->linesize[0] = data->linesize;
+		out->width = data->width;
+		out->height = data->height;
+		out->timestamp = timeval2ns(buf.timestamp);
+		out->format = v4l2_to_obs_video_format(data->pixelformat);
+
+		/* the buffer is queued again once libobs releases the frame */
+		if (data->zero_copy) {
+			os_atomic_inc_long(&set->refs);
+			obs_source_output_video_owned(data->source, out,
+					v4l2_release_frame, set);
+			data->frames++;
+			continue;
+		}
 
-		obs_source_output_video(data->source, &out);
+		obs_source_output_video(data->source, out);
 
 		if (ioctl(data->dev, VIDIOC_QBUF, &buf) < 0) {
 			blog(LOG_DEBUG, "v4l2-input: failed to enqueue buffer");
@@ -277,6 +367,8 @@ static void v4l2_defaults(obs_data_t settings)
 	obs_data_set_default_int(settings, "resolution",
 			pack_tuple(640, 480));
 	obs_data_set_default_int(settings, "framerate", pack_tuple(1, 30));
+	obs_data_set_default_int(settings, "buffer_count", 4);
+	obs_data_set_default_bool(settings, "zero_copy", false);
 }
 
 /*
@@ -481,6 +573,12 @@ static obs_properties_t v4l2_properties(void)
 			"framerate", obs_module_text("FrameRate"),
 			OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
 
+	obs_properties_add_int(props, "buffer_count",
+			obs_module_text("BufferCount"), 2, 32, 1);
+
+	obs_properties_add_bool(props, "zero_copy",
+			obs_module_text("ZeroCopy"));
+
 	v4l2_device_list(device_list, NULL);
 	obs_property_set_modified_callback(device_list, device_selected);
 	obs_property_set_modified_callback(format_list, format_selected);
@@ -511,7 +609,7 @@ static void v4l2_terminate(struct v4l2_data *data)
 		os_event_destroy(data->event);
 	}
 
-	if (data->buf_count)
+	if (data->buffers)
 		v4l2_destroy_mmap(data);
 
 	if (data->dev != -1) {
@@ -630,6 +728,16 @@ static void v4l2_update(void *vptr, obs_data_t settings)
 		restart = true;
 	}
 
+	if (data->buf_request != obs_data_getint(settings, "buffer_count")) {
+		data->buf_request = obs_data_getint(settings, "buffer_count");
+		restart = true;
+	}
+
+	if (data->zero_copy != obs_data_getbool(settings, "zero_copy")) {
+		data->zero_copy = obs_data_getbool(settings, "zero_copy");
+		restart = true;
+	}
+
 	if (restart) {
 		v4l2_terminate(data);
 
@@ -265,17 +265,32 @@ static size_t aac_frame_size(void *data)
 	return enc->frame_size;
 }
 
+/* FFmpeg's own AAC encoder reads the bitrate from the codec context for its
+ * rate control on every frame, so it can be changed while encoding.  wrapped
+ * external encoders only use it when opened. */
+static bool aac_set_bitrate(void *data, uint32_t bitrate)
+{
+	struct aac_encoder *enc = data;
+
+	if (strcmp(enc->aac->name, "aac") != 0)
+		return false;
+
+	enc->context->bit_rate = (int)bitrate * 1000;
+	return true;
+}
+
 struct obs_encoder_info aac_encoder_info = {
-	.id         = "ffmpeg_aac",
-	.type       = OBS_ENCODER_AUDIO,
-	.codec      = "AAC",
-	.getname    = aac_getname,
-	.create     = aac_create,
-	.destroy    = aac_destroy,
-	.encode     = aac_encode,
-	.frame_size = aac_frame_size,
-	.defaults   = aac_defaults,
-	.properties = aac_properties,
-	.extra_data = aac_extra_data,
-	.audio_info = aac_audio_info
+	.id          = "ffmpeg_aac",
+	.type        = OBS_ENCODER_AUDIO,
+	.codec       = "AAC",
+	.getname     = aac_getname,
+	.create      = aac_create,
+	.destroy     = aac_destroy,
+	.encode      = aac_encode,
+	.frame_size  = aac_frame_size,
+	.defaults    = aac_defaults,
+	.properties  = aac_properties,
+	.extra_data  = aac_extra_data,
+	.audio_info  = aac_audio_info,
+	.set_bitrate = aac_set_bitrate
 };
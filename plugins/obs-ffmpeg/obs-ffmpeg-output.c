@@ -19,8 +19,8 @@
 #include <util/circlebuf.h>
 #include <util/threading.h>
 #include <util/dstr.h>
-#include <util/darray.h>
 #include <util/platform.h>
+#include <inttypes.h>
 
 #include <libavutil/opt.h>
 #include <libavutil/avstring.h>
@@ -48,7 +48,6 @@ struct ffmpeg_data {
 	AVPicture          dst_picture;
 	AVFrame            *vframe;
 	int                frame_size;
-	int                total_frames;
 
 	uint64_t           start_timestamp;
 
@@ -67,6 +66,24 @@ struct ffmpeg_data {
 	bool               initialized;
 };
 
+/* raw frame copied out of the video callback, waiting to be encoded */
+struct video_frame {
+	AVPicture          picture;
+	int64_t            pts;
+	uint64_t           queued_ns;
+};
+
+struct ffmpeg_packet {
+	AVPacket           packet;
+	uint64_t           queued_ns;
+};
+
+struct stage_latency {
+	uint64_t           total_ns;
+	uint64_t           max_ns;
+	uint64_t           count;
+};
+
 struct ffmpeg_output {
 	obs_output_t       output;
 	volatile bool      active;
@@ -81,9 +98,51 @@ struct ffmpeg_output {
 	os_sem_t           write_sem;
 	os_event_t         stop_event;
 
-	DARRAY(AVPacket)   packets;
+	struct circlebuf   packets;
+	size_t             max_packets;
+	os_event_t         packet_event;
+	struct stage_latency mux_latency;
+
+	/* video frames are encoded on their own thread so that a slow codec
+	 * does not hold up the video output thread */
+	bool               encode_thread_active;
+	pthread_mutex_t    frame_mutex;
+	pthread_t          encode_thread;
+	os_sem_t           frame_sem;
+	struct video_frame *frames;
+	size_t             num_frames;
+	struct circlebuf   frame_queue;
+	struct circlebuf   free_frames;
+	int64_t            next_pts;
+	uint64_t           dropped_frames;
+	struct stage_latency queue_latency;
+	struct stage_latency encode_latency;
 };
 
+static inline size_t num_packets(struct ffmpeg_output *output)
+{
+	return output->packets.size / sizeof(struct ffmpeg_packet);
+}
+
+static inline float ns_to_ms(uint64_t ns)
+{
+	return (float)((double)ns / 1000000.0);
+}
+
+static inline void add_latency(struct stage_latency *latency, uint64_t ns)
+{
+	latency->total_ns += ns;
+	latency->count++;
+	if (ns > latency->max_ns)
+		latency->max_ns = ns;
+}
+
+static inline float avg_latency_ms(const struct stage_latency *latency)
+{
+	return latency->count ?
+		ns_to_ms(latency->total_ns / latency->count) : 0.0f;
+}
+
 /* ------------------------------------------------------------------------- */
 
 static bool new_stream(struct ffmpeg_data *data, AVStream **stream,
@@ -397,18 +456,63 @@ static void ffmpeg_log_callback(void *param, int level, const char *format,
 	UNUSED_PARAMETER(param);
 }
 
+static void ffmpeg_output_get_pipeline_stats(void *data, calldata_t params)
+{
+	struct ffmpeg_output *output = data;
+
+	pthread_mutex_lock(&output->frame_mutex);
+	calldata_setint  (params, "queued_frames",
+			(long long)(output->frame_queue.size /
+				sizeof(struct video_frame*)));
+	calldata_setint  (params, "dropped_frames",
+			(long long)output->dropped_frames);
+	calldata_setfloat(params, "avg_queue_ms",
+			avg_latency_ms(&output->queue_latency));
+	calldata_setfloat(params, "max_queue_ms",
+			ns_to_ms(output->queue_latency.max_ns));
+	calldata_setfloat(params, "avg_encode_ms",
+			avg_latency_ms(&output->encode_latency));
+	calldata_setfloat(params, "max_encode_ms",
+			ns_to_ms(output->encode_latency.max_ns));
+	pthread_mutex_unlock(&output->frame_mutex);
+
+	pthread_mutex_lock(&output->write_mutex);
+	calldata_setint  (params, "queued_packets",
+			(long long)num_packets(output));
+	calldata_setfloat(params, "avg_mux_ms",
+			avg_latency_ms(&output->mux_latency));
+	calldata_setfloat(params, "max_mux_ms",
+			ns_to_ms(output->mux_latency.max_ns));
+	pthread_mutex_unlock(&output->write_mutex);
+}
+
 static void *ffmpeg_output_create(obs_data_t settings, obs_output_t output)
 {
 	struct ffmpeg_output *data = bzalloc(sizeof(struct ffmpeg_output));
 	pthread_mutex_init_value(&data->write_mutex);
+	pthread_mutex_init_value(&data->frame_mutex);
 	data->output = output;
 
 	if (pthread_mutex_init(&data->write_mutex, NULL) != 0)
 		goto fail;
-	if (os_event_init(&data->stop_event, OS_EVENT_TYPE_AUTO) != 0)
+	if (pthread_mutex_init(&data->frame_mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&data->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+	if (os_event_init(&data->packet_event, OS_EVENT_TYPE_AUTO) != 0)
 		goto fail;
 	if (os_sem_init(&data->write_sem, 0) != 0)
 		goto fail;
+	if (os_sem_init(&data->frame_sem, 0) != 0)
+		goto fail;
+
+	proc_handler_add(obs_output_prochandler(output),
+			"void get_pipeline_stats(out int queued_frames, "
+			"out int dropped_frames, out float avg_queue_ms, "
+			"out float max_queue_ms, out float avg_encode_ms, "
+			"out float max_encode_ms, out int queued_packets, "
+			"out float avg_mux_ms, out float max_mux_ms)",
+			ffmpeg_output_get_pipeline_stats, data);
 
 	av_log_set_callback(ffmpeg_log_callback);
 
@@ -417,7 +521,10 @@ static void *ffmpeg_output_create(obs_data_t settings, obs_output_t output)
 
 fail:
 	pthread_mutex_destroy(&data->write_mutex);
+	pthread_mutex_destroy(&data->frame_mutex);
 	os_event_destroy(data->stop_event);
+	os_event_destroy(data->packet_event);
+	os_sem_destroy(data->write_sem);
 	bfree(data);
 	return NULL;
 }
@@ -435,12 +542,21 @@ static void ffmpeg_output_destroy(void *data)
 		ffmpeg_output_stop(output);
 
 		pthread_mutex_destroy(&output->write_mutex);
+		pthread_mutex_destroy(&output->frame_mutex);
 		os_sem_destroy(output->write_sem);
+		os_sem_destroy(output->frame_sem);
 		os_event_destroy(output->stop_event);
+		os_event_destroy(output->packet_event);
 		bfree(data);
 	}
 }
 
+static void ffmpeg_output_defaults(obs_data_t settings)
+{
+	obs_data_set_default_int(settings, "video_queue_size", 4);
+	obs_data_set_default_int(settings, "packet_queue_size", 0);
+}
+
 static inline void copy_data(AVPicture *pic, const struct video_data *frame,
 		int height)
 {
@@ -465,69 +581,175 @@ static inline void copy_data(AVPicture *pic, const struct video_data *frame,
 	}
 }
 
-static void receive_video(void *param, struct video_data *frame)
+static void push_packet(struct ffmpeg_output *output, AVPacket *packet)
 {
-	struct ffmpeg_output *output = param;
-	struct ffmpeg_data   *data   = &output->ff_data;
-	AVCodecContext *context = data->video->codec;
-	AVPacket packet = {0};
-	int ret = 0, got_packet;
-	enum AVPixelFormat format;
+	struct ffmpeg_packet queued = {*packet, os_gettime_ns()};
 
-	av_init_packet(&packet);
+	pthread_mutex_lock(&output->write_mutex);
+	circlebuf_push_back(&output->packets, &queued, sizeof(queued));
+	pthread_mutex_unlock(&output->write_mutex);
+	os_sem_post(output->write_sem);
+}
 
-	if (!data->start_timestamp)
-		data->start_timestamp = frame->timestamp;
+/* blocks the encode thread (never the video thread) while the muxer is
+ * behind, if the packet queue has been limited */
+static bool wait_for_packet_space(struct ffmpeg_output *output)
+{
+	bool full;
+
+	if (!output->max_packets)
+		return true;
+
+	for (;;) {
+		if (os_event_try(output->stop_event) == 0)
+			return false;
+
+		pthread_mutex_lock(&output->write_mutex);
+		full = num_packets(output) >= output->max_packets;
+		pthread_mutex_unlock(&output->write_mutex);
+
+		if (!full)
+			return true;
+
+		os_event_wait(output->packet_event);
+	}
+}
+
+static AVPicture *convert_frame(struct ffmpeg_data *data,
+		struct video_frame *frame)
+{
+	AVCodecContext *context = data->video->codec;
+	enum AVPixelFormat format;
 
 	format = obs_to_ffmpeg_video_format(OBS_FFMPEG_VIDEO_FORMAT);
-	if (context->pix_fmt != format)
-		sws_scale(data->swscale, (const uint8_t *const *)frame->data,
-				(const int*)frame->linesize,
+	if (context->pix_fmt != format) {
+		sws_scale(data->swscale,
+				(const uint8_t *const *)frame->picture.data,
+				(const int*)frame->picture.linesize,
 				0, context->height, data->dst_picture.data,
 				data->dst_picture.linesize);
-	else
-		copy_data(&data->dst_picture, frame, context->height);
+		return &data->dst_picture;
+
+	} else if (data->output->flags & AVFMT_RAWPICTURE) {
+		av_picture_copy(&data->dst_picture, &frame->picture, format,
+				context->width, context->height);
+		return &data->dst_picture;
+	}
+
+	return &frame->picture;
+}
+
+static void encode_video(struct ffmpeg_output *output,
+		struct video_frame *frame)
+{
+	struct ffmpeg_data *data    = &output->ff_data;
+	AVCodecContext     *context = data->video->codec;
+	AVPicture          *picture;
+	AVPacket packet = {0};
+	int ret, got_packet;
+
+	av_init_packet(&packet);
+
+	picture = convert_frame(data, frame);
 
 	if (data->output->flags & AVFMT_RAWPICTURE) {
 		packet.flags        |= AV_PKT_FLAG_KEY;
 		packet.stream_index  = data->video->index;
-		packet.data          = data->dst_picture.data[0];
+		packet.data          = picture->data[0];
 		packet.size          = sizeof(AVPicture);
 
-		pthread_mutex_lock(&output->write_mutex);
-		da_push_back(output->packets, &packet);
-		pthread_mutex_unlock(&output->write_mutex);
-		os_sem_post(output->write_sem);
+		push_packet(output, &packet);
+		return;
+	}
 
-	} else {
-		data->vframe->pts = data->total_frames;
-		ret = avcodec_encode_video2(context, &packet, data->vframe,
-				&got_packet);
-		if (ret < 0) {
-			return;
-		}
+	*((AVPicture*)data->vframe) = *picture;
+	data->vframe->pts = frame->pts;
 
-		if (!ret && got_packet && packet.size) {
-			packet.pts = rescale_ts(packet.pts, context,
-					data->video->time_base);
-			packet.dts = rescale_ts(packet.dts, context,
-					data->video->time_base);
-			packet.duration = (int)av_rescale_q(packet.duration,
-					context->time_base,
-					data->video->time_base);
-
-			pthread_mutex_lock(&output->write_mutex);
-			da_push_back(output->packets, &packet);
-			pthread_mutex_unlock(&output->write_mutex);
-			os_sem_post(output->write_sem);
-		} else {
-			ret = 0;
-		}
+	ret = avcodec_encode_video2(context, &packet, data->vframe,
+			&got_packet);
+	if (ret < 0 || !got_packet || !packet.size)
+		return;
+
+	packet.pts = rescale_ts(packet.pts, context, data->video->time_base);
+	packet.dts = rescale_ts(packet.dts, context, data->video->time_base);
+	packet.duration = (int)av_rescale_q(packet.duration,
+			context->time_base, data->video->time_base);
+
+	push_packet(output, &packet);
+}
+
+static void *encode_thread(void *data)
+{
+	struct ffmpeg_output *output = data;
+	struct video_frame   *frame;
+	uint64_t             start_ns, end_ns;
+
+	while (os_sem_wait(output->frame_sem) == 0) {
+		if (os_event_try(output->stop_event) == 0)
+			break;
+
+		frame = NULL;
+
+		pthread_mutex_lock(&output->frame_mutex);
+		if (output->frame_queue.size)
+			circlebuf_pop_front(&output->frame_queue, &frame,
+					sizeof(frame));
+		pthread_mutex_unlock(&output->frame_mutex);
+
+		if (!frame)
+			continue;
+
+		if (!wait_for_packet_space(output))
+			break;
+
+		start_ns = os_gettime_ns();
+		encode_video(output, frame);
+		end_ns = os_gettime_ns();
+
+		pthread_mutex_lock(&output->frame_mutex);
+		add_latency(&output->queue_latency,
+				start_ns - frame->queued_ns);
+		add_latency(&output->encode_latency, end_ns - start_ns);
+		circlebuf_push_back(&output->free_frames, &frame,
+				sizeof(frame));
+		pthread_mutex_unlock(&output->frame_mutex);
 	}
 
+	return NULL;
+}
+
+static void receive_video(void *param, struct video_data *frame)
+{
+	struct ffmpeg_output *output = param;
+	struct ffmpeg_data   *data   = &output->ff_data;
+	struct video_frame   *queued = NULL;
 
+	if (!data->start_timestamp)
+		data->start_timestamp = frame->timestamp;
+
+	pthread_mutex_lock(&output->frame_mutex);
+	if (output->free_frames.size)
+		circlebuf_pop_front(&output->free_frames, &queued,
+				sizeof(queued));
+	else
+		output->dropped_frames++;
+	pthread_mutex_unlock(&output->frame_mutex);
+
+	/* the pts still advances for dropped frames so that the timing of
+	 * the remaining frames stays correct */
+	if (queued) {
+		copy_data(&queued->picture, frame, data->video->codec->height);
+		queued->pts       = output->next_pts;
+		queued->queued_ns = os_gettime_ns();
+
+		pthread_mutex_lock(&output->frame_mutex);
+		circlebuf_push_back(&output->frame_queue, &queued,
+				sizeof(queued));
+		pthread_mutex_unlock(&output->frame_mutex);
+		os_sem_post(output->frame_sem);
+	}
 
-	data->total_frames++;
+	output->next_pts++;
 }
 
 static void encode_audio(struct ffmpeg_output *output,
@@ -568,10 +790,7 @@ static void encode_audio(struct ffmpeg_output *output,
 			data->audio->time_base);
 	packet.stream_index = data->audio->index;
 
-	pthread_mutex_lock(&output->write_mutex);
-	da_push_back(output->packets, &packet);
-	pthread_mutex_unlock(&output->write_mutex);
-	os_sem_post(output->write_sem);
+	push_packet(output, &packet);
 }
 
 static bool prepare_audio(struct ffmpeg_data *data,
@@ -629,32 +848,50 @@ static void receive_audio(void *param, struct audio_data *frame)
 	}
 }
 
-static bool process_packet(struct ffmpeg_output *output)
+static bool get_packet(struct ffmpeg_output *output,
+		struct ffmpeg_packet *queued)
 {
-	AVPacket packet;
 	bool new_packet = false;
-	int ret;
 
 	pthread_mutex_lock(&output->write_mutex);
-	if (output->packets.num) {
-		packet = output->packets.array[0];
-		da_erase(output->packets, 0);
+	if (output->packets.size) {
+		circlebuf_pop_front(&output->packets, queued, sizeof(*queued));
 		new_packet = true;
 	}
 	pthread_mutex_unlock(&output->write_mutex);
 
-	if (!new_packet)
-		return true;
+	return new_packet;
+}
 
-	/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d, "
-			"packets queued: %lu",
-			packet.size, packet.flags,
-			packet.stream_index, output->packets.num);*/
+/* writes every packet that is currently queued; the semaphore may have
+ * been posted several times for them, so later wakes can find the queue
+ * already empty */
+static bool process_packets(struct ffmpeg_output *output)
+{
+	struct ffmpeg_packet queued;
+	int ret;
 
-	ret = av_interleaved_write_frame(output->ff_data.output, &packet);
-	if (ret < 0) {
-		av_free_packet(&packet);
-		return false;
+	while (os_event_try(output->stop_event) != 0 &&
+	       get_packet(output, &queued)) {
+		os_event_signal(output->packet_event);
+
+		/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d, "
+				"packets queued: %lu",
+				queued.packet.size, queued.packet.flags,
+				queued.packet.stream_index,
+				num_packets(output));*/
+
+		ret = av_interleaved_write_frame(output->ff_data.output,
+				&queued.packet);
+		if (ret < 0) {
+			av_free_packet(&queued.packet);
+			return false;
+		}
+
+		pthread_mutex_lock(&output->write_mutex);
+		add_latency(&output->mux_latency,
+				os_gettime_ns() - queued.queued_ns);
+		pthread_mutex_unlock(&output->write_mutex);
 	}
 
 	return true;
@@ -669,7 +906,7 @@ static void *write_thread(void *data)
 		if (os_event_try(output->stop_event) == 0)
 			break;
 
-		if (!process_packet(output)) {
+		if (!process_packets(output)) {
 			pthread_detach(output->write_thread);
 			output->write_thread_active = false;
 
@@ -682,19 +919,101 @@ static void *write_thread(void *data)
 	return NULL;
 }
 
+static bool init_frame_queue(struct ffmpeg_output *output, size_t num)
+{
+	AVCodecContext     *context;
+	enum AVPixelFormat format;
+	int ret;
+
+	memset(&output->queue_latency,  0, sizeof(struct stage_latency));
+	memset(&output->encode_latency, 0, sizeof(struct stage_latency));
+	memset(&output->mux_latency,    0, sizeof(struct stage_latency));
+	output->dropped_frames = 0;
+	output->next_pts       = 0;
+
+	if (!output->ff_data.video)
+		return true;
+
+	context = output->ff_data.video->codec;
+	format  = obs_to_ffmpeg_video_format(OBS_FFMPEG_VIDEO_FORMAT);
+
+	output->frames = bzalloc(sizeof(struct video_frame) * num);
+
+	for (size_t i = 0; i < num; i++) {
+		struct video_frame *frame = output->frames + i;
+
+		ret = avpicture_alloc(&frame->picture, format,
+				context->width, context->height);
+		if (ret < 0) {
+			blog(LOG_WARNING, "Failed to allocate video frame "
+			                  "queue");
+			return false;
+		}
+
+		output->num_frames++;
+		circlebuf_push_back(&output->free_frames, &frame,
+				sizeof(frame));
+	}
+
+	return true;
+}
+
+static void free_frame_queue(struct ffmpeg_output *output)
+{
+	pthread_mutex_lock(&output->frame_mutex);
+
+	for (size_t i = 0; i < output->num_frames; i++)
+		avpicture_free(&output->frames[i].picture);
+
+	bfree(output->frames);
+	output->frames     = NULL;
+	output->num_frames = 0;
+	circlebuf_free(&output->frame_queue);
+	circlebuf_free(&output->free_frames);
+
+	pthread_mutex_unlock(&output->frame_mutex);
+}
+
+static void log_pipeline_stats(struct ffmpeg_output *output)
+{
+	if (!output->num_frames)
+		return;
+
+	blog(LOG_INFO, "ffmpeg output: %"PRIu64" frames dropped, "
+	               "queue: avg %.1fms max %.1fms, "
+	               "encode: avg %.1fms max %.1fms, "
+	               "mux: avg %.1fms max %.1fms",
+	               output->dropped_frames,
+	               avg_latency_ms(&output->queue_latency),
+	               ns_to_ms(output->queue_latency.max_ns),
+	               avg_latency_ms(&output->encode_latency),
+	               ns_to_ms(output->encode_latency.max_ns),
+	               avg_latency_ms(&output->mux_latency),
+	               ns_to_ms(output->mux_latency.max_ns));
+}
+
 static bool try_connect(struct ffmpeg_output *output)
 {
 	const char *filename_test;
 	obs_data_t settings;
 	int audio_bitrate, video_bitrate;
+	int video_queue_size, packet_queue_size;
 	int ret;
 
 	settings = obs_output_get_settings(output->output);
 	filename_test = obs_data_getstring(settings, "filename");
 	video_bitrate = (int)obs_data_getint(settings, "video_bitrate");
 	audio_bitrate = (int)obs_data_getint(settings, "audio_bitrate");
+	video_queue_size = (int)obs_data_getint(settings, "video_queue_size");
+	packet_queue_size = (int)obs_data_getint(settings,
+			"packet_queue_size");
 	obs_data_release(settings);
 
+	if (video_queue_size < 1)
+		video_queue_size = 1;
+	output->max_packets = packet_queue_size > 0 ?
+		(size_t)packet_queue_size : 0;
+
 	if (!filename_test || !*filename_test)
 		return false;
 
@@ -702,6 +1021,12 @@ static bool try_connect(struct ffmpeg_output *output)
 				video_bitrate, audio_bitrate))
 		return false;
 
+	if (!init_frame_queue(output, (size_t)video_queue_size)) {
+		free_frame_queue(output);
+		ffmpeg_data_free(&output->ff_data);
+		return false;
+	}
+
 	struct audio_convert_info aci = {
 		.format = output->ff_data.audio_format
 	};
@@ -711,6 +1036,7 @@ static bool try_connect(struct ffmpeg_output *output)
 	};
 
 	output->active = true;
+	os_event_reset(output->stop_event);
 
 	if (!obs_output_can_begin_data_capture(output->output, 0))
 		return false;
@@ -723,10 +1049,22 @@ static bool try_connect(struct ffmpeg_output *output)
 		return false;
 	}
 
+	output->write_thread_active = true;
+
+	ret = pthread_create(&output->encode_thread, NULL, encode_thread,
+			output);
+	if (ret != 0) {
+		blog(LOG_WARNING, "ffmpeg_output_start: failed to create "
+		                  "encode thread.");
+		ffmpeg_output_stop(output);
+		return false;
+	}
+
+	output->encode_thread_active = true;
+
 	obs_output_set_video_conversion(output->output, &vsi);
 	obs_output_set_audio_conversion(output->output, &aci);
 	obs_output_begin_data_capture(output->output, 0);
-	output->write_thread_active = true;
 	return true;
 }
 
@@ -761,8 +1099,16 @@ static void ffmpeg_output_stop(void *data)
 	if (output->active) {
 		obs_output_end_data_capture(output->output);
 
+		os_event_signal(output->stop_event);
+		os_event_signal(output->packet_event);
+
+		if (output->encode_thread_active) {
+			os_sem_post(output->frame_sem);
+			pthread_join(output->encode_thread, NULL);
+			output->encode_thread_active = false;
+		}
+
 		if (output->write_thread_active) {
-			os_event_signal(output->stop_event);
 			os_sem_post(output->write_sem);
 			pthread_join(output->write_thread, NULL);
 			output->write_thread_active = false;
@@ -770,12 +1116,18 @@ static void ffmpeg_output_stop(void *data)
 
 		pthread_mutex_lock(&output->write_mutex);
 
-		for (size_t i = 0; i < output->packets.num; i++)
-			av_free_packet(output->packets.array+i);
-		da_free(output->packets);
+		while (output->packets.size) {
+			struct ffmpeg_packet queued;
+			circlebuf_pop_front(&output->packets, &queued,
+					sizeof(queued));
+			av_free_packet(&queued.packet);
+		}
+		circlebuf_free(&output->packets);
 
 		pthread_mutex_unlock(&output->write_mutex);
 
+		log_pipeline_stats(output);
+		free_frame_queue(output);
 		ffmpeg_data_free(&output->ff_data);
 	}
 }
@@ -786,6 +1138,7 @@ struct obs_output_info ffmpeg_output = {
 	.getname   = ffmpeg_output_getname,
 	.create    = ffmpeg_output_create,
 	.destroy   = ffmpeg_output_destroy,
+	.defaults  = ffmpeg_output_defaults,
 	.start     = ffmpeg_output_start,
 	.stop      = ffmpeg_output_stop,
 	.raw_video = receive_video,
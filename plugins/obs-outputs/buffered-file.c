@@ -0,0 +1,371 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* O_DIRECT */
+#endif
+
+#include <util/bmem.h>
+#include <util/base.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "buffered-file.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* direct writes must start at aligned file offsets and memory addresses,
+ * and be a multiple of the block size in length.  4096 covers the block
+ * size of practically any disk. */
+#define DIRECT_ALIGNMENT 4096
+
+struct write_buffer {
+	uint8_t *data;
+	size_t  size;
+};
+
+struct buffered_file {
+	FILE                       *file;
+	bool                       direct;
+	uint64_t                   sync_interval_ns;
+	uint64_t                   last_sync_ns;
+
+	uint8_t                    *memory;
+	struct write_buffer        *buffers;
+	size_t                     buffer_size;
+	size_t                     num_buffers;
+
+	/* the buffer being filled by the caller, and the next buffer to be
+	 * written by the writer thread */
+	size_t                     fill_idx;
+	size_t                     write_idx;
+	int64_t                    total_size;
+
+	os_sem_t                   write_sem;
+	os_sem_t                   free_sem;
+	pthread_t                  write_thread;
+	bool                       thread_active;
+	volatile long              error;
+
+	pthread_mutex_t            stats_mutex;
+	struct buffered_file_stats stats;
+};
+
+static bool set_direct(FILE *file, bool enable)
+{
+#if defined(__linux__) && defined(O_DIRECT)
+	int fd    = fileno(file);
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1)
+		return false;
+
+	flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	return fcntl(fd, F_SETFL, flags) == 0;
+#elif defined(F_NOCACHE)
+	return fcntl(fileno(file), F_NOCACHE, enable ? 1 : 0) != -1;
+#else
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(enable);
+	return false;
+#endif
+}
+
+static bool sync_file(FILE *file)
+{
+	if (fflush(file) != 0)
+		return false;
+
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+static void write_buffer(struct buffered_file *bf, struct write_buffer *buf)
+{
+	uint64_t start_ns = os_gettime_ns();
+	uint64_t write_ns = 0, sync_ns = 0;
+	bool     synced   = false;
+
+	/* only the last buffer can be partially filled, and it can't be
+	 * written directly */
+	if (bf->direct && buf->size % DIRECT_ALIGNMENT) {
+		set_direct(bf->file, false);
+		bf->direct = false;
+	}
+
+	/* once a write has failed, the rest of the data is discarded */
+	if (os_atomic_load_long(&bf->error))
+		goto update_stats;
+
+	if (fwrite(buf->data, 1, buf->size, bf->file) != buf->size) {
+		blog(LOG_ERROR, "buffered_file: Failed to write to file");
+		os_atomic_set_long(&bf->error, 1);
+	}
+
+	write_ns = os_gettime_ns() - start_ns;
+
+	if (!os_atomic_load_long(&bf->error) && bf->sync_interval_ns &&
+	    start_ns - bf->last_sync_ns >= bf->sync_interval_ns) {
+		if (!sync_file(bf->file)) {
+			blog(LOG_ERROR, "buffered_file: Failed to sync file");
+			os_atomic_set_long(&bf->error, 1);
+		}
+
+		bf->last_sync_ns = os_gettime_ns();
+		sync_ns          = bf->last_sync_ns - start_ns - write_ns;
+		synced           = true;
+	}
+
+update_stats:
+
+	pthread_mutex_lock(&bf->stats_mutex);
+	bf->stats.queued_bytes   -= buf->size;
+	bf->stats.written_bytes  += buf->size;
+	bf->stats.writes++;
+	bf->stats.total_write_ns += write_ns;
+	if (write_ns > bf->stats.max_write_ns)
+		bf->stats.max_write_ns = write_ns;
+	if (synced) {
+		bf->stats.syncs++;
+		if (sync_ns > bf->stats.max_sync_ns)
+			bf->stats.max_sync_ns = sync_ns;
+	}
+	pthread_mutex_unlock(&bf->stats_mutex);
+
+	buf->size = 0;
+}
+
+static void *write_thread(void *data)
+{
+	struct buffered_file *bf = data;
+
+	while (os_sem_wait(bf->write_sem) == 0) {
+		struct write_buffer *buf = bf->buffers + bf->write_idx;
+
+		/* an empty buffer is only ever queued when stopping */
+		if (!buf->size)
+			break;
+
+		write_buffer(bf, buf);
+
+		bf->write_idx = (bf->write_idx + 1) % bf->num_buffers;
+		os_sem_post(bf->free_sem);
+	}
+
+	return NULL;
+}
+
+/* hands the current buffer to the writer thread and moves on to the next
+ * one, waiting for it to be written first if necessary */
+static void queue_buffer(struct buffered_file *bf)
+{
+	size_t   size     = bf->buffers[bf->fill_idx].size;
+	uint64_t start_ns = os_gettime_ns();
+	uint64_t wait_ns;
+
+	pthread_mutex_lock(&bf->stats_mutex);
+	bf->stats.queued_bytes += size;
+	if (bf->stats.queued_bytes > bf->stats.max_queued_bytes)
+		bf->stats.max_queued_bytes = bf->stats.queued_bytes;
+	pthread_mutex_unlock(&bf->stats_mutex);
+
+	os_sem_post(bf->write_sem);
+	os_sem_wait(bf->free_sem);
+
+	bf->fill_idx = (bf->fill_idx + 1) % bf->num_buffers;
+
+	/* waiting on a free buffer normally returns immediately; anything
+	 * longer than a millisecond means the disk isn't keeping up */
+	wait_ns = os_gettime_ns() - start_ns;
+	if (wait_ns >= 1000000) {
+		pthread_mutex_lock(&bf->stats_mutex);
+		bf->stats.stalls++;
+		bf->stats.stall_ns += wait_ns;
+		pthread_mutex_unlock(&bf->stats_mutex);
+	}
+}
+
+static void buffered_file_free(struct buffered_file *bf)
+{
+	if (bf->file)
+		fclose(bf->file);
+
+	os_sem_destroy(bf->write_sem);
+	os_sem_destroy(bf->free_sem);
+	pthread_mutex_destroy(&bf->stats_mutex);
+	bfree(bf->buffers);
+	bfree(bf->memory);
+	bfree(bf);
+}
+
+struct buffered_file *buffered_file_open(const char *path,
+		const struct buffered_file_info *info)
+{
+	struct buffered_file *bf = bzalloc(sizeof(struct buffered_file));
+	size_t               buffer_size;
+	uint8_t              *aligned;
+
+	pthread_mutex_init_value(&bf->stats_mutex);
+
+	buffer_size = (info->buffer_size + DIRECT_ALIGNMENT - 1) &
+		~(size_t)(DIRECT_ALIGNMENT - 1);
+	if (!buffer_size)
+		buffer_size = DIRECT_ALIGNMENT;
+
+	bf->buffer_size      = buffer_size;
+	bf->num_buffers      = info->num_buffers < 2 ? 2 : info->num_buffers;
+	bf->sync_interval_ns = (uint64_t)info->sync_interval_ms * 1000000ULL;
+	bf->last_sync_ns     = os_gettime_ns();
+
+	if (pthread_mutex_init(&bf->stats_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&bf->write_sem, 0) != 0)
+		goto fail;
+	if (os_sem_init(&bf->free_sem, (int)bf->num_buffers - 1) != 0)
+		goto fail;
+
+	bf->file = os_fopen(path, "wb");
+	if (!bf->file)
+		goto fail;
+
+	/* the write buffers are already large, there's no point in having
+	 * the C library copy them into its own buffer */
+	setvbuf(bf->file, NULL, _IONBF, 0);
+
+	if (info->direct) {
+		bf->direct = set_direct(bf->file, true);
+		if (!bf->direct)
+			blog(LOG_WARNING, "buffered_file: Direct writes are not "
+			                  "supported for '%s'", path);
+	}
+
+	bf->memory  = bmalloc(bf->buffer_size * bf->num_buffers +
+			DIRECT_ALIGNMENT);
+	bf->buffers = bzalloc(sizeof(struct write_buffer) * bf->num_buffers);
+
+	aligned = (uint8_t*)(((uintptr_t)bf->memory + DIRECT_ALIGNMENT - 1) &
+			~(uintptr_t)(DIRECT_ALIGNMENT - 1));
+	for (size_t i = 0; i < bf->num_buffers; i++)
+		bf->buffers[i].data = aligned + i * bf->buffer_size;
+
+	if (pthread_create(&bf->write_thread, NULL, write_thread, bf) != 0)
+		goto fail;
+
+	bf->thread_active = true;
+	return bf;
+
+fail:
+	buffered_file_free(bf);
+	return NULL;
+}
+
+bool buffered_file_write(struct buffered_file *bf, const void *data,
+		size_t size)
+{
+	const uint8_t *ptr = data;
+
+	if (!bf)
+		return false;
+
+	bf->total_size += (int64_t)size;
+
+	while (size) {
+		struct write_buffer *buf = bf->buffers + bf->fill_idx;
+		size_t              part = bf->buffer_size - buf->size;
+
+		if (part > size)
+			part = size;
+
+		memcpy(buf->data + buf->size, ptr, part);
+		buf->size += part;
+		ptr       += part;
+		size      -= part;
+
+		if (buf->size == bf->buffer_size)
+			queue_buffer(bf);
+	}
+
+	return !os_atomic_load_long(&bf->error);
+}
+
+void buffered_file_flush(struct buffered_file *bf)
+{
+	if (bf && bf->buffers[bf->fill_idx].size)
+		queue_buffer(bf);
+}
+
+int64_t buffered_file_size(struct buffered_file *bf)
+{
+	return bf ? bf->total_size : 0;
+}
+
+void buffered_file_get_stats(struct buffered_file *bf,
+		struct buffered_file_stats *stats)
+{
+	if (!bf) {
+		memset(stats, 0, sizeof(struct buffered_file_stats));
+		return;
+	}
+
+	pthread_mutex_lock(&bf->stats_mutex);
+	*stats = bf->stats;
+	pthread_mutex_unlock(&bf->stats_mutex);
+
+	stats->error = os_atomic_load_long(&bf->error) != 0;
+}
+
+FILE *buffered_file_detach(struct buffered_file *bf,
+		struct buffered_file_stats *stats)
+{
+	FILE *file;
+
+	if (stats)
+		memset(stats, 0, sizeof(struct buffered_file_stats));
+	if (!bf)
+		return NULL;
+
+	if (bf->thread_active) {
+		if (bf->buffers[bf->fill_idx].size)
+			queue_buffer(bf);
+
+		/* the buffer after the last one queued is empty, which tells
+		 * the writer thread to stop */
+		os_sem_post(bf->write_sem);
+		pthread_join(bf->write_thread, NULL);
+	}
+
+	/* the file may still be updated by the caller at unaligned offsets */
+	if (bf->direct)
+		set_direct(bf->file, false);
+
+	if (stats)
+		buffered_file_get_stats(bf, stats);
+
+	file     = bf->file;
+	bf->file = NULL;
+	buffered_file_free(bf);
+	return file;
+}
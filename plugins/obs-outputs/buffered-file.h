@@ -0,0 +1,85 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+#include <util/c99defs.h>
+
+/*
+ * Buffered file writer
+ *
+ *   Data written to the file is copied into a ring of large write buffers, and
+ * each buffer is written to disk by a separate thread once it's full, so a
+ * slow disk only stalls the caller once the whole ring is full.
+ */
+
+struct buffered_file;
+
+struct buffered_file_info {
+	size_t buffer_size;      /* size of each write buffer */
+	size_t num_buffers;      /* number of write buffers in the ring */
+	bool   direct;           /* bypass the system file cache if possible */
+	int    sync_interval_ms; /* how often to sync to disk, 0 to never */
+};
+
+struct buffered_file_stats {
+	size_t   queued_bytes;     /* data waiting to be written */
+	size_t   max_queued_bytes;
+	uint64_t written_bytes;
+	uint64_t writes;
+	uint64_t total_write_ns;
+	uint64_t max_write_ns;
+	uint64_t syncs;
+	uint64_t max_sync_ns;
+	uint64_t stalls;           /* times the caller waited for a buffer */
+	uint64_t stall_ns;
+	bool     error;
+};
+
+extern struct buffered_file *buffered_file_open(const char *path,
+		const struct buffered_file_info *info);
+
+/**
+ * Queues data to be written.  Only blocks if every write buffer is waiting
+ * to be written.  Returns false if writing to the file has failed.
+ */
+extern bool buffered_file_write(struct buffered_file *bf, const void *data,
+		size_t size);
+
+/**
+ * Queues whatever is in the current write buffer without waiting for it to
+ * fill up, so that everything written so far reaches the file.  Direct writes
+ * are disabled from then on, as the following writes are no longer aligned.
+ */
+extern void buffered_file_flush(struct buffered_file *bf);
+
+/** Returns the total amount of data queued to the file so far */
+extern int64_t buffered_file_size(struct buffered_file *bf);
+
+extern void buffered_file_get_stats(struct buffered_file *bf,
+		struct buffered_file_stats *stats);
+
+/**
+ * Waits for all queued data to be written, stops the writer thread and frees
+ * the buffers.  Returns the underlying file (positioned at its end) so that
+ * headers can be updated before closing it, or NULL if bf is NULL.
+ *
+ * @param  stats  Optional, receives the final statistics of the file
+ */
+extern FILE *buffered_file_detach(struct buffered_file *bf,
+		struct buffered_file_stats *stats);
@@ -16,6 +16,7 @@
 ******************************************************************************/
 
 #include <stdio.h>
+#include <string.h>
 #include <obs-module.h>
 #include <obs-avc.h>
 #include <util/platform.h>
@@ -23,13 +24,60 @@
 #include <util/threading.h>
 #include <inttypes.h>
 #include "flv-mux.h"
+#include "buffered-file.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[flv output: '%s'] " format, \
+			obs_output_getname(stream->output), ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
+
+#define OPT_BUFFER_SIZE       "buffer_size_mb"
+#define OPT_DIRECT_IO         "direct_io"
+#define OPT_SYNC_INTERVAL     "sync_interval_ms"
+#define OPT_SEGMENT_DURATION  "segment_duration_sec"
+#define OPT_SEGMENT_SIZE      "segment_size_mb"
+#define OPT_FRAGMENT_DURATION "fragment_duration_ms"
+
+/* the write buffer is split into buffers of this size, each of which is
+ * written to disk in one call */
+#define WRITE_BUFFER_SIZE (1024 * 1024)
 
 struct flv_output {
-	obs_output_t output;
-	struct dstr  path;
-	FILE         *file;
-	bool         active;
-	int64_t      last_packet_ts;
+	obs_output_t              output;
+	struct dstr               path;
+	struct dstr               file_path;
+	pthread_mutex_t           file_mutex;
+	struct buffered_file      *file;
+	struct buffered_file_info file_info;
+	bool                      active;
+	bool                      write_failed;
+	int64_t                   last_packet_ts;
+
+	/* write failures are found on the encoder thread, which can't stop the
+	 * output itself, so the output is stopped from this thread instead */
+	pthread_t                 stop_thread;
+	bool                      stopping;
+
+	/* segmented output: a new file is started at the first keyframe
+	 * after the segment duration or size is reached, and everything up
+	 * to each keyframe is flushed to disk once per fragment duration */
+	bool                      segmented;
+	int64_t                   segment_duration_usec;
+	int64_t                   segment_size;
+	int64_t                   fragment_duration_usec;
+	int                       segment_idx;
+	int64_t                   segment_start_usec;
+	int64_t                   fragment_start_usec;
+
+	/* the previous segment is finished on its own thread, so waiting for
+	 * the rest of its data to be written doesn't hold up the encoders */
+	pthread_t                 close_thread;
+	bool                      closing;
+	struct buffered_file      *closing_file;
+	struct dstr               closing_path;
+	int64_t                   closing_duration_ms;
 };
 
 static const char *flv_output_getname(void)
@@ -37,43 +85,232 @@ static const char *flv_output_getname(void)
 	return obs_module_text("FLVOutput");
 }
 
+static const char *flv_segment_output_getname(void)
+{
+	return obs_module_text("FLVSegmentOutput");
+}
+
 static void flv_output_stop(void *data);
 
+static void wait_for_close(struct flv_output *stream)
+{
+	if (stream->closing) {
+		pthread_join(stream->close_thread, NULL);
+		stream->closing = false;
+	}
+}
+
+static void wait_for_stop(struct flv_output *stream)
+{
+	if (stream->stopping &&
+	    !pthread_equal(pthread_self(), stream->stop_thread)) {
+		pthread_join(stream->stop_thread, NULL);
+		stream->stopping = false;
+	}
+}
+
 static void flv_output_destroy(void *data)
 {
 	struct flv_output *stream = data;
 
+	wait_for_stop(stream);
+
 	if (stream->active)
 		flv_output_stop(data);
 
+	wait_for_close(stream);
+	pthread_mutex_destroy(&stream->file_mutex);
 	dstr_free(&stream->path);
+	dstr_free(&stream->file_path);
+	dstr_free(&stream->closing_path);
 	bfree(stream);
 }
 
-static void *flv_output_create(obs_data_t settings, obs_output_t output)
+static inline float ns_to_ms(uint64_t ns)
+{
+	return (float)((double)ns / 1000000.0);
+}
+
+static void flv_output_get_write_stats(void *data, calldata_t params)
+{
+	struct flv_output          *stream = data;
+	struct buffered_file_stats stats;
+
+	pthread_mutex_lock(&stream->file_mutex);
+	buffered_file_get_stats(stream->file, &stats);
+	pthread_mutex_unlock(&stream->file_mutex);
+
+	calldata_setint  (params, "queued_bytes", (long long)stats.queued_bytes);
+	calldata_setint  (params, "max_queued_bytes",
+			(long long)stats.max_queued_bytes);
+	calldata_setfloat(params, "avg_write_ms", stats.writes ?
+			ns_to_ms(stats.total_write_ns / stats.writes) : 0.0f);
+	calldata_setfloat(params, "max_write_ms",
+			ns_to_ms(stats.max_write_ns));
+	calldata_setfloat(params, "max_sync_ms", ns_to_ms(stats.max_sync_ns));
+	calldata_setint  (params, "stalls", (long long)stats.stalls);
+}
+
+static void *create_output(obs_output_t output, bool segmented)
 {
 	struct flv_output *stream = bzalloc(sizeof(struct flv_output));
-	stream->output = output;
+	stream->output    = output;
+	stream->segmented = segmented;
+	pthread_mutex_init_value(&stream->file_mutex);
+
+	if (pthread_mutex_init(&stream->file_mutex, NULL) != 0) {
+		bfree(stream);
+		return NULL;
+	}
+
+	proc_handler_add(obs_output_prochandler(output),
+			"void get_write_stats(out int queued_bytes, "
+			"out int max_queued_bytes, out float avg_write_ms, "
+			"out float max_write_ms, out float max_sync_ms, "
+			"out int stalls)",
+			flv_output_get_write_stats, stream);
+
+	if (segmented)
+		signal_handler_add(obs_output_signalhandler(output),
+				"void segment_finished(ptr output, "
+				"string path)");
 
-	UNUSED_PARAMETER(settings);
 	return stream;
 }
 
+static void *flv_output_create(obs_data_t settings, obs_output_t output)
+{
+	UNUSED_PARAMETER(settings);
+	return create_output(output, false);
+}
+
+static void *flv_segment_output_create(obs_data_t settings,
+		obs_output_t output)
+{
+	UNUSED_PARAMETER(settings);
+	return create_output(output, true);
+}
+
+static void log_write_stats(struct flv_output *stream, const char *path,
+		struct buffered_file_stats *stats)
+{
+	info("Wrote %"PRIu64" bytes to '%s' in %"PRIu64" writes (avg %.1fms, "
+	     "max %.1fms), max queued: %"PRIu64" bytes, max sync: %.1fms, "
+	     "stalls: %"PRIu64" (%.1fms)",
+	     stats->written_bytes, path, stats->writes,
+	     stats->writes ?
+		ns_to_ms(stats->total_write_ns / stats->writes) : 0.0f,
+	     ns_to_ms(stats->max_write_ns),
+	     (uint64_t)stats->max_queued_bytes,
+	     ns_to_ms(stats->max_sync_ns),
+	     stats->stalls, ns_to_ms(stats->stall_ns));
+}
+
+/* waits for the rest of the file to be written, then fills in the duration
+ * and size in its header */
+static void finish_file(struct flv_output *stream, struct buffered_file *bf,
+		const char *path, int64_t duration_ms)
+{
+	struct buffered_file_stats stats;
+	FILE                       *file;
+
+	file = buffered_file_detach(bf, &stats);
+	if (!file)
+		return;
+
+	log_write_stats(stream, path, &stats);
+
+	write_file_info(file, duration_ms, os_ftelli64(file));
+	fclose(file);
+
+	if (stream->segmented) {
+		struct calldata params = {0};
+
+		calldata_setptr   (&params, "output", stream->output);
+		calldata_setstring(&params, "path",   path);
+		signal_handler_signal(obs_output_signalhandler(stream->output),
+				"segment_finished", &params);
+		calldata_free(&params);
+	}
+}
+
+static void *close_thread(void *data)
+{
+	struct flv_output *stream = data;
+
+	finish_file(stream, stream->closing_file, stream->closing_path.array,
+			stream->closing_duration_ms);
+	stream->closing_file = NULL;
+	return NULL;
+}
+
 static void flv_output_stop(void *data)
 {
 	struct flv_output *stream = data;
 
+	/* a write failure may already be stopping the output */
+	wait_for_stop(stream);
+
 	if (stream->active) {
-		if (stream->file)
-			write_file_info(stream->file, stream->last_packet_ts,
-					os_ftelli64(stream->file));
+		struct buffered_file *file;
 
-		fclose(stream->file);
 		obs_output_end_data_capture(stream->output);
 		stream->active = false;
+
+		wait_for_close(stream);
+
+		pthread_mutex_lock(&stream->file_mutex);
+		file = stream->file;
+		stream->file = NULL;
+		pthread_mutex_unlock(&stream->file_mutex);
+
+		finish_file(stream, file, stream->file_path.array,
+				stream->last_packet_ts);
 	}
 }
 
+/* segments start their timestamps from zero, so each file plays on its own
+ * like any other recording */
+static inline void rebase_packet(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	int64_t offset = stream->segment_start_usec * packet->timebase_den /
+		(1000000LL * packet->timebase_num);
+
+	packet->dts -= offset;
+	packet->pts -= offset;
+
+	if (packet->dts < 0)
+		packet->dts = 0;
+	if (packet->pts < packet->dts)
+		packet->pts = packet->dts;
+}
+
+static void *stop_thread(void *data)
+{
+	struct flv_output *stream = data;
+
+	flv_output_stop(stream);
+	obs_output_signal_stop(stream->output, OBS_OUTPUT_ERROR);
+	return NULL;
+}
+
+/* stops the recording (once) so the frontend knows it has ended, rather
+ * than carrying on without writing anything */
+static void stop_on_write_failure(struct flv_output *stream)
+{
+	if (stream->write_failed)
+		return;
+
+	stream->write_failed = true;
+
+	if (pthread_create(&stream->stop_thread, NULL, stop_thread,
+				stream) == 0)
+		stream->stopping = true;
+	else
+		warn("Failed to create the thread to stop the output");
+}
+
 static int write_packet(struct flv_output *stream,
 		struct encoder_packet *packet, bool is_header)
 {
@@ -81,10 +318,17 @@ static int write_packet(struct flv_output *stream,
 	size_t  size;
 	int     ret = 0;
 
+	if (stream->segmented && !is_header)
+		rebase_packet(stream, packet);
+
 	stream->last_packet_ts = get_ms_time(packet, packet->dts);
 
 	flv_packet_mux(packet, &data, &size, is_header);
-	fwrite(data, 1, size, stream->file);
+	if (!buffered_file_write(stream->file, data, size) &&
+	    !stream->write_failed) {
+		warn("Failed to write to '%s'", stream->file_path.array);
+		stop_on_write_failure(stream);
+	}
 	bfree(data);
 	obs_free_encoder_packet(packet);
 
@@ -97,7 +341,7 @@ static void write_meta_data(struct flv_output *stream)
 	size_t  meta_data_size;
 
 	flv_meta_data(stream->output, &meta_data, &meta_data_size, true);
-	fwrite(meta_data, 1, meta_data_size, stream->file);
+	buffered_file_write(stream->file, meta_data, meta_data_size);
 	bfree(meta_data);
 }
 
@@ -142,12 +386,108 @@ static void write_headers(struct flv_output *stream)
 	write_video_header(stream);
 }
 
+/* inserts the segment number before the extension, for example
+ * "recording.flv" becomes "recording-0001.flv" */
+static void get_segment_path(struct flv_output *stream, struct dstr *dst)
+{
+	const char *path  = stream->path.array;
+	const char *ext   = strrchr(path, '.');
+	const char *slash = strrchr(path, '/');
+	const char *bslash = strrchr(path, '\\');
+
+	if (bslash > slash)
+		slash = bslash;
+	if (!ext || ext < slash)
+		ext = path + stream->path.len;
+
+	dstr_ncopy(dst, path, ext - path);
+	dstr_catf(dst, "-%04d%s", stream->segment_idx, ext);
+}
+
+/* opens the next file and writes its headers, so every file (and every
+ * segment) can be played back on its own */
+static bool open_file(struct flv_output *stream)
+{
+	struct buffered_file *file;
+
+	if (stream->segmented)
+		get_segment_path(stream, &stream->file_path);
+	else
+		dstr_copy_dstr(&stream->file_path, &stream->path);
+
+	file = buffered_file_open(stream->file_path.array, &stream->file_info);
+	if (!file) {
+		warn("Unable to open FLV file '%s'", stream->file_path.array);
+		return false;
+	}
+
+	pthread_mutex_lock(&stream->file_mutex);
+	stream->file = file;
+	pthread_mutex_unlock(&stream->file_mutex);
+
+	write_headers(stream);
+	return true;
+}
+
+static void start_new_segment(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	struct buffered_file *file;
+
+	wait_for_close(stream);
+
+	pthread_mutex_lock(&stream->file_mutex);
+	file = stream->file;
+	stream->file = NULL;
+	pthread_mutex_unlock(&stream->file_mutex);
+
+	stream->closing_file        = file;
+	stream->closing_duration_ms = stream->last_packet_ts;
+	dstr_copy_dstr(&stream->closing_path, &stream->file_path);
+
+	if (pthread_create(&stream->close_thread, NULL, close_thread,
+				stream) == 0)
+		stream->closing = true;
+	else
+		close_thread(stream);
+
+	stream->segment_idx++;
+	stream->segment_start_usec  = packet->dts_usec;
+	stream->fragment_start_usec = packet->dts_usec;
+
+	/* open_file has already logged the failure */
+	if (!open_file(stream))
+		stop_on_write_failure(stream);
+}
+
+/* called with each video keyframe, before it's written */
+static void check_segment(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	int64_t segment_usec  = packet->dts_usec - stream->segment_start_usec;
+	int64_t fragment_usec = packet->dts_usec - stream->fragment_start_usec;
+
+	if ((stream->segment_duration_usec &&
+	     segment_usec >= stream->segment_duration_usec) ||
+	    (stream->segment_size &&
+	     buffered_file_size(stream->file) >= stream->segment_size)) {
+		start_new_segment(stream, packet);
+
+	} else if (stream->fragment_duration_usec &&
+	           fragment_usec >= stream->fragment_duration_usec) {
+		buffered_file_flush(stream->file);
+		stream->fragment_start_usec = packet->dts_usec;
+	}
+}
+
 static bool flv_output_start(void *data)
 {
 	struct flv_output *stream = data;
 	obs_data_t settings;
 	const char *path;
 
+	wait_for_stop(stream);
+
 	if (!obs_output_can_begin_data_capture(stream->output, 0))
 		return false;
 	if (!obs_output_initialize_encoders(stream->output, 0))
@@ -157,18 +497,40 @@ static bool flv_output_start(void *data)
 	settings = obs_output_get_settings(stream->output);
 	path = obs_data_getstring(settings, "path");
 	dstr_copy(&stream->path, path);
+
+	stream->file_info.buffer_size      = WRITE_BUFFER_SIZE;
+	stream->file_info.num_buffers      =
+		(size_t)obs_data_getint(settings, OPT_BUFFER_SIZE);
+	stream->file_info.sync_interval_ms =
+		(int)obs_data_getint(settings, OPT_SYNC_INTERVAL);
+
+	/* fragments are flushed as partial buffers, which can't be written
+	 * directly */
+	stream->file_info.direct = !stream->segmented &&
+		obs_data_getbool(settings, OPT_DIRECT_IO);
+
+	if (stream->segmented) {
+		stream->segment_duration_usec = 1000000LL *
+			obs_data_getint(settings, OPT_SEGMENT_DURATION);
+		stream->segment_size = 1024LL * 1024LL *
+			obs_data_getint(settings, OPT_SEGMENT_SIZE);
+		stream->fragment_duration_usec = 1000LL *
+			obs_data_getint(settings, OPT_FRAGMENT_DURATION);
+	}
+
 	obs_data_release(settings);
 
-	stream->file = os_fopen(stream->path.array, "wb");
-	if (!stream->file) {
-		blog(LOG_WARNING, "Unable to open FLV file '%s'",
-				stream->path.array);
+	stream->segment_idx         = 1;
+	stream->segment_start_usec  = 0;
+	stream->fragment_start_usec = 0;
+	stream->write_failed        = false;
+	stream->last_packet_ts      = 0;
+
+	if (!open_file(stream))
 		return false;
-	}
 
-	/* write headers and start capture */
+	/* start capture */
 	stream->active = true;
-	write_headers(stream);
 	obs_output_begin_data_capture(stream->output, 0);
 
 	return true;
@@ -181,6 +543,10 @@ static void flv_output_data(void *data, struct encoder_packet *packet)
 
 	if (packet->type == OBS_ENCODER_VIDEO) {
 		obs_parse_avc_packet(&parsed_packet, packet);
+
+		if (stream->segmented && parsed_packet.keyframe)
+			check_segment(stream, &parsed_packet);
+
 		write_packet(stream, &parsed_packet, false);
 		obs_free_encoder_packet(&parsed_packet);
 	} else {
@@ -188,6 +554,21 @@ static void flv_output_data(void *data, struct encoder_packet *packet)
 	}
 }
 
+static void flv_output_defaults(obs_data_t defaults)
+{
+	obs_data_set_default_int(defaults, OPT_BUFFER_SIZE, 16);
+	obs_data_set_default_bool(defaults, OPT_DIRECT_IO, false);
+	obs_data_set_default_int(defaults, OPT_SYNC_INTERVAL, 0);
+}
+
+static void flv_segment_output_defaults(obs_data_t defaults)
+{
+	flv_output_defaults(defaults);
+	obs_data_set_default_int(defaults, OPT_SEGMENT_DURATION, 300);
+	obs_data_set_default_int(defaults, OPT_SEGMENT_SIZE, 0);
+	obs_data_set_default_int(defaults, OPT_FRAGMENT_DURATION, 2000);
+}
+
 static obs_properties_t flv_output_properties(void)
 {
 	obs_properties_t props = obs_properties_create();
@@ -195,6 +576,39 @@ static obs_properties_t flv_output_properties(void)
 	obs_properties_add_text(props, "path",
 			obs_module_text("FLVOutput.FilePath"),
 			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, OPT_BUFFER_SIZE,
+			obs_module_text("FLVOutput.BufferSize"),
+			2, 1024, 1);
+	obs_properties_add_bool(props, OPT_DIRECT_IO,
+			obs_module_text("FLVOutput.DirectIO"));
+	obs_properties_add_int(props, OPT_SYNC_INTERVAL,
+			obs_module_text("FLVOutput.SyncInterval"),
+			0, 60000, 100);
+	return props;
+}
+
+static obs_properties_t flv_segment_output_properties(void)
+{
+	obs_properties_t props = obs_properties_create();
+
+	obs_properties_add_text(props, "path",
+			obs_module_text("FLVOutput.FilePath"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, OPT_SEGMENT_DURATION,
+			obs_module_text("FLVOutput.SegmentDuration"),
+			0, 86400, 1);
+	obs_properties_add_int(props, OPT_SEGMENT_SIZE,
+			obs_module_text("FLVOutput.SegmentSize"),
+			0, 1024 * 1024, 1);
+	obs_properties_add_int(props, OPT_FRAGMENT_DURATION,
+			obs_module_text("FLVOutput.FragmentDuration"),
+			0, 60000, 100);
+	obs_properties_add_int(props, OPT_BUFFER_SIZE,
+			obs_module_text("FLVOutput.BufferSize"),
+			2, 1024, 1);
+	obs_properties_add_int(props, OPT_SYNC_INTERVAL,
+			obs_module_text("FLVOutput.SyncInterval"),
+			0, 60000, 100);
 	return props;
 }
 
@@ -207,5 +621,19 @@ struct obs_output_info flv_output_info = {
 	.start          = flv_output_start,
 	.stop           = flv_output_stop,
 	.encoded_packet = flv_output_data,
+	.defaults       = flv_output_defaults,
 	.properties     = flv_output_properties
 };
+
+struct obs_output_info flv_segment_output_info = {
+	.id             = "flv_segment_output",
+	.flags          = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
+	.getname        = flv_segment_output_getname,
+	.create         = flv_segment_output_create,
+	.destroy        = flv_output_destroy,
+	.start          = flv_output_start,
+	.stop           = flv_output_stop,
+	.encoded_packet = flv_output_data,
+	.defaults       = flv_segment_output_defaults,
+	.properties     = flv_segment_output_properties
+};
@@ -0,0 +1,223 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <obs.h>
+#include <obs-avc.h>
+#include "frame-drops.h"
+
+static inline bool should_drop_packet(struct encoder_packet *packet,
+		enum drop_stage stage)
+{
+	if (packet->type != OBS_ENCODER_VIDEO)
+		return false;
+
+	switch (stage) {
+	case DROP_STAGE_NONE:
+		return false;
+	case DROP_STAGE_DISPOSABLE:
+		return packet->priority == OBS_NAL_PRIORITY_DISPOSABLE;
+	case DROP_STAGE_NON_KEYFRAMES:
+		return !packet->keyframe;
+	case DROP_STAGE_ALL:
+		break;
+	}
+
+	return true;
+}
+
+static int drop_frames(struct frame_drops *drops, struct circlebuf *packets,
+		enum drop_stage stage)
+{
+	struct circlebuf new_buf            = {0};
+	int              drop_priority      = 0;
+	int64_t          last_drop_dts_usec = 0;
+	int              num_frames_dropped = 0;
+
+	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
+
+	while (packets->size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(packets, &packet, sizeof(packet));
+
+		last_drop_dts_usec = packet.dts_usec;
+
+		if (!should_drop_packet(&packet, stage)) {
+			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
+
+		} else {
+			if (drop_priority < packet.drop_priority)
+				drop_priority = packet.drop_priority;
+
+			num_frames_dropped++;
+			obs_free_encoder_packet(&packet);
+		}
+	}
+
+	circlebuf_free(packets);
+	*packets                 = new_buf;
+	drops->min_drop_dts_usec = last_drop_dts_usec;
+
+	if (drops->min_priority < drop_priority)
+		drops->min_priority = drop_priority;
+
+	drops->dropped_frames += num_frames_dropped;
+	return num_frames_dropped;
+}
+
+/* moves the packets of 'from' to the end of 'to', dropping the video frames
+ * if 'drop' is set, and returns the number of frames dropped */
+static int move_packets(struct circlebuf *to, struct circlebuf *from,
+		bool drop)
+{
+	int num_frames_dropped = 0;
+
+	while (from->size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(from, &packet, sizeof(packet));
+
+		if (drop && packet.type == OBS_ENCODER_VIDEO) {
+			num_frames_dropped++;
+			obs_free_encoder_packet(&packet);
+		} else {
+			circlebuf_push_back(to, &packet, sizeof(packet));
+		}
+	}
+
+	return num_frames_dropped;
+}
+
+/* drops the buffered video frames that come before a buffered keyframe.
+ * those are the end of a GOP, so nothing after them depends on them and
+ * there's no need to wait for another keyframe afterwards */
+static int drop_gop_tails(struct frame_drops *drops, struct circlebuf *packets)
+{
+	struct circlebuf new_buf            = {0};
+	struct circlebuf tail               = {0};
+	int64_t          last_drop_dts_usec = 0;
+	int              num_frames_dropped = 0;
+
+	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
+
+	while (packets->size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(packets, &packet, sizeof(packet));
+
+		if (packet.type == OBS_ENCODER_VIDEO && packet.keyframe) {
+			num_frames_dropped += move_packets(&new_buf, &tail,
+					true);
+			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
+			last_drop_dts_usec = packet.dts_usec;
+		} else {
+			circlebuf_push_back(&tail, &packet, sizeof(packet));
+		}
+	}
+
+	move_packets(&new_buf, &tail, false);
+	circlebuf_free(&tail);
+
+	circlebuf_free(packets);
+	*packets = new_buf;
+
+	if (num_frames_dropped) {
+		drops->min_drop_dts_usec = last_drop_dts_usec;
+		drops->dropped_frames   += num_frames_dropped;
+	}
+
+	return num_frames_dropped;
+}
+
+static inline void set_drop_stage(struct frame_drops *drops,
+		enum drop_stage stage)
+{
+	if (drops->stage != stage) {
+		drops->stage         = stage;
+		drops->stage_changed = true;
+	}
+}
+
+static int drop_stage_frames(struct frame_drops *drops,
+		struct circlebuf *packets, enum drop_stage stage)
+{
+	/* frames from the middle of a GOP are only dropped (followed by
+	 * waiting for the next keyframe) if no GOP ends in the buffer */
+	if (stage == DROP_STAGE_NON_KEYFRAMES) {
+		int dropped = drop_gop_tails(drops, packets);
+		if (dropped)
+			return dropped;
+	}
+
+	return drop_frames(drops, packets, stage);
+}
+
+static void check_to_drop_frames(struct frame_drops *drops,
+		struct circlebuf *packets, int64_t last_dts_usec)
+{
+	struct encoder_packet first;
+	int64_t buffer_duration_usec;
+	enum drop_stage stage;
+
+	if (packets->size < 5 * sizeof(struct encoder_packet)) {
+		set_drop_stage(drops, DROP_STAGE_NONE);
+		return;
+	}
+
+	circlebuf_peek_front(packets, &first, sizeof(first));
+
+	/* do not drop frames if frames were just dropped within this time */
+	if (first.dts_usec < drops->min_drop_dts_usec)
+		return;
+
+	buffer_duration_usec = last_dts_usec - first.dts_usec;
+
+	/* only consider the congestion over once most of the buffer has been
+	 * sent, otherwise it would just alternate between stages */
+	if (buffer_duration_usec <= drops->threshold_usec) {
+		if (buffer_duration_usec < drops->threshold_usec / 4)
+			set_drop_stage(drops, DROP_STAGE_NONE);
+		return;
+	}
+
+	/* if the amount of time stored in the buffered packets waiting to be
+	 * sent is higher than threshold, drop frames, starting with the least
+	 * important ones.  if the previous stage wasn't enough to get under
+	 * the threshold (or had nothing to drop), move on to the next one. */
+	stage = drops->stage;
+
+	do {
+		if (stage < DROP_STAGE_ALL)
+			stage++;
+	} while (!drop_stage_frames(drops, packets, stage) &&
+	         stage < DROP_STAGE_ALL);
+
+	set_drop_stage(drops, stage);
+}
+
+bool frame_drops_check(struct frame_drops *drops, struct circlebuf *packets,
+		int64_t last_dts_usec, const struct encoder_packet *packet)
+{
+	check_to_drop_frames(drops, packets, last_dts_usec);
+
+	/* if currently dropping frames, drop packets until it reaches the
+	 * desired priority */
+	if (packet->priority < drops->min_priority) {
+		drops->dropped_frames++;
+		return false;
+	}
+
+	drops->min_priority = 0;
+	return true;
+}
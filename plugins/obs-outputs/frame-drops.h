@@ -0,0 +1,63 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/circlebuf.h>
+#include <string.h>
+
+struct encoder_packet;
+
+/* frames are dropped in stages when the output can't keep up, each stage
+ * only being used if the previous one didn't get the buffer back under the
+ * drop threshold */
+enum drop_stage {
+	DROP_STAGE_NONE,
+	DROP_STAGE_DISPOSABLE,    /* non-reference frames only */
+	DROP_STAGE_NON_KEYFRAMES, /* ends of buffered GOPs, otherwise
+	                           * everything but keyframes */
+	DROP_STAGE_ALL            /* all buffered video */
+};
+
+/* frame drop state of a network output's send buffer */
+struct frame_drops {
+	int64_t          threshold_usec;
+	int64_t          min_drop_dts_usec;
+	int              min_priority;
+	enum drop_stage  stage;
+	bool             stage_changed;
+	int              dropped_frames;
+};
+
+static inline void frame_drops_init(struct frame_drops *drops,
+		int64_t threshold_usec)
+{
+	memset(drops, 0, sizeof(struct frame_drops));
+	drops->threshold_usec = threshold_usec;
+}
+
+/**
+ * Called before a new video packet is added to the send buffer.  'packets'
+ * is the buffer of struct encoder_packet waiting to be sent, the last of
+ * which has a DTS of last_dts_usec.  Drops buffered frames if the buffer has
+ * grown past the threshold, and returns false if the new packet has to be
+ * dropped as well (for example, until the next keyframe).
+ */
+extern bool frame_drops_check(struct frame_drops *drops,
+		struct circlebuf *packets, int64_t last_dts_usec,
+		const struct encoder_packet *packet);
@@ -1146,10 +1146,45 @@ finish:
 #define E_ACCES        EACCES
 #endif
 
+static void
+SetSocketOptions(RTMP *r)
+{
+    int on = 1;
+
+    /* set timeout */
+    {
+        SET_RCVTIMEO(tv, r->Link.timeout);
+        if (setsockopt
+                (r->m_sb.sb_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv)))
+        {
+            RTMP_Log(RTMP_LOGERROR, "%s, Setting socket timeout to %ds failed!",
+                     __FUNCTION__, r->Link.timeout);
+        }
+    }
+
+    if(!r->m_bUseNagle)
+        setsockopt(r->m_sb.sb_socket, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
+}
+
+/* uses a socket that has already been connected to the server by the
+ * caller, in place of RTMP_Connect0.  follow with RTMP_Connect1. */
+int
+RTMP_AttachSocket(RTMP *r, SOCKET sock)
+{
+    r->m_sb.sb_timedout = FALSE;
+    r->m_pausing = 0;
+    r->m_fDuration = 0.0;
+    r->m_sb.sb_socket = sock;
+
+    SetSocketOptions(r);
+
+    r->m_bSendCounter = TRUE;
+    return TRUE;
+}
+
 int
 RTMP_Connect0(RTMP *r, struct sockaddr * service)
 {
-    int on = 1;
     r->m_sb.sb_timedout = FALSE;
     r->m_pausing = 0;
     r->m_fDuration = 0.0;
@@ -1209,20 +1244,7 @@ RTMP_Connect0(RTMP *r, struct sockaddr * service)
         return FALSE;
     }
 
-    /* set timeout */
-    {
-        SET_RCVTIMEO(tv, r->Link.timeout);
-        if (setsockopt
-                (r->m_sb.sb_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv)))
-        {
-            RTMP_Log(RTMP_LOGERROR, "%s, Setting socket timeout to %ds failed!",
-                     __FUNCTION__, r->Link.timeout);
-        }
-    }
-
-    if(!r->m_bUseNagle)
-        setsockopt(r->m_sb.sb_socket, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
-
+    SetSocketOptions(r);
     return TRUE;
 }
 
@@ -0,0 +1,497 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <util/bmem.h>
+#include <util/base.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include "net-connect.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#define close_socket      closesocket
+#define socket_error()    WSAGetLastError()
+#define in_progress(err)  ((err) == WSAEWOULDBLOCK)
+#define socklen_t         int
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#define close_socket      close
+#define socket_error()    errno
+#define in_progress(err)  ((err) == EINPROGRESS)
+#endif
+
+/* getaddrinfo doesn't give us the record's TTL, so just keep results for a
+ * fixed amount of time.  entries are also removed when none of the cached
+ * addresses can be reached. */
+#define DNS_CACHE_TTL_NS  (300ULL * 1000000000ULL)
+
+/* delay before trying the next address while the previous attempt is still
+ * pending (RFC 6555 / 8305 recommend 150-250ms) */
+#define ATTEMPT_DELAY_NS  (250ULL * 1000000ULL)
+
+/* maximum time to wait in select, so the stop event is still checked */
+#define WAIT_SLICE_NS     (50ULL * 1000000ULL)
+
+struct net_address {
+	struct sockaddr_storage addr;
+	socklen_t               len;
+};
+
+struct dns_cache_entry {
+	char                       *host;
+	int                        port;
+	uint64_t                   expire_ts;
+	DARRAY(struct net_address) addresses;
+};
+
+struct connect_attempt {
+	net_socket_t               socket;
+	size_t                     idx;
+};
+
+static pthread_mutex_t dns_cache_mutex;
+static DARRAY(struct dns_cache_entry) dns_cache;
+
+void net_dns_cache_init(void)
+{
+	pthread_mutex_init(&dns_cache_mutex, NULL);
+	da_init(dns_cache);
+}
+
+static inline void free_cache_entry(struct dns_cache_entry *entry)
+{
+	bfree(entry->host);
+	da_free(entry->addresses);
+}
+
+void net_dns_cache_free(void)
+{
+	for (size_t i = 0; i < dns_cache.num; i++)
+		free_cache_entry(dns_cache.array + i);
+	da_free(dns_cache);
+
+	pthread_mutex_destroy(&dns_cache_mutex);
+}
+
+/* call with dns_cache_mutex held */
+static size_t find_cache_entry(const char *host, int port)
+{
+	for (size_t i = 0; i < dns_cache.num; i++) {
+		struct dns_cache_entry *entry = dns_cache.array + i;
+
+		if (entry->port == port && strcmp(entry->host, host) == 0)
+			return i;
+	}
+
+	return DARRAY_INVALID;
+}
+
+void net_dns_cache_remove(const char *host, int port)
+{
+	size_t idx;
+
+	pthread_mutex_lock(&dns_cache_mutex);
+
+	idx = find_cache_entry(host, port);
+	if (idx != DARRAY_INVALID) {
+		free_cache_entry(dns_cache.array + idx);
+		da_erase(dns_cache, idx);
+	}
+
+	pthread_mutex_unlock(&dns_cache_mutex);
+}
+
+static bool get_cached_addresses(const char *host, int port,
+		struct darray *addresses)
+{
+	bool   found = false;
+	size_t idx;
+
+	pthread_mutex_lock(&dns_cache_mutex);
+
+	idx = find_cache_entry(host, port);
+	if (idx != DARRAY_INVALID) {
+		struct dns_cache_entry *entry = dns_cache.array + idx;
+
+		if (entry->expire_ts > os_gettime_ns()) {
+			darray_copy(sizeof(struct net_address), addresses,
+					&entry->addresses.da);
+			found = true;
+		} else {
+			free_cache_entry(entry);
+			da_erase(dns_cache, idx);
+		}
+	}
+
+	pthread_mutex_unlock(&dns_cache_mutex);
+	return found;
+}
+
+static void cache_addresses(const char *host, int port,
+		const struct darray *addresses)
+{
+	struct dns_cache_entry *entry;
+	size_t idx;
+
+	pthread_mutex_lock(&dns_cache_mutex);
+
+	idx = find_cache_entry(host, port);
+	if (idx == DARRAY_INVALID) {
+		entry       = da_push_back_new(dns_cache);
+		entry->host = bstrdup(host);
+		entry->port = port;
+	} else {
+		entry = dns_cache.array + idx;
+	}
+
+	entry->expire_ts = os_gettime_ns() + DNS_CACHE_TTL_NS;
+	darray_copy(sizeof(struct net_address), &entry->addresses.da,
+			addresses);
+
+	pthread_mutex_unlock(&dns_cache_mutex);
+}
+
+static inline void add_address(struct darray *addresses,
+		const struct addrinfo *ai)
+{
+	struct net_address *address;
+
+	if (ai->ai_addrlen > sizeof(address->addr))
+		return;
+
+	address = darray_push_back_new(sizeof(struct net_address), addresses);
+	memcpy(&address->addr, ai->ai_addr, ai->ai_addrlen);
+	address->len = (socklen_t)ai->ai_addrlen;
+}
+
+/* orders the addresses so that the address families alternate, starting
+ * with the family of the first address returned by the resolver */
+static void add_interleaved(struct darray *addresses,
+		const struct addrinfo *results)
+{
+	const struct addrinfo *first  = results;
+	const struct addrinfo *second = results;
+	int first_family = results->ai_family;
+
+	while (first || second) {
+		while (first && first->ai_family != first_family)
+			first = first->ai_next;
+		while (second && second->ai_family == first_family)
+			second = second->ai_next;
+
+		if (first) {
+			add_address(addresses, first);
+			first = first->ai_next;
+		}
+		if (second) {
+			add_address(addresses, second);
+			second = second->ai_next;
+		}
+	}
+}
+
+static bool resolve(const char *host, int port, struct darray *addresses,
+		struct net_connect_info *info)
+{
+	struct addrinfo hints = {0};
+	struct addrinfo *results = NULL;
+	char port_str[16];
+	uint64_t start_ts = os_gettime_ns();
+	int ret;
+
+	if (get_cached_addresses(host, port, addresses)) {
+		info->dns_cached = true;
+		info->dns_ns     = os_gettime_ns() - start_ts;
+		return true;
+	}
+
+	snprintf(port_str, sizeof(port_str), "%d", port);
+
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags    = AI_ADDRCONFIG;
+
+	ret = getaddrinfo(host, port_str, &hints, &results);
+	info->dns_ns = os_gettime_ns() - start_ts;
+
+	if (ret != 0 || !results) {
+		blog(LOG_WARNING, "net_connect: Could not resolve '%s': %s",
+				host, gai_strerror(ret));
+		return false;
+	}
+
+	add_interleaved(addresses, results);
+	freeaddrinfo(results);
+
+	if (!addresses->num)
+		return false;
+
+	cache_addresses(host, port, addresses);
+	return true;
+}
+
+static inline bool set_blocking(net_socket_t socket, bool blocking)
+{
+#ifdef _WIN32
+	u_long nonblocking = blocking ? 0 : 1;
+	return ioctlsocket(socket, FIONBIO, &nonblocking) == 0;
+#else
+	int flags = fcntl(socket, F_GETFL, 0);
+	if (flags == -1)
+		return false;
+
+	flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+	return fcntl(socket, F_SETFL, flags) == 0;
+#endif
+}
+
+/* returns a socket that's either connecting or connected, *connected being
+ * set if it connected immediately */
+static net_socket_t start_attempt(const struct net_address *address,
+		bool *connected, int *error)
+{
+	const struct sockaddr *addr = (const struct sockaddr*)&address->addr;
+	net_socket_t socket_fd;
+
+	socket_fd = socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if (socket_fd == NET_INVALID_SOCKET) {
+		*error = socket_error();
+		return NET_INVALID_SOCKET;
+	}
+
+	if (!set_blocking(socket_fd, false)) {
+		*error = socket_error();
+		close_socket(socket_fd);
+		return NET_INVALID_SOCKET;
+	}
+
+	*connected = connect(socket_fd, addr, address->len) == 0;
+	if (!*connected) {
+		int err = socket_error();
+
+		if (!in_progress(err)) {
+			*error = err;
+			close_socket(socket_fd);
+			return NET_INVALID_SOCKET;
+		}
+	}
+
+	return socket_fd;
+}
+
+static inline int get_connect_error(net_socket_t socket_fd)
+{
+	int       err  = 0;
+	socklen_t size = sizeof(err);
+
+	if (getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, (char*)&err,
+				&size) != 0)
+		return socket_error();
+
+	return err;
+}
+
+/* waits until one of the pending attempts finishes or the wait time runs
+ * out.  returns the index of the attempt that connected, if any, and
+ * removes any attempts that failed. */
+static size_t wait_for_attempts(struct darray *attempts_da,
+		uint64_t wait_ns, int *error)
+{
+	DARRAY(struct connect_attempt) attempts;
+	struct timeval timeout;
+	fd_set write_set, except_set;
+	net_socket_t max_fd = 0;
+	int ret;
+
+	attempts.da = *attempts_da;
+
+	FD_ZERO(&write_set);
+	FD_ZERO(&except_set);
+
+	for (size_t i = 0; i < attempts.num; i++) {
+		net_socket_t socket_fd = attempts.array[i].socket;
+		FD_SET(socket_fd, &write_set);
+		FD_SET(socket_fd, &except_set);
+		if (socket_fd > max_fd)
+			max_fd = socket_fd;
+	}
+
+	timeout.tv_sec  = (long)(wait_ns / 1000000000ULL);
+	timeout.tv_usec = (long)(wait_ns % 1000000000ULL / 1000);
+
+	ret = select((int)max_fd + 1, NULL, &write_set, &except_set, &timeout);
+	if (ret <= 0)
+		return DARRAY_INVALID;
+
+	for (size_t i = attempts.num; i > 0; i--) {
+		struct connect_attempt *attempt = attempts.array + (i - 1);
+		bool writable = FD_ISSET(attempt->socket, &write_set) != 0;
+		bool except   = FD_ISSET(attempt->socket, &except_set) != 0;
+		int  err;
+
+		if (!writable && !except)
+			continue;
+
+		err = get_connect_error(attempt->socket);
+		if (err == 0 && writable) {
+			*attempts_da = attempts.da;
+			return i - 1;
+		}
+
+		*error = err;
+		close_socket(attempt->socket);
+		da_erase(attempts, i - 1);
+	}
+
+	*attempts_da = attempts.da;
+	return DARRAY_INVALID;
+}
+
+static void get_address_str(const struct net_address *address, char *str,
+		size_t size)
+{
+	if (getnameinfo((const struct sockaddr*)&address->addr, address->len,
+				str, (socklen_t)size, NULL, 0,
+				NI_NUMERICHOST) != 0)
+		strncpy(str, "unknown", size);
+
+	str[size - 1] = 0;
+}
+
+static inline bool stop_requested(os_event_t stop_event)
+{
+	return stop_event && os_event_try(stop_event) != EAGAIN;
+}
+
+net_socket_t net_connect(const char *host, int port, int timeout_sec,
+		os_event_t stop_event, struct net_connect_info *info)
+{
+	DARRAY(struct net_address)     addresses;
+	DARRAY(struct connect_attempt) attempts;
+	struct net_connect_info        dummy_info;
+	net_socket_t                   socket_fd = NET_INVALID_SOCKET;
+	size_t                         next_idx  = 0;
+	uint64_t                       start_ts, end_ts, next_ts;
+
+	if (!info)
+		info = &dummy_info;
+
+	memset(info, 0, sizeof(*info));
+	da_init(addresses);
+	da_init(attempts);
+
+	if (!resolve(host, port, &addresses.da, info))
+		goto finish;
+
+	start_ts = os_gettime_ns();
+	end_ts   = start_ts + (uint64_t)timeout_sec * 1000000000ULL;
+	next_ts  = start_ts;
+
+	while (socket_fd == NET_INVALID_SOCKET && !stop_requested(stop_event)) {
+		uint64_t cur_ts = os_gettime_ns();
+		uint64_t wait_ns;
+		size_t   idx;
+
+		if (cur_ts >= end_ts) {
+			info->error = ETIMEDOUT;
+			break;
+		}
+
+		/* start a new attempt if the delay since the last one has
+		 * passed or there's nothing left to wait for */
+		if (next_idx < addresses.num &&
+		    (cur_ts >= next_ts || !attempts.num)) {
+			struct connect_attempt attempt;
+			bool connected = false;
+
+			attempt.idx    = next_idx++;
+			attempt.socket = start_attempt(
+					addresses.array + attempt.idx,
+					&connected, &info->error);
+			info->attempts++;
+
+			if (attempt.socket == NET_INVALID_SOCKET) {
+				next_ts = cur_ts;
+				continue;
+			}
+
+			da_push_back(attempts, &attempt);
+			next_ts = cur_ts + ATTEMPT_DELAY_NS;
+
+			if (!connected)
+				continue;
+
+			idx = attempts.num - 1;
+
+		} else {
+			if (!attempts.num)
+				break;
+
+			wait_ns = end_ts - cur_ts;
+			if (next_idx < addresses.num &&
+			    next_ts - cur_ts < wait_ns)
+				wait_ns = next_ts - cur_ts;
+			if (wait_ns > WAIT_SLICE_NS)
+				wait_ns = WAIT_SLICE_NS;
+
+			idx = wait_for_attempts(&attempts.da, wait_ns,
+					&info->error);
+			if (idx == DARRAY_INVALID) {
+				/* start the next attempt right away if all
+				 * the pending ones failed */
+				if (!attempts.num)
+					next_ts = cur_ts;
+				continue;
+			}
+		}
+
+		socket_fd        = attempts.array[idx].socket;
+		info->connect_ns = os_gettime_ns() - start_ts;
+		info->error      = 0;
+		get_address_str(addresses.array + attempts.array[idx].idx,
+				info->address, sizeof(info->address));
+		da_erase(attempts, idx);
+	}
+
+	if (socket_fd != NET_INVALID_SOCKET && !set_blocking(socket_fd, true)) {
+		info->error = socket_error();
+		close_socket(socket_fd);
+		socket_fd = NET_INVALID_SOCKET;
+	}
+
+	if (socket_fd == NET_INVALID_SOCKET && !stop_requested(stop_event))
+		net_dns_cache_remove(host, port);
+
+finish:
+	for (size_t i = 0; i < attempts.num; i++)
+		close_socket(attempts.array[i].socket);
+
+	da_free(attempts);
+	da_free(addresses);
+	return socket_fd;
+}
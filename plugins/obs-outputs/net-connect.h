@@ -0,0 +1,66 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <util/c99defs.h>
+#include <util/threading.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET net_socket_t;
+#define NET_INVALID_SOCKET INVALID_SOCKET
+#else
+typedef int net_socket_t;
+#define NET_INVALID_SOCKET (-1)
+#endif
+
+struct net_connect_info {
+	uint64_t dns_ns;       /* time spent resolving the host */
+	uint64_t connect_ns;   /* time spent establishing the TCP connection */
+	bool     dns_cached;   /* whether the addresses came from the cache */
+	int      attempts;     /* number of addresses tried */
+	int      error;        /* last socket error, if the connection failed */
+	char     address[64];  /* numeric address that was connected to */
+};
+
+extern void net_dns_cache_init(void);
+extern void net_dns_cache_free(void);
+
+/**
+ * Removes a host from the DNS cache, so the next connection to it resolves
+ * it again.  Called when none of the cached addresses could be reached.
+ */
+extern void net_dns_cache_remove(const char *host, int port);
+
+/**
+ * Connects a TCP socket to the specified host.  Resolved addresses are cached
+ * for subsequent connections.  If the host has more than one address, a new
+ * connection attempt is started every 250 milliseconds without waiting for
+ * the previous ones to fail, alternating between IPv6 and IPv4, and the first
+ * attempt to succeed is used.
+ *
+ * @param  host         Host name or numeric address
+ * @param  port         Port to connect to
+ * @param  timeout_sec  Total time to wait for a connection
+ * @param  stop_event   If signalled, cancels the connection attempt.  Can be
+ *                      NULL.
+ * @param  info         Receives timing information.  Can be NULL.
+ * @return              Connected (blocking) socket, or NET_INVALID_SOCKET
+ */
+extern net_socket_t net_connect(const char *host, int port, int timeout_sec,
+		os_event_t stop_event, struct net_connect_info *info);
@@ -5,11 +5,14 @@
 #include <winsock2.h>
 #endif
 
+#include "net-connect.h"
+
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("obs-outputs", "en-US")
 
 extern struct obs_output_info rtmp_output_info;
 extern struct obs_output_info flv_output_info;
+extern struct obs_output_info flv_segment_output_info;
 
 bool obs_module_load(uint32_t libobs_ver)
 {
@@ -18,8 +21,11 @@ bool obs_module_load(uint32_t libobs_ver)
 	WSAStartup(MAKEWORD(2, 2), &wsad);
 #endif
 
+	net_dns_cache_init();
+
 	obs_register_output(&rtmp_output_info);
 	obs_register_output(&flv_output_info);
+	obs_register_output(&flv_segment_output_info);
 
 	UNUSED_PARAMETER(libobs_ver);
 	return true;
@@ -27,6 +33,8 @@ bool obs_module_load(uint32_t libobs_ver)
 
 void obs_module_unload(void)
 {
+	net_dns_cache_free();
+
 #ifdef _WIN32
 	WSACleanup();
 #endif
@@ -19,12 +19,19 @@
 #include <obs-avc.h>
 #include <util/platform.h>
 #include <util/circlebuf.h>
+#include <util/darray.h>
 #include <util/dstr.h>
 #include <util/threading.h>
 #include <inttypes.h>
 #include "librtmp/rtmp.h"
 #include "librtmp/log.h"
 #include "flv-mux.h"
+#include "net-connect.h"
+#include "frame-drops.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 #define do_log(level, format, ...) \
 	blog(level, "[rtmp stream: '%s'] " format, \
@@ -35,9 +42,29 @@
 #define debug(format, ...) do_log(LOG_DEBUG,   format, ##__VA_ARGS__)
 
 #define OPT_DROP_THRESHOLD "drop_threshold_ms"
+#define OPT_DYN_BITRATE    "dynamic_bitrate"
 
 //#define TEST_FRAMEDROPS
 
+#ifdef _WIN32
+typedef WSABUF send_buf_t;
+#define send_buf_size(buf) ((size_t)(buf)->len)
+#else
+typedef struct iovec send_buf_t;
+#define send_buf_size(buf) ((buf)->iov_len)
+#endif
+
+#define MAX_SEND_BUFS        256
+
+/* when dynamic bitrate is enabled, the video bitrate is lowered once the
+ * buffer reaches half the drop threshold, and raised back in steps once it
+ * has drained, at most once per interval */
+#define BITRATE_ADJUST_INTERVAL_USEC 1000000LL
+#define BITRATE_MIN_PERCENT          25
+#define BITRATE_STEP_UP_PERCENT      10
+#define RTMP_SOURCE_CHANNEL  0x04
+#define MAX_TAG_PREFIX_SIZE  5
+
 struct rtmp_stream {
 	obs_output_t     output;
 
@@ -57,14 +84,37 @@ struct rtmp_stream {
 	struct dstr      username, password;
 
 	/* frame drop variables */
-	int64_t          drop_threshold_usec;
-	int64_t          min_drop_dts_usec;
-	int              min_priority;
+	struct frame_drops drops;
+
+	/* dynamic bitrate variables */
+	bool             dynamic_bitrate;
+	uint32_t         max_bitrate;
+	uint32_t         cur_bitrate;
+	uint32_t         new_bitrate;
+	int64_t          last_adjust_dts_usec;
+
+	/* measured send rate, updated by the send thread */
+	uint64_t         rate_start_ns;
+	uint64_t         rate_start_bytes;
+	volatile long    send_kbps;
 
 	int64_t          last_dts_usec;
 
 	uint64_t         total_bytes_sent;
-	int              dropped_frames;
+
+	/* timings of the last connection */
+	uint64_t         dns_ns;
+	uint64_t         connect_ns;
+	uint64_t         handshake_ns;
+	uint64_t         publish_ns;
+	bool             dns_cached;
+
+	/* send thread only: the packets currently being sent, the chunk
+	 * headers built for them, and the buffers handed to the socket */
+	DARRAY(struct encoder_packet) send_packets;
+	DARRAY(struct obs_avc_nal) send_nals;
+	DARRAY(uint8_t)  send_arena;
+	DARRAY(send_buf_t) send_bufs;
 
 	RTMP             rtmp;
 };
@@ -82,6 +132,13 @@ static void log_rtmp(int level, const char *format, va_list args)
 	blogva(LOG_INFO, format, args);
 }
 
+static inline void free_send_packets(struct rtmp_stream *stream)
+{
+	for (size_t i = 0; i < stream->send_packets.num; i++)
+		obs_free_encoder_packet(stream->send_packets.array + i);
+	stream->send_packets.num = 0;
+}
+
 static inline void free_packets(struct rtmp_stream *stream)
 {
 	while (stream->packets.size) {
@@ -89,6 +146,8 @@ static inline void free_packets(struct rtmp_stream *stream)
 		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
 		obs_free_encoder_packet(&packet);
 	}
+
+	free_send_packets(stream);
 }
 
 static void rtmp_stream_stop(void *data);
@@ -110,16 +169,43 @@ static void rtmp_stream_destroy(void *data)
 		os_sem_destroy(stream->send_sem);
 		pthread_mutex_destroy(&stream->packets_mutex);
 		circlebuf_free(&stream->packets);
+		da_free(stream->send_packets);
+		da_free(stream->send_nals);
+		da_free(stream->send_arena);
+		da_free(stream->send_bufs);
 		bfree(stream);
 	}
 }
 
+static inline float ns_to_ms(uint64_t ns)
+{
+	return (float)((double)ns / 1000000.0);
+}
+
+static void rtmp_stream_get_connect_timings(void *data, calldata_t params)
+{
+	struct rtmp_stream *stream = data;
+
+	calldata_setfloat(params, "dns_ms",       ns_to_ms(stream->dns_ns));
+	calldata_setfloat(params, "connect_ms",   ns_to_ms(stream->connect_ns));
+	calldata_setfloat(params, "handshake_ms",
+			ns_to_ms(stream->handshake_ns));
+	calldata_setfloat(params, "publish_ms",   ns_to_ms(stream->publish_ns));
+	calldata_setbool (params, "dns_cached",   stream->dns_cached);
+}
+
 static void *rtmp_stream_create(obs_data_t settings, obs_output_t output)
 {
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
 
+	proc_handler_add(obs_output_prochandler(output),
+			"void get_connect_timings(out float dns_ms, "
+			"out float connect_ms, out float handshake_ms, "
+			"out float publish_ms, out bool dns_cached)",
+			rtmp_stream_get_connect_timings, stream);
+
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
 	RTMP_LogSetLevel(RTMP_LOGWARNING);
@@ -137,6 +223,19 @@ fail:
 	return NULL;
 }
 
+/* the video encoder may be shared with other outputs, so don't leave it at a
+ * lowered bitrate once the stream stops or disconnects */
+static void restore_bitrate(struct rtmp_stream *stream)
+{
+	if (stream->max_bitrate && stream->cur_bitrate != stream->max_bitrate) {
+		obs_encoder_t vencoder =
+			obs_output_get_video_encoder(stream->output);
+
+		obs_encoder_set_bitrate(vencoder, stream->max_bitrate);
+		stream->cur_bitrate = stream->max_bitrate;
+	}
+}
+
 static void rtmp_stream_stop(void *data)
 {
 	struct rtmp_stream *stream = data;
@@ -149,6 +248,7 @@ static void rtmp_stream_stop(void *data)
 
 	if (stream->active) {
 		obs_output_end_data_capture(stream->output);
+		restore_bitrate(stream);
 		os_sem_post(stream->send_sem);
 		pthread_join(stream->send_thread, &ret);
 		RTMP_Close(&stream->rtmp);
@@ -171,20 +271,20 @@ static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
 	val->av_len = valid ? (int)str->len : 0;
 }
 
-static inline bool get_next_packet(struct rtmp_stream *stream,
-		struct encoder_packet *packet)
+/* takes every packet that's currently queued, so they can all be sent at
+ * once without going back to the packet mutex for each one */
+static inline bool get_next_packets(struct rtmp_stream *stream)
 {
-	bool new_packet = false;
-
 	pthread_mutex_lock(&stream->packets_mutex);
-	if (stream->packets.size) {
+	while (stream->packets.size) {
+		struct encoder_packet *packet;
+		packet = da_push_back_new(stream->send_packets);
 		circlebuf_pop_front(&stream->packets, packet,
 				sizeof(struct encoder_packet));
-		new_packet = true;
 	}
 	pthread_mutex_unlock(&stream->packets_mutex);
 
-	return new_packet;
+	return stream->send_packets.num != 0;
 }
 
 static int send_packet(struct rtmp_stream *stream,
@@ -195,9 +295,6 @@ static int send_packet(struct rtmp_stream *stream,
 	int     ret = 0;
 
 	flv_packet_mux(packet, &data, &size, is_header);
-#ifdef TEST_FRAMEDROPS
-	os_sleep_ms(rand() % 40);
-#endif
 	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size);
 	bfree(data);
 
@@ -207,12 +304,428 @@ static int send_packet(struct rtmp_stream *stream,
 	return ret;
 }
 
-static bool send_remaining_packets(struct rtmp_stream *stream)
+/* sends a queued packet through RTMP_Write, converting video packets from
+ * Annex B to length prefixed NAL units first */
+static int send_avc_packet(struct rtmp_stream *stream,
+		struct encoder_packet *packet)
+{
+	struct encoder_packet copy = *packet;
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		obs_parse_avc_packet(&copy, packet);
+		obs_free_encoder_packet(packet);
+	}
+
+	packet->data = NULL;
+	return copy.size ? send_packet(stream, &copy, false) : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* vectored send path
+ *
+ * rather than muxing each packet into a newly allocated FLV tag and having
+ * RTMP_Write copy it again into an RTMP packet, the RTMP chunk headers and
+ * FLV tag prefixes are written into a reusable arena, and the socket is
+ * handed a list of buffers that point directly at the packet payloads.  the
+ * headers follow the same rules as RTMP_Write/RTMP_SendPacket, and the
+ * channel state in librtmp is kept up to date so both paths can be mixed.
+ *
+ * video packets are queued as the encoder's Annex B data.  rather than being
+ * converted to length prefixed NAL units up front, the length prefixes are
+ * written into the arena as well, and each NAL unit is sent in place. */
+
+static inline bool can_send_vectored(struct rtmp_stream *stream)
+{
+	RTMP *r = &stream->rtmp;
+
+#ifdef CRYPTO
+	if (r->Link.rc4keyOut)
+		return false;
+#endif
+
+	return !(r->Link.protocol & RTMP_FEATURE_HTTP) &&
+	       !r->m_bCustomSend   &&
+	       !r->m_sb.sb_ssl     &&
+	       r->m_outChunkSize > 0 &&
+	       r->m_channelsAllocatedOut > RTMP_SOURCE_CHANNEL &&
+	       r->m_vecChannelsOut[RTMP_SOURCE_CHANNEL] != NULL;
+}
+
+static int flush_send_bufs(struct rtmp_stream *stream)
+{
+	send_buf_t *bufs  = stream->send_bufs.array;
+	size_t     count  = stream->send_bufs.num;
+	SOCKET     socket = stream->rtmp.m_sb.sb_socket;
+
+	while (count) {
+		size_t sent;
+
+#ifdef _WIN32
+		DWORD bytes_sent = 0;
+		if (WSASend(socket, bufs, (DWORD)count, &bytes_sent, 0,
+					NULL, NULL) != 0) {
+			warn("Send error: %d", WSAGetLastError());
+			return -1;
+		}
+		sent = (size_t)bytes_sent;
+#else
+		ssize_t ret = writev(socket, bufs, (int)count);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			warn("Send error: %d", errno);
+			return -1;
+		}
+		sent = (size_t)ret;
+#endif
+
+		stream->total_bytes_sent += sent;
+
+		while (count && sent >= send_buf_size(bufs)) {
+			sent -= send_buf_size(bufs);
+			bufs++;
+			count--;
+		}
+
+		if (count) {
+#ifdef _WIN32
+			bufs->buf += sent;
+			bufs->len -= (ULONG)sent;
+#else
+			bufs->iov_base = (uint8_t*)bufs->iov_base + sent;
+			bufs->iov_len -= sent;
+#endif
+		}
+	}
+
+	stream->send_bufs.num = 0;
+	return 0;
+}
+
+static inline int add_send_buf(struct rtmp_stream *stream, const void *data,
+		size_t size)
+{
+	send_buf_t *buf;
+
+	if (!size)
+		return 0;
+
+	buf = da_push_back_new(stream->send_bufs);
+#ifdef _WIN32
+	buf->buf = (CHAR*)data;
+	buf->len = (ULONG)size;
+#else
+	buf->iov_base = (void*)data;
+	buf->iov_len  = size;
+#endif
+
+	return (stream->send_bufs.num >= MAX_SEND_BUFS) ?
+		flush_send_bufs(stream) : 0;
+}
+
+static inline uint8_t *arena_alloc(struct rtmp_stream *stream, size_t size)
+{
+	uint8_t *data = stream->send_arena.array + stream->send_arena.num;
+	stream->send_arena.num += size;
+	return data;
+}
+
+/* the send buffers point into the arena, so it must not be resized while
+ * they're in use.  if a packet doesn't fit in what's left of it, whatever
+ * is pending is sent first so the arena can be reset. */
+static inline int reserve_arena(struct rtmp_stream *stream, size_t size)
+{
+	if (stream->send_arena.capacity - stream->send_arena.num >= size)
+		return 0;
+
+	if (flush_send_bufs(stream) < 0)
+		return -1;
+
+	/* grow in steps so that a whole batch eventually fits */
+	stream->send_arena.num = 0;
+	da_reserve(stream->send_arena, size > stream->send_arena.capacity * 2 ?
+			size : stream->send_arena.capacity * 2);
+	return 0;
+}
+
+/* upper bound of the arena space needed for a packet: the chunk header (with
+ * an extended timestamp), the FLV tag prefix, the NAL unit length prefixes
+ * and one byte per chunk */
+static inline size_t packet_arena_size(struct rtmp_stream *stream,
+		size_t payload_size, size_t num_nals)
+{
+	size_t chunk_size = (size_t)stream->rtmp.m_outChunkSize;
+	return RTMP_MAX_HEADER_SIZE + MAX_TAG_PREFIX_SIZE + num_nals * 4 +
+		(payload_size + MAX_TAG_PREFIX_SIZE) / chunk_size + 1;
+}
+
+/* gets the NAL units of a queued video packet, and returns the size of the
+ * payload once they're length prefixed */
+static size_t get_packet_nals(struct rtmp_stream *stream,
+		struct encoder_packet *packet)
+{
+	const uint8_t *pos = packet->data;
+	const uint8_t *end = pos + packet->size;
+	size_t        size = 0;
+
+	stream->send_nals.num = 0;
+
+	while (true) {
+		struct obs_avc_nal *nal = da_push_back_new(stream->send_nals);
+		if (!obs_avc_next_nal(nal, &pos, end)) {
+			stream->send_nals.num--;
+			break;
+		}
+
+		size += 4 + nal->size;
+	}
+
+	return size;
+}
+
+static inline size_t write_tag_prefix(uint8_t *prefix,
+		struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		int32_t offset = get_ms_time(packet, packet->pts - packet->dts);
+
+		prefix[0] = packet->keyframe ? 0x17 : 0x27;
+		prefix[1] = 1;
+		prefix[2] = (uint8_t)(offset >> 16);
+		prefix[3] = (uint8_t)(offset >> 8);
+		prefix[4] = (uint8_t)offset;
+		return 5;
+	}
+
+	prefix[0] = 0xaf;
+	prefix[1] = 1;
+	return 2;
+}
+
+static inline uint8_t *write_be24(uint8_t *ptr, uint32_t val)
+{
+	*ptr++ = (uint8_t)(val >> 16);
+	*ptr++ = (uint8_t)(val >> 8);
+	*ptr++ = (uint8_t)val;
+	return ptr;
+}
+
+static inline uint8_t *write_be32(uint8_t *ptr, uint32_t val)
+{
+	*ptr++ = (uint8_t)(val >> 24);
+	return write_be24(ptr, val);
+}
+
+/* adds part of the body of the packet being built, inserting a chunk header
+ * each time the data crosses into a new chunk */
+static int add_chunked_data(struct rtmp_stream *stream, const uint8_t *data,
+		size_t size, size_t *chunk_left)
+{
+	while (size) {
+		size_t part = size;
+
+		if (!*chunk_left) {
+			uint8_t *cont = arena_alloc(stream, 1);
+			*cont = 0xc0 | RTMP_SOURCE_CHANNEL;
+
+			if (add_send_buf(stream, cont, 1) < 0)
+				return -1;
+
+			*chunk_left = (size_t)stream->rtmp.m_outChunkSize;
+		}
+
+		if (part > *chunk_left)
+			part = *chunk_left;
+
+		if (add_send_buf(stream, data, part) < 0)
+			return -1;
+
+		data        += part;
+		size        -= part;
+		*chunk_left -= part;
+	}
+
+	return 0;
+}
+
+static int add_packet_payload(struct rtmp_stream *stream,
+		struct encoder_packet *packet, size_t *chunk_left)
+{
+	if (packet->type != OBS_ENCODER_VIDEO)
+		return add_chunked_data(stream, packet->data, packet->size,
+				chunk_left);
+
+	for (size_t i = 0; i < stream->send_nals.num; i++) {
+		struct obs_avc_nal *nal  = stream->send_nals.array + i;
+		uint8_t            *size = arena_alloc(stream, 4);
+
+		write_be32(size, (uint32_t)nal->size);
+
+		if (add_chunked_data(stream, size, 4, chunk_left) < 0)
+			return -1;
+		if (add_chunked_data(stream, nal->data, nal->size,
+					chunk_left) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int add_vectored_packet(struct rtmp_stream *stream,
+		struct encoder_packet *packet)
+{
+	static const int header_sizes[] = {12, 8, 4, 1};
+
+	RTMP       *r          = &stream->rtmp;
+	RTMPPacket *prev       = r->m_vecChannelsOut[RTMP_SOURCE_CHANNEL];
+	bool       is_video    = packet->type == OBS_ENCODER_VIDEO;
+	size_t     chunk_left  = (size_t)r->m_outChunkSize;
+	size_t     payload_size;
+	uint8_t    *prefix;
+	size_t     prefix_size;
+	uint32_t   body_size;
+	uint32_t   timestamp   = get_ms_time(packet, packet->dts) & 0x7FFFFFFF;
+	uint8_t    packet_type = is_video ?
+		RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO;
+	uint8_t    header_type = timestamp ?
+		RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
+	uint32_t   last        = 0;
+	uint32_t   t;
+	uint8_t    *header, *hptr;
+	int        nsize;
+
+	payload_size = is_video ?
+		get_packet_nals(stream, packet) : packet->size;
+	if (!payload_size)
+		return 0;
+
+	if (reserve_arena(stream, packet_arena_size(stream, payload_size,
+					stream->send_nals.num)) < 0)
+		return -1;
+
+	prefix      = arena_alloc(stream, MAX_TAG_PREFIX_SIZE);
+	prefix_size = write_tag_prefix(prefix, packet);
+	body_size   = (uint32_t)(prefix_size + payload_size);
+
+	if (header_type != RTMP_PACKET_SIZE_LARGE) {
+		if (prev->m_nBodySize == body_size &&
+		    prev->m_packetType == packet_type)
+			header_type = RTMP_PACKET_SIZE_SMALL;
+		if (prev->m_nTimeStamp == timestamp &&
+		    header_type == RTMP_PACKET_SIZE_SMALL)
+			header_type = RTMP_PACKET_SIZE_MINIMUM;
+		last = prev->m_nTimeStamp;
+	}
+
+	nsize = header_sizes[header_type];
+	t     = timestamp - last;
+
+	header = hptr = arena_alloc(stream, RTMP_MAX_HEADER_SIZE);
+	*hptr++ = (uint8_t)((header_type << 6) | RTMP_SOURCE_CHANNEL);
+	if (nsize > 1)
+		hptr = write_be24(hptr, t > 0xffffff ? 0xffffff : t);
+	if (nsize > 4) {
+		hptr = write_be24(hptr, body_size);
+		*hptr++ = packet_type;
+	}
+	if (nsize > 8) {
+		uint32_t id = (uint32_t)r->m_stream_id;
+		*hptr++ = (uint8_t)id;
+		*hptr++ = (uint8_t)(id >> 8);
+		*hptr++ = (uint8_t)(id >> 16);
+		*hptr++ = (uint8_t)(id >> 24);
+	}
+	if (nsize > 1 && t >= 0xffffff)
+		hptr = write_be32(hptr, t);
+
+	if (add_send_buf(stream, header, hptr - header) < 0)
+		return -1;
+	if (add_chunked_data(stream, prefix, prefix_size, &chunk_left) < 0)
+		return -1;
+
+	if (add_packet_payload(stream, packet, &chunk_left) < 0)
+		return -1;
+
+	prev->m_headerType   = header_type;
+	prev->m_packetType   = packet_type;
+	prev->m_nChannel     = RTMP_SOURCE_CHANNEL;
+	prev->m_nTimeStamp   = timestamp;
+	prev->m_nInfoField2  = r->m_stream_id;
+	prev->m_nBodySize    = body_size;
+	prev->m_nBytesRead   = 0;
+	prev->m_body         = NULL;
+	return 0;
+}
+
+#define SEND_RATE_INTERVAL_NS 1000000000ULL
+
+static void update_send_rate(struct rtmp_stream *stream)
 {
-	struct encoder_packet packet;
+	uint64_t ts = os_gettime_ns();
+	uint64_t elapsed, bytes;
 
-	while (get_next_packet(stream, &packet))
-		if (send_packet(stream, &packet, false) < 0)
+	if (!stream->rate_start_ns) {
+		stream->rate_start_ns    = ts;
+		stream->rate_start_bytes = stream->total_bytes_sent;
+		return;
+	}
+
+	elapsed = ts - stream->rate_start_ns;
+	if (elapsed < SEND_RATE_INTERVAL_NS)
+		return;
+
+	bytes = stream->total_bytes_sent - stream->rate_start_bytes;
+	os_atomic_set_long(&stream->send_kbps,
+			(long)(bytes * 8 * 1000000 / elapsed));
+
+	stream->rate_start_ns    = ts;
+	stream->rate_start_bytes = stream->total_bytes_sent;
+}
+
+static int send_packet_batch(struct rtmp_stream *stream)
+{
+	int ret = 0;
+
+#ifdef TEST_FRAMEDROPS
+	os_sleep_ms(rand() % 40);
+#endif
+
+	stream->send_arena.num = 0;
+
+	for (size_t i = 0; i < stream->send_packets.num && ret >= 0; i++) {
+		struct encoder_packet *packet = stream->send_packets.array + i;
+
+		if (!packet->data || !packet->size)
+			continue;
+
+		if (can_send_vectored(stream)) {
+			ret = add_vectored_packet(stream, packet);
+		} else {
+			ret = flush_send_bufs(stream);
+			if (ret >= 0)
+				ret = send_avc_packet(stream, packet);
+		}
+	}
+
+	if (ret >= 0)
+		ret = flush_send_bufs(stream);
+	else
+		stream->send_bufs.num = 0;
+
+	free_send_packets(stream);
+
+	if (ret < 0)
+		RTMP_Close(&stream->rtmp);
+	else
+		update_send_rate(stream);
+	return ret;
+}
+
+static bool send_remaining_packets(struct rtmp_stream *stream)
+{
+	while (get_next_packets(stream))
+		if (send_packet_batch(stream) < 0)
 			return false;
 
 	return true;
@@ -224,13 +737,11 @@ static void *send_thread(void *data)
 	bool disconnected = false;
 
 	while (os_sem_wait(stream->send_sem) == 0) {
-		struct encoder_packet packet;
-
 		if (os_event_try(stream->stop_event) != EAGAIN)
 			break;
-		if (!get_next_packet(stream, &packet))
+		if (!get_next_packets(stream))
 			continue;
-		if (send_packet(stream, &packet, false) < 0) {
+		if (send_packet_batch(stream) < 0) {
 			disconnected = true;
 			break;
 		}
@@ -248,6 +759,11 @@ static void *send_thread(void *data)
 
 	if (os_event_try(stream->stop_event) == EAGAIN) {
 		pthread_detach(stream->send_thread);
+
+		/* stop receiving packets first so the bitrate can't be lowered
+		 * again before the output reconnects */
+		obs_output_end_data_capture(stream->output);
+		restore_bitrate(stream);
 		obs_output_signal_stop(stream->output, OBS_OUTPUT_DISCONNECTED);
 	}
 
@@ -357,8 +873,60 @@ static int init_send(struct rtmp_stream *stream)
 	return OBS_OUTPUT_SUCCESS;
 }
 
+/* connects the socket and performs the RTMP handshake.  the TCP connection
+ * is made by net_connect, which caches DNS results between reconnects and
+ * tries multiple addresses in parallel, unless going through a SOCKS proxy,
+ * which librtmp handles itself */
+static bool connect_socket(struct rtmp_stream *stream)
+{
+	RTMP                    *r = &stream->rtmp;
+	struct net_connect_info net_info;
+	struct dstr             host = {0};
+	net_socket_t            socket_fd;
+	uint64_t                start_ts;
+
+	if (r->Link.socksport) {
+		start_ts = os_gettime_ns();
+		if (!RTMP_Connect(r, NULL))
+			return false;
+
+		stream->handshake_ns = os_gettime_ns() - start_ts;
+		return true;
+	}
+
+	dstr_ncopy(&host, r->Link.hostname.av_val, r->Link.hostname.av_len);
+	socket_fd = net_connect(host.array, r->Link.port, r->Link.timeout,
+			stream->stop_event, &net_info);
+
+	stream->dns_ns     = net_info.dns_ns;
+	stream->connect_ns = net_info.connect_ns;
+	stream->dns_cached = net_info.dns_cached;
+
+	if (socket_fd == NET_INVALID_SOCKET) {
+		warn("Could not connect to %s:%d (%d address(es) tried, "
+		     "error %d)", host.array, r->Link.port,
+		     net_info.attempts, net_info.error);
+		dstr_free(&host);
+		return false;
+	}
+
+	debug("Connected to %s (%s)", host.array, net_info.address);
+	dstr_free(&host);
+
+	RTMP_AttachSocket(r, socket_fd);
+
+	start_ts = os_gettime_ns();
+	if (!RTMP_Connect1(r, NULL))
+		return false;
+
+	stream->handshake_ns = os_gettime_ns() - start_ts;
+	return true;
+}
+
 static int try_connect(struct rtmp_stream *stream)
 {
+	uint64_t start_ts;
+
 	if (dstr_isempty(&stream->path)) {
 		warn("URL is empty");
 		return OBS_OUTPUT_BAD_PATH;
@@ -387,12 +955,27 @@ static int try_connect(struct rtmp_stream *stream)
 	stream->rtmp.m_bSendChunkSizeInfo = true;
 	stream->rtmp.m_bUseNagle          = true;
 
-	if (!RTMP_Connect(&stream->rtmp, NULL))
+	stream->dns_ns       = 0;
+	stream->connect_ns   = 0;
+	stream->handshake_ns = 0;
+	stream->publish_ns   = 0;
+	stream->dns_cached   = false;
+
+	if (!connect_socket(stream))
 		return OBS_OUTPUT_CONNECT_FAILED;
+
+	start_ts = os_gettime_ns();
 	if (!RTMP_ConnectStream(&stream->rtmp, 0))
 		return OBS_OUTPUT_INVALID_STREAM;
+	stream->publish_ns = os_gettime_ns() - start_ts;
 
-	info("Connection to %s successful", stream->path.array);
+	info("Connection to %s successful (dns: %.1fms%s, connect: %.1fms, "
+	     "handshake: %.1fms, publish: %.1fms)",
+	     stream->path.array,
+	     ns_to_ms(stream->dns_ns), stream->dns_cached ? " cached" : "",
+	     ns_to_ms(stream->connect_ns),
+	     ns_to_ms(stream->handshake_ns),
+	     ns_to_ms(stream->publish_ns));
 
 	return init_send(stream);
 }
@@ -418,6 +1001,7 @@ static bool rtmp_stream_start(void *data)
 {
 	struct rtmp_stream *stream = data;
 	obs_service_t service = obs_output_get_service(stream->output);
+	obs_encoder_t vencoder;
 	obs_data_t settings;
 
 	if (!obs_output_can_begin_data_capture(stream->output, 0))
@@ -425,16 +1009,29 @@ static bool rtmp_stream_start(void *data)
 	if (!obs_output_initialize_encoders(stream->output, 0))
 		return false;
 
-	stream->total_bytes_sent = 0;
-	stream->dropped_frames   = 0;
+	stream->total_bytes_sent   = 0;
+	stream->rate_start_ns      = 0;
+	stream->send_kbps          = 0;
 
 	settings = obs_output_get_settings(stream->output);
 	dstr_copy(&stream->path,     obs_service_get_url(service));
 	dstr_copy(&stream->key,      obs_service_get_key(service));
 	dstr_copy(&stream->username, obs_service_get_username(service));
 	dstr_copy(&stream->password, obs_service_get_password(service));
-	stream->drop_threshold_usec =
-		(int64_t)obs_data_getint(settings, OPT_DROP_THRESHOLD) * 1000;
+	frame_drops_init(&stream->drops,
+		(int64_t)obs_data_getint(settings, OPT_DROP_THRESHOLD) * 1000);
+	stream->dynamic_bitrate = obs_data_getbool(settings, OPT_DYN_BITRATE);
+	obs_data_release(settings);
+
+	/* the ceiling is the bitrate the encoder is configured with, not one
+	 * it may have been left at by a previous congested connection */
+	vencoder = obs_output_get_video_encoder(stream->output);
+	settings = obs_encoder_get_settings_snapshot(vencoder);
+	stream->max_bitrate          = (uint32_t)obs_data_getint(settings,
+			"bitrate");
+	stream->cur_bitrate          = obs_encoder_get_bitrate(vencoder);
+	stream->new_bitrate          = 0;
+	stream->last_adjust_dts_usec = 0;
 	obs_data_release(settings);
 
 	return pthread_create(&stream->connect_thread, NULL, connect_thread,
@@ -450,87 +1047,68 @@ static inline bool add_packet(struct rtmp_stream *stream,
 	return true;
 }
 
-static inline size_t num_buffered_packets(struct rtmp_stream *stream)
+static inline int64_t get_buffer_duration(struct rtmp_stream *stream)
 {
-	return stream->packets.size / sizeof(struct encoder_packet);
-}
-
-static void drop_frames(struct rtmp_stream *stream)
-{
-	struct circlebuf new_buf            = {0};
-	int              drop_priority      = 0;
-	uint64_t         last_drop_dts_usec = 0;
-	int              num_frames_dropped = 0;
-
-	debug("Previous packet count: %d", (int)num_buffered_packets(stream));
-
-	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
-
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-
-		last_drop_dts_usec = packet.dts_usec;
-
-		if (packet.type == OBS_ENCODER_AUDIO) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
-
-		} else {
-			if (drop_priority < packet.drop_priority)
-				drop_priority = packet.drop_priority;
-
-			num_frames_dropped++;
-			obs_free_encoder_packet(&packet);
-		}
-	}
+	struct encoder_packet first;
 
-	circlebuf_free(&stream->packets);
-	stream->packets           = new_buf;
-	stream->min_priority      = drop_priority;
-	stream->min_drop_dts_usec = last_drop_dts_usec;
+	if (!stream->packets.size)
+		return 0;
 
-	stream->dropped_frames += num_frames_dropped;
-	debug("New packet count: %d", (int)num_buffered_packets(stream));
+	circlebuf_peek_front(&stream->packets, &first, sizeof(first));
+	return stream->last_dts_usec - first.dts_usec;
 }
 
-static void check_to_drop_frames(struct rtmp_stream *stream)
+/* lowers the video bitrate towards what the connection is actually managing
+ * to send before the buffer gets large enough to start dropping frames, and
+ * slowly raises it back up once the congestion is gone */
+static void check_bitrate(struct rtmp_stream *stream)
 {
-	struct encoder_packet first;
-	int64_t buffer_duration_usec;
+	int64_t  buffer_duration_usec = get_buffer_duration(stream);
+	int64_t  threshold_usec       = stream->drops.threshold_usec;
+	uint32_t min_bitrate;
+	uint32_t bitrate;
 
-	if (num_buffered_packets(stream) < 5)
+	if (!stream->dynamic_bitrate || !stream->max_bitrate)
+		return;
+	if (stream->last_dts_usec - stream->last_adjust_dts_usec <
+			BITRATE_ADJUST_INTERVAL_USEC)
 		return;
 
-	circlebuf_peek_front(&stream->packets, &first, sizeof(first));
+	min_bitrate = stream->max_bitrate * BITRATE_MIN_PERCENT / 100;
+	bitrate     = stream->cur_bitrate;
 
-	/* do not drop frames if frames were just dropped within this time */
-	if (first.dts_usec < stream->min_drop_dts_usec)
-		return;
+	if (buffer_duration_usec > threshold_usec / 2) {
+		uint32_t send_kbps =
+			(uint32_t)os_atomic_load_long(&stream->send_kbps);
 
-	/* if the amount of time stored in the buffered packets waiting to be
-	 * sent is higher than threshold, drop frames */
-	buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
+		bitrate = bitrate * 3 / 4;
+		if (send_kbps && send_kbps * 8 / 10 < bitrate)
+			bitrate = send_kbps * 8 / 10;
+		if (bitrate < min_bitrate)
+			bitrate = min_bitrate;
 
-	if (buffer_duration_usec > stream->drop_threshold_usec) {
-		drop_frames(stream);
-		debug("dropping %" PRId64 " worth of frames",
-				buffer_duration_usec);
+	} else if (buffer_duration_usec < threshold_usec / 8 &&
+	           stream->drops.stage == DROP_STAGE_NONE) {
+		bitrate += stream->max_bitrate * BITRATE_STEP_UP_PERCENT / 100;
+		if (bitrate > stream->max_bitrate)
+			bitrate = stream->max_bitrate;
+	}
+
+	if (bitrate != stream->cur_bitrate) {
+		stream->cur_bitrate          = bitrate;
+		stream->new_bitrate          = bitrate;
+		stream->last_adjust_dts_usec = stream->last_dts_usec;
 	}
 }
 
 static bool add_video_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet)
 {
-	check_to_drop_frames(stream);
+	check_bitrate(stream);
 
-	/* if currently dropping frames, drop packets until it reaches the
-	 * desired priority */
-	if (packet->priority < stream->min_priority) {
-		stream->dropped_frames++;
+	if (!frame_drops_check(&stream->drops, &stream->packets,
+				stream->last_dts_usec, packet))
 		return false;
-	} else {
-		stream->min_priority = 0;
-	}
 
 	return add_packet(stream, packet);
 }
@@ -540,11 +1118,13 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 	struct rtmp_stream    *stream = data;
 	struct encoder_packet new_packet;
 	bool                  added_packet;
+	bool                  stage_changed;
+	enum drop_stage       stage;
+	uint32_t              new_bitrate;
 
+	obs_duplicate_encoder_packet(&new_packet, packet);
 	if (packet->type == OBS_ENCODER_VIDEO)
-		obs_parse_avc_packet(&new_packet, packet);
-	else
-		obs_duplicate_encoder_packet(&new_packet, packet);
+		obs_parse_avc_packet_info(&new_packet);
 
 	pthread_mutex_lock(&stream->packets_mutex);
 
@@ -552,8 +1132,38 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 		add_video_packet(stream, &new_packet) :
 		add_packet(stream, &new_packet);
 
+	stage_changed               = stream->drops.stage_changed;
+	stage                       = stream->drops.stage;
+	stream->drops.stage_changed = false;
+	new_bitrate                 = stream->new_bitrate;
+	stream->new_bitrate         = 0;
+
 	pthread_mutex_unlock(&stream->packets_mutex);
 
+	if (new_bitrate) {
+		obs_encoder_t vencoder =
+			obs_output_get_video_encoder(stream->output);
+
+		if (obs_encoder_set_bitrate(vencoder, new_bitrate)) {
+			debug("Requested video bitrate of %u", new_bitrate);
+		} else {
+			warn("Video encoder does not support changing its "
+			     "bitrate while active");
+
+			pthread_mutex_lock(&stream->packets_mutex);
+			stream->dynamic_bitrate = false;
+			pthread_mutex_unlock(&stream->packets_mutex);
+		}
+	}
+
+	if (stage_changed) {
+		long send_kbps = os_atomic_load_long(&stream->send_kbps);
+		info("Congestion stage %d (sending at %ld kbps)", (int)stage,
+				send_kbps);
+		obs_output_signal_congestion(stream->output, (int)stage,
+				(int)send_kbps);
+	}
+
 	if (added_packet)
 		os_sem_post(stream->send_sem);
 	else
@@ -563,6 +1173,7 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 static void rtmp_stream_defaults(obs_data_t defaults)
 {
 	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 600);
+	obs_data_set_default_bool(defaults, OPT_DYN_BITRATE, true);
 }
 
 static obs_properties_t rtmp_stream_properties(void)
@@ -572,6 +1183,8 @@ static obs_properties_t rtmp_stream_properties(void)
 	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
 			obs_module_text("RTMPStream.DropThreshold"),
 			200, 10000, 100);
+	obs_properties_add_bool(props, OPT_DYN_BITRATE,
+			obs_module_text("RTMPStream.DynamicBitrate"));
 	return props;
 }
 
@@ -584,7 +1197,7 @@ static uint64_t rtmp_stream_total_bytes_sent(void *data)
 static int rtmp_stream_dropped_frames(void *data)
 {
 	struct rtmp_stream *stream = data;
-	return stream->dropped_frames;
+	return stream->drops.dropped_frames;
 }
 
 struct obs_output_info rtmp_output_info = {
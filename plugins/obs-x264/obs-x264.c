@@ -342,6 +342,24 @@ static bool obs_x264_update(void *data, obs_data_t settings)
 	return false;
 }
 
+static bool obs_x264_set_bitrate(void *data, uint32_t bitrate)
+{
+	struct obs_x264 *obsx264 = data;
+	int ret;
+
+	obsx264->params.rc.i_bitrate         = (int)bitrate;
+	obsx264->params.rc.i_vbv_max_bitrate = (int)bitrate;
+
+	ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
+	if (ret != 0) {
+		warn("Failed to change bitrate to %u: %d", bitrate, ret);
+		return false;
+	}
+
+	debug("bitrate changed to %u", bitrate);
+	return true;
+}
+
 static void load_headers(struct obs_x264 *obsx264)
 {
 	x264_nal_t      *nals;
@@ -506,17 +524,18 @@ static bool obs_x264_video_info(void *data, struct video_scale_info *info)
 }
 
 struct obs_encoder_info obs_x264_encoder = {
-	.id         = "obs_x264",
-	.type       = OBS_ENCODER_VIDEO,
-	.codec      = "h264",
-	.getname    = obs_x264_getname,
-	.create     = obs_x264_create,
-	.destroy    = obs_x264_destroy,
-	.encode     = obs_x264_encode,
-	.properties = obs_x264_props,
-	.defaults   = obs_x264_defaults,
-	.update     = obs_x264_update,
-	.extra_data = obs_x264_extra_data,
-	.sei_data   = obs_x264_sei,
-	.video_info = obs_x264_video_info
+	.id          = "obs_x264",
+	.type        = OBS_ENCODER_VIDEO,
+	.codec       = "h264",
+	.getname     = obs_x264_getname,
+	.create      = obs_x264_create,
+	.destroy     = obs_x264_destroy,
+	.encode      = obs_x264_encode,
+	.properties  = obs_x264_props,
+	.defaults    = obs_x264_defaults,
+	.update      = obs_x264_update,
+	.extra_data  = obs_x264_extra_data,
+	.sei_data    = obs_x264_sei,
+	.video_info  = obs_x264_video_info,
+	.set_bitrate = obs_x264_set_bitrate
 };
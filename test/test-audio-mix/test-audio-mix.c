@@ -0,0 +1,250 @@
+/*
+ * Mixes 32 lines of 48khz stereo audio the way the audio thread does
+ * (libobs/media-io/audio-io.c), with the old loop that popped each line
+ * through a small stack buffer and clamped one sample at a time, and with
+ * each of the mixing kernels in media-io/audio-mix.c straight out of the
+ * circular buffers.
+ *
+ * Every kernel has to produce exactly the same bits as the old loop,
+ * including for samples that are NaN or infinite.  The time spent mixing is
+ * printed for each, as a multiple of real time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/platform.h>
+#include <media-io/audio-mix.h>
+
+#define LINES              32
+#define CHANNELS           2
+#define SAMPLE_RATE        48000
+#define PERIOD_FRAMES      (SAMPLE_RATE / 40)
+#define SECONDS            30
+#define PERIODS            (SECONDS * SAMPLE_RATE / PERIOD_FRAMES)
+
+/* the old code popped this many bytes at a time */
+#define MIX_BUFFER_SIZE    256
+
+/* each line's data is pushed in chunks that don't line up with the mixing
+ * period, so the circular buffers wrap around at different points */
+#define CHUNK_FRAMES       1024
+
+struct mix_func {
+	const char         *name;
+	audio_mix_float_t  func;
+};
+
+struct test_line {
+	struct circlebuf   buffers[CHANNELS];
+	float              *source;
+	size_t             source_pos;
+};
+
+static struct test_line lines[LINES];
+static size_t source_frames;
+
+/* the mixing loop from before the kernels were added */
+static void mix_float_old(float *mix, struct circlebuf *buf, size_t size)
+{
+	float vals[MIX_BUFFER_SIZE];
+	register float mix_val;
+
+	while (size) {
+		size_t pop_count = size < sizeof(vals) ? size : sizeof(vals);
+		size -= pop_count;
+
+		circlebuf_pop_front(buf, vals, pop_count);
+		pop_count /= sizeof(float);
+
+		for (size_t i = 0; i < pop_count; i++) {
+			mix_val =  *mix + vals[i];
+
+			mix_val = (mix_val >  1.0f) ?  1.0f : mix_val;
+			mix_val = (mix_val < -1.0f) ? -1.0f : mix_val;
+
+			*(mix++) = mix_val;
+		}
+	}
+}
+
+/* the same as mix_float in audio-io.c */
+static void mix_float_spans(audio_mix_float_t func, float *mix,
+		struct circlebuf *buf, size_t size)
+{
+	uint8_t *data      = (uint8_t*)buf->data + buf->start_pos;
+	size_t  start_size = buf->capacity - buf->start_pos;
+
+	if (start_size < size) {
+		func(mix, (const float*)data, start_size / sizeof(float));
+		func((float*)((uint8_t*)mix + start_size),
+				(const float*)buf->data,
+				(size - start_size) / sizeof(float));
+	} else {
+		func(mix, (const float*)data, size / sizeof(float));
+	}
+
+	circlebuf_pop_front(buf, NULL, size);
+}
+
+/* random samples, loud enough that the mix clips often, with the odd NaN
+ * and infinity thrown in */
+static void init_lines(void)
+{
+	source_frames = (size_t)SECONDS * SAMPLE_RATE;
+
+	for (size_t i = 0; i < LINES; i++) {
+		struct test_line *line = &lines[i];
+
+		line->source = bmalloc(source_frames * CHANNELS *
+				sizeof(float));
+
+		for (size_t j = 0; j < source_frames * CHANNELS; j++) {
+			int r = rand();
+
+			if (r % 100000 == 0)
+				line->source[j] = NAN;
+			else if (r % 100000 == 1)
+				line->source[j] = (r & 0x100) ?
+					INFINITY : -INFINITY;
+			else
+				line->source[j] = (float)r / RAND_MAX - 0.5f;
+		}
+	}
+}
+
+static void reset_lines(void)
+{
+	for (size_t i = 0; i < LINES; i++) {
+		for (size_t ch = 0; ch < CHANNELS; ch++) {
+			circlebuf_free(&lines[i].buffers[ch]);
+			circlebuf_init(&lines[i].buffers[ch]);
+		}
+		lines[i].source_pos = i * 37;
+	}
+}
+
+/* keeps at least one period of data buffered in each line */
+static void fill_line(struct test_line *line)
+{
+	while (line->buffers[0].size < PERIOD_FRAMES * sizeof(float)) {
+		for (size_t ch = 0; ch < CHANNELS; ch++) {
+			const float *src = line->source +
+				ch * source_frames + line->source_pos;
+			size_t frames = CHUNK_FRAMES;
+
+			if (line->source_pos + frames > source_frames)
+				frames = source_frames - line->source_pos;
+
+			circlebuf_push_back(&line->buffers[ch], src,
+					frames * sizeof(float));
+		}
+
+		line->source_pos += CHUNK_FRAMES;
+		if (line->source_pos >= source_frames)
+			line->source_pos = 0;
+	}
+}
+
+/* mixes every period in to 'output' (when it isn't NULL), and returns the
+ * time spent mixing */
+static uint64_t run_mix(audio_mix_float_t func, float *output)
+{
+	size_t size = PERIOD_FRAMES * sizeof(float);
+	float mix[CHANNELS][PERIOD_FRAMES];
+	uint64_t mix_time = 0;
+
+	reset_lines();
+
+	for (size_t period = 0; period < PERIODS; period++) {
+		uint64_t start;
+
+		for (size_t i = 0; i < LINES; i++)
+			fill_line(&lines[i]);
+
+		start = os_gettime_ns();
+		memset(mix, 0, sizeof(mix));
+
+		for (size_t i = 0; i < LINES; i++) {
+			for (size_t ch = 0; ch < CHANNELS; ch++) {
+				struct circlebuf *buf = &lines[i].buffers[ch];
+
+				if (func)
+					mix_float_spans(func, mix[ch], buf,
+							size);
+				else
+					mix_float_old(mix[ch], buf, size);
+			}
+		}
+
+		mix_time += os_gettime_ns() - start;
+
+		if (output)
+			memcpy(output + period * CHANNELS * PERIOD_FRAMES,
+					mix, sizeof(mix));
+	}
+
+	return mix_time;
+}
+
+static void print_time(const char *name, uint64_t mix_time,
+		uint64_t old_time)
+{
+	double sec = (double)mix_time / 1000000000.0;
+
+	printf("%-10s %8.2f ms for %d seconds of audio (%7.0fx real time, "
+	       "%.2fx the old loop)\n", name, sec * 1000.0, SECONDS,
+	       (double)SECONDS / sec, (double)old_time / (double)mix_time);
+}
+
+int main(void)
+{
+	struct mix_func funcs[3];
+	size_t num_funcs = 0;
+	size_t output_size = (size_t)PERIODS * CHANNELS * PERIOD_FRAMES;
+	float *expected = bmalloc(output_size * sizeof(float));
+	float *output   = bmalloc(output_size * sizeof(float));
+	uint64_t old_time;
+	bool success = true;
+
+	srand(1);
+	init_lines();
+
+	funcs[num_funcs++] = (struct mix_func){"sse2", audio_mix_float_sse2};
+	if (os_get_cpu_features() & OS_CPU_FEATURE_AVX)
+		funcs[num_funcs++] = (struct mix_func){"avx",
+			audio_mix_float_avx};
+	funcs[num_funcs++] = (struct mix_func){"selected",
+		audio_get_mix_float_func()};
+
+	printf("mixing %d lines of %d hz stereo, %d frames per period\n",
+			LINES, SAMPLE_RATE, PERIOD_FRAMES);
+
+	old_time = run_mix(NULL, expected);
+	print_time("old", old_time, old_time);
+
+	for (size_t i = 0; i < num_funcs; i++) {
+		uint64_t mix_time = run_mix(funcs[i].func, output);
+
+		print_time(funcs[i].name, mix_time, old_time);
+
+		if (memcmp(expected, output, output_size * sizeof(float))) {
+			fprintf(stderr, "%s: output differs from the old "
+			                "loop\n", funcs[i].name);
+			success = false;
+		}
+	}
+
+	for (size_t i = 0; i < LINES; i++) {
+		for (size_t ch = 0; ch < CHANNELS; ch++)
+			circlebuf_free(&lines[i].buffers[ch]);
+		bfree(lines[i].source);
+	}
+
+	bfree(expected);
+	bfree(output);
+	return success ? 0 : 1;
+}
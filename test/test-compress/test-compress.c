@@ -0,0 +1,248 @@
+/*
+ * Tests and times the conversion of the packed 444 YUV output frames to
+ * I420/NV12 (media-io/format-conversion.c and format-conversion-avx2.c).
+ *
+ * The AVX2 functions have to produce exactly the same bytes as the SSE2
+ * ones, at a range of widths (including ones that aren't a multiple of the
+ * AVX2 block size) and with the rows split in to bands by task pools of
+ * different sizes the same way convert_frame does.
+ *
+ * Then 1080p and 2160p frames are converted with SSE2 and AVX2 on one
+ * thread, and with the runtime selected function split across a task pool,
+ * and the time per frame is printed for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/task-pool.h>
+#include <media-io/format-conversion.h>
+
+#define BENCHMARK_FRAMES 30
+
+typedef void (*compress_func_t)(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
+
+struct test_frame {
+	compress_func_t  func;
+	uint8_t          *input;
+	uint32_t         in_linesize;
+	uint32_t         height;
+	uint8_t          *output[3];
+	uint32_t         out_linesize[3];
+	size_t           out_size[3];
+};
+
+static void compress_band(void *param, uint32_t start_y, uint32_t end_y)
+{
+	struct test_frame *f = param;
+
+	f->func(f->input, f->in_linesize, start_y, end_y,
+			f->output, f->out_linesize);
+}
+
+static uint8_t *random_data(size_t size)
+{
+	uint8_t *data = bmalloc(size);
+	for (size_t i = 0; i < size; i++)
+		data[i] = (uint8_t)rand();
+	return data;
+}
+
+/* the output linesizes are the same as convert_frame uses, plus padding.
+ * the luma linesize also sets the width that is converted, so only the
+ * chroma planes are padded */
+static void frame_init(struct test_frame *f, bool nv12, uint32_t width,
+		uint32_t height, uint32_t in_pad, uint32_t out_pad)
+{
+	memset(f, 0, sizeof(*f));
+
+	f->height          = height;
+	f->in_linesize     = width * 4 + in_pad;
+	f->input           = random_data((size_t)f->in_linesize * height);
+	f->out_linesize[0] = width;
+	f->out_size[0]     = (size_t)f->out_linesize[0] * height;
+
+	if (nv12) {
+		f->out_linesize[1] = width + out_pad;
+		f->out_size[1]     = (size_t)f->out_linesize[1] * height / 2;
+	} else {
+		f->out_linesize[1] = width / 2 + out_pad;
+		f->out_linesize[2] = width / 2 + out_pad;
+		f->out_size[1]     = (size_t)f->out_linesize[1] * height / 2;
+		f->out_size[2]     = (size_t)f->out_linesize[2] * height / 2;
+	}
+
+	/* the output starts out with garbage so that any bytes written
+	 * outside of the image show up as well */
+	for (size_t i = 0; i < 3; i++)
+		if (f->out_size[i])
+			f->output[i] = random_data(f->out_size[i]);
+}
+
+static void frame_free(struct test_frame *f)
+{
+	bfree(f->input);
+	for (size_t i = 0; i < 3; i++)
+		bfree(f->output[i]);
+}
+
+static bool frames_equal(const struct test_frame *a,
+		const struct test_frame *b)
+{
+	for (size_t i = 0; i < 3; i++) {
+		if (a->out_size[i] &&
+		    memcmp(a->output[i], b->output[i], a->out_size[i]) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool test_frame(task_pool_t pool, bool nv12, uint32_t width,
+		uint32_t height, uint32_t in_pad, uint32_t out_pad)
+{
+	struct test_frame sse2, avx2;
+	bool success;
+
+	frame_init(&sse2, nv12, width, height, in_pad, out_pad);
+	avx2 = sse2;
+	avx2.input = bmemdup(sse2.input, (size_t)sse2.in_linesize * height);
+	for (size_t i = 0; i < 3; i++)
+		if (sse2.out_size[i])
+			avx2.output[i] = bmemdup(sse2.output[i],
+					sse2.out_size[i]);
+
+	sse2.func = nv12 ? compress_uyvx_to_nv12_sse2 :
+		compress_uyvx_to_i420_sse2;
+	avx2.func = nv12 ? compress_uyvx_to_nv12_avx2 :
+		compress_uyvx_to_i420_avx2;
+
+	task_pool_run_bands(NULL, height, 2, compress_band, &sse2);
+	task_pool_run_bands(pool, height, 2, compress_band, &avx2);
+
+	success = frames_equal(&sse2, &avx2);
+	if (!success)
+		fprintf(stderr, "%s %ux%u (input padding %u, output padding "
+		                "%u, %u threads): AVX2 output differs from "
+		                "SSE2\n",
+		                nv12 ? "NV12" : "I420", width, height, in_pad,
+		                out_pad, (uint32_t)task_pool_threads(pool));
+
+	frame_free(&sse2);
+	frame_free(&avx2);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static const uint32_t widths[]  = {4, 8, 12, 16, 20, 28, 36, 60, 100, 1284};
+static const uint32_t heights[] = {2, 4, 10, 32};
+static const uint32_t in_pads[] = {0, 16, 64};
+static const uint32_t out_pads[]= {0, 4, 32};
+static const size_t   threads[] = {0, 1, 3};
+
+#define countof(x) (sizeof(x) / sizeof(x[0]))
+
+static bool test_equivalence(void)
+{
+	size_t failures = 0;
+	size_t count = 0;
+
+	for (size_t t = 0; t < countof(threads); t++) {
+		task_pool_t pool = task_pool_create(threads[t]);
+
+		for (int nv12 = 0; nv12 <= 1; nv12++)
+		for (size_t w = 0; w < countof(widths); w++)
+		for (size_t h = 0; h < countof(heights); h++)
+		for (size_t ip = 0; ip < countof(in_pads); ip++)
+		for (size_t op = 0; op < countof(out_pads); op++) {
+			if (!test_frame(pool, nv12 != 0, widths[w],
+						heights[h], in_pads[ip],
+						out_pads[op]))
+				failures++;
+			count++;
+		}
+
+		task_pool_destroy(pool);
+	}
+
+	printf("%u of %u AVX2 conversion tests matched SSE2\n",
+			(uint32_t)(count - failures), (uint32_t)count);
+	return failures == 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static double time_frames(task_pool_t pool, struct test_frame *f)
+{
+	uint64_t start = os_gettime_ns();
+
+	for (int i = 0; i < BENCHMARK_FRAMES; i++)
+		task_pool_run_bands(pool, f->height, 2, compress_band, f);
+
+	return (double)(os_gettime_ns() - start) / 1000000.0 /
+		BENCHMARK_FRAMES;
+}
+
+static void benchmark(task_pool_t pool, bool have_avx2, bool nv12,
+		uint32_t width, uint32_t height)
+{
+	struct test_frame f;
+	double sse2_ms, avx2_ms = 0.0, pool_ms;
+
+	frame_init(&f, nv12, width, height, 0, 0);
+
+	f.func  = nv12 ? compress_uyvx_to_nv12_sse2 :
+		compress_uyvx_to_i420_sse2;
+	sse2_ms = time_frames(NULL, &f);
+
+	if (have_avx2) {
+		f.func  = nv12 ? compress_uyvx_to_nv12_avx2 :
+			compress_uyvx_to_i420_avx2;
+		avx2_ms = time_frames(NULL, &f);
+	}
+
+	f.func  = nv12 ? compress_uyvx_to_nv12 : compress_uyvx_to_i420;
+	pool_ms = time_frames(pool, &f);
+
+	printf("%s %4ux%-4u  SSE2 %6.2f ms", nv12 ? "NV12" : "I420",
+			width, height, sse2_ms);
+	if (have_avx2)
+		printf("  AVX2 %6.2f ms (%.2fx)", avx2_ms, sse2_ms / avx2_ms);
+	printf("  %u threads %6.2f ms (%.2fx)\n",
+			(uint32_t)task_pool_threads(pool) + 1, pool_ms,
+			sse2_ms / pool_ms);
+
+	frame_free(&f);
+}
+
+int main(void)
+{
+	bool have_avx2 = (os_get_cpu_features() & OS_CPU_FEATURE_AVX2) != 0;
+	int cores = os_get_logical_cores();
+	task_pool_t pool;
+	bool success = true;
+
+	srand(1);
+
+	if (have_avx2)
+		success = test_equivalence();
+	else
+		printf("no AVX2 support, only timing SSE2\n");
+
+	/* the same number of threads as the video thread would use if it had
+	 * every core to itself, up to four */
+	pool = task_pool_create(cores > 4 ? 3 : (size_t)(cores - 1));
+
+	for (int nv12 = 0; nv12 <= 1; nv12++) {
+		benchmark(pool, have_avx2, nv12 != 0, 1920, 1080);
+		benchmark(pool, have_avx2, nv12 != 0, 3840, 2160);
+	}
+
+	task_pool_destroy(pool);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/*
+ * Compares the SSE2 frame decompression functions in
+ * media-io/format-conversion.c byte for byte against plain scalar versions.
+ *
+ * Each format is run at a range of odd and even widths, with input and
+ * output linesizes that are wider than the image, and split in to row bands
+ * by task pools of different sizes the same way update_async_texture does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/task-pool.h>
+#include <media-io/format-conversion.h>
+
+enum test_format {
+	TEST_420,
+	TEST_NV12,
+	TEST_422_Y,
+	TEST_422_U
+};
+
+static const char *format_names[] = {"420", "NV12", "422 (YUY2)", "422 (UYVY)"};
+
+struct test_frame {
+	enum test_format format;
+	uint8_t          *data[3];
+	uint32_t         linesize[3];
+	uint32_t         height;
+	uint8_t          *output;
+	uint32_t         out_linesize;
+};
+
+static inline uint32_t min_uint32(uint32_t a, uint32_t b)
+{
+	return a < b ? a : b;
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar reference versions                                                  */
+
+static void ref_420(const struct test_frame *f, uint8_t *output)
+{
+	uint32_t width_d2 = min_uint32(f->linesize[0], f->out_linesize/4)/2;
+
+	for (uint32_t y = 0; y < f->height/2; y++) {
+		const uint8_t *lum0 = f->data[0] + y * 2 * f->linesize[0];
+		const uint8_t *lum1 = lum0 + f->linesize[0];
+		const uint8_t *u    = f->data[1] + y * f->linesize[1];
+		const uint8_t *v    = f->data[2] + y * f->linesize[2];
+		uint8_t *out0 = output + y * 2 * f->out_linesize;
+		uint8_t *out1 = out0 + f->out_linesize;
+
+		for (uint32_t x = 0; x < width_d2 * 2; x++) {
+			out0[x*4+0] = lum0[x]; out0[x*4+1] = u[x/2];
+			out0[x*4+2] = v[x/2];  out0[x*4+3] = 0;
+			out1[x*4+0] = lum1[x]; out1[x*4+1] = u[x/2];
+			out1[x*4+2] = v[x/2];  out1[x*4+3] = 0;
+		}
+	}
+}
+
+static void ref_nv12(const struct test_frame *f, uint8_t *output)
+{
+	uint32_t width_d2 = min_uint32(f->linesize[0], f->out_linesize/4)/2;
+
+	for (uint32_t y = 0; y < f->height/2; y++) {
+		const uint8_t *lum0 = f->data[0] + y * 2 * f->linesize[0];
+		const uint8_t *lum1 = lum0 + f->linesize[0];
+		const uint8_t *uv   = f->data[1] + y * f->linesize[1];
+		uint8_t *out0 = output + y * 2 * f->out_linesize;
+		uint8_t *out1 = out0 + f->out_linesize;
+
+		for (uint32_t x = 0; x < width_d2 * 2; x++) {
+			uint8_t u = uv[(x/2)*2];
+			uint8_t v = uv[(x/2)*2 + 1];
+
+			out0[x*4+0] = lum0[x]; out0[x*4+1] = u;
+			out0[x*4+2] = v;       out0[x*4+3] = 0;
+			out1[x*4+0] = lum1[x]; out1[x*4+1] = u;
+			out1[x*4+2] = v;       out1[x*4+3] = 0;
+		}
+	}
+}
+
+/* each 4 byte input group holds two pixels sharing chroma.  the first pixel
+ * is copied as is, the second has its own luma byte moved to where the first
+ * pixel's luma byte was */
+static void ref_422(const struct test_frame *f, uint8_t *output,
+		bool leading_lum)
+{
+	uint32_t width_d2 = min_uint32(f->linesize[0], f->out_linesize/2)/4;
+	int lum0 = leading_lum ? 0 : 1;
+	int lum1 = leading_lum ? 2 : 3;
+
+	for (uint32_t y = 0; y < f->height; y++) {
+		const uint8_t *in = f->data[0] + y * f->linesize[0];
+		uint8_t *out = output + y * f->out_linesize;
+
+		for (uint32_t x = 0; x < width_d2; x++) {
+			memcpy(out, in, 4);
+			memcpy(out + 4, in, 4);
+			out[4 + lum0] = in[lum1];
+
+			in  += 4;
+			out += 8;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void decompress_band(void *param, uint32_t start_y, uint32_t end_y)
+{
+	struct test_frame *f = param;
+
+	if (f->format == TEST_420)
+		decompress_420((const uint8_t* const*)f->data, f->linesize,
+				start_y, end_y, f->output, f->out_linesize);
+	else if (f->format == TEST_NV12)
+		decompress_nv12((const uint8_t* const*)f->data, f->linesize,
+				start_y, end_y, f->output, f->out_linesize);
+	else
+		decompress_422(f->data[0], f->linesize[0],
+				start_y, end_y, f->output, f->out_linesize,
+				f->format == TEST_422_Y);
+}
+
+static uint8_t *random_plane(uint32_t size)
+{
+	uint8_t *plane = bmalloc(size);
+	for (uint32_t i = 0; i < size; i++)
+		plane[i] = (uint8_t)rand();
+	return plane;
+}
+
+static bool test_frame(task_pool_t pool, enum test_format format,
+		uint32_t width, uint32_t height, uint32_t in_pad,
+		uint32_t out_pad)
+{
+	struct test_frame f = {0};
+	uint8_t *expected;
+	size_t out_size;
+	bool success;
+
+	f.format = format;
+	f.height = height;
+
+	if (format == TEST_420) {
+		f.linesize[0] = width + in_pad;
+		f.linesize[1] = (width+1)/2 + in_pad;
+		f.linesize[2] = (width+1)/2 + in_pad;
+		f.data[0] = random_plane(f.linesize[0] * height);
+		f.data[1] = random_plane(f.linesize[1] * ((height+1)/2));
+		f.data[2] = random_plane(f.linesize[2] * ((height+1)/2));
+		f.out_linesize = width * 4 + out_pad;
+
+	} else if (format == TEST_NV12) {
+		f.linesize[0] = width + in_pad;
+		f.linesize[1] = ((width+1)/2) * 2 + in_pad;
+		f.data[0] = random_plane(f.linesize[0] * height);
+		f.data[1] = random_plane(f.linesize[1] * ((height+1)/2));
+		f.out_linesize = width * 4 + out_pad;
+
+	} else {
+		f.linesize[0] = ((width+1)/2) * 4 + in_pad;
+		f.data[0] = random_plane(f.linesize[0] * height);
+		f.out_linesize = width * 4 + out_pad;
+	}
+
+	/* the output starts out with the same garbage in both buffers so that
+	 * any byte written outside of the expected area shows up as well */
+	out_size = (size_t)f.out_linesize * height;
+	f.output = random_plane((uint32_t)out_size);
+	expected = bmemdup(f.output, out_size);
+
+	if (format == TEST_420)
+		ref_420(&f, expected);
+	else if (format == TEST_NV12)
+		ref_nv12(&f, expected);
+	else
+		ref_422(&f, expected, format == TEST_422_Y);
+
+	task_pool_run_bands(pool, height, 2, decompress_band, &f);
+
+	success = memcmp(expected, f.output, out_size) == 0;
+	if (!success) {
+		size_t i = 0;
+		while (expected[i] == f.output[i])
+			i++;
+
+		fprintf(stderr, "%s %ux%u (input padding %u, output padding "
+		                "%u, %u threads): mismatch at row %u, byte "
+		                "%u\n",
+		                format_names[format], width, height, in_pad,
+		                out_pad, (uint32_t)task_pool_threads(pool),
+		                (uint32_t)(i / f.out_linesize),
+		                (uint32_t)(i % f.out_linesize));
+	}
+
+	for (size_t i = 0; i < 3; i++)
+		bfree(f.data[i]);
+	bfree(f.output);
+	bfree(expected);
+	return success;
+}
+
+static const uint32_t widths[]  = {2, 6, 15, 16, 17, 31, 32, 33, 47, 130, 641};
+static const uint32_t heights[] = {2, 4, 9, 18, 31};
+static const uint32_t pads[]    = {0, 4, 12, 64};
+static const size_t   threads[] = {0, 1, 2, 5};
+
+#define countof(x) (sizeof(x) / sizeof(x[0]))
+
+int main(void)
+{
+	size_t failures = 0;
+	size_t count = 0;
+
+	srand(1);
+
+	for (size_t t = 0; t < countof(threads); t++) {
+		task_pool_t pool = task_pool_create(threads[t]);
+
+		for (int format = TEST_420; format <= TEST_422_U; format++)
+		for (size_t w = 0; w < countof(widths); w++)
+		for (size_t h = 0; h < countof(heights); h++)
+		for (size_t ip = 0; ip < countof(pads); ip++)
+		for (size_t op = 0; op < countof(pads); op++) {
+			if (!test_frame(pool, (enum test_format)format,
+						widths[w], heights[h],
+						pads[ip], pads[op]))
+				failures++;
+			count++;
+		}
+
+		task_pool_destroy(pool);
+	}
+
+	printf("%u of %u conversion tests passed\n",
+			(uint32_t)(count - failures), (uint32_t)count);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,469 @@
+/*
+ * Saves and loads a generated scene collection with 5000 sources, each with
+ * settings, filters and scene items, as JSON with obs_data_getjson and
+ * obs_data_create_from_json (libobs/obs-data.c), which write and read the
+ * text directly instead of going through a jansson DOM.
+ *
+ * The JSON has to be exactly what jansson writes for the same data with the
+ * flags obs-data used (JSON_PRESERVE_ORDER | JSON_INDENT(4)), and loading it
+ * has to give the same values of the same types, and the same text when it's
+ * saved again.
+ *
+ * The collection is also saved and loaded in the binary format
+ * (obs_data_write_binary and obs_data_create_from_binary), which has to give
+ * back the same values and the same JSON, and the same bytes whether it's
+ * written from the original data or from the data loaded from JSON.
+ * Truncated binary data has to be rejected.
+ *
+ * Then the time to save and load the collection and its size are printed for
+ * both formats, along with the time jansson takes just to dump and parse its
+ * DOM of it.  Saving and loading JSON used to do both of those and also
+ * convert between the DOM and obs_data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+#include <obs-data.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/array-serializer.h>
+
+#define SOURCES            5000
+#define SCENES             50
+#define SCENE_ITEMS        (SOURCES / SCENES)
+#define BENCHMARK_RUNS     5
+#define TRUNCATIONS        8
+
+static const char *source_ids[] = {
+	"image_source", "text_ft2_source", "ffmpeg_source",
+	"xshm_input", "pulse_input_capture", "color_source"
+};
+
+static const char *strings[] = {
+	"", "Arial", "/home/user/Videos/intro.mp4",
+	"Caf\xc3\xa9 \"main\" camera\n\tline two",
+	"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e \xf0\x9f\x8e\xae",
+	"C:\\Users\\user\\Pictures\\overlay.png",
+	"control \x01\x1f characters"
+};
+
+#define countof(x) (sizeof(x) / sizeof(x[0]))
+
+static double random_double(void)
+{
+	switch (rand() % 4) {
+	case 0:  return (double)(rand() % 100) / 10.0;
+	case 1:  return (double)rand() / RAND_MAX;
+	case 2:  return (double)rand() * 1e-9;
+	default: return (double)rand() * (double)rand() * 1e6;
+	}
+}
+
+static obs_data_t make_settings(size_t idx)
+{
+	obs_data_t settings = obs_data_create();
+	obs_data_t font     = obs_data_create();
+	char name[32];
+
+	obs_data_setstring(font, "face",  strings[idx % 2]);
+	obs_data_setint   (font, "size",  12 + rand() % 200);
+	obs_data_setint   (font, "flags", rand() % 16);
+	obs_data_setstring(font, "style", "Regular");
+
+	for (int i = 0; i < 8; i++) {
+		snprintf(name, sizeof(name), "value_%d", i);
+
+		switch (rand() % 4) {
+		case 0: obs_data_setint(settings, name, rand() - RAND_MAX / 2);
+			break;
+		case 1: obs_data_setdouble(settings, name, random_double());
+			break;
+		case 2: obs_data_setbool(settings, name, rand() % 2 != 0);
+			break;
+		default:
+			obs_data_setstring(settings, name,
+					strings[(size_t)rand() %
+						countof(strings)]);
+		}
+	}
+
+	obs_data_setobj(settings, "font", font);
+	obs_data_setint(settings, "color", 0xFF000000LL | rand());
+	obs_data_setdouble(settings, "speed_percent", 100.0);
+	obs_data_setbool(settings, "looping", idx % 3 == 0);
+
+	obs_data_release(font);
+	return settings;
+}
+
+static obs_data_array_t make_filters(size_t idx)
+{
+	obs_data_array_t filters = obs_data_array_create();
+
+	for (size_t i = 0; i < idx % 3; i++) {
+		obs_data_t filter   = obs_data_create();
+		obs_data_t settings = obs_data_create();
+		char name[32];
+
+		snprintf(name, sizeof(name), "Filter %u", (uint32_t)i);
+		obs_data_setdouble(settings, "gain_db", random_double());
+		obs_data_setstring(filter, "name", name);
+		obs_data_setstring(filter, "id", "gain_filter");
+		obs_data_setobj(filter, "settings", settings);
+		obs_data_array_push_back(filters, filter);
+
+		obs_data_release(settings);
+		obs_data_release(filter);
+	}
+
+	return filters;
+}
+
+static obs_data_t make_source(size_t idx)
+{
+	obs_data_t       source   = obs_data_create();
+	obs_data_t       settings = make_settings(idx);
+	obs_data_array_t filters  = make_filters(idx);
+	char name[32];
+
+	snprintf(name, sizeof(name), "Source %u", (uint32_t)idx);
+	obs_data_setstring(source, "name", name);
+	obs_data_setstring(source, "id",
+			source_ids[idx % countof(source_ids)]);
+	obs_data_setobj(source, "settings", settings);
+	obs_data_setdouble(source, "volume", random_double());
+	obs_data_setint(source, "mixers", 0xF);
+	obs_data_setint(source, "sync", 0);
+	obs_data_setint(source, "flags", 0);
+	obs_data_setarray(source, "filters", filters);
+
+	obs_data_array_release(filters);
+	obs_data_release(settings);
+	return source;
+}
+
+static obs_data_t make_scene(size_t idx)
+{
+	obs_data_t       scene    = obs_data_create();
+	obs_data_t       settings = obs_data_create();
+	obs_data_array_t items    = obs_data_array_create();
+	char name[32];
+
+	for (size_t i = 0; i < SCENE_ITEMS; i++) {
+		obs_data_t item = obs_data_create();
+		obs_data_t pos  = obs_data_create();
+
+		snprintf(name, sizeof(name), "Source %u",
+				(uint32_t)(idx * SCENE_ITEMS + i));
+		obs_data_setdouble(pos, "x", (double)(rand() % 1920));
+		obs_data_setdouble(pos, "y", (double)(rand() % 1080));
+		obs_data_setstring(item, "name", name);
+		obs_data_setbool(item, "visible", rand() % 4 != 0);
+		obs_data_setobj(item, "pos", pos);
+		obs_data_setdouble(item, "rot", random_double());
+		obs_data_array_push_back(items, item);
+
+		obs_data_release(pos);
+		obs_data_release(item);
+	}
+
+	snprintf(name, sizeof(name), "Scene %u", (uint32_t)idx);
+	obs_data_setarray(settings, "items", items);
+	obs_data_setstring(scene, "name", name);
+	obs_data_setstring(scene, "id", "scene");
+	obs_data_setobj(scene, "settings", settings);
+
+	obs_data_array_release(items);
+	obs_data_release(settings);
+	return scene;
+}
+
+static obs_data_t make_collection(void)
+{
+	obs_data_t       collection = obs_data_create();
+	obs_data_array_t sources    = obs_data_array_create();
+
+	for (size_t i = 0; i < SOURCES + SCENES; i++) {
+		obs_data_t source = i < SOURCES ?
+			make_source(i) : make_scene(i - SOURCES);
+
+		obs_data_array_push_back(sources, source);
+		obs_data_release(source);
+	}
+
+	obs_data_setstring(collection, "current_scene", "Scene 0");
+	obs_data_setarray(collection, "sources", sources);
+
+	obs_data_array_release(sources);
+	return collection;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool data_equal(obs_data_t a, obs_data_t b);
+
+static bool array_equal(obs_data_array_t a, obs_data_array_t b)
+{
+	size_t count = obs_data_array_count(a);
+	bool equal = count == obs_data_array_count(b);
+
+	for (size_t i = 0; equal && i < count; i++) {
+		obs_data_t a_obj = obs_data_array_item(a, i);
+		obs_data_t b_obj = obs_data_array_item(b, i);
+
+		equal = data_equal(a_obj, b_obj);
+
+		obs_data_release(a_obj);
+		obs_data_release(b_obj);
+	}
+
+	return equal;
+}
+
+static bool item_equal(obs_data_item_t a, obs_data_item_t b)
+{
+	enum obs_data_type type = obs_data_item_gettype(a);
+	bool equal;
+
+	if (type != obs_data_item_gettype(b))
+		return false;
+
+	switch (type) {
+	case OBS_DATA_STRING:
+		return strcmp(obs_data_item_getstring(a),
+				obs_data_item_getstring(b)) == 0;
+
+	case OBS_DATA_NUMBER:
+		if (obs_data_item_numtype(a) != obs_data_item_numtype(b))
+			return false;
+		if (obs_data_item_numtype(a) == OBS_DATA_NUM_INT)
+			return obs_data_item_getint(a) ==
+				obs_data_item_getint(b);
+		return obs_data_item_getdouble(a) ==
+			obs_data_item_getdouble(b);
+
+	case OBS_DATA_BOOLEAN:
+		return obs_data_item_getbool(a) == obs_data_item_getbool(b);
+
+	case OBS_DATA_OBJECT: {
+		obs_data_t a_obj = obs_data_item_getobj(a);
+		obs_data_t b_obj = obs_data_item_getobj(b);
+
+		equal = data_equal(a_obj, b_obj);
+
+		obs_data_release(a_obj);
+		obs_data_release(b_obj);
+		return equal;
+	}
+
+	case OBS_DATA_ARRAY: {
+		obs_data_array_t a_array = obs_data_item_getarray(a);
+		obs_data_array_t b_array = obs_data_item_getarray(b);
+
+		equal = array_equal(a_array, b_array);
+
+		obs_data_array_release(a_array);
+		obs_data_array_release(b_array);
+		return equal;
+	}
+
+	case OBS_DATA_NULL:
+		break;
+	}
+
+	return true;
+}
+
+/* the names are compared by the JSON, this compares the types and values,
+ * which the JSON alone doesn't show for numbers */
+static bool data_equal(obs_data_t a, obs_data_t b)
+{
+	obs_data_item_t a_item = obs_data_first(a);
+	obs_data_item_t b_item = obs_data_first(b);
+	bool equal = true;
+
+	while (equal && a_item && b_item) {
+		equal = item_equal(a_item, b_item);
+		obs_data_item_next(&a_item);
+		obs_data_item_next(&b_item);
+	}
+
+	equal = equal && !a_item && !b_item;
+
+	obs_data_item_release(&a_item);
+	obs_data_item_release(&b_item);
+	return equal;
+}
+
+static bool test_json(obs_data_t collection, const char *json)
+{
+	json_error_t error;
+	json_t *root;
+	char *dumped;
+	obs_data_t loaded;
+	bool matches_jansson, round_trip;
+
+	root = json_loads(json, JSON_REJECT_DUPLICATES, &error);
+	if (!root) {
+		fprintf(stderr, "jansson could not parse the JSON: %s "
+		                "(line %d)\n", error.text, error.line);
+		return false;
+	}
+
+	dumped = json_dumps(root, JSON_PRESERVE_ORDER | JSON_INDENT(4));
+	matches_jansson = dumped && strcmp(dumped, json) == 0;
+	free(dumped);
+	json_decref(root);
+
+	loaded     = obs_data_create_from_json(json);
+	round_trip = loaded && data_equal(collection, loaded) &&
+		strcmp(obs_data_getjson(loaded), json) == 0;
+	obs_data_release(loaded);
+
+	printf("%u bytes of JSON: %s jansson's, %s after loading\n",
+			(uint32_t)strlen(json),
+			matches_jansson ? "same as" : "DIFFERENT from",
+			round_trip ? "same" : "DIFFERENT");
+	return matches_jansson && round_trip;
+}
+
+static void write_binary(obs_data_t data, struct array_output_data *output)
+{
+	struct serializer s;
+
+	array_output_serializer_init(&s, output);
+	obs_data_write_binary(data, &s);
+}
+
+static bool test_binary(obs_data_t collection, const char *json)
+{
+	struct array_output_data binary, from_json;
+	obs_data_t loaded, json_loaded;
+	bool round_trip, same_bytes;
+	size_t rejected = 0;
+
+	write_binary(collection, &binary);
+
+	loaded     = obs_data_create_from_binary(binary.bytes.array,
+			binary.bytes.num);
+	round_trip = loaded && data_equal(collection, loaded) &&
+		strcmp(obs_data_getjson(loaded), json) == 0;
+	obs_data_release(loaded);
+
+	json_loaded = obs_data_create_from_json(json);
+	write_binary(json_loaded, &from_json);
+	same_bytes = binary.bytes.num == from_json.bytes.num &&
+		memcmp(binary.bytes.array, from_json.bytes.array,
+				binary.bytes.num) == 0;
+	obs_data_release(json_loaded);
+
+	for (int i = 0; i < TRUNCATIONS; i++) {
+		size_t size = i == 0 ? binary.bytes.num - 1 :
+			(size_t)rand() % binary.bytes.num;
+
+		loaded = obs_data_create_from_binary(binary.bytes.array, size);
+		if (!loaded)
+			rejected++;
+		obs_data_release(loaded);
+	}
+
+	printf("%u bytes of binary data: %s after loading, %s when written "
+	       "from JSON, %u of %u truncations rejected\n",
+	       (uint32_t)binary.bytes.num,
+	       round_trip ? "same" : "DIFFERENT",
+	       same_bytes ? "same" : "DIFFERENT",
+	       (uint32_t)rejected, TRUNCATIONS);
+
+	array_output_serializer_free(&from_json);
+	array_output_serializer_free(&binary);
+	return round_trip && same_bytes && rejected == TRUNCATIONS;
+}
+
+static inline double avg_ms(uint64_t ns)
+{
+	return (double)ns / 1000000.0 / BENCHMARK_RUNS;
+}
+
+static void benchmark(obs_data_t collection, const char *json)
+{
+	uint64_t save_ns = 0, load_ns = 0, dump_ns = 0, parse_ns = 0;
+	uint64_t bin_save_ns = 0, bin_load_ns = 0;
+	json_t *root = json_loads(json, 0, NULL);
+	size_t bin_size = 0;
+
+	for (int i = 0; i < BENCHMARK_RUNS; i++) {
+		struct array_output_data binary;
+		uint64_t start;
+		obs_data_t loaded;
+		json_t *parsed;
+
+		start = os_gettime_ns();
+		obs_data_getjson(collection);
+		save_ns += os_gettime_ns() - start;
+
+		start = os_gettime_ns();
+		write_binary(collection, &binary);
+		bin_save_ns += os_gettime_ns() - start;
+
+		start  = os_gettime_ns();
+		loaded = obs_data_create_from_binary(binary.bytes.array,
+				binary.bytes.num);
+		bin_load_ns += os_gettime_ns() - start;
+
+		bin_size = binary.bytes.num;
+		obs_data_release(loaded);
+		array_output_serializer_free(&binary);
+
+		start = os_gettime_ns();
+		free(json_dumps(root, JSON_PRESERVE_ORDER | JSON_INDENT(4)));
+		dump_ns += os_gettime_ns() - start;
+
+		start  = os_gettime_ns();
+		loaded = obs_data_create_from_json(json);
+		load_ns += os_gettime_ns() - start;
+
+		start  = os_gettime_ns();
+		parsed = json_loads(json, JSON_REJECT_DUPLICATES, NULL);
+		parse_ns += os_gettime_ns() - start;
+
+		obs_data_release(loaded);
+		json_decref(parsed);
+	}
+
+	json_decref(root);
+
+	printf("JSON    save %7.2f ms  load %7.2f ms  %8u bytes\n",
+			avg_ms(save_ns), avg_ms(load_ns),
+			(uint32_t)strlen(json));
+	printf("binary  save %7.2f ms  load %7.2f ms  %8u bytes "
+	       "(%.1fx faster, %.1fx smaller)\n",
+			avg_ms(bin_save_ns), avg_ms(bin_load_ns),
+			(uint32_t)bin_size,
+			(double)(save_ns + load_ns) /
+				(double)(bin_save_ns + bin_load_ns),
+			(double)strlen(json) / (double)bin_size);
+	printf("jansson dump %7.2f ms  parse %7.2f ms (DOM only)\n",
+			avg_ms(dump_ns), avg_ms(parse_ns));
+}
+
+int main(void)
+{
+	obs_data_t collection;
+	char *json;
+	bool success;
+
+	srand(1);
+
+	collection = make_collection();
+	json       = bstrdup(obs_data_getjson(collection));
+
+	success = test_json(collection, json);
+	success = test_binary(collection, json) && success;
+	benchmark(collection, json);
+
+	bfree(json);
+	obs_data_release(collection);
+	return success ? 0 : 1;
+}
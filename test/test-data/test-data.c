@@ -0,0 +1,252 @@
+/*
+ * Fills obs_data objects (libobs/obs-data.c) with 10, 100 and 1000 keys, the
+ * sizes of a typical source, a large source or encoder, and a scene
+ * collection's list of sources, and then erases and re-adds a third of them.
+ *
+ * Every key has to read back the value it was last set to, erased keys have
+ * to be gone, and the keys have to be saved in the same order as before the
+ * index was added: the most recently added key first.
+ *
+ * Then the time per get and per set of an existing key is printed for each
+ * size, along with the time per lookup of the old item list, which compared
+ * the name of every item in front of the one it was looking for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <obs-data.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#define MAX_KEYS           1000
+#define BENCHMARK_OPS      2000000
+#define OLD_BENCHMARK_OPS  200000
+
+static char   names[MAX_KEYS][32];
+static size_t order[MAX_KEYS];
+
+static void make_names(size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		snprintf(names[i], sizeof(names[i]), "setting_%u_%x",
+				(uint32_t)i, (uint32_t)(i * 2654435761U));
+		order[i] = i;
+	}
+
+	/* look the keys up in a different order from the one they're in */
+	for (size_t i = count; i > 1; i--) {
+		size_t j   = (size_t)rand() % i;
+		size_t tmp = order[i - 1];
+		order[i - 1] = order[j];
+		order[j]     = tmp;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool check_values(obs_data_t data, size_t count, long long offset,
+		const bool *erased)
+{
+	for (size_t i = 0; i < count; i++) {
+		bool has = obs_data_has_user_value(data, names[i]);
+
+		if (erased && erased[i]) {
+			if (has)
+				return false;
+		} else if (!has ||
+		           obs_data_getint(data, names[i]) !=
+		           (long long)i + offset) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* the items are saved newest first, so expected lists the keys in the
+ * order they were added and is checked backwards */
+static bool check_order(obs_data_t data, const size_t *expected, size_t num)
+{
+	const char *json = obs_data_getjson(data);
+	const char *pos  = json;
+	size_t found = 0;
+	char key[40];
+
+	for (size_t i = num; i > 0; i--) {
+		snprintf(key, sizeof(key), "\"%s\":", names[expected[i - 1]]);
+		pos = strstr(pos, key);
+		if (!pos)
+			return false;
+	}
+
+	for (pos = json; (pos = strstr(pos, "\"setting_")) != NULL; pos++)
+		found++;
+
+	return found == num;
+}
+
+static bool test_keys(size_t count)
+{
+	obs_data_t data = obs_data_create();
+	bool   erased[MAX_KEYS] = {0};
+	size_t expected[MAX_KEYS] = {0};
+	size_t num = 0;
+	bool   success;
+
+	make_names(count);
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_setint(data, names[i], (long long)i);
+		expected[num++] = i;
+	}
+
+	success = check_values(data, count, 0, NULL) &&
+		check_order(data, expected, num);
+
+	/* overwriting a key keeps its position */
+	for (size_t i = 0; i < count; i++)
+		obs_data_setint(data, names[order[i]], (long long)order[i] + 1);
+
+	success = success && check_values(data, count, 1, NULL) &&
+		check_order(data, expected, num);
+
+	/* erase a third of the keys in random order, which moves the other
+	 * entries around in the index */
+	for (size_t i = 0; i < count; i += 3) {
+		obs_data_erase(data, names[order[i]]);
+		erased[order[i]] = true;
+	}
+
+	num = 0;
+	for (size_t i = 0; i < count; i++)
+		if (!erased[i])
+			expected[num++] = i;
+
+	success = success && check_values(data, count, 1, erased) &&
+		check_order(data, expected, num);
+
+	/* and add them back */
+	for (size_t i = 0; i < count; i += 3) {
+		obs_data_setint(data, names[order[i]], (long long)order[i] + 1);
+		expected[num++] = order[i];
+	}
+
+	success = success && check_values(data, count, 1, NULL) &&
+		check_order(data, expected, num);
+
+	printf("%4u keys: %s\n", (uint32_t)count,
+			success ? "values and order correct" : "FAILED");
+
+	obs_data_release(data);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* the item list that was searched before the index */
+struct old_item {
+	struct old_item *next;
+	char            *name;
+	long long       val;
+};
+
+static struct old_item *old_get_item(struct old_item *first, const char *name)
+{
+	struct old_item *item = first;
+
+	while (item) {
+		if (strcmp(item->name, name) == 0)
+			return item;
+
+		item = item->next;
+	}
+
+	return NULL;
+}
+
+static double time_old(size_t count)
+{
+	struct old_item *first = NULL, **last = &first;
+	size_t rounds = OLD_BENCHMARK_OPS / count;
+	long long sum = 0;
+	uint64_t start;
+
+	for (size_t i = 0; i < count; i++) {
+		struct old_item *item = bzalloc(sizeof(struct old_item));
+		item->name = names[i];
+		item->val  = (long long)i;
+		*last = item;
+		last  = &item->next;
+	}
+
+	start = os_gettime_ns();
+	for (size_t r = 0; r < rounds; r++)
+		for (size_t i = 0; i < count; i++)
+			sum += old_get_item(first, names[order[i]])->val;
+	start = os_gettime_ns() - start;
+
+	while (first) {
+		struct old_item *next = first->next;
+		bfree(first);
+		first = next;
+	}
+
+	/* keeps the lookups from being optimized out */
+	if (sum < 0)
+		printf("\n");
+
+	return (double)start / (double)(rounds * count);
+}
+
+static void benchmark(size_t count)
+{
+	obs_data_t data = obs_data_create();
+	size_t rounds = BENCHMARK_OPS / count;
+	double get_ns, set_ns, old_ns;
+	long long sum = 0;
+	uint64_t start;
+
+	make_names(count);
+
+	for (size_t i = 0; i < count; i++)
+		obs_data_setint(data, names[i], (long long)i);
+
+	start = os_gettime_ns();
+	for (size_t r = 0; r < rounds; r++)
+		for (size_t i = 0; i < count; i++)
+			sum += obs_data_getint(data, names[order[i]]);
+	get_ns = (double)(os_gettime_ns() - start) / (double)(rounds * count);
+
+	start = os_gettime_ns();
+	for (size_t r = 0; r < rounds; r++)
+		for (size_t i = 0; i < count; i++)
+			obs_data_setint(data, names[order[i]], (long long)r);
+	set_ns = (double)(os_gettime_ns() - start) / (double)(rounds * count);
+
+	old_ns = time_old(count);
+
+	if (sum < 0)
+		printf("\n");
+
+	printf("%4u keys: get %7.1f ns, set %7.1f ns, old lookup %7.1f ns "
+	       "(%.1fx)\n", (uint32_t)count, get_ns, set_ns, old_ns,
+	       old_ns / get_ns);
+
+	obs_data_release(data);
+}
+
+int main(void)
+{
+	static const size_t counts[] = {10, 100, MAX_KEYS};
+	bool success = true;
+
+	srand(1);
+
+	for (size_t i = 0; i < 3; i++)
+		success = test_keys(counts[i]) && success;
+	for (size_t i = 0; i < 3; i++)
+		benchmark(counts[i]);
+
+	return success ? 0 : 1;
+}
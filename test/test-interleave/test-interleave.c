@@ -0,0 +1,366 @@
+/*
+ * Feeds the packet interleaver used by outputs (libobs/obs-interleave.c) a
+ * video stream and three audio tracks whose packets arrive with random
+ * delays and in bursts, the way they do when each encoder runs on its own
+ * thread.
+ *
+ * The packets have to come out in dts order, with each stream's packets in
+ * their original order and none of them lost, apart from audio from before
+ * the first video packet.
+ *
+ * Then one video and one audio stream are interleaved with the old sorted
+ * array, which inserted each packet with a linear scan and sent at most one
+ * packet per packet received, and with the interleaver, and the time per
+ * packet is printed for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <obs.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include "obs-interleave.h"
+
+#define AUDIO_TRACKS       3
+#define STREAMS            (AUDIO_TRACKS + 1)
+#define DURATION_SEC       600
+
+#define FPS                30
+#define SAMPLE_RATE        48000
+#define AUDIO_FRAMES       1024
+
+/* the time the encoders were started at */
+#define VIDEO_START_USEC   5000000LL
+
+/* how late a packet can arrive, and how often and for how long a stream's
+ * packets are held up and then arrive all at once */
+#define VIDEO_JITTER_USEC  150000
+#define AUDIO_JITTER_USEC  40000
+#define BURST_INTERVAL     (10 * 1000000LL)
+#define BURST_USEC         500000
+
+struct test_packet {
+	int64_t            arrival;
+	int                stream;
+	uint32_t           seq;
+	int64_t            dts;
+	int64_t            dts_usec;
+};
+
+struct test_stream {
+	int32_t            timebase_den;
+	int64_t            dts_step;
+	int64_t            start_usec;
+	int64_t            jitter_usec;
+	int64_t            burst_offset;
+	uint32_t           count;
+};
+
+static int64_t rand_usec(int64_t max)
+{
+	return (int64_t)((double)rand() / RAND_MAX * (double)max);
+}
+
+static DARRAY(struct test_packet) packets;
+
+/* each stream's packets arrive in dts order, but at random times relative to
+ * the other streams */
+static void generate_stream(int idx, struct test_stream *stream)
+{
+	int64_t last_arrival = 0;
+	int64_t duration     = DURATION_SEC * (int64_t)stream->timebase_den;
+
+	for (int64_t dts = 0; dts < duration; dts += stream->dts_step) {
+		struct test_packet *packet = da_push_back_new(packets);
+		int64_t usec = stream->start_usec +
+			dts * 1000000 / stream->timebase_den;
+		int64_t arrival = usec + rand_usec(stream->jitter_usec);
+		int64_t burst = (usec + stream->burst_offset) % BURST_INTERVAL;
+
+		if (burst < BURST_USEC)
+			arrival += BURST_USEC - burst;
+		if (arrival < last_arrival)
+			arrival = last_arrival;
+
+		packet->arrival  = arrival;
+		packet->stream   = idx;
+		packet->seq      = stream->count++;
+		packet->dts      = dts;
+		packet->dts_usec = usec;
+
+		last_arrival = arrival;
+	}
+}
+
+static int compare_arrival(const void *a_ptr, const void *b_ptr)
+{
+	const struct test_packet *a = a_ptr;
+	const struct test_packet *b = b_ptr;
+
+	if (a->arrival != b->arrival)
+		return a->arrival < b->arrival ? -1 : 1;
+	if (a->stream != b->stream)
+		return a->stream - b->stream;
+	return a->seq < b->seq ? -1 : 1;
+}
+
+static void generate_packets(struct test_stream *streams, int num_streams)
+{
+	da_free(packets);
+
+	for (int i = 0; i < num_streams; i++)
+		generate_stream(i, streams + i);
+
+	qsort(packets.array, packets.num, sizeof(struct test_packet),
+			compare_arrival);
+}
+
+static void make_packet(struct encoder_packet *out,
+		const struct test_packet *packet, uint32_t *payload,
+		const struct test_stream *streams)
+{
+	memset(out, 0, sizeof(*out));
+
+	*payload = packet->seq;
+	out->data         = (uint8_t*)payload;
+	out->size         = sizeof(*payload);
+	out->dts          = packet->dts;
+	out->pts          = packet->dts;
+	out->timebase_num = 1;
+	out->timebase_den = streams[packet->stream].timebase_den;
+	out->dts_usec     = packet->dts_usec;
+	out->keyframe     = true;
+
+	if (packet->stream == 0) {
+		out->type = OBS_ENCODER_VIDEO;
+	} else {
+		out->type      = OBS_ENCODER_AUDIO;
+		out->track_idx = (size_t)(packet->stream - 1);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct stream_check {
+	uint32_t           first_seq;
+	uint32_t           next_seq;
+	uint32_t           received;
+	bool               started;
+};
+
+static struct stream_check checks[STREAMS];
+static int64_t last_dts_usec;
+static size_t  out_of_order;
+static size_t  lost;
+static size_t  bad_offsets;
+
+static void check_packet(const struct encoder_packet *packet)
+{
+	int stream = packet->type == OBS_ENCODER_VIDEO ?
+		0 : (int)packet->track_idx + 1;
+	struct stream_check *check = &checks[stream];
+	uint32_t seq = *(uint32_t*)packet->data;
+
+	if (packet->dts_usec < last_dts_usec || packet->dts_usec < 0)
+		out_of_order++;
+	last_dts_usec = packet->dts_usec;
+
+	/* the first packet of each stream starts at 0, and audio packets that
+	 * were dropped before the first video packet are skipped */
+	if (!check->started) {
+		if (packet->dts != 0 || (stream == 0 && seq != 0))
+			bad_offsets++;
+		check->first_seq = seq;
+		check->next_seq  = seq;
+		check->started   = true;
+	}
+
+	if (seq != check->next_seq)
+		lost++;
+
+	check->next_seq = seq + 1;
+	check->received++;
+}
+
+static bool test_order(void)
+{
+	struct test_stream streams[STREAMS] = {
+		{FPS,         1,            VIDEO_START_USEC,
+			VIDEO_JITTER_USEC, 0,       0},
+		{SAMPLE_RATE, AUDIO_FRAMES, VIDEO_START_USEC - 100000,
+			AUDIO_JITTER_USEC, 2500000, 0},
+		{SAMPLE_RATE, AUDIO_FRAMES, VIDEO_START_USEC - 7000,
+			AUDIO_JITTER_USEC, 5000000, 0},
+		{SAMPLE_RATE, AUDIO_FRAMES, VIDEO_START_USEC + 13000,
+			AUDIO_JITTER_USEC, 7500000, 0},
+	};
+	struct packet_interleaver il;
+	struct encoder_packet out;
+	size_t max_queued = 0;
+	size_t queued     = 0;
+	bool success;
+
+	memset(&il, 0, sizeof(il));
+	memset(checks, 0, sizeof(checks));
+	packet_interleaver_reset(&il, AUDIO_TRACKS);
+	generate_packets(streams, STREAMS);
+
+	for (size_t i = 0; i < packets.num; i++) {
+		struct encoder_packet packet;
+		uint32_t payload;
+
+		make_packet(&packet, packets.array + i, &payload, streams);
+		if (packet_interleaver_push(&il, &packet))
+			queued++;
+
+		while (packet_interleaver_pop(&il, &out)) {
+			check_packet(&out);
+			obs_free_encoder_packet(&out);
+			queued--;
+		}
+
+		if (queued > max_queued)
+			max_queued = queued;
+	}
+
+	/* whatever wasn't sent has to still be queued */
+	for (int i = 0; i < STREAMS; i++) {
+		struct circlebuf *queue = i == 0 ? &il.video : &il.audio[i - 1];
+		size_t left = queue->size / sizeof(struct encoder_packet);
+
+		if (checks[i].received + left !=
+				streams[i].count - checks[i].first_seq)
+			lost++;
+	}
+
+	packet_interleaver_free(&il);
+
+	printf("%u packets, %u sent, %u still queued (at most %u): "
+	       "%u out of order, %u lost, %u bad offsets\n",
+	       (uint32_t)packets.num,
+	       (uint32_t)(checks[0].received + checks[1].received +
+		       checks[2].received + checks[3].received),
+	       (uint32_t)queued, (uint32_t)max_queued,
+	       (uint32_t)out_of_order, (uint32_t)lost,
+	       (uint32_t)bad_offsets);
+
+	success = !out_of_order && !lost && !bad_offsets && checks[0].started;
+	for (int i = 1; i < STREAMS; i++)
+		success = success && checks[i].started;
+
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* the interleaving from before the per-stream queues */
+struct old_interleaver {
+	DARRAY(struct encoder_packet) packets;
+	int64_t            highest_video_ts;
+	int64_t            highest_audio_ts;
+	bool               received_video;
+	bool               received_audio;
+};
+
+static void old_interleave(struct old_interleaver *il,
+		struct encoder_packet *packet)
+{
+	struct encoder_packet out;
+	size_t idx;
+
+	obs_duplicate_encoder_packet(&out, packet);
+
+	for (idx = 0; idx < il->packets.num; idx++) {
+		if (out.dts_usec < il->packets.array[idx].dts_usec)
+			break;
+	}
+
+	da_insert(il->packets, idx, &out);
+
+	if (out.type == OBS_ENCODER_VIDEO) {
+		il->received_video = true;
+		if (il->highest_video_ts < out.dts_usec)
+			il->highest_video_ts = out.dts_usec;
+	} else {
+		il->received_audio = true;
+		if (il->highest_audio_ts < out.dts_usec)
+			il->highest_audio_ts = out.dts_usec;
+	}
+
+	if (il->received_video && il->received_audio) {
+		struct encoder_packet *first = il->packets.array;
+		int64_t opposing = first->type == OBS_ENCODER_VIDEO ?
+			il->highest_audio_ts : il->highest_video_ts;
+
+		if (opposing > first->dts_usec) {
+			out = *first;
+			da_erase(il->packets, 0);
+			obs_free_encoder_packet(&out);
+		}
+	}
+}
+
+static double benchmark(bool old)
+{
+	struct test_stream streams[2] = {
+		{FPS,         1,            VIDEO_START_USEC,
+			VIDEO_JITTER_USEC, 0,       0},
+		{SAMPLE_RATE, AUDIO_FRAMES, VIDEO_START_USEC,
+			AUDIO_JITTER_USEC, 2500000, 0},
+	};
+	struct old_interleaver old_il;
+	struct packet_interleaver il;
+	uint64_t start;
+
+	memset(&old_il, 0, sizeof(old_il));
+	memset(&il, 0, sizeof(il));
+	packet_interleaver_reset(&il, 1);
+	generate_packets(streams, 2);
+
+	start = os_gettime_ns();
+
+	for (size_t i = 0; i < packets.num; i++) {
+		struct encoder_packet packet, out;
+		uint32_t payload;
+
+		make_packet(&packet, packets.array + i, &payload, streams);
+
+		if (old) {
+			old_interleave(&old_il, &packet);
+		} else {
+			packet_interleaver_push(&il, &packet);
+			while (packet_interleaver_pop(&il, &out))
+				obs_free_encoder_packet(&out);
+		}
+	}
+
+	start = os_gettime_ns() - start;
+
+	for (size_t i = 0; i < old_il.packets.num; i++)
+		obs_free_encoder_packet(old_il.packets.array + i);
+	da_free(old_il.packets);
+	packet_interleaver_free(&il);
+
+	return (double)start / (double)packets.num;
+}
+
+int main(void)
+{
+	double old_ns, new_ns;
+	bool success;
+
+	srand(1);
+
+	success = test_order();
+
+	old_ns = benchmark(true);
+	new_ns = benchmark(false);
+	printf("old sorted array %8.1f ns per packet\n", old_ns);
+	printf("interleaver      %8.1f ns per packet (%.2fx)\n", new_ns,
+			old_ns / new_ns);
+
+	da_free(packets);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,634 @@
+/*
+ * Connects to loopback stand-ins for RTMP servers with the connection code
+ * used by the RTMP output (plugins/obs-outputs/net-connect.c), which is
+ * compiled in to this test with getaddrinfo replaced, so that a host name can
+ * resolve to any list of loopback addresses:
+ *
+ *   - an address that refuses the connection, followed by one that accepts
+ *     it.  The connection has to fall back to the second address right away,
+ *     and the socket is then attached to librtmp with RTMP_AttachSocket and
+ *     has to get through the handshake and the connect command the same way
+ *     a socket from RTMP_Connect0 does.
+ *   - the same host again, which has to come from the DNS cache.
+ *   - two addresses that never answer (listeners with a full backlog),
+ *     followed by one that accepts.  The attempts have to be started in
+ *     parallel, the third one 500ms after the first, and the two that lost
+ *     have to be closed.
+ *   - addresses that all refuse, after which the host has to be removed from
+ *     the cache.
+ *   - an address that never answers, with the attempt cancelled by the stop
+ *     event, and with the attempt timing out.
+ *
+ * No socket may be left open apart from the one that's returned.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+static int fake_getaddrinfo(const char *node, const char *service,
+		const struct addrinfo *hints, struct addrinfo **res);
+static void fake_freeaddrinfo(struct addrinfo *res);
+
+#define getaddrinfo                   fake_getaddrinfo
+#define freeaddrinfo                  fake_freeaddrinfo
+
+#include "net-connect.c"
+
+#undef getaddrinfo
+#undef freeaddrinfo
+
+#include "librtmp/rtmp.h"
+
+#define MAX_ADDRESSES      4
+#define HANGING_BACKLOG    8
+
+/* size of C1/S1/C2/S2 (RTMP_SIG_SIZE in librtmp) */
+#define HANDSHAKE_SIZE     1536
+
+/* ------------------------------------------------------------------------- */
+/* resolver */
+
+static struct sockaddr_in resolve_addrs[MAX_ADDRESSES];
+static size_t             resolve_count;
+static int                resolve_calls;
+
+static void set_addresses(const struct sockaddr_in *addrs, size_t count)
+{
+	memcpy(resolve_addrs, addrs, count * sizeof(struct sockaddr_in));
+	resolve_count = count;
+}
+
+static int fake_getaddrinfo(const char *node, const char *service,
+		const struct addrinfo *hints, struct addrinfo **res)
+{
+	struct addrinfo *first = NULL;
+	struct addrinfo **next = &first;
+
+	UNUSED_PARAMETER(node);
+	UNUSED_PARAMETER(service);
+	UNUSED_PARAMETER(hints);
+
+	resolve_calls++;
+
+	if (!resolve_count)
+		return EAI_NONAME;
+
+	for (size_t i = 0; i < resolve_count; i++) {
+		struct addrinfo *ai = bzalloc(sizeof(struct addrinfo));
+
+		ai->ai_family   = AF_INET;
+		ai->ai_socktype = SOCK_STREAM;
+		ai->ai_protocol = IPPROTO_TCP;
+		ai->ai_addrlen  = sizeof(struct sockaddr_in);
+		ai->ai_addr     = bmemdup(resolve_addrs + i,
+				sizeof(struct sockaddr_in));
+
+		*next = ai;
+		next  = &ai->ai_next;
+	}
+
+	*res = first;
+	return 0;
+}
+
+static void fake_freeaddrinfo(struct addrinfo *res)
+{
+	while (res) {
+		struct addrinfo *next = res->ai_next;
+		bfree(res->ai_addr);
+		bfree(res);
+		res = next;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* stand-ins */
+
+static bool bind_loopback(int socket_fd, struct sockaddr_in *addr)
+{
+	socklen_t addr_len = sizeof(*addr);
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family      = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	return bind(socket_fd, (struct sockaddr*)addr, sizeof(*addr)) == 0 &&
+		getsockname(socket_fd, (struct sockaddr*)addr,
+				&addr_len) == 0;
+}
+
+/* a bound socket that isn't listening, which refuses connections */
+static int open_refusing(struct sockaddr_in *addr)
+{
+	int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (socket_fd >= 0 && !bind_loopback(socket_fd, addr)) {
+		close(socket_fd);
+		socket_fd = -1;
+	}
+
+	return socket_fd;
+}
+
+/* a listener whose backlog has been filled up by connections that are never
+ * accepted, so new connection attempts to it are left pending */
+struct hanging {
+	int                listen_socket;
+	int                fillers[HANGING_BACKLOG];
+	size_t             num_fillers;
+	struct sockaddr_in addr;
+};
+
+static bool connect_within(int socket_fd, const struct sockaddr_in *addr,
+		long usec)
+{
+	struct timeval timeout = {0, usec};
+	fd_set write_set;
+
+	set_blocking(socket_fd, false);
+
+	if (connect(socket_fd, (const struct sockaddr*)addr,
+				sizeof(*addr)) == 0)
+		return true;
+	if (errno != EINPROGRESS)
+		return false;
+
+	FD_ZERO(&write_set);
+	FD_SET(socket_fd, &write_set);
+	return select(socket_fd + 1, NULL, &write_set, NULL, &timeout) > 0 &&
+		get_connect_error(socket_fd) == 0;
+}
+
+static bool hanging_init(struct hanging *h)
+{
+	memset(h, 0, sizeof(*h));
+
+	h->listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (h->listen_socket < 0 ||
+	    !bind_loopback(h->listen_socket, &h->addr) ||
+	    listen(h->listen_socket, 0) != 0)
+		return false;
+
+	while (h->num_fillers < HANGING_BACKLOG) {
+		int filler = socket(AF_INET, SOCK_STREAM, 0);
+
+		h->fillers[h->num_fillers++] = filler;
+		if (!connect_within(filler, &h->addr, 100000))
+			return true;
+	}
+
+	fprintf(stderr, "could not fill the backlog of a listener\n");
+	return false;
+}
+
+static void hanging_free(struct hanging *h)
+{
+	for (size_t i = 0; i < h->num_fillers; i++)
+		close(h->fillers[i]);
+	if (h->listen_socket >= 0)
+		close(h->listen_socket);
+}
+
+/* a server that accepts connections and answers the RTMP handshake */
+struct stand_in {
+	int                listen_socket;
+	struct sockaddr_in addr;
+	pthread_t          thread;
+	volatile bool      stop;
+
+	/* connections accepted, and connections served and closed again */
+	volatile long      accepted;
+	volatile long      served;
+	bool               handshake_ok;
+	bool               connect_received;
+};
+
+static bool recv_all(int socket_fd, void *data, size_t size)
+{
+	uint8_t *ptr = data;
+
+	while (size) {
+		ssize_t ret = recv(socket_fd, ptr, size, 0);
+		if (ret <= 0)
+			return false;
+
+		ptr  += ret;
+		size -= (size_t)ret;
+	}
+
+	return true;
+}
+
+static bool send_all(int socket_fd, const void *data, size_t size)
+{
+	return send(socket_fd, data, size, 0) == (ssize_t)size;
+}
+
+/* checks the handshake, then that the first message after any protocol
+ * control messages (chunk stream 2) is the connect command: a type 0 header
+ * on chunk stream 3 for an AMF0 command message (0x14), whose body starts
+ * with the string "connect" */
+static void serve(struct stand_in *si, int socket_fd)
+{
+	static const uint8_t connect_str[] = {0x02, 0x00, 0x07,
+		'c', 'o', 'n', 'n', 'e', 'c', 't'};
+	uint8_t c0c1[HANDSHAKE_SIZE + 1];
+	uint8_t s0s1[HANDSHAKE_SIZE + 1];
+	uint8_t c2[HANDSHAKE_SIZE];
+	uint8_t header[12];
+	uint8_t body[128];
+
+	if (!recv_all(socket_fd, c0c1, sizeof(c0c1)) || c0c1[0] != 0x03)
+		return;
+
+	s0s1[0] = 0x03;
+	for (size_t i = 1; i < sizeof(s0s1); i++)
+		s0s1[i] = (uint8_t)rand();
+
+	if (!send_all(socket_fd, s0s1, sizeof(s0s1)) ||
+	    !send_all(socket_fd, c0c1 + 1, HANDSHAKE_SIZE) ||
+	    !recv_all(socket_fd, c2, sizeof(c2)))
+		return;
+
+	si->handshake_ok = memcmp(c2, s0s1 + 1, HANDSHAKE_SIZE) == 0;
+
+	for (;;) {
+		size_t size;
+
+		if (!recv_all(socket_fd, header, sizeof(header)))
+			return;
+
+		size = ((size_t)header[4] << 16) | ((size_t)header[5] << 8) |
+			header[6];
+
+		if (header[0] != 0x02)
+			break;
+		if (size > sizeof(body) || !recv_all(socket_fd, body, size))
+			return;
+	}
+
+	if (!recv_all(socket_fd, body, sizeof(connect_str)))
+		return;
+
+	si->connect_received = header[0] == 0x03 && header[7] == 0x14 &&
+		memcmp(body, connect_str, sizeof(connect_str)) == 0;
+}
+
+static void *stand_in_thread(void *data)
+{
+	struct stand_in *si = data;
+
+	while (!si->stop) {
+		struct timeval timeout = {0, 20000};
+		fd_set read_set;
+		int socket_fd;
+
+		FD_ZERO(&read_set);
+		FD_SET(si->listen_socket, &read_set);
+		if (select(si->listen_socket + 1, &read_set, NULL, NULL,
+					&timeout) <= 0)
+			continue;
+
+		socket_fd = accept(si->listen_socket, NULL, NULL);
+		if (socket_fd < 0)
+			continue;
+
+		os_atomic_inc_long(&si->accepted);
+		serve(si, socket_fd);
+		close(socket_fd);
+		os_atomic_inc_long(&si->served);
+	}
+
+	return NULL;
+}
+
+static bool stand_in_init(struct stand_in *si)
+{
+	memset(si, 0, sizeof(*si));
+
+	si->listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (si->listen_socket < 0 ||
+	    !bind_loopback(si->listen_socket, &si->addr) ||
+	    listen(si->listen_socket, 4) != 0)
+		return false;
+
+	return pthread_create(&si->thread, NULL, stand_in_thread, si) == 0;
+}
+
+/* waits for the stand-in to finish with a connection */
+static bool stand_in_wait(struct stand_in *si, long served)
+{
+	for (int i = 0; i < 100; i++) {
+		if (os_atomic_load_long(&si->served) >= served)
+			return true;
+		os_sleep_ms(10);
+	}
+
+	return false;
+}
+
+static void stand_in_free(struct stand_in *si)
+{
+	si->stop = true;
+	pthread_join(si->thread, NULL);
+	close(si->listen_socket);
+}
+
+/* ------------------------------------------------------------------------- */
+/* tests */
+
+static in_port_t server_ports[2];
+
+/* counts the open sockets, apart from the ones on the server side of a
+ * connection, which the stand-in opens and closes on its own thread */
+static int count_client_sockets(void)
+{
+	int count = 0;
+
+	for (int i = 0; i < 1024; i++) {
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+
+		if (getsockname(i, (struct sockaddr*)&addr, &addr_len) != 0)
+			continue;
+		if (addr.sin_port == server_ports[0] ||
+		    addr.sin_port == server_ports[1])
+			continue;
+
+		count++;
+	}
+
+	return count;
+}
+
+static inline double to_ms(uint64_t ns)
+{
+	return (double)ns / 1000000.0;
+}
+
+static bool check(bool condition, const char *test, const char *what)
+{
+	if (!condition)
+		fprintf(stderr, "%s: %s\n", test, what);
+	return condition;
+}
+
+/* connects, and then closes the socket, checking that nothing else was left
+ * open */
+static net_socket_t connect_and_check(const char *test, const char *host,
+		int timeout_sec, os_event_t stop_event,
+		struct net_connect_info *info, bool *success)
+{
+	int fds = count_client_sockets();
+	uint64_t start_ts = os_gettime_ns();
+	net_socket_t socket_fd;
+
+	socket_fd = net_connect(host, 1935, timeout_sec, stop_event, info);
+	start_ts  = os_gettime_ns() - start_ts;
+
+	*success = check(count_client_sockets() ==
+			fds + (socket_fd != NET_INVALID_SOCKET ? 1 : 0),
+			test, "sockets were left open") && *success;
+
+	printf("%-9s %s after %7.2f ms, %d attempt(s), dns %s, %s\n", test,
+			socket_fd != NET_INVALID_SOCKET ?
+				"connected" : "failed   ",
+			to_ms(start_ts), info->attempts,
+			info->dns_cached ? "cached" : "resolved",
+			info->address[0] ? info->address : "-");
+	return socket_fd;
+}
+
+static bool test_fallback(struct stand_in *si, struct sockaddr_in refused)
+{
+	struct sockaddr_in addrs[2] = {refused, si->addr};
+	struct net_connect_info info;
+	char url[] = "rtmp://fallback.test/live";
+	char key[] = "key";
+	int fds = count_client_sockets();
+	bool success = true;
+	net_socket_t socket_fd;
+	RTMP rtmp;
+
+	set_addresses(addrs, 2);
+	resolve_calls = 0;
+
+	RTMP_Init(&rtmp);
+	RTMP_SetupURL2(&rtmp, url, key);
+	RTMP_EnableWrite(&rtmp);
+
+	socket_fd = connect_and_check("fallback", "fallback.test",
+			rtmp.Link.timeout, NULL, &info, &success);
+	if (!check(socket_fd != NET_INVALID_SOCKET, "fallback",
+				"could not connect"))
+		return false;
+
+	success = check(info.attempts == 2, "fallback",
+			"expected two attempts") && success;
+	success = check(!info.dns_cached && resolve_calls == 1, "fallback",
+			"expected the host to be resolved") && success;
+	success = check(info.connect_ns < ATTEMPT_DELAY_NS, "fallback",
+			"didn't fall back right away") && success;
+
+	RTMP_AttachSocket(&rtmp, socket_fd);
+	success = check(RTMP_IsConnected(&rtmp) != 0, "fallback",
+			"attached socket isn't connected") && success;
+	success = check(RTMP_Connect1(&rtmp, NULL) != 0, "fallback",
+			"RTMP_Connect1 failed") && success;
+
+	RTMP_Close(&rtmp);
+
+	success = check(stand_in_wait(si, 1) && si->accepted == 1, "fallback",
+			"expected one connection to the stand-in") && success;
+	success = check(si->handshake_ok, "fallback",
+			"handshake didn't complete") && success;
+	success = check(si->connect_received, "fallback",
+			"connect command not received") && success;
+	success = check(count_client_sockets() == fds, "fallback",
+			"RTMP_Close left the socket open") && success;
+	return success;
+}
+
+static bool test_cached(struct stand_in *si)
+{
+	struct net_connect_info info;
+	bool success = true;
+	net_socket_t socket_fd;
+
+	/* the resolver would fail now, so the addresses have to be cached */
+	set_addresses(NULL, 0);
+	resolve_calls = 0;
+
+	socket_fd = connect_and_check("cached", "fallback.test", 5, NULL,
+			&info, &success);
+	if (!check(socket_fd != NET_INVALID_SOCKET, "cached",
+				"could not connect"))
+		return false;
+
+	close(socket_fd);
+
+	success = check(info.dns_cached && resolve_calls == 0, "cached",
+			"expected the cached addresses to be used") && success;
+	success = check(info.attempts == 2, "cached",
+			"expected the cached addresses in the same order") &&
+		success;
+	UNUSED_PARAMETER(si);
+	return success;
+}
+
+static bool test_parallel(struct stand_in *si, struct hanging *h)
+{
+	struct sockaddr_in addrs[3] = {h->addr, h->addr, si->addr};
+	struct net_connect_info info;
+	long accepted = os_atomic_load_long(&si->accepted);
+	bool success = true;
+	net_socket_t socket_fd;
+
+	set_addresses(addrs, 3);
+
+	socket_fd = connect_and_check("parallel", "parallel.test", 5, NULL,
+			&info, &success);
+	if (!check(socket_fd != NET_INVALID_SOCKET, "parallel",
+				"could not connect"))
+		return false;
+
+	close(socket_fd);
+
+	success = check(info.attempts == 3, "parallel",
+			"expected three attempts") && success;
+	success = check(info.connect_ns >= 2 * ATTEMPT_DELAY_NS, "parallel",
+			"attempts started too early") && success;
+	success = check(info.connect_ns < 2 * ATTEMPT_DELAY_NS + 500000000ULL,
+			"parallel", "attempts weren't made in parallel") &&
+		success;
+
+	success = check(stand_in_wait(si, accepted + 1) &&
+			si->accepted == accepted + 1, "parallel",
+			"expected one connection to the stand-in") && success;
+	return success;
+}
+
+static bool test_unreachable(struct sockaddr_in refused)
+{
+	struct sockaddr_in addrs[2] = {refused, refused};
+	struct net_connect_info info;
+	bool success = true;
+	net_socket_t socket_fd;
+
+	set_addresses(addrs, 2);
+	resolve_calls = 0;
+
+	socket_fd = connect_and_check("refused", "refused.test", 5, NULL,
+			&info, &success);
+	success = check(socket_fd == NET_INVALID_SOCKET, "refused",
+			"expected the connection to fail") && success;
+	success = check(info.attempts == 2 && info.error == ECONNREFUSED,
+			"refused", "expected both addresses to refuse") &&
+		success;
+
+	/* the host has to be resolved again the next time */
+	socket_fd = connect_and_check("refused", "refused.test", 5, NULL,
+			&info, &success);
+	success = check(socket_fd == NET_INVALID_SOCKET && resolve_calls == 2,
+			"refused", "host wasn't removed from the cache") &&
+		success;
+	return success;
+}
+
+static void *signal_thread(void *data)
+{
+	os_sleep_ms(100);
+	os_event_signal(data);
+	return NULL;
+}
+
+static bool test_cancel(struct hanging *h)
+{
+	struct net_connect_info info;
+	os_event_t stop_event;
+	pthread_t thread;
+	bool success = true;
+	uint64_t start_ts;
+	net_socket_t socket_fd;
+
+	set_addresses(&h->addr, 1);
+	resolve_calls = 0;
+
+	os_event_init(&stop_event, OS_EVENT_TYPE_MANUAL);
+	pthread_create(&thread, NULL, signal_thread, stop_event);
+
+	start_ts  = os_gettime_ns();
+	socket_fd = connect_and_check("stopped", "hanging.test", 5,
+			stop_event, &info, &success);
+	start_ts  = os_gettime_ns() - start_ts;
+	pthread_join(thread, NULL);
+	os_event_destroy(stop_event);
+
+	success = check(socket_fd == NET_INVALID_SOCKET, "stopped",
+			"expected the connection to fail") && success;
+	success = check(start_ts < 100000000ULL + 2 * WAIT_SLICE_NS,
+			"stopped", "stop event wasn't checked") && success;
+
+	/* a cancelled attempt doesn't mean the addresses are bad */
+	socket_fd = connect_and_check("timeout", "hanging.test", 1, NULL,
+			&info, &success);
+	success = check(resolve_calls == 1 && info.dns_cached, "stopped",
+			"cancelling removed the host from the cache") &&
+		success;
+	success = check(socket_fd == NET_INVALID_SOCKET &&
+			info.error == ETIMEDOUT, "timeout",
+			"expected the connection to time out") && success;
+	success = check(info.connect_ns == 0 && info.attempts == 1,
+			"timeout", "expected one attempt") && success;
+	return success;
+}
+
+int main(void)
+{
+	struct sockaddr_in refused;
+	struct stand_in si;
+	struct hanging h;
+	int refused_socket;
+	bool success = false;
+
+	srand(1);
+	net_dns_cache_init();
+
+	refused_socket = open_refusing(&refused);
+
+	if (refused_socket >= 0 && stand_in_init(&si)) {
+		if (hanging_init(&h)) {
+			server_ports[0] = si.addr.sin_port;
+			server_ports[1] = h.addr.sin_port;
+
+			success = test_fallback(&si, refused);
+			success = test_cached(&si) && success;
+			success = test_parallel(&si, &h) && success;
+			success = test_unreachable(refused) && success;
+			success = test_cancel(&h) && success;
+		}
+
+		hanging_free(&h);
+		stand_in_free(&si);
+	}
+
+	if (refused_socket >= 0)
+		close(refused_socket);
+
+	net_dns_cache_free();
+	return success ? 0 : 1;
+}
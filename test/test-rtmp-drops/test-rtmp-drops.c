@@ -0,0 +1,499 @@
+/*
+ * Streams a simulated H.264 stream over a throttled loopback TCP connection,
+ * once with the staged frame dropping used by the RTMP output
+ * (plugins/obs-outputs/frame-drops.c) and once with the old logic, which
+ * dropped all buffered video and waited for a keyframe whenever the send
+ * buffer went over the threshold.  Both run at the same time over their own
+ * connection, against the same bandwidth profile.
+ *
+ * The staged logic has to drop fewer frames in total, and no more reference
+ * frames, than the old logic did.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <obs.h>
+#include <obs-avc.h>
+#include <util/bmem.h>
+#include <util/circlebuf.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "frame-drops.h"
+
+/* the simulation runs this many times faster than real time, with the
+ * bandwidth scaled to match */
+#define SPEED              5
+
+#define FPS                30
+#define FRAME_USEC         (1000000LL / FPS)
+#define GOP_FRAMES         60
+#define DURATION_SEC       75
+#define THRESHOLD_USEC     600000LL
+
+/* average frame sizes, which add up to about 2.3 mbps of video */
+#define I_FRAME_SIZE       60000
+#define P_FRAME_SIZE       14000
+#define B_FRAME_SIZE       6000
+#define AUDIO_PACKET_SIZE  533
+
+enum frame_type {
+	FRAME_I,
+	FRAME_P,
+	FRAME_B,
+	FRAME_AUDIO,
+	FRAME_TYPE_COUNT
+};
+
+static const char *type_names[] = {"I", "P", "B", "audio"};
+
+/* link speed in kbps at a given point in the stream */
+static int link_kbps(int64_t usec)
+{
+	int64_t sec = usec / 1000000;
+
+	if (sec >= 10 && sec < 12) return 800;
+	if (sec >= 25 && sec < 27) return 800;
+	if (sec >= 40 && sec < 50) return 1900;
+	if (sec >= 60 && sec < 62) return 500;
+	return 3500;
+}
+
+struct test_stream {
+	const char        *name;
+	bool              staged;
+
+	int               send_socket;
+	int               recv_socket;
+	pthread_t         send_thread;
+	pthread_t         recv_thread;
+	bool              send_thread_active;
+	bool              recv_thread_active;
+
+	pthread_mutex_t   packets_mutex;
+	struct circlebuf  packets;
+	os_sem_t          send_sem;
+	volatile bool     stop;
+	int64_t           last_dts_usec;
+
+	/* staged frame drops */
+	struct frame_drops drops;
+
+	/* old frame drops */
+	int64_t           min_drop_dts_usec;
+	int               min_priority;
+
+	int               produced[FRAME_TYPE_COUNT];
+	int               sent[FRAME_TYPE_COUNT];
+	int               dropped[FRAME_TYPE_COUNT];
+	int64_t           max_buffer_usec;
+};
+
+static uint64_t start_time;
+
+static inline int64_t stream_time_usec(void)
+{
+	return (int64_t)(os_gettime_ns() - start_time) * SPEED / 1000;
+}
+
+/* ------------------------------------------------------------------------- */
+/* the old frame drop logic, as it was before the drop stages               */
+
+static void legacy_drop_frames(struct test_stream *ts)
+{
+	struct circlebuf new_buf            = {0};
+	int              drop_priority      = 0;
+	int64_t          last_drop_dts_usec = 0;
+
+	while (ts->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&ts->packets, &packet, sizeof(packet));
+
+		last_drop_dts_usec = packet.dts_usec;
+
+		if (packet.type == OBS_ENCODER_AUDIO) {
+			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
+
+		} else {
+			if (drop_priority < packet.drop_priority)
+				drop_priority = packet.drop_priority;
+
+			obs_free_encoder_packet(&packet);
+		}
+	}
+
+	circlebuf_free(&ts->packets);
+	ts->packets           = new_buf;
+	ts->min_priority      = drop_priority;
+	ts->min_drop_dts_usec = last_drop_dts_usec;
+}
+
+static bool legacy_check(struct test_stream *ts,
+		const struct encoder_packet *packet)
+{
+	if (ts->packets.size >= 5 * sizeof(struct encoder_packet)) {
+		struct encoder_packet first;
+		circlebuf_peek_front(&ts->packets, &first, sizeof(first));
+
+		if (first.dts_usec >= ts->min_drop_dts_usec &&
+		    ts->last_dts_usec - first.dts_usec > THRESHOLD_USEC)
+			legacy_drop_frames(ts);
+	}
+
+	if (packet->priority < ts->min_priority)
+		return false;
+
+	ts->min_priority = 0;
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline enum frame_type packet_frame_type(
+		const struct encoder_packet *packet)
+{
+	if (packet->type == OBS_ENCODER_AUDIO)
+		return FRAME_AUDIO;
+	if (packet->keyframe)
+		return FRAME_I;
+	return packet->priority == OBS_NAL_PRIORITY_DISPOSABLE ?
+		FRAME_B : FRAME_P;
+}
+
+static void *send_thread(void *data)
+{
+	struct test_stream *ts = data;
+
+	while (os_sem_wait(ts->send_sem) == 0) {
+		struct encoder_packet packet;
+		size_t sent = 0;
+
+		if (ts->stop)
+			break;
+
+		pthread_mutex_lock(&ts->packets_mutex);
+		if (!ts->packets.size) {
+			pthread_mutex_unlock(&ts->packets_mutex);
+			continue;
+		}
+		circlebuf_pop_front(&ts->packets, &packet, sizeof(packet));
+		pthread_mutex_unlock(&ts->packets_mutex);
+
+		while (sent < packet.size) {
+			ssize_t ret = send(ts->send_socket, packet.data + sent,
+					packet.size - sent, 0);
+			if (ret <= 0)
+				break;
+			sent += (size_t)ret;
+		}
+
+		ts->sent[packet_frame_type(&packet)]++;
+		obs_free_encoder_packet(&packet);
+	}
+
+	return NULL;
+}
+
+/* reads from the connection no faster than the link speed allows.  capacity
+ * that isn't used right away is only kept for a few milliseconds, like a
+ * real link */
+static void *recv_thread(void *data)
+{
+	struct test_stream *ts = data;
+	uint8_t  buf[16384];
+	double   budget    = 0.0;
+	int64_t  last_time = stream_time_usec();
+
+	for (;;) {
+		int64_t cur_time = stream_time_usec();
+		double  bytes_per_usec = link_kbps(cur_time) * 1000.0 / 8.0 /
+			1000000.0;
+		double  max_budget = bytes_per_usec * 20000.0;
+		ssize_t ret;
+		size_t  size;
+
+		budget += bytes_per_usec * (double)(cur_time - last_time);
+		if (budget > max_budget)
+			budget = max_budget;
+		last_time = cur_time;
+
+		if (budget < 1.0) {
+			os_sleep_ms(1);
+			continue;
+		}
+
+		size = budget < sizeof(buf) ? (size_t)budget : sizeof(buf);
+		ret  = recv(ts->recv_socket, buf, size, 0);
+		if (ret <= 0)
+			break;
+
+		budget -= (double)ret;
+	}
+
+	return NULL;
+}
+
+static bool open_loopback(struct test_stream *ts)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t addr_len = sizeof(addr);
+	int buf_size = 32768;
+	int listen_socket;
+	int nodelay = 1;
+
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_socket < 0)
+		return false;
+
+	if (bind(listen_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+	    listen(listen_socket, 1) != 0 ||
+	    getsockname(listen_socket, (struct sockaddr*)&addr,
+		    &addr_len) != 0) {
+		close(listen_socket);
+		return false;
+	}
+
+	/* keep the socket buffers small so that the throttled reader pushes
+	 * back on the sender right away */
+	ts->send_socket = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(ts->send_socket, SOL_SOCKET, SO_SNDBUF, &buf_size,
+			sizeof(buf_size));
+	setsockopt(ts->send_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+			sizeof(nodelay));
+
+	if (connect(ts->send_socket, (struct sockaddr*)&addr,
+				sizeof(addr)) != 0) {
+		close(listen_socket);
+		return false;
+	}
+
+	ts->recv_socket = accept(listen_socket, NULL, NULL);
+	close(listen_socket);
+
+	if (ts->recv_socket < 0)
+		return false;
+
+	setsockopt(ts->recv_socket, SOL_SOCKET, SO_RCVBUF, &buf_size,
+			sizeof(buf_size));
+	return true;
+}
+
+static bool test_stream_init(struct test_stream *ts, const char *name,
+		bool staged)
+{
+	memset(ts, 0, sizeof(struct test_stream));
+	ts->name          = name;
+	ts->staged        = staged;
+	ts->send_socket   = -1;
+	ts->recv_socket   = -1;
+
+	frame_drops_init(&ts->drops, THRESHOLD_USEC);
+	pthread_mutex_init(&ts->packets_mutex, NULL);
+
+	if (os_sem_init(&ts->send_sem, 0) != 0)
+		return false;
+	if (!open_loopback(ts))
+		return false;
+
+	ts->send_thread_active = pthread_create(&ts->send_thread, NULL,
+			send_thread, ts) == 0;
+	ts->recv_thread_active = pthread_create(&ts->recv_thread, NULL,
+			recv_thread, ts) == 0;
+
+	return ts->send_thread_active && ts->recv_thread_active;
+}
+
+static void test_stream_free(struct test_stream *ts)
+{
+	ts->stop = true;
+
+	/* the sender may be blocked on a full socket, so shut the connection
+	 * down before waiting for it */
+	if (ts->send_socket >= 0)
+		shutdown(ts->send_socket, SHUT_RDWR);
+	if (ts->recv_socket >= 0)
+		shutdown(ts->recv_socket, SHUT_RDWR);
+
+	if (ts->send_thread_active) {
+		os_sem_post(ts->send_sem);
+		pthread_join(ts->send_thread, NULL);
+	}
+	if (ts->recv_thread_active)
+		pthread_join(ts->recv_thread, NULL);
+
+	while (ts->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&ts->packets, &packet, sizeof(packet));
+		ts->sent[packet_frame_type(&packet)]++;
+		obs_free_encoder_packet(&packet);
+	}
+
+	for (int i = 0; i < FRAME_TYPE_COUNT; i++)
+		ts->dropped[i] = ts->produced[i] - ts->sent[i];
+
+	if (ts->send_socket >= 0)
+		close(ts->send_socket);
+	if (ts->recv_socket >= 0)
+		close(ts->recv_socket);
+
+	circlebuf_free(&ts->packets);
+	os_sem_destroy(ts->send_sem);
+	pthread_mutex_destroy(&ts->packets_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint32_t rand_state = 1;
+
+/* identical for both streams, so they get the same packets */
+static inline int frame_size(int average)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return average * 8 / 10 + (int)((rand_state >> 16) % (average * 4 / 10));
+}
+
+static void make_packet(struct encoder_packet *packet, enum frame_type type,
+		int size, int64_t dts_usec)
+{
+	memset(packet, 0, sizeof(struct encoder_packet));
+	packet->data     = bzalloc(size);
+	packet->size     = size;
+	packet->dts_usec = dts_usec;
+	packet->type     = type == FRAME_AUDIO ?
+		OBS_ENCODER_AUDIO : OBS_ENCODER_VIDEO;
+
+	if (type == FRAME_I) {
+		packet->keyframe = true;
+		packet->priority = OBS_NAL_PRIORITY_HIGHEST;
+	} else if (type == FRAME_P) {
+		packet->priority = OBS_NAL_PRIORITY_HIGH;
+	} else {
+		packet->priority = OBS_NAL_PRIORITY_DISPOSABLE;
+	}
+
+	/* same as obs_parse_avc_packet_info */
+	packet->drop_priority = packet->priority < OBS_NAL_PRIORITY_HIGH ?
+		packet->priority : OBS_NAL_PRIORITY_HIGHEST;
+}
+
+static void add_packet(struct test_stream *ts, enum frame_type type,
+		int size, int64_t dts_usec)
+{
+	struct encoder_packet packet;
+	bool added = true;
+
+	make_packet(&packet, type, size, dts_usec);
+	ts->produced[type]++;
+
+	pthread_mutex_lock(&ts->packets_mutex);
+
+	if (type != FRAME_AUDIO)
+		added = ts->staged ?
+			frame_drops_check(&ts->drops, &ts->packets,
+					ts->last_dts_usec, &packet) :
+			legacy_check(ts, &packet);
+
+	if (added) {
+		struct encoder_packet first;
+
+		circlebuf_push_back(&ts->packets, &packet, sizeof(packet));
+		ts->last_dts_usec = dts_usec;
+
+		circlebuf_peek_front(&ts->packets, &first, sizeof(first));
+		if (dts_usec - first.dts_usec > ts->max_buffer_usec)
+			ts->max_buffer_usec = dts_usec - first.dts_usec;
+	}
+
+	pthread_mutex_unlock(&ts->packets_mutex);
+
+	if (added)
+		os_sem_post(ts->send_sem);
+	else
+		obs_free_encoder_packet(&packet);
+}
+
+static inline enum frame_type gop_frame_type(int frame)
+{
+	int idx = frame % GOP_FRAMES;
+
+	if (idx == 0)
+		return FRAME_I;
+	return (idx % 3) == 0 ? FRAME_P : FRAME_B;
+}
+
+static void print_results(struct test_stream *ts)
+{
+	int video_dropped = ts->dropped[FRAME_I] + ts->dropped[FRAME_P] +
+		ts->dropped[FRAME_B];
+	int video_total = ts->produced[FRAME_I] + ts->produced[FRAME_P] +
+		ts->produced[FRAME_B];
+
+	printf("%-7s dropped %4d of %d video frames (", ts->name,
+			video_dropped, video_total);
+	for (int i = 0; i < FRAME_TYPE_COUNT; i++)
+		printf("%s%s %d", i ? ", " : "", type_names[i],
+				ts->dropped[i]);
+	printf("), max buffer %d ms\n", (int)(ts->max_buffer_usec / 1000));
+}
+
+int main(void)
+{
+	struct test_stream staged, legacy;
+	int staged_dropped, legacy_dropped;
+	int staged_ref_dropped, legacy_ref_dropped;
+	bool success;
+
+	start_time = os_gettime_ns();
+
+	if (!test_stream_init(&staged, "staged", true) ||
+	    !test_stream_init(&legacy, "old", false)) {
+		fprintf(stderr, "failed to set up the loopback connections\n");
+		return 1;
+	}
+
+	for (int frame = 0; frame < DURATION_SEC * FPS; frame++) {
+		static const int sizes[] = {
+			I_FRAME_SIZE, P_FRAME_SIZE, B_FRAME_SIZE};
+		int64_t dts_usec = frame * FRAME_USEC;
+		enum frame_type type = gop_frame_type(frame);
+		int size = frame_size(sizes[type]);
+
+		os_sleepto_ns(start_time + (uint64_t)dts_usec * 1000 / SPEED);
+
+		add_packet(&staged, type, size, dts_usec);
+		add_packet(&legacy, type, size, dts_usec);
+		add_packet(&staged, FRAME_AUDIO, AUDIO_PACKET_SIZE, dts_usec);
+		add_packet(&legacy, FRAME_AUDIO, AUDIO_PACKET_SIZE, dts_usec);
+	}
+
+	test_stream_free(&staged);
+	test_stream_free(&legacy);
+
+	print_results(&staged);
+	print_results(&legacy);
+
+	staged_dropped = staged.dropped[FRAME_I] + staged.dropped[FRAME_P] +
+		staged.dropped[FRAME_B];
+	legacy_dropped = legacy.dropped[FRAME_I] + legacy.dropped[FRAME_P] +
+		legacy.dropped[FRAME_B];
+	staged_ref_dropped = staged.dropped[FRAME_I] + staged.dropped[FRAME_P];
+	legacy_ref_dropped = legacy.dropped[FRAME_I] + legacy.dropped[FRAME_P];
+
+	success = legacy_dropped > 0 &&
+		staged_dropped < legacy_dropped &&
+		staged_ref_dropped <= legacy_ref_dropped;
+
+	if (!success)
+		fprintf(stderr, "staged frame dropping did not do better than "
+		                "the old logic\n");
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,426 @@
+/*
+ * Streams the same packets through the two send paths of the RTMP output
+ * (plugins/obs-outputs/rtmp-stream.c), each over its own loopback TCP
+ * connection: the vectored path, which writes the chunk headers in to an
+ * arena and hands the socket a list of buffers pointing at the packet data,
+ * and the RTMP_Write path, which muxes each packet in to an FLV tag and has
+ * librtmp chunk it.
+ *
+ * The plugin is compiled in to this test.  The RTMP_Write path is chosen by
+ * giving that connection a custom send function, which the vectored path
+ * can't be used with.
+ *
+ * The packets cover the cases the chunk headers have to handle the same way
+ * librtmp does: timestamp 0, repeated sizes and timestamps, a timestamp jump
+ * that needs an extended timestamp, packets smaller and larger than the chunk
+ * size, changes of the chunk size, and video packets with more NAL units
+ * than fit in one call to writev.  Both connections have to receive exactly
+ * the same bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <obs.h>
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+static const char *fake_module_text(const char *lookup)
+{
+	return lookup;
+}
+
+#define obs_module_text               fake_module_text
+
+#include "rtmp-stream.c"
+
+#define PACKETS            6000
+#define FPS                30
+#define SAMPLE_RATE        48000
+#define AUDIO_FRAMES       1024
+#define KEYFRAME_INTERVAL  60
+#define MAX_BATCH          24
+
+/* the point in the stream where the timestamps jump far enough ahead that
+ * the next chunk header needs an extended timestamp */
+#define JUMP_PACKET        (PACKETS / 2)
+#define JUMP_MS            0x1000000LL
+
+struct test_conn {
+	const char         *name;
+	struct rtmp_stream *stream;
+	int                recv_socket;
+	pthread_t          recv_thread;
+	bool               recv_thread_active;
+	DARRAY(uint8_t)    received;
+	uint64_t           send_ns;
+};
+
+static void *recv_thread(void *data)
+{
+	struct test_conn *conn = data;
+	uint8_t buf[65536];
+	ssize_t ret;
+
+	while ((ret = recv(conn->recv_socket, buf, sizeof(buf), 0)) > 0)
+		da_push_back_array(conn->received, buf, (size_t)ret);
+
+	return NULL;
+}
+
+/* the send path librtmp takes with a custom send function is the same as
+ * without one, apart from the function that writes to the socket */
+static int plain_send(RTMPSockBuf *sb, const char *buf, int len, void *param)
+{
+	UNUSED_PARAMETER(param);
+	return (int)send(sb->sb_socket, buf, len, 0);
+}
+
+static bool open_loopback(int *send_socket, int *recv_socket)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t addr_len = sizeof(addr);
+	int listen_socket;
+
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_socket < 0)
+		return false;
+
+	if (bind(listen_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+	    listen(listen_socket, 1) != 0 ||
+	    getsockname(listen_socket, (struct sockaddr*)&addr,
+		    &addr_len) != 0) {
+		close(listen_socket);
+		return false;
+	}
+
+	*send_socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(*send_socket, (struct sockaddr*)&addr,
+				sizeof(addr)) != 0) {
+		close(listen_socket);
+		return false;
+	}
+
+	*recv_socket = accept(listen_socket, NULL, NULL);
+	close(listen_socket);
+	return *recv_socket >= 0;
+}
+
+static bool test_conn_init(struct test_conn *conn, const char *name,
+		bool vectored)
+{
+	struct rtmp_stream *stream;
+	int send_socket;
+
+	memset(conn, 0, sizeof(struct test_conn));
+	conn->name        = name;
+	conn->recv_socket = -1;
+	conn->stream      = stream = bzalloc(sizeof(struct rtmp_stream));
+
+	RTMP_Init(&stream->rtmp);
+
+	if (!open_loopback(&send_socket, &conn->recv_socket))
+		return false;
+
+	stream->rtmp.m_sb.sb_socket = send_socket;
+	stream->rtmp.m_stream_id    = 1;
+
+	if (!vectored) {
+		stream->rtmp.m_bCustomSend    = true;
+		stream->rtmp.m_customSendFunc = plain_send;
+	}
+
+	conn->recv_thread_active = pthread_create(&conn->recv_thread, NULL,
+			recv_thread, conn) == 0;
+	return conn->recv_thread_active;
+}
+
+/* closes the sending side and waits for everything sent to arrive */
+static void test_conn_finish(struct test_conn *conn)
+{
+	struct rtmp_stream *stream = conn->stream;
+
+	if (stream->rtmp.m_sb.sb_socket >= 0)
+		shutdown(stream->rtmp.m_sb.sb_socket, SHUT_WR);
+	if (conn->recv_thread_active)
+		pthread_join(conn->recv_thread, NULL);
+	if (conn->recv_socket >= 0)
+		close(conn->recv_socket);
+
+	/* no deleteStream message on the way out */
+	stream->rtmp.m_stream_id = 0;
+	RTMP_Close(&stream->rtmp);
+
+	da_free(stream->send_packets);
+	da_free(stream->send_nals);
+	da_free(stream->send_arena);
+	da_free(stream->send_bufs);
+	bfree(stream);
+}
+
+static void test_conn_free(struct test_conn *conn)
+{
+	da_free(conn->received);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static DARRAY(struct encoder_packet) packets;
+
+static inline uint8_t random_byte(void)
+{
+	/* no zero bytes, so the payload can't contain a start code */
+	return (uint8_t)(rand() % 255 + 1);
+}
+
+/* the Annex B data of the video packet being generated */
+static DARRAY(uint8_t) nal_data;
+
+static void add_nal(int type, size_t size, bool long_start_code)
+{
+	static const uint8_t start_code[] = {0, 0, 0, 1};
+	uint8_t header = (uint8_t)(0x60 | type);
+
+	if (long_start_code)
+		da_push_back_array(nal_data, start_code, 4);
+	else
+		da_push_back_array(nal_data, start_code + 1, 3);
+
+	da_push_back(nal_data, &header);
+	for (size_t i = 1; i < size; i++) {
+		uint8_t val = random_byte();
+		da_push_back(nal_data, &val);
+	}
+}
+
+static void make_video_packet(size_t frame, int64_t jump)
+{
+	struct encoder_packet *packet = da_push_back_new(packets);
+
+	nal_data.num = 0;
+
+	if (frame % KEYFRAME_INTERVAL == 0) {
+		add_nal(7, 12, true);
+		add_nal(8, 4, false);
+		add_nal(6, 20, true);
+		add_nal(5, 20000 + rand() % 40000, true);
+
+	} else if (frame % 97 == 0) {
+		/* more NAL units than there can be buffers in one writev */
+		for (int i = 0; i < 300; i++)
+			add_nal(1, 1 + rand() % 64, i % 2 == 0);
+
+	} else {
+		add_nal(1, 16 + rand() % 6000, frame % 3 == 0);
+	}
+
+	packet->type         = OBS_ENCODER_VIDEO;
+	packet->timebase_num = 1;
+	packet->timebase_den = FPS;
+	packet->dts          = (int64_t)frame + jump * FPS / 1000;
+	packet->pts          = packet->dts + (int64_t)(frame % 3);
+	packet->data         = bmemdup(nal_data.array, nal_data.num);
+	packet->size         = nal_data.num;
+	obs_parse_avc_packet_info(packet);
+}
+
+static void make_audio_packet(size_t frame, int64_t jump, size_t size)
+{
+	struct encoder_packet *packet = da_push_back_new(packets);
+
+	packet->type         = OBS_ENCODER_AUDIO;
+	packet->timebase_num = 1;
+	packet->timebase_den = SAMPLE_RATE;
+	packet->dts          = (int64_t)frame * AUDIO_FRAMES +
+		jump * SAMPLE_RATE / 1000;
+	packet->pts          = packet->dts;
+	packet->size         = size;
+	packet->data         = bmalloc(size);
+	packet->keyframe     = true;
+
+	for (size_t i = 0; i < size; i++)
+		packet->data[i] = random_byte();
+}
+
+/* audio and video interleaved roughly as the output would send them, with
+ * the odd pair of audio packets of the same size and timestamp so that the
+ * smallest chunk headers get used as well */
+static void generate_packets(void)
+{
+	size_t video_frame = 0;
+	size_t audio_frame = 0;
+	int64_t jump = 0;
+
+	for (size_t i = 0; i < PACKETS; i++) {
+		int64_t video_ms = (int64_t)video_frame * 1000 / FPS;
+		int64_t audio_ms = (int64_t)audio_frame * AUDIO_FRAMES * 1000 /
+			SAMPLE_RATE;
+
+		if (i == JUMP_PACKET)
+			jump = JUMP_MS;
+
+		if (video_ms <= audio_ms) {
+			make_video_packet(video_frame++, jump);
+		} else {
+			size_t size = 100 + rand() % 500;
+
+			if (audio_frame % 50 == 1)
+				size = 250;
+
+			make_audio_packet(audio_frame, jump, size);
+
+			if (audio_frame % 50 == 7) {
+				make_audio_packet(audio_frame, jump, size);
+				i++;
+			}
+
+			audio_frame++;
+		}
+	}
+}
+
+static void queue_packet(struct rtmp_stream *stream,
+		const struct encoder_packet *packet)
+{
+	struct encoder_packet *copy = da_push_back_new(stream->send_packets);
+
+	*copy = *packet;
+	copy->data = bmemdup(packet->data, packet->size);
+}
+
+/* the audio header is sent through RTMP_Write on both connections, the
+ * same as send_headers does, which sets up librtmp's channel state */
+static bool send_header(struct rtmp_stream *stream)
+{
+	static uint8_t audio_config[] = {0x11, 0x90};
+	struct encoder_packet packet = {
+		.type         = OBS_ENCODER_AUDIO,
+		.timebase_den = 1,
+		.data         = audio_config,
+		.size         = sizeof(audio_config)
+	};
+	uint8_t *data;
+	size_t  size;
+	int     ret;
+
+	flv_packet_mux(&packet, &data, &size, true);
+	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size);
+	bfree(data);
+
+	return ret >= 0;
+}
+
+static const int chunk_sizes[] = {128, 4096, 60000, 1024};
+
+static bool stream_packets(struct test_conn *conn, bool vectored)
+{
+	struct rtmp_stream *stream = conn->stream;
+	size_t chunk_idx = 0;
+	size_t i = 0;
+	uint64_t start;
+
+	stream->rtmp.m_outChunkSize = chunk_sizes[0];
+
+	if (!send_header(stream))
+		return false;
+
+	if (can_send_vectored(stream) != vectored) {
+		fprintf(stderr, "%s: the wrong send path would be used\n",
+				conn->name);
+		return false;
+	}
+
+	start = os_gettime_ns();
+
+	while (i < packets.num) {
+		size_t batch = 1 + (size_t)rand() % MAX_BATCH;
+
+		if (i >= (chunk_idx + 1) * packets.num / 4 && chunk_idx < 3)
+			stream->rtmp.m_outChunkSize = chunk_sizes[++chunk_idx];
+
+		for (; batch && i < packets.num; batch--, i++)
+			queue_packet(stream, packets.array + i);
+
+		if (send_packet_batch(stream) < 0) {
+			fprintf(stderr, "%s: send failed\n", conn->name);
+			return false;
+		}
+	}
+
+	conn->send_ns = os_gettime_ns() - start;
+	return true;
+}
+
+int main(void)
+{
+	struct test_conn vectored, plain;
+	bool success = false;
+	unsigned int seed = 1;
+
+	srand(seed);
+	generate_packets();
+
+	if (!test_conn_init(&vectored, "vectored", true) ||
+	    !test_conn_init(&plain, "RTMP_Write", false)) {
+		fprintf(stderr, "failed to open the loopback connections\n");
+		goto fail;
+	}
+
+	/* both connections get the same chunk size changes and batches */
+	srand(seed);
+	if (!stream_packets(&vectored, true))
+		goto fail;
+
+	srand(seed);
+	if (!stream_packets(&plain, false))
+		goto fail;
+
+	test_conn_finish(&vectored);
+	test_conn_finish(&plain);
+
+	printf("%u packets: vectored %u bytes in %.2f ms, RTMP_Write %u bytes "
+	       "in %.2f ms\n",
+	       (uint32_t)packets.num,
+	       (uint32_t)vectored.received.num,
+	       (double)vectored.send_ns / 1000000.0,
+	       (uint32_t)plain.received.num,
+	       (double)plain.send_ns / 1000000.0);
+
+	success = vectored.received.num == plain.received.num &&
+		memcmp(vectored.received.array, plain.received.array,
+				plain.received.num) == 0;
+
+	if (!success) {
+		size_t size = vectored.received.num < plain.received.num ?
+			vectored.received.num : plain.received.num;
+		size_t pos = 0;
+
+		while (pos < size && vectored.received.array[pos] ==
+				plain.received.array[pos])
+			pos++;
+
+		fprintf(stderr, "the byte streams differ from offset %u\n",
+				(uint32_t)pos);
+	}
+
+	test_conn_free(&vectored);
+	test_conn_free(&plain);
+
+fail:
+	for (size_t i = 0; i < packets.num; i++)
+		bfree(packets.array[i].data);
+	da_free(packets);
+	da_free(nal_data);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,488 @@
+/*
+ * Sends volume levels from 200 sources the way obs_source_update_volume_level
+ * does, as "volume_level" on each source's signal handler and then as
+ * "source_volume_level" on the global one, with a volume meter connected to
+ * each source and a mixer connected to the global handler.
+ *
+ * Every meter has to receive each level of its own source once, with the
+ * values it was sent with, and the mixer has to receive every level.  The
+ * same has to hold while another thread keeps disconnecting and reconnecting
+ * meters, and once a disconnect has returned that meter must not be called
+ * until it's connected again.
+ *
+ * Then the signals per second are printed for the signal handler, with the
+ * meters being reconnected at the same time, and for the old one, which
+ * looked signals up by comparing every name before it under the handler's
+ * mutex and held a mutex on the signal while calling its callbacks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <callback/signal.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define NUM_SOURCES        200
+#define TEST_TICKS         2000
+#define BENCHMARK_TICKS    5000
+
+/* the same signals, in the same order, as libobs declares */
+static const char *source_signals[] = {
+	"void destroy(ptr source)",
+	"void add(ptr source)",
+	"void remove(ptr source)",
+	"void activate(ptr source)",
+	"void deactivate(ptr source)",
+	"void show(ptr source)",
+	"void hide(ptr source)",
+	"void rename(ptr source, string new_name, string prev_name)",
+	"void volume(ptr source, in out float volume)",
+	"void volume_level(ptr source, float level, float magnitude, "
+		"float peak)",
+	NULL
+};
+
+static const char *obs_signals[] = {
+	"void source_create(ptr source)",
+	"void source_destroy(ptr source)",
+	"void source_add(ptr source)",
+	"void source_remove(ptr source)",
+	"void source_activate(ptr source)",
+	"void source_deactivate(ptr source)",
+	"void source_show(ptr source)",
+	"void source_hide(ptr source)",
+	"void source_rename(ptr source, string new_name, string prev_name)",
+	"void source_volume(ptr source, in out float volume)",
+	"void source_volume_level(ptr source, float level, float magnitude, "
+		"float peak)",
+
+	"void channel_change(int channel, in out ptr source, ptr prev_source)",
+	"void master_volume(in out float volume)",
+
+	NULL
+};
+
+struct test_source {
+	signal_handler_t   signals;
+	struct calldata    data;
+	float              level;
+};
+
+struct meter {
+	struct test_source *source;
+	volatile long      connected;
+	volatile long      calls;
+	volatile long      wrong;
+	volatile long      late;
+};
+
+static struct test_source sources[NUM_SOURCES];
+static struct meter       meters[NUM_SOURCES];
+static struct meter       mixer;
+static struct meter       global_meter;
+static signal_handler_t   global_signals;
+
+/* the levels are only changed and checked outside of the benchmarks, as
+ * looking up the values would take longer than sending the signals */
+static bool               check_levels = true;
+
+static void meter_callback(void *param, calldata_t data)
+{
+	struct meter *meter = param;
+	struct test_source *source;
+
+	if (!os_atomic_load_long(&meter->connected))
+		os_atomic_inc_long(&meter->late);
+
+	os_atomic_inc_long(&meter->calls);
+	if (!check_levels)
+		return;
+
+	source = calldata_ptr(data, "source");
+	if ((meter->source && source != meter->source) ||
+	    calldata_float(data, "level")     != source->level ||
+	    calldata_float(data, "magnitude") != source->level * 0.5f ||
+	    calldata_float(data, "peak")      != source->level)
+		os_atomic_inc_long(&meter->wrong);
+}
+
+static void connect_meter(signal_handler_t handler, const char *signal,
+		struct meter *meter)
+{
+	os_atomic_set_long(&meter->connected, 1);
+	signal_handler_connect(handler, signal, meter_callback, meter);
+}
+
+static void disconnect_meter(signal_handler_t handler, const char *signal,
+		struct meter *meter)
+{
+	signal_handler_disconnect(handler, signal, meter_callback, meter);
+	os_atomic_set_long(&meter->connected, 0);
+}
+
+static void reset_meter(struct meter *meter)
+{
+	meter->calls = 0;
+	meter->wrong = 0;
+	meter->late  = 0;
+}
+
+static void create_sources(void)
+{
+	global_signals = signal_handler_create();
+	signal_handler_add_array(global_signals, obs_signals);
+	connect_meter(global_signals, "source_volume_level", &mixer);
+
+	for (size_t i = 0; i < NUM_SOURCES; i++) {
+		struct test_source *source = sources + i;
+
+		source->signals = signal_handler_create();
+		signal_handler_add_array(source->signals, source_signals);
+
+		calldata_init(&source->data);
+		calldata_setptr(&source->data, "source", source);
+
+		meters[i].source = source;
+		connect_meter(source->signals, "volume_level", meters + i);
+	}
+}
+
+static void destroy_sources(void)
+{
+	for (size_t i = 0; i < NUM_SOURCES; i++) {
+		signal_handler_destroy(sources[i].signals);
+		calldata_free(&sources[i].data);
+	}
+
+	signal_handler_destroy(global_signals);
+}
+
+static inline void set_level(struct test_source *source, uint32_t tick,
+		size_t idx)
+{
+	source->level = (float)((tick + idx) % 100) / 100.0f;
+
+	calldata_setfloat(&source->data, "level",     source->level);
+	calldata_setfloat(&source->data, "magnitude", source->level * 0.5f);
+	calldata_setfloat(&source->data, "peak",      source->level);
+}
+
+static void send_levels(uint32_t ticks)
+{
+	for (uint32_t tick = 0; tick < ticks; tick++) {
+		for (size_t i = 0; i < NUM_SOURCES; i++) {
+			struct test_source *source = sources + i;
+
+			if (check_levels)
+				set_level(source, tick, i);
+			signal_handler_signal(source->signals, "volume_level",
+					&source->data);
+			signal_handler_signal(global_signals,
+					"source_volume_level", &source->data);
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool test_levels(void)
+{
+	bool success = true;
+
+	reset_meter(&mixer);
+	for (size_t i = 0; i < NUM_SOURCES; i++)
+		reset_meter(meters + i);
+
+	send_levels(TEST_TICKS);
+
+	for (size_t i = 0; i < NUM_SOURCES; i++)
+		if (meters[i].calls != TEST_TICKS || meters[i].wrong)
+			success = false;
+
+	if (mixer.calls != TEST_TICKS * NUM_SOURCES || mixer.wrong)
+		success = false;
+
+	printf("%u sources, %u levels each: %s\n", NUM_SOURCES, TEST_TICKS,
+			success ? "all received correctly" : "FAILED");
+	return success;
+}
+
+struct send_thread {
+	pthread_t          thread;
+	uint32_t           ticks;
+	uint64_t           time;
+	volatile long      done;
+};
+
+static void *send_thread(void *param)
+{
+	struct send_thread *st = param;
+	uint64_t start = os_gettime_ns();
+
+	send_levels(st->ticks);
+
+	st->time = os_gettime_ns() - start;
+	os_atomic_set_long(&st->done, 1);
+	return NULL;
+}
+
+/* reconnects meters on this thread while levels are sent on another one,
+ * and returns the signals per second */
+static double test_reconnecting(uint32_t ticks, bool *success)
+{
+	struct send_thread st = {0};
+	long late = 0, wrong = 0;
+	uint32_t reconnects = 0;
+
+	reset_meter(&mixer);
+	reset_meter(&global_meter);
+	for (size_t i = 0; i < NUM_SOURCES; i++)
+		reset_meter(meters + i);
+
+	st.ticks = ticks;
+	if (pthread_create(&st.thread, NULL, send_thread, &st) != 0) {
+		printf("could not create send thread\n");
+		*success = false;
+		return 0.0;
+	}
+
+	while (!os_atomic_load_long(&st.done)) {
+		struct meter *meter = meters + rand() % NUM_SOURCES;
+		signal_handler_t handler = meter->source->signals;
+
+		disconnect_meter(handler, "volume_level", meter);
+		connect_meter(global_signals, "source_volume_level",
+				&global_meter);
+		disconnect_meter(global_signals, "source_volume_level",
+				&global_meter);
+		connect_meter(handler, "volume_level", meter);
+		reconnects++;
+	}
+
+	pthread_join(st.thread, NULL);
+
+	for (size_t i = 0; i < NUM_SOURCES; i++) {
+		if (meters[i].calls > (long)ticks)
+			wrong++;
+		late  += meters[i].late;
+		wrong += meters[i].wrong;
+	}
+
+	late  += global_meter.late + mixer.late;
+	wrong += global_meter.wrong + mixer.wrong;
+	if (mixer.calls != (long)ticks * NUM_SOURCES)
+		wrong++;
+
+	printf("%u levels each while reconnecting %u times: "
+	       "%ld wrong, %ld after disconnect\n", ticks, reconnects,
+	       wrong, late);
+
+	*success = !late && !wrong;
+	return (double)ticks * NUM_SOURCES * 2.0 /
+		((double)st.time / 1000000000.0);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* the signal handler from before the hash table and callback lists */
+struct old_callback {
+	signal_callback_t  callback;
+	void               *data;
+	bool               remove;
+};
+
+struct old_signal {
+	char                        *name;
+	DARRAY(struct old_callback) callbacks;
+	pthread_mutex_t             mutex;
+	bool                        signalling;
+	struct old_signal           *next;
+};
+
+struct old_handler {
+	struct old_signal  *first;
+	pthread_mutex_t    mutex;
+};
+
+static void old_handler_init(struct old_handler *handler, const char **decls)
+{
+	struct old_signal **last = &handler->first;
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&handler->mutex, NULL);
+
+	for (; *decls; decls++) {
+		struct old_signal *sig = bzalloc(sizeof(struct old_signal));
+		const char *name = strchr(*decls, ' ') + 1;
+
+		sig->name = bstrdup_n(name, strchr(name, '(') - name);
+		pthread_mutex_init(&sig->mutex, &attr);
+
+		*last = sig;
+		last  = &sig->next;
+	}
+
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void old_handler_free(struct old_handler *handler)
+{
+	struct old_signal *sig = handler->first;
+
+	while (sig) {
+		struct old_signal *next = sig->next;
+
+		pthread_mutex_destroy(&sig->mutex);
+		da_free(sig->callbacks);
+		bfree(sig->name);
+		bfree(sig);
+		sig = next;
+	}
+
+	pthread_mutex_destroy(&handler->mutex);
+}
+
+static struct old_signal *old_getsignal(struct old_handler *handler,
+		const char *name)
+{
+	struct old_signal *sig;
+
+	pthread_mutex_lock(&handler->mutex);
+
+	sig = handler->first;
+	while (sig && strcmp(sig->name, name) != 0)
+		sig = sig->next;
+
+	pthread_mutex_unlock(&handler->mutex);
+	return sig;
+}
+
+static void old_connect(struct old_handler *handler, const char *name,
+		signal_callback_t callback, void *data)
+{
+	struct old_signal *sig = old_getsignal(handler, name);
+	struct old_callback cb = {callback, data, false};
+
+	pthread_mutex_lock(&sig->mutex);
+	da_push_back(sig->callbacks, &cb);
+	pthread_mutex_unlock(&sig->mutex);
+}
+
+static void old_signal(struct old_handler *handler, const char *name,
+		calldata_t params)
+{
+	struct old_signal *sig = old_getsignal(handler, name);
+
+	if (!sig)
+		return;
+
+	pthread_mutex_lock(&sig->mutex);
+	sig->signalling = true;
+
+	for (size_t i = 0; i < sig->callbacks.num; i++) {
+		struct old_callback *cb = sig->callbacks.array+i;
+		cb->callback(cb->data, params);
+	}
+
+	for (size_t i = sig->callbacks.num; i > 0; i--) {
+		struct old_callback *cb = sig->callbacks.array+i-1;
+		if (cb->remove)
+			da_erase(sig->callbacks, i-1);
+	}
+
+	sig->signalling = false;
+	pthread_mutex_unlock(&sig->mutex);
+}
+
+static double benchmark_old(uint32_t ticks)
+{
+	struct old_handler *handlers;
+	struct old_handler global = {0};
+	uint64_t start;
+
+	handlers = bzalloc(sizeof(struct old_handler) * NUM_SOURCES);
+
+	old_handler_init(&global, obs_signals);
+	old_connect(&global, "source_volume_level", meter_callback, &mixer);
+
+	for (size_t i = 0; i < NUM_SOURCES; i++) {
+		old_handler_init(handlers + i, source_signals);
+		old_connect(handlers + i, "volume_level", meter_callback,
+				meters + i);
+	}
+
+	start = os_gettime_ns();
+
+	for (uint32_t tick = 0; tick < ticks; tick++) {
+		for (size_t i = 0; i < NUM_SOURCES; i++) {
+			struct test_source *source = sources + i;
+
+			old_signal(handlers + i, "volume_level",
+					&source->data);
+			old_signal(&global, "source_volume_level",
+					&source->data);
+		}
+	}
+
+	start = os_gettime_ns() - start;
+
+	for (size_t i = 0; i < NUM_SOURCES; i++)
+		old_handler_free(handlers + i);
+	old_handler_free(&global);
+	bfree(handlers);
+
+	return (double)ticks * NUM_SOURCES * 2.0 /
+		((double)start / 1000000000.0);
+}
+
+static double benchmark(uint32_t ticks)
+{
+	uint64_t start = os_gettime_ns();
+
+	send_levels(ticks);
+
+	start = os_gettime_ns() - start;
+	return (double)ticks * NUM_SOURCES * 2.0 /
+		((double)start / 1000000000.0);
+}
+
+int main(void)
+{
+	double old_rate, rate, reconnect_rate;
+	bool success, reconnect_success;
+
+	srand(1);
+	create_sources();
+
+	success = test_levels();
+	test_reconnecting(TEST_TICKS, &reconnect_success);
+	success = success && reconnect_success;
+
+	check_levels = false;
+
+	old_rate = benchmark_old(BENCHMARK_TICKS);
+	rate     = benchmark(BENCHMARK_TICKS);
+	reconnect_rate = test_reconnecting(BENCHMARK_TICKS,
+			&reconnect_success);
+	success = success && reconnect_success;
+
+	printf("old signal handler     %6.2f M signals/s\n", old_rate / 1e6);
+	printf("signal handler         %6.2f M signals/s (%.2fx)\n",
+			rate / 1e6, rate / old_rate);
+	printf("  while reconnecting   %6.2f M signals/s\n",
+			reconnect_rate / 1e6);
+
+	destroy_sources();
+
+	if (bnum_allocs() != 0) {
+		printf("%ld allocations leaked\n", bnum_allocs());
+		success = false;
+	}
+
+	return success ? 0 : 1;
+}
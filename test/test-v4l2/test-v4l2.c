@@ -0,0 +1,642 @@
+/*
+ * Captures from a fake V4L2 device through plugins/linux-v4l2/v4l2-input.c,
+ * once copying each frame and once in zero-copy mode.
+ *
+ * The plugin is compiled in to this test with its device calls (open, ioctl,
+ * mmap, select and so on) redirected to a stand-in that behaves like the
+ * vivid driver: buffers are filled in the order they were queued, and each
+ * frame is stamped with its sequence number.  The stand-in rejects anything
+ * the kernel could reject, such as queueing a buffer that is already queued,
+ * or queueing one with a request flag or reserved fields that aren't zeroed.
+ *
+ * In zero-copy mode the frames handed to libobs have to point at the mapped
+ * buffers, must not be queued with the device again (and overwritten) until
+ * they are released, and have to stay mapped after the capture is destroyed
+ * until the last one is released.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <linux/videodev2.h>
+
+#include <obs.h>
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define FAKE_DEVICE        "/dev/video-test"
+#define FAKE_FD            100
+#define MAX_BUFFERS        32
+#define FRAME_NS           1000000ULL
+
+#define WIDTH              64
+#define HEIGHT             48
+
+#define COPY_FRAMES        100
+#define ZERO_COPY_FRAMES   300
+#define HELD_FRAMES        2
+
+enum buffer_state {
+	BUFFER_IDLE,
+	BUFFER_QUEUED,
+	BUFFER_DEQUEUED
+};
+
+struct fake_buffer {
+	enum buffer_state  state;
+	uint8_t            *mem;
+	bool               mapped;
+};
+
+static struct fake_device {
+	pthread_mutex_t    mutex;
+	pthread_cond_t     cond;
+
+	bool               opened;
+	bool               streaming;
+	uint32_t           bytesperline;
+	uint32_t           sizeimage;
+
+	uint32_t           count;
+	struct fake_buffer buffers[MAX_BUFFERS];
+
+	/* buffers are filled in the order they were queued */
+	uint32_t           queue[MAX_BUFFERS];
+	uint32_t           queue_start;
+	uint32_t           queue_num;
+
+	uint32_t           sequence;
+	uint64_t           next_frame_ns;
+
+	int                errors;
+	int                unmapped;
+} dev = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond  = PTHREAD_COND_INITIALIZER
+};
+
+static void device_error(const char *error)
+{
+	fprintf(stderr, "fake device: %s\n", error);
+	dev.errors++;
+}
+
+/* ------------------------------------------------------------------------- */
+/* fake device calls                                                          */
+
+static int fake_open(const char *path, int flags, ...)
+{
+	UNUSED_PARAMETER(flags);
+
+	if (strcmp(path, FAKE_DEVICE) != 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev.mutex);
+	dev.opened = true;
+	pthread_mutex_unlock(&dev.mutex);
+	return FAKE_FD;
+}
+
+static int fake_close(int fd)
+{
+	pthread_mutex_lock(&dev.mutex);
+	if (fd != FAKE_FD || !dev.opened)
+		device_error("closing a file that isn't open");
+	dev.opened    = false;
+	dev.streaming = false;
+	pthread_mutex_unlock(&dev.mutex);
+	return 0;
+}
+
+static void *fake_mmap(void *addr, size_t length, int prot, int flags,
+		int fd, off_t offset)
+{
+	struct fake_buffer *buf;
+	uint32_t index = (uint32_t)(offset / 4096);
+
+	UNUSED_PARAMETER(addr);
+	UNUSED_PARAMETER(prot);
+	UNUSED_PARAMETER(flags);
+
+	pthread_mutex_lock(&dev.mutex);
+
+	if (fd != FAKE_FD || index >= dev.count || length != dev.sizeimage) {
+		device_error("invalid mmap");
+		pthread_mutex_unlock(&dev.mutex);
+		return MAP_FAILED;
+	}
+
+	buf = &dev.buffers[index];
+	buf->mem    = bzalloc(length);
+	buf->mapped = true;
+
+	pthread_mutex_unlock(&dev.mutex);
+	return buf->mem;
+}
+
+static int fake_munmap(void *addr, size_t length)
+{
+	UNUSED_PARAMETER(length);
+
+	pthread_mutex_lock(&dev.mutex);
+
+	for (uint32_t i = 0; i < MAX_BUFFERS; i++) {
+		struct fake_buffer *buf = &dev.buffers[i];
+
+		if (buf->mapped && buf->mem == addr) {
+			bfree(buf->mem);
+			buf->mem    = NULL;
+			buf->mapped = false;
+			dev.unmapped++;
+			pthread_mutex_unlock(&dev.mutex);
+			return 0;
+		}
+	}
+
+	device_error("unmapping memory that isn't mapped");
+	pthread_mutex_unlock(&dev.mutex);
+	return -1;
+}
+
+/* waits for a queued buffer, and paces the frames as a real device would */
+static int fake_select(int nfds, fd_set *readfds, fd_set *writefds,
+		fd_set *exceptfds, struct timeval *timeout)
+{
+	uint64_t end_ns = os_gettime_ns() +
+		(uint64_t)timeout->tv_sec * 1000000000ULL +
+		(uint64_t)timeout->tv_usec * 1000ULL;
+	uint64_t frame_ns;
+
+	UNUSED_PARAMETER(nfds);
+	UNUSED_PARAMETER(readfds);
+	UNUSED_PARAMETER(writefds);
+	UNUSED_PARAMETER(exceptfds);
+
+	pthread_mutex_lock(&dev.mutex);
+
+	while (!dev.streaming || !dev.queue_num) {
+		struct timespec ts;
+
+		if (os_gettime_ns() >= end_ns) {
+			pthread_mutex_unlock(&dev.mutex);
+			return 0;
+		}
+
+		/* the condition variable uses the realtime clock, so just
+		 * check back once a millisecond */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&dev.cond, &dev.mutex, &ts);
+	}
+
+	frame_ns = dev.next_frame_ns;
+	pthread_mutex_unlock(&dev.mutex);
+
+	os_sleepto_ns(frame_ns);
+	return 1;
+}
+
+static int queue_buffer(struct v4l2_buffer *buf)
+{
+	struct fake_buffer *fb;
+
+	if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE ||
+	    buf->memory != V4L2_MEMORY_MMAP || buf->index >= dev.count) {
+		device_error("QBUF with an invalid type, memory or index");
+		return EINVAL;
+	}
+#ifdef V4L2_BUF_FLAG_REQUEST_FD
+	if (buf->flags & V4L2_BUF_FLAG_REQUEST_FD) {
+		device_error("QBUF with a stray request flag");
+		return EINVAL;
+	}
+#endif
+	if (buf->reserved2 != 0 || buf->reserved != 0) {
+		device_error("QBUF with reserved fields set");
+		return EINVAL;
+	}
+
+	fb = &dev.buffers[buf->index];
+	if (fb->state == BUFFER_QUEUED) {
+		device_error("QBUF of a buffer that is already queued");
+		return EINVAL;
+	}
+
+	fb->state = BUFFER_QUEUED;
+	dev.queue[(dev.queue_start + dev.queue_num++) % MAX_BUFFERS] =
+		buf->index;
+	pthread_cond_signal(&dev.cond);
+	return 0;
+}
+
+/* fills the oldest queued buffer with the next frame */
+static int dequeue_buffer(struct v4l2_buffer *buf)
+{
+	struct fake_buffer *fb;
+	uint32_t index;
+	uint64_t ns;
+
+	if (!dev.streaming || !dev.queue_num)
+		return EAGAIN;
+
+	index = dev.queue[dev.queue_start];
+	dev.queue_start = (dev.queue_start + 1) % MAX_BUFFERS;
+	dev.queue_num--;
+
+	fb = &dev.buffers[index];
+	fb->state = BUFFER_DEQUEUED;
+	memset(fb->mem, (uint8_t)dev.sequence, dev.sizeimage);
+	memcpy(fb->mem, &dev.sequence, sizeof(dev.sequence));
+
+	ns = os_gettime_ns();
+
+	memset(buf, 0, sizeof(*buf));
+	buf->index             = index;
+	buf->type              = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf->memory            = V4L2_MEMORY_MMAP;
+	buf->bytesused         = dev.sizeimage;
+	buf->length            = dev.sizeimage;
+	buf->flags             = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_DONE;
+	buf->field             = V4L2_FIELD_NONE;
+	buf->sequence          = dev.sequence++;
+	buf->m.offset          = index * 4096;
+	buf->timestamp.tv_sec  = (time_t)(ns / 1000000000);
+	buf->timestamp.tv_usec = (suseconds_t)(ns % 1000000000 / 1000);
+
+	dev.next_frame_ns = ns + FRAME_NS;
+	return 0;
+}
+
+static int device_ioctl(unsigned long request, void *arg)
+{
+	if (request == VIDIOC_S_FMT) {
+		struct v4l2_format *fmt = arg;
+
+		dev.bytesperline = fmt->fmt.pix.width * 2;
+		dev.sizeimage    = dev.bytesperline * fmt->fmt.pix.height;
+		fmt->fmt.pix.bytesperline = dev.bytesperline;
+		fmt->fmt.pix.sizeimage    = dev.sizeimage;
+		fmt->fmt.pix.field        = V4L2_FIELD_NONE;
+		return 0;
+
+	} else if (request == VIDIOC_S_PARM) {
+		return 0;
+
+	} else if (request == VIDIOC_REQBUFS) {
+		struct v4l2_requestbuffers *req = arg;
+
+		if (req->count > MAX_BUFFERS)
+			req->count = MAX_BUFFERS;
+		for (uint32_t i = 0; i < MAX_BUFFERS; i++) {
+			if (dev.buffers[i].mapped)
+				return EBUSY;
+			dev.buffers[i].state = BUFFER_IDLE;
+		}
+		dev.count = req->count;
+		return 0;
+
+	} else if (request == VIDIOC_QUERYBUF) {
+		struct v4l2_buffer *buf = arg;
+
+		if (buf->index >= dev.count)
+			return EINVAL;
+		buf->length   = dev.sizeimage;
+		buf->m.offset = buf->index * 4096;
+		return 0;
+
+	} else if (request == VIDIOC_QBUF) {
+		return queue_buffer(arg);
+
+	} else if (request == VIDIOC_DQBUF) {
+		return dequeue_buffer(arg);
+
+	} else if (request == VIDIOC_STREAMON) {
+		dev.streaming     = true;
+		dev.next_frame_ns = os_gettime_ns();
+		pthread_cond_signal(&dev.cond);
+		return 0;
+
+	} else if (request == VIDIOC_STREAMOFF) {
+		/* the kernel gives every queued buffer back */
+		for (uint32_t i = 0; i < dev.count; i++) {
+			if (dev.buffers[i].state == BUFFER_QUEUED)
+				dev.buffers[i].state = BUFFER_IDLE;
+		}
+		dev.queue_num = 0;
+		dev.streaming = false;
+		return 0;
+	}
+
+	return EINVAL;
+}
+
+static int fake_ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	void *arg;
+	int error;
+
+	va_start(args, request);
+	arg = va_arg(args, void*);
+	va_end(args);
+
+	pthread_mutex_lock(&dev.mutex);
+	if (fd != FAKE_FD || !dev.opened) {
+		device_error("ioctl on a file that isn't open");
+		error = EBADF;
+	} else {
+		error = device_ioctl(request, arg);
+	}
+	pthread_mutex_unlock(&dev.mutex);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* fake libobs source calls                                                   */
+
+struct held_frame {
+	struct source_frame *frame;
+	void                (*release)(void *param, struct source_frame *frame);
+	void                *param;
+	uint32_t            sequence;
+};
+
+static struct capture_state {
+	pthread_mutex_t     mutex;
+	pthread_cond_t      cond;
+	DARRAY(struct held_frame) held;
+	uint32_t            next_sequence;
+	int                 frames;
+	int                 errors;
+} capture = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond  = PTHREAD_COND_INITIALIZER
+};
+
+static void capture_error(const char *error)
+{
+	fprintf(stderr, "capture: %s\n", error);
+	capture.errors++;
+}
+
+static uint32_t frame_sequence(const struct source_frame *frame)
+{
+	uint32_t sequence;
+	memcpy(&sequence, frame->data[0], sizeof(sequence));
+	return sequence;
+}
+
+/* frames are checked on arrival, for whether they come from the mapped
+ * buffers, are in order and have the right parameters */
+static void check_frame(const struct source_frame *frame)
+{
+	bool mapped = false;
+
+	pthread_mutex_lock(&dev.mutex);
+	for (uint32_t i = 0; i < dev.count; i++) {
+		if (dev.buffers[i].mapped &&
+		    dev.buffers[i].mem == frame->data[0] &&
+		    dev.buffers[i].state == BUFFER_DEQUEUED)
+			mapped = true;
+	}
+	pthread_mutex_unlock(&dev.mutex);
+
+	if (!mapped)
+		capture_error("frame isn't a dequeued buffer");
+	if (frame->width != WIDTH || frame->height != HEIGHT ||
+	    frame->linesize[0] != WIDTH * 2 ||
+	    frame->format != VIDEO_FORMAT_YUY2)
+		capture_error("wrong frame parameters");
+	if (frame_sequence(frame) != capture.next_sequence)
+		capture_error("frame out of sequence");
+
+	capture.next_sequence = frame_sequence(frame) + 1;
+	capture.frames++;
+	pthread_cond_signal(&capture.cond);
+}
+
+static void fake_output_video(obs_source_t source,
+		const struct source_frame *frame)
+{
+	UNUSED_PARAMETER(source);
+
+	pthread_mutex_lock(&capture.mutex);
+	check_frame(frame);
+	pthread_mutex_unlock(&capture.mutex);
+}
+
+static void fake_output_video_owned(obs_source_t source,
+		struct source_frame *frame,
+		void (*release)(void *param, struct source_frame *frame),
+		void *param)
+{
+	struct held_frame held = {frame, release, param, 0};
+
+	UNUSED_PARAMETER(source);
+
+	pthread_mutex_lock(&capture.mutex);
+	check_frame(frame);
+	held.sequence = frame_sequence(frame);
+	da_push_back(capture.held, &held);
+	pthread_mutex_unlock(&capture.mutex);
+}
+
+static const char *fake_module_text(const char *lookup)
+{
+	return lookup;
+}
+
+#define open                          fake_open
+#define close                         fake_close
+#define mmap                          fake_mmap
+#define munmap                        fake_munmap
+#define select                        fake_select
+#define ioctl                         fake_ioctl
+#define obs_source_output_video       fake_output_video
+#define obs_source_output_video_owned fake_output_video_owned
+#define obs_module_text               fake_module_text
+
+#include "v4l2-input.c"
+
+/* ------------------------------------------------------------------------- */
+
+/* fills the stack with garbage, so that anything passed to the device
+ * without being initialized shows up */
+static void __attribute__((noinline)) dirty_stack(void)
+{
+	volatile uint8_t garbage[4096];
+	memset((void*)garbage, 0xA5, sizeof(garbage));
+}
+
+/* releases a held frame the way the graphics thread would, after checking
+ * that its buffer wasn't queued again or overwritten while it was held */
+static void release_frame(struct held_frame *held)
+{
+	if (frame_sequence(held->frame) != held->sequence ||
+	    held->frame->data[0][sizeof(uint32_t)] != (uint8_t)held->sequence)
+		capture_error("held frame was overwritten");
+
+	dirty_stack();
+	held->release(held->param, held->frame);
+}
+
+static bool check_held_buffers(void)
+{
+	bool success = true;
+
+	pthread_mutex_lock(&dev.mutex);
+	for (size_t i = 0; i < capture.held.num; i++) {
+		struct source_frame *frame = capture.held.array[i].frame;
+
+		for (uint32_t j = 0; j < dev.count; j++) {
+			if (dev.buffers[j].mem == frame->data[0] &&
+			    dev.buffers[j].state != BUFFER_DEQUEUED)
+				success = false;
+		}
+	}
+	pthread_mutex_unlock(&dev.mutex);
+
+	return success;
+}
+
+static void *create_capture(bool zero_copy, int buffer_count)
+{
+	obs_data_t settings = obs_data_create();
+	void *data;
+
+	obs_data_setstring(settings, "device_id", FAKE_DEVICE);
+	obs_data_setint(settings, "pixelformat", V4L2_PIX_FMT_YUYV);
+	obs_data_setint(settings, "resolution", pack_tuple(WIDTH, HEIGHT));
+	obs_data_setint(settings, "framerate", pack_tuple(1, 1000));
+	obs_data_setint(settings, "buffer_count", buffer_count);
+	obs_data_setbool(settings, "zero_copy", zero_copy);
+
+	capture.next_sequence = dev.sequence;
+	capture.frames        = 0;
+
+	data = v4l2_input.create(settings, NULL);
+	obs_data_release(settings);
+	return data;
+}
+
+/* call with capture.mutex held */
+static bool wait_for_frames(int frames)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 2;
+
+	while (capture.frames < frames) {
+		if (pthread_cond_timedwait(&capture.cond, &capture.mutex,
+					&ts) == ETIMEDOUT) {
+			capture_error("timed out waiting for a frame");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool test_copy(void)
+{
+	void *data = create_capture(false, 3);
+
+	pthread_mutex_lock(&capture.mutex);
+	wait_for_frames(COPY_FRAMES);
+	pthread_mutex_unlock(&capture.mutex);
+
+	v4l2_input.destroy(data);
+
+	printf("copy:      %d frames, %d unmapped\n", capture.frames,
+			dev.unmapped);
+	return capture.frames >= COPY_FRAMES && dev.unmapped == 3;
+}
+
+static bool test_zero_copy(void)
+{
+	void *data = create_capture(true, 4);
+	bool held_ok = true;
+	int released = 0;
+	int unmapped_before;
+
+	dev.unmapped = 0;
+
+	pthread_mutex_lock(&capture.mutex);
+
+	while (released < ZERO_COPY_FRAMES &&
+	       wait_for_frames(released + HELD_FRAMES + 1)) {
+		struct held_frame held;
+
+		if (!check_held_buffers())
+			held_ok = false;
+
+		/* the graphics thread keeps a couple of frames at a time */
+		held = capture.held.array[0];
+		da_erase(capture.held, 0);
+		pthread_mutex_unlock(&capture.mutex);
+
+		release_frame(&held);
+		released++;
+
+		pthread_mutex_lock(&capture.mutex);
+	}
+
+	pthread_mutex_unlock(&capture.mutex);
+
+	/* frames still held keep the buffers mapped after the capture is
+	 * destroyed, and aren't queued with the closed device once released */
+	v4l2_input.destroy(data);
+	unmapped_before = dev.unmapped;
+
+	pthread_mutex_lock(&capture.mutex);
+	for (size_t i = 0; i < capture.held.num; i++)
+		release_frame(&capture.held.array[i]);
+	da_free(capture.held);
+	pthread_mutex_unlock(&capture.mutex);
+
+	if (!held_ok)
+		capture_error("held buffer was queued with the device");
+	if (unmapped_before != 0)
+		capture_error("buffers were unmapped while frames were held");
+
+	printf("zero-copy: %d frames, %d released, %d unmapped\n",
+			capture.frames, released, dev.unmapped);
+	return released == ZERO_COPY_FRAMES && dev.unmapped == 4;
+}
+
+int main(void)
+{
+	bool success;
+
+	success = test_copy();
+	success = test_zero_copy() && success;
+	success = success && !dev.errors && !capture.errors;
+
+	if (!success)
+		fprintf(stderr, "v4l2 capture test failed\n");
+	return success ? 0 : 1;
+}